@@ -1,97 +1,914 @@
 #include "BoundingVolume.h"
 #include <queue>
+#include <cassert>
 
+#include "OcclusionBuffer.h"
+#include "InstanceSpan.h"
+
+#if !defined(CULLING_HEADLESS)
 #include "InstanceShader.h"
+#include "InstanceBatcher.h"
+#endif
 
-BoundingVolume::BoundingVolume(std::vector<MeshInstance*>& meshes)
+namespace
+{
+	// Copy (or pack) the visible objects of a parallel culling task into its range of the output
+	void WriteRange(MeshInstance* const* instances, size_t count, std::vector<MeshInstance*>& output, size_t offset)
+	{
+		std::copy(instances, instances + count, output.begin() + offset);
+	}
+
+	void WriteRange(MeshInstance* const* instances, size_t count, InstanceSpan& output, size_t offset)
+	{
+		output.Write(offset, instances, count);
+	}
+
+	// Finish writing the output of a query
+	void Flush(std::vector<MeshInstance*>&)
+	{
+	}
+
+	void Flush(InstanceSpan& output)
+	{
+		output.Flush();
+	}
+}
+
+BoundingVolume::BoundingVolume(std::vector<MeshInstance*>& meshes, HierarchyType type)
+	:	mHierarchyType(type)
 {
 	Init(*meshes.data(), meshes.size());
 }
 
-BoundingVolume::BoundingVolume(MeshInstance * const meshes, int count)
+BoundingVolume::BoundingVolume(MeshInstance * const meshes, int count, HierarchyType type)
+	:	mHierarchyType(type)
 {
 	Init(meshes, count);
 }
 
+BoundingVolume::BoundingVolume(MeshInstance* const meshes, int count, HierarchyType type, const std::string& cacheFile)
+	:	mHierarchyType(type)
+{
+	Init(meshes, count, cacheFile);
+}
+
 BoundingVolume::~BoundingVolume()
 {
 	delete[] mExtents;
 }
 
-int BoundingVolume::GetVisibleGeometry(BoundingFrustum frustum, std::vector<MeshInstance*>& visibleInstances)
+void BoundingVolume::Update(MeshInstance* const* movedInstances, int count, WorkerPool* pool)
 {
-	int visibleObjects = 0;
+	mUpdateStats.movedObjects = count;
+	mUpdateStats.reinsertedObjects = 0;
+	mUpdateStats.refittedNodes = 0;
+	mUpdateStats.updateCost = 0;
+
+	// Nothing moved, so every kind of hierarchy is still up to date
+	if (count == 0)
+		return;
+
+	// Rebuilt from scratch, however many objects moved
+	if (mHierarchyType == HierarchyType::LBVH)
+	{
+		mLinearBVH->RebuildMorton(pool);
+		mUpdateStats.updateCost = mUpdateStats.rebuildCost = mLinearBVH->GetBuildCost();
+
+		mSceneExtent = mLinearBVH->GetSceneExtent();
+		return;
+	}
+
+	// The flat hierarchy cannot move objects between nodes, so it can only be refitted
+	if (mLinearBVH)
+	{
+		mUpdateStats.refittedNodes = mLinearBVH->Refit(movedInstances, count);
+		mUpdateStats.updateCost = count + mUpdateStats.refittedNodes;
+
+		mSceneExtent = mLinearBVH->GetSceneExtent();
+		return;
+	}
+
+	mOctree->ResetInsertVisits();
+
+	std::vector<Extent*> reinsert;
+
+	for (int i = 0; i < count; ++i)
+	{
+		// The hierarchy was built from a contiguous array, so the object's index is also the index of its extent
+		const int idx = static_cast<int>(movedInstances[i] - mMeshes);
+		assert(idx >= 0 && idx < mNumMeshes);
+
+		Extent& object = mExtents[idx];
+
+		// Recalculate the object's world-space bounding box
+		BoundingBox boundingBox = object.object->GetBoundingBox();
+		boundingBox.Transform(object.extent, object.object->GetWorldMatrix());
+
+		// Objects are placed in the octree by their centre, so an object only has to move to a different
+		// leaf if its centre has left the leaf's cell. Otherwise refitting the leaf's extent is enough
+		// The root cell is fixed when the octree is built, so a centre outside of it is in no leaf's cell. Such an
+		// object stays where it is if Insert would only put it back into the same leaf
+		XMVECTOR center = XMLoadFloat3(&object.extent.Center);
+		if (object.leaf->cell.Contains(center) != ContainmentType::DISJOINT || mOctree->FindLeaf(object.extent.Center) == object.leaf)
+		{
+			mOctree->MarkDirty(object.leaf);
+		}
+		else
+		{
+			mOctree->Remove(object);
+			reinsert.push_back(&object);
+		}
+	}
+
+	// Re-insert objects that have moved to a different cell
+	// NOTE: Done after all removals so empty branches have been pruned before anything is inserted into them again
+	for (Extent* object : reinsert)
+		mOctree->Insert(*object);
+
+	mUpdateStats.reinsertedObjects = (int) reinsert.size();
+
+	// Refit the extents of all affected nodes, bottom-up
+	mUpdateStats.refittedNodes = mOctree->Refit();
+	mUpdateStats.updateCost = mUpdateStats.movedObjects + mOctree->GetInsertVisits() + mUpdateStats.refittedNodes;
+
+	// Root extent is the tight-fitting extent of the whole scene
+	mSceneExtent = mOctree->GetRoot()->extent;
+}
 
-	// Frustum does not intersect with the scene at all
-	if (frustum.Contains(mSceneExtent) == ContainmentType::DISJOINT)
+int BoundingVolume::GetVisibleGeometry(BoundingFrustum frustum, std::vector<MeshInstance*>& visibleInstances, WorkerPool* pool, const OcclusionBuffer* occlusion)
+{
+	// Planes are extracted once, so that boxes can be tested against them in batches
+	return GetVisibleGeometry(CullingFrustum(frustum), visibleInstances, pool, occlusion);
+}
+
+int BoundingVolume::GetVisibleGeometry(const CullingFrustum& cullingFrustum, std::vector<MeshInstance*>& visibleInstances, WorkerPool* pool, const OcclusionBuffer* occlusion)
+{
+	return CullVisible(cullingFrustum, visibleInstances, pool, occlusion);
+}
+
+int BoundingVolume::GetVisibleGeometry(const CullingFrustum& cullingFrustum, InstanceSpan& visibleInstances, WorkerPool* pool, const OcclusionBuffer* occlusion)
+{
+	return CullVisible(cullingFrustum, visibleInstances, pool, occlusion);
+}
+
+template <typename Output>
+int BoundingVolume::CullVisible(const CullingFrustum& cullingFrustum, Output& visibleInstances, WorkerPool* pool, const OcclusionBuffer* occlusion)
+{
+	mCullingStats = CullingStats();
+	mCullingStats.nodesVisited = 1;
+	mCullingStats.planeTests = CullingFrustum::NUM_PLANES;
+
+	CullingFrustum::BoxBatch batch;
+	batch.Add(mSceneExtent);
+
+	CullingFrustum::BatchResult result;
+
+	uint32_t visible = cullingFrustum.Test(batch, CullingFrustum::ALL_PLANES, result);
+	mCullingStats.smallBoxes += cullingFrustum.CullSmallBoxes(batch, visible);
+
+	// Frustum does not intersect with the scene at all (or the whole scene is too small to see)
+	if (!visible)
 		return -1;
 
-	// Traverse the BVH and test for visibility
-	std::queue< pointer<Octree::Node> > queue;
-	queue.push(mOctree->GetRoot());
+	const uint32_t planeMask = mPlaneMasking ? result.undecidedPlanes[0] : CullingFrustum::ALL_PLANES;
+
+	const size_t firstVisible = visibleInstances.size();
+
+	if (pool && pool->GetNumWorkers() > 1)
+		CullParallel(cullingFrustum, planeMask, visibleInstances, *pool, occlusion);
+	else if (mLinearBVH)
+		mCullingStats += mLinearBVH->CullSubtree(cullingFrustum, 0, planeMask, visibleInstances, occlusion);
+	else
+		mCullingStats += CullSubtree(cullingFrustum, mOctree->GetRoot().get(), planeMask, visibleInstances, occlusion);
+
+	Flush(visibleInstances);
+
+	return (int) (visibleInstances.size() - firstVisible);
+}
+
+template <typename Output>
+void BoundingVolume::CullParallel(const CullingFrustum& frustum, uint32_t planeMask, Output& visibleInstances, WorkerPool& pool, const OcclusionBuffer* occlusion)
+{
+	const int numWorkers = pool.GetNumWorkers();
+
+	SplitCullTasks(frustum, planeMask, numWorkers * TASKS_PER_WORKER, occlusion);
+
+	// Every worker appends to its own list, and remembers which part of it belongs to which task
+	// NOTE: The lists are kept between calls so that they do not have to grow again every frame
+	mWorkerVisible.resize(numWorkers);
+
+	for (auto& workerVisible : mWorkerVisible)
+		workerVisible.clear();
+
+	pool.Run((int) mCullTasks.size(), [&](int taskIdx, int workerIdx)
+	{
+		CullTask& task = mCullTasks[taskIdx];
+		std::vector<MeshInstance*>& workerVisible = mWorkerVisible[workerIdx];
+
+		task.worker = workerIdx;
+		task.begin = workerVisible.size();
+
+		if (mLinearBVH)
+			task.stats = mLinearBVH->CullSubtree(frustum, task.linearNode, task.planeMask, workerVisible, occlusion);
+		else
+			task.stats = CullSubtree(frustum, task.octreeNode, task.planeMask, workerVisible, occlusion);
+
+		task.end = workerVisible.size();
+	});
+
+	// The tasks are in traversal order, so laying their results out one after another gives the same order
+	// no matter which worker ran which task. Every task then owns a disjoint range of the output, and the
+	// results can be copied into place in parallel without any locking
+	size_t offset = visibleInstances.size();
+
+	for (auto& task : mCullTasks)
+	{
+		task.outputOffset = offset;
+		offset += task.end - task.begin;
+
+		mCullingStats += task.stats;
+	}
+
+	visibleInstances.resize(offset);
+
+	pool.Run((int) mCullTasks.size(), [&](int taskIdx, int)
+	{
+		const CullTask& task = mCullTasks[taskIdx];
+		const std::vector<MeshInstance*>& workerVisible = mWorkerVisible[task.worker];
+
+		WriteRange(workerVisible.data() + task.begin, task.end - task.begin, visibleInstances, task.outputOffset);
+	});
+}
+
+void BoundingVolume::SplitCullTasks(const CullingFrustum& frustum, uint32_t planeMask, int targetTasks, const OcclusionBuffer* occlusion)
+{
+	mCullTasks.clear();
+	mCullTasks.emplace_back();
+	mCullTasks.back().planeMask = planeMask;
+
+	if (mLinearBVH)
+		mCullTasks.back().linearNode = 0;
+	else
+		mCullTasks.back().octreeNode = mOctree->GetRoot().get();
+
+	// Replace every internal node on the frontier with its visible children, a level at a time, until there are
+	// enough subtrees to go around. Children replace their parent in place, so the frontier stays in traversal order
+	while ((int) mCullTasks.size() < targetTasks)
+	{
+		bool splitAny = false;
+		mNextCullTasks.clear();
+
+		for (const auto& task : mCullTasks)
+		{
+			// Leaves cannot be split, and subtrees fully inside the frustum are cheap enough as they are
+			const bool isLeaf = mLinearBVH ? mLinearBVH->GetNodes()[task.linearNode].IsLeaf() : task.octreeNode->isLeaf;
+
+			if (isLeaf || task.planeMask == 0)
+			{
+				mNextCullTasks.push_back(task);
+				continue;
+			}
+
+			if (mLinearBVH)
+			{
+				uint32_t children[2];
+				uint32_t childMasks[2];
+				const int numChildren = mLinearBVH->GetVisibleChildren(frustum, task.linearNode, task.planeMask, children, childMasks, mCullingStats, occlusion);
 
-	while (!queue.empty())
+				for (int i = 0; i < numChildren; ++i)
+				{
+					mNextCullTasks.emplace_back();
+					mNextCullTasks.back().linearNode = children[i];
+					mNextCullTasks.back().planeMask = childMasks[i];
+				}
+			}
+			else
+			{
+				Octree::Node* children[8];
+				uint32_t childMasks[8];
+				const int numChildren = GetVisibleChildren(frustum, task.octreeNode, task.planeMask, children, childMasks, mCullingStats, occlusion);
+
+				for (int i = 0; i < numChildren; ++i)
+				{
+					mNextCullTasks.emplace_back();
+					mNextCullTasks.back().octreeNode = children[i];
+					mNextCullTasks.back().planeMask = childMasks[i];
+				}
+			}
+
+			splitAny = true;
+		}
+
+		mCullTasks.swap(mNextCullTasks);
+
+		// Nothing but leaves left
+		if (!splitAny)
+			break;
+	}
+}
+
+template <typename Output>
+CullingStats BoundingVolume::CullSubtree(const CullingFrustum& frustum, Octree::Node* root, uint32_t planeMask, Output& visibleInstances, const OcclusionBuffer* occlusion) const
+{
+	CullingStats stats;
+
+	// Depth-first traversal of the nodes known to intersect the frustum, along with the planes they intersect
+	// Every level of the octree pushes at most 8 nodes, so the stack can live on the stack
+	struct StackEntry
 	{
-		auto node = queue.front();
-		queue.pop();
+		Octree::Node* node;
+		uint32_t planeMask;
+	};
+
+	StackEntry stack[8 * (MAX_DEPTH + 1)];
+	int stackSize = 0;
+
+	stack[stackSize++] = { root, planeMask };
+
+	CullingFrustum::BoxBatch batch;
+	CullingFrustum::BatchResult result;
+	Extent* batchObjects[CullingFrustum::BATCH_SIZE];
+
+	while (stackSize > 0)
+	{
+		const StackEntry entry = stack[--stackSize];
+		Octree::Node* node = entry.node;
+
+		// Fully inside the frustum, so everything below it is visible (unless it is occluded, or too small to
+		// be drawn even at the node's furthest corner)
+		if (entry.planeMask == 0 && !occlusion && frustum.IsAboveMinScreenSize(node->extent.Center, node->extent.Extents, node->minObjectSize))
+		{
+			AcceptSubtree(node, visibleInstances);
+			continue;
+		}
 
 		if (node->isLeaf)
 		{
-			// Frustum check geometry
-			for (auto& object : node->contents)
+			// Frustum check geometry, a batch at a time
+			// NOTE: The world-space bounding boxes are kept up to date by BoundingVolume::Update
+			const int numContents = (int) node->contents.size();
+
+			for (int i = 0; i < numContents; ++i)
 			{
-				// Transform object bounding volume to world space
-				XMMATRIX world = object->object->GetWorldMatrix();
+				batchObjects[batch.count] = node->contents[i];
+				batch.Add(node->contents[i]->extent);
 
-				BoundingBox boundingBox = object->object->GetBoundingBox();
-				boundingBox.Transform(boundingBox, world);
+				if (!batch.IsFull() && i + 1 < numContents)
+					continue;
+
+				// Objects that are either inside or intersecting the frustum are drawn
+				uint32_t visible = frustum.Test(batch, entry.planeMask, result);
+				stats.smallBoxes += frustum.CullSmallBoxes(batch, visible);
+				stats.planeTests += batch.count * CullingFrustum::CountPlanes(entry.planeMask);
 
-				if (frustum.Contains(boundingBox) != ContainmentType::DISJOINT)
+				for (int lane = 0; lane < batch.count; ++lane)
 				{
-					// Object is either inside or intersecting the frustum, so we draw it
-					visibleInstances.push_back(object->object);
-					++visibleObjects;
+					if (!(visible & (1u << lane)))
+						continue;
+
+					if (occlusion && occlusion->IsOccluded(batchObjects[lane]->extent))
+					{
+						++stats.occludedBoxes;
+						continue;
+					}
+
+					visibleInstances.push_back(batchObjects[lane]->object);
 				}
+
+				batch.Clear();
 			}
 		}
 		else
 		{
-			// Frustum check children
+			Octree::Node* children[8];
+			uint32_t childMasks[8];
+			const int numChildren = GetVisibleChildren(frustum, node, entry.planeMask, children, childMasks, stats, occlusion);
+
+			// Push in reverse, so that the children are visited in order
+			for (int i = numChildren - 1; i >= 0; --i)
+				stack[stackSize++] = { children[i], childMasks[i] };
+		}
+	}
+
+	return stats;
+}
+
+int BoundingVolume::GetVisibleChildren(const CullingFrustum& frustum, Octree::Node* node, uint32_t planeMask, Octree::Node* children[8], uint32_t childMasks[8], CullingStats& stats, const OcclusionBuffer* occlusion) const
+{
+	int numChildren = 0;
+
+	CullingFrustum::BoxBatch batch;
+	CullingFrustum::BatchResult result;
+	Octree::Node* batchChildren[CullingFrustum::BATCH_SIZE];
+
+	// Frustum check children, a batch at a time
+	const auto TestBatch = [&]()
+	{
+		uint32_t visible = frustum.Test(batch, planeMask, result);
+		stats.smallBoxes += frustum.CullSmallBoxes(batch, visible);
+		stats.planeTests += batch.count * CullingFrustum::CountPlanes(planeMask);
+
+		for (int lane = 0; lane < batch.count; ++lane)
+		{
+			batchChildren[lane]->rejectingPlanes[frustum.GetViewId()] = static_cast<uint8_t>(result.rejectingPlane[lane]);
+
+			if (!(visible & (1u << lane)))
+				continue;
+
+			if (occlusion && occlusion->IsOccluded(batchChildren[lane]->extent))
+			{
+				++stats.occludedBoxes;
+				continue;
+			}
+
+			children[numChildren] = batchChildren[lane];
+			childMasks[numChildren] = mPlaneMasking ? result.undecidedPlanes[lane] : CullingFrustum::ALL_PLANES;
+			++numChildren;
+		}
+
+		batch.Clear();
+	};
+
+	for (const auto& child : node->children)
+	{
+		if (!child)
+			continue;
+
+		++stats.nodesVisited;
+
+		// A view moves little from one frame to the next, so the plane that rejected a node last time
+		// is likely to reject it again. Try it on its own before testing the remaining planes
+		const uint32_t cachedPlane = child->rejectingPlanes[frustum.GetViewId()];
+
+		if (mPlaneMasking && cachedPlane != CullingFrustum::NO_PLANE && (planeMask & (1u << cachedPlane)))
+		{
+			++stats.planeTests;
+
+			if (frustum.IsOutside(child->extent.Center, child->extent.Extents, cachedPlane))
+				continue;
+		}
+
+		batchChildren[batch.count] = child.get();
+		batch.Add(child->extent);
+
+		if (batch.IsFull())
+			TestBatch();
+	}
+
+	if (batch.count > 0)
+		TestBatch();
+
+	return numChildren;
+}
+
+template <typename Output>
+void BoundingVolume::AcceptSubtree(Octree::Node* node, Output& visibleInstances)
+{
+	if (node->isLeaf)
+	{
+		for (const auto& object : node->contents)
+			visibleInstances.push_back(object->object);
+
+		return;
+	}
+
+	for (const auto& child : node->children)
+	{
+		if (child)
+			AcceptSubtree(child.get(), visibleInstances);
+	}
+}
+
+int BoundingVolume::GetVisibleGeometry(const MultiViewFrustum& frustum, MultiViewVisibility& visibility)
+{
+	visibility.Reset(mNumMeshes);
+
+	mCullingStats = CullingStats();
+	mCullingStats.nodesVisited = 1;
+
+	CullingFrustum::BoxBatch batch;
+	batch.Add(mSceneExtent);
+
+	MultiViewFrustum::ViewMask rootMask;
+	frustum.Test(batch, frustum.GetRootMask(), mPlaneMasking, &rootMask, mCullingStats);
+
+	// None of the views intersect with the scene
+	if (!rootMask.views)
+		return 0;
+
+	if (mLinearBVH)
+		mCullingStats += mLinearBVH->CullMultiView(frustum, 0, rootMask, visibility);
+	else
+		mCullingStats += CullMultiView(frustum, mOctree->GetRoot().get(), rootMask, visibility);
+
+	return visibility.visibleObjects;
+}
+
+CullingStats BoundingVolume::CullMultiView(const MultiViewFrustum& frustum, Octree::Node* root, const MultiViewFrustum::ViewMask& rootMask, MultiViewVisibility& visibility) const
+{
+	CullingStats stats;
+
+	// Same traversal as CullSubtree, so every view's objects come out in the same order as a query for that view alone
+	struct StackEntry
+	{
+		Octree::Node* node;
+		MultiViewFrustum::ViewMask mask;
+	};
+
+	StackEntry stack[8 * (MAX_DEPTH + 1)];
+	int stackSize = 0;
+
+	stack[stackSize++] = { root, rootMask };
+
+	CullingFrustum::BoxBatch batch;
+	MultiViewFrustum::ViewMask results[CullingFrustum::BATCH_SIZE];
+	Extent* batchObjects[CullingFrustum::BATCH_SIZE];
+	Octree::Node* batchChildren[CullingFrustum::BATCH_SIZE];
+
+	while (stackSize > 0)
+	{
+		const StackEntry entry = stack[--stackSize];
+		Octree::Node* node = entry.node;
+
+		// Fully inside every view it is visible in
+		if (MultiViewFrustum::IsInside(entry.mask))
+		{
+			AcceptSubtree(node, entry.mask.views, visibility);
+			continue;
+		}
+
+		if (node->isLeaf)
+		{
+			const int numContents = (int) node->contents.size();
+
+			for (int i = 0; i < numContents; ++i)
+			{
+				batchObjects[batch.count] = node->contents[i];
+				batch.Add(node->contents[i]->extent);
+
+				if (!batch.IsFull() && i + 1 < numContents)
+					continue;
+
+				frustum.Test(batch, entry.mask, mPlaneMasking, results, stats);
+
+				for (int lane = 0; lane < batch.count; ++lane)
+				{
+					if (!results[lane].views)
+						continue;
+
+					MeshInstance* instance = batchObjects[lane]->object;
+					visibility.Add(instance, (uint32_t) (instance - mMeshes), results[lane].views);
+				}
+
+				batch.Clear();
+			}
+		}
+		else
+		{
+			StackEntry children[8];
+			int numChildren = 0;
+
+			const auto TestBatch = [&]()
+			{
+				frustum.Test(batch, entry.mask, mPlaneMasking, results, stats);
+
+				for (int lane = 0; lane < batch.count; ++lane)
+				{
+					if (results[lane].views)
+						children[numChildren++] = { batchChildren[lane], results[lane] };
+				}
+
+				batch.Clear();
+			};
+
 			for (const auto& child : node->children)
 			{
 				if (!child)
 					continue;
 
-				// Queue the child if it is not outside the frustum
-				if (frustum.Contains(child->extent) != ContainmentType::DISJOINT)
-					queue.push(child);
+				++stats.nodesVisited;
+
+				batchChildren[batch.count] = child.get();
+				batch.Add(child->extent);
+
+				if (batch.IsFull())
+					TestBatch();
 			}
+
+			if (batch.count > 0)
+				TestBatch();
+
+			// Push in reverse, so that the children are visited in order
+			for (int i = numChildren - 1; i >= 0; --i)
+				stack[stackSize++] = children[i];
 		}
 	}
 
-	return visibleObjects;
+	return stats;
 }
 
-int BoundingVolume::GetVisibleGeometry(BoundingFrustum frustum, InstanceShader& shader)
+void BoundingVolume::AcceptSubtree(Octree::Node* node, uint32_t views, MultiViewVisibility& visibility) const
+{
+	if (node->isLeaf)
+	{
+		for (const auto& object : node->contents)
+			visibility.Add(object->object, (uint32_t) (object->object - mMeshes), views);
+
+		return;
+	}
+
+	for (const auto& child : node->children)
+	{
+		if (child)
+			AcceptSubtree(child.get(), views, visibility);
+	}
+}
+
+RayHit BoundingVolume::Raycast(const Ray& ray, RayQueryMode mode)
+{
+	RayHit hit;
+
+	if (mLinearBVH)
+		mRayStats = mLinearBVH->Raycast(ray, mode, hit);
+	else
+		mRayStats = Raycast(mOctree->GetRoot().get(), ray, mode, hit);
+
+	return hit;
+}
+
+void BoundingVolume::Raycast(const Ray* rays, int count, RayHit* hits, RayQueryMode mode, int packetSize)
+{
+	assert(packetSize > 0 && packetSize <= RayPacket::MAX_SIZE);
+
+	mRayStats = CullingStats();
+
+	for (int first = 0; first < count; first += packetSize)
+	{
+		const int packetCount = std::min(packetSize, count - first);
+
+		// Single rays skip the bookkeeping of the packet's masks
+		if (packetCount == 1)
+		{
+			if (mLinearBVH)
+				mRayStats += mLinearBVH->Raycast(rays[first], mode, hits[first]);
+			else
+				mRayStats += Raycast(mOctree->GetRoot().get(), rays[first], mode, hits[first]);
+
+			continue;
+		}
+
+		RayPacket packet(rays + first, packetCount);
+		RayHit packetHits[RayPacket::MAX_SIZE];
+
+		if (mLinearBVH)
+			mRayStats += mLinearBVH->Raycast(packet, mode, packetHits);
+		else
+			mRayStats += Raycast(mOctree->GetRoot().get(), packet, mode, packetHits);
+
+		std::copy(packetHits, packetHits + packetCount, hits + first);
+	}
+}
+
+CullingStats BoundingVolume::Raycast(Octree::Node* root, const Ray& ray, RayQueryMode mode, RayHit& hit) const
+{
+	CullingStats stats;
+	stats.nodesVisited = 1;
+
+	hit = RayHit();
+	PreparedRay preparedRay(ray);
+
+	// Nodes the ray enters, along with the distance it enters them at
+	struct StackEntry
+	{
+		Octree::Node* node;
+		float tNear;
+	};
+
+	StackEntry stack[8 * (MAX_DEPTH + 1)];
+	int stackSize = 0;
+
+	float tNear;
+	if (!preparedRay.Intersect(root->extent.Center, root->extent.Extents, tNear))
+		return stats;
+
+	stack[stackSize++] = { root, tNear };
+
+	while (stackSize > 0)
+	{
+		const StackEntry entry = stack[--stackSize];
+		Octree::Node* node = entry.node;
+
+		// Something closer has been hit since the node was pushed
+		if (entry.tNear > preparedRay.GetMaxDistance())
+			continue;
+
+		if (node->isLeaf)
+		{
+			for (Extent* object : node->contents)
+			{
+				if (!preparedRay.Intersect(object->extent.Center, object->extent.Extents, tNear) || tNear >= hit.distance)
+					continue;
+
+				hit.instance = object->object;
+				hit.distance = tNear;
+
+				if (mode == RayQueryMode::ANY_HIT)
+					return stats;
+
+				preparedRay.SetMaxDistance(tNear);
+			}
+		}
+		else
+		{
+			StackEntry children[8];
+			int numChildren = 0;
+
+			for (const auto& child : node->children)
+			{
+				if (!child)
+					continue;
+
+				++stats.nodesVisited;
+
+				if (!preparedRay.Intersect(child->extent.Center, child->extent.Extents, tNear))
+					continue;
+
+				// Insertion sort, furthest first, so that the nearest child ends up on top of the stack
+				int i = numChildren++;
+				for (; i > 0 && children[i - 1].tNear < tNear; --i)
+					children[i] = children[i - 1];
+
+				children[i] = { child.get(), tNear };
+			}
+
+			for (int i = 0; i < numChildren; ++i)
+				stack[stackSize++] = children[i];
+		}
+	}
+
+	return stats;
+}
+
+CullingStats BoundingVolume::Raycast(Octree::Node* root, RayPacket& packet, RayQueryMode mode, RayHit hits[RayPacket::MAX_SIZE]) const
+{
+	CullingStats stats;
+	stats.nodesVisited = 1;
+
+	for (int i = 0; i < packet.GetCount(); ++i)
+		hits[i] = RayHit();
+
+	// Rays that are still looking for a hit. With RayQueryMode::ANY_HIT, a ray drops out as soon as it hits something
+	uint32_t searchingRays = packet.GetAllRays();
+
+	// Nodes entered by at least one ray, along with the rays that enter them and the nearest distance they do so at
+	struct StackEntry
+	{
+		Octree::Node* node;
+		uint32_t rays;
+		float tNear;
+	};
+
+	StackEntry stack[8 * (MAX_DEPTH + 1)];
+	int stackSize = 0;
+
+	float tNear[RayPacket::MAX_SIZE];
+
+	const uint32_t rootRays = packet.Intersect(root->extent.Center, root->extent.Extents, searchingRays, tNear);
+	if (!rootRays)
+		return stats;
+
+	stack[stackSize++] = { root, rootRays, 0.f };
+
+	while (stackSize > 0)
+	{
+		const StackEntry entry = stack[--stackSize];
+		Octree::Node* node = entry.node;
+
+		uint32_t rays = entry.rays & searchingRays;
+		if (!rays)
+			continue;
+
+		if (node->isLeaf)
+		{
+			for (auto it = node->contents.begin(); it != node->contents.end() && rays; ++it)
+			{
+				const Extent* object = *it;
+
+				for (uint32_t hitRays = packet.Intersect(object->extent.Center, object->extent.Extents, rays, tNear); hitRays; hitRays &= hitRays - 1)
+				{
+					const uint32_t ray = CullingFrustum::LowestBit(hitRays);
+
+					if (tNear[ray] >= hits[ray].distance)
+						continue;
+
+					hits[ray].instance = object->object;
+					hits[ray].distance = tNear[ray];
+					packet.SetMaxDistance(ray, tNear[ray]);
+
+					if (mode == RayQueryMode::ANY_HIT)
+					{
+						searchingRays &= ~(1u << ray);
+						rays &= ~(1u << ray);
+					}
+				}
+			}
+
+			if (!searchingRays)
+				return stats;
+		}
+		else
+		{
+			StackEntry children[8];
+			int numChildren = 0;
+
+			for (const auto& child : node->children)
+			{
+				if (!child)
+					continue;
+
+				++stats.nodesVisited;
+
+				const uint32_t childRays = packet.Intersect(child->extent.Center, child->extent.Extents, rays, tNear);
+				if (!childRays)
+					continue;
+
+				// Children are ordered by the closest distance any of the packet's rays enter them at
+				float childNear = FLT_MAX;
+				for (uint32_t hitRays = childRays; hitRays; hitRays &= hitRays - 1)
+					childNear = std::min(childNear, tNear[CullingFrustum::LowestBit(hitRays)]);
+
+				// Insertion sort, furthest first, so that the nearest child ends up on top of the stack
+				int i = numChildren++;
+				for (; i > 0 && children[i - 1].tNear < childNear; --i)
+					children[i] = children[i - 1];
+
+				children[i] = { child.get(), childRays, childNear };
+			}
+
+			for (int i = 0; i < numChildren; ++i)
+				stack[stackSize++] = children[i];
+		}
+	}
+
+	return stats;
+}
+
+#if !defined(CULLING_HEADLESS)
+int BoundingVolume::GetVisibleGeometry(BoundingFrustum frustum, InstanceBatcher& batcher, WorkerPool* pool, const OcclusionBuffer* occlusion)
 {
 	std::vector<MeshInstance*> visibleInstances;
-	int visibleObjects = GetVisibleGeometry(frustum, visibleInstances);
+	int visibleObjects = GetVisibleGeometry(frustum, visibleInstances, pool, occlusion);
 
-	// Add the visible objects to the InstanceShader so that they may be rendered in one draw call
-	// Assumes all the instances use the same mesh
-	for (const auto& instance : visibleInstances)
-		shader.addInstance(instance->GetWorldMatrix());
+	// Add the visible objects to the batcher so that every kind of object may be rendered in one draw call
+	batcher.Add(visibleInstances);
 
 	return visibleObjects;
 }
 
 void BoundingVolume::GetBoundingVolumes(InstanceShader& shader, int depth) const
 {
-	GetBoundingVolumes(mOctree->GetRoot(), shader, depth);
+	if (mLinearBVH)
+		GetBoundingVolumes(0, shader, depth);
+	else
+		GetBoundingVolumes(mOctree->GetRoot(), shader, depth);
+}
+#endif
+
+void BoundingVolume::SetPlaneMasking(bool enabled)
+{
+	mPlaneMasking = enabled;
+
+	if (mLinearBVH)
+		mLinearBVH->SetPlaneMasking(enabled);
 }
 
-void BoundingVolume::Init(MeshInstance * const meshes, int count)
+void BoundingVolume::Init(MeshInstance * const meshes, int count, const std::string& cacheFile)
 {
+	mMeshes = meshes;
+	mNumMeshes = count;
+
+	if (mHierarchyType == HierarchyType::SAH || mHierarchyType == HierarchyType::LBVH)
+	{
+		if (mHierarchyType == HierarchyType::LBVH)
+			mLinearBVH = LinearBVH::BuildMorton(meshes, count);
+		else if (!cacheFile.empty())
+			mLinearBVH = LinearBVH::LoadCache(cacheFile, meshes, count);
+
+		if (!mLinearBVH)
+		{
+			mLinearBVH = std::make_shared<LinearBVH>(meshes, count);
+
+			if (!cacheFile.empty())
+				mLinearBVH->SaveCache(cacheFile);
+		}
+
+		mLinearBVH->SetPlaneMasking(mPlaneMasking);
+
+		mSceneExtent = mLinearBVH->GetSceneExtent();
+		mUpdateStats.rebuildCost = mLinearBVH->GetBuildCost();
+		return;
+	}
+
 	// Initialise scene extent
 	meshes[0].GetBoundingBox().Transform(mSceneExtent, meshes[0].GetWorldMatrix());
 
@@ -119,8 +936,25 @@ void BoundingVolume::Init(MeshInstance * const meshes, int count)
 
 	// Calculate the node's tight-fitting bounding volumes
 	mOctree->Build();
+
+	// Building visits every inserted node once more to fit its extent, which is the same work Refit does per node
+	mUpdateStats.rebuildCost = count + mOctree->GetInsertVisits() + CountNodes(mOctree->GetRoot());
+}
+
+int BoundingVolume::CountNodes(pointer<Octree::Node> node)
+{
+	int count = 1;
+
+	for (const auto& child : node->children)
+	{
+		if (child)
+			count += CountNodes(child);
+	}
+
+	return count;
 }
 
+#if !defined(CULLING_HEADLESS)
 void BoundingVolume::GetBoundingVolumes(pointer<Octree::Node> node, InstanceShader & shader, int depth) const
 {
 	// Keep traversing the hierarchy until the desired depth has been reached
@@ -170,3 +1004,23 @@ void BoundingVolume::GetBoundingVolumes(pointer<Octree::Node> node, InstanceShad
 		}
 	}
 }
+
+void BoundingVolume::GetBoundingVolumes(uint32_t nodeIdx, InstanceShader& shader, int depth) const
+{
+	const LinearBVH::Node& node = mLinearBVH->GetNodes()[nodeIdx];
+
+	// Keep traversing the hierarchy until the desired depth (or a leaf) has been reached
+	if (depth > 0 && !node.IsLeaf())
+	{
+		GetBoundingVolumes(nodeIdx + 1, shader, depth - 1);
+		GetBoundingVolumes(node.offset, shader, depth - 1);
+		return;
+	}
+
+	// Scale and translate a cube so that it visualises the bounding volume
+	XMMATRIX extentTransform = XMMatrixScalingFromVector(XMLoadFloat3(&node.extents));
+	extentTransform *= XMMatrixTranslationFromVector(XMLoadFloat3(&node.center));
+
+	shader.addInstance(extentTransform);
+}
+#endif
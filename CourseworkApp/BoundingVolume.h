@@ -1,34 +1,34 @@
 // A bounding volume hierarchy (BVH) built on top of an Octree
 // Allows for frustum culling to be performed much more efficently than a naive implementation
-// Hierarchy is only generated once, so it does not support dynamic objects
+// Hierarchy is generated once; objects that move afterwards are handled by BoundingVolume::Update,
+// which refits the affected nodes and only re-inserts objects that have left their cell
 
 #pragma once
 #include <DirectXMath.h>
 #include <DirectXCollision.h>
 #include <vector>
 #include <memory>
+#include <algorithm>
+#include <string>
 
 #include "MeshInstance.h"
+#include "LinearBVH.h"
+#include "WorkerPool.h"
+
+class OcclusionBuffer;
+class InstanceSpan;
 
 using namespace DirectX;
 
 class InstanceShader;
+class InstanceBatcher;
 
 class BoundingVolume
 {
 	template <typename T>
 	using pointer = std::shared_ptr<T>;
 
-	// Extent is the type that is stored within the leaf nodes of the BVH,
-	// representing a single object
-	struct Extent
-	{
-		// Object's world-space bounding box
-		BoundingBox extent;
-
-		// Pointer to an object within the BVH
-		MeshInstance* object = nullptr;
-	};
+	struct Extent;
 
 	class Octree
 	{
@@ -37,21 +37,42 @@ class BoundingVolume
 		{
 			bool isLeaf = true;
 
+			// Set while the node is waiting to have its extent refitted
+			bool isDirty = false;
+
+			int depth = 0;
+
+			// Non-owning pointer to the parent node (nullptr for the root)
+			Node* parent = nullptr;
+
 			// The child voxels
 			pointer<Node> children[8];
 
+			// The voxel (cell) this node represents. Objects whose centre leaves this cell must be re-inserted
+			BoundingBox cell;
+
 			// Bounding volume that contains all of the node's children
 			BoundingBox extent;
 
+			// Squared length of the extents of the smallest object below the node, for small-feature culling
+			float minObjectSize = 0.f;
+
 			// The bounding box + pointers to objects in this node (leaf)
 			std::vector<Extent*> contents;
+
+			// The frustum plane that rejected this node the last time it was tested by each view (see
+			// CullingFrustum::SetViewId), or CullingFrustum::NO_PLANE
+			uint8_t rejectingPlanes[CullingFrustum::MAX_CACHED_VIEWS] = { CullingFrustum::NO_PLANE, CullingFrustum::NO_PLANE, CullingFrustum::NO_PLANE, CullingFrustum::NO_PLANE };
 		};
 
+		static_assert(CullingFrustum::MAX_CACHED_VIEWS == 4, "Node::rejectingPlanes is initialised with one entry per cached view");
+
 		// Create the octree by first initialising the root node
-		Octree(const BoundingBox& sceneExtent, int maxDepth) : mSceneExtent(sceneExtent), mMaxDepth(maxDepth)
+		Octree(const BoundingBox& sceneExtent, int maxDepth) : mSceneExtent(sceneExtent), mMaxDepth(maxDepth), mDirtyNodes(maxDepth + 2)
 		{
 			mRoot = std::make_shared<Node>();
 			mRoot->extent = mSceneExtent;
+			mRoot->cell = mSceneExtent;
 		}
 
 		// Insert a new object into the octree
@@ -60,17 +81,92 @@ class BoundingVolume
 			Insert(mRoot, mSceneExtent, &newObject, 0);
 		}
 
+		// Remove an object from the leaf it is currently stored in
+		void Remove(Extent& object)
+		{
+			Node* leaf = object.leaf;
+			auto it = std::find(leaf->contents.begin(), leaf->contents.end(), &object);
+
+			// Order within a leaf does not matter, so swap-and-pop
+			std::iter_swap(it, leaf->contents.end() - 1);
+			leaf->contents.pop_back();
+			object.leaf = nullptr;
+
+			if (leaf->contents.empty())
+				Prune(leaf);
+			else
+				MarkDirty(leaf);
+		}
+
 		// Calculate the extents of all the nodes within the tree once all objects have been inserted
 		void Build()
 		{
 			Build(mRoot, mSceneExtent);
 		}
 
+		// Flag a node so that its extent (and its ancestors' extents) are recalculated by the next call to Refit
+		void MarkDirty(Node* node)
+		{
+			if (node->isDirty)
+				return;
+
+			node->isDirty = true;
+			mDirtyNodes[node->depth].push_back(node);
+		}
+
+		// Recalculate the extents of all dirty nodes, deepest first, so every node is only refitted once
+		// Returns the number of nodes that were refitted
+		int Refit()
+		{
+			int refittedNodes = 0;
+
+			for (int depth = (int) mDirtyNodes.size() - 1; depth >= 0; --depth)
+			{
+				// NOTE: Refitting a node only ever queues its parent, which lives in a shallower bucket
+				for (Node* node : mDirtyNodes[depth])
+				{
+					node->isDirty = false;
+					++refittedNodes;
+
+					BoundingBox oldExtent = node->extent;
+					const float oldMinObjectSize = node->minObjectSize;
+					FitExtent(node);
+
+					// The parent only needs refitting if this node's extent (or smallest object) actually changed
+					if (node->parent && (!IsSameExtent(oldExtent, node->extent) || oldMinObjectSize != node->minObjectSize))
+						MarkDirty(node->parent);
+				}
+
+				mDirtyNodes[depth].clear();
+			}
+
+			return refittedNodes;
+		}
+
 		auto GetRoot() const { return mRoot; }
 
+		// The leaf Insert would place an object with this centre in, or nullptr if it would have to create one
+		// Objects outside the root cell are placed in the leaf at the nearest point of the cell
+		Node* FindLeaf(const XMFLOAT3& center) const
+		{
+			Node* node = mRoot.get();
+
+			while (node && !node->isLeaf)
+				node = node->children[GetChildIndex(center, node->cell)].get();
+
+			return node;
+		}
+
+		// Number of nodes visited by Insert since the counter was last reset
+		// Used to compare the cost of updating the hierarchy against the cost of rebuilding it
+		int GetInsertVisits() const { return mInsertVisits; }
+		void ResetInsertVisits() { mInsertVisits = 0; }
+
 	private:
 		void Insert(pointer<Node> node, const BoundingBox& nodeBounds, Extent* newObject, int depth)
 		{
+			++mInsertVisits;
+
 			if (node->isLeaf)
 			{
 				// If it is an empty leaf, then we have found a place for our new object
@@ -79,6 +175,9 @@ class BoundingVolume
 				if (node->contents.empty() || depth >= mMaxDepth)
 				{
 					node->contents.push_back(newObject);
+					newObject->leaf = node.get();
+
+					MarkDirty(node.get());
 				}
 				// Otherwise, we need to make this node an internal node, and relocate its current content
 				else
@@ -98,32 +197,43 @@ class BoundingVolume
 			else
 			{
 				// Determine which of this node's children the new object should be (attempted) inserted into
-				int childIdx = 0;
-
-				// TERMINOLOGY: Bounding volume == extent == cell
-				//				Cells are split into voxels, and a voxel can itself be a cell
+				const int childIdx = GetChildIndex(newObject->extent.Center, nodeBounds);
 
-				// If true, right half of cell
-				if (newObject->extent.Center.x > nodeBounds.Center.x) childIdx += 4;
-				// If true, upper half of cell
-				if (newObject->extent.Center.y > nodeBounds.Center.y) childIdx += 2;
-				// If true, near half of cell
-				if (newObject->extent.Center.z > nodeBounds.Center.z) childIdx += 1;
+				// Calculate child bounds
+				BoundingBox childBounds = CalculateChildBounds(childIdx, nodeBounds);
 
 				// Create new node if it does not already exist
 				if (!node->children[childIdx])
 				{
 					node->children[childIdx] = std::make_shared<Node>();
+					node->children[childIdx]->parent = node.get();
+					node->children[childIdx]->depth = depth + 1;
+					node->children[childIdx]->cell = childBounds;
 				}
 
-				// Calculate child bounds
-				BoundingBox childBounds = CalculateChildBounds(childIdx, nodeBounds);
-
 				// Insert new object into the new node
 				Insert(node->children[childIdx], childBounds, newObject, depth + 1);
 			}
 		}
 
+		// Index of the child voxel of a cell that a point falls into
+		static int GetChildIndex(const XMFLOAT3& point, const BoundingBox& cell)
+		{
+			int childIdx = 0;
+
+			// TERMINOLOGY: Bounding volume == extent == cell
+			//				Cells are split into voxels, and a voxel can itself be a cell
+
+			// If true, right half of cell
+			if (point.x > cell.Center.x) childIdx += 4;
+			// If true, upper half of cell
+			if (point.y > cell.Center.y) childIdx += 2;
+			// If true, near half of cell
+			if (point.z > cell.Center.z) childIdx += 1;
+
+			return childIdx;
+		}
+
 		// Creates the bounding box of a child node (cell) within the octree
 		BoundingBox CalculateChildBounds(int idx, const BoundingBox& parentExtents)
 		{
@@ -151,41 +261,158 @@ class BoundingVolume
 		// Calculate the tight-fitting extent of all nodes (bottom-up)
 		void Build(pointer<Node> node, const BoundingBox& nodeBounds)
 		{
+			node->isDirty = false;
+
+			for (int childIdx = 0; childIdx < 8; ++childIdx)
+			{
+				if (!node->children[childIdx])
+					continue;
+
+				BoundingBox childBounds = CalculateChildBounds(childIdx, nodeBounds);
+				Build(node->children[childIdx], childBounds);
+			}
+
+			FitExtent(node.get());
+
+			// Everything has just been fitted, so nothing is pending a refit
+			if (node == mRoot)
+			{
+				for (auto& bucket : mDirtyNodes)
+					bucket.clear();
+			}
+		}
+
+		// Calculate the tight-fitting extent of a single node from its contents (leaf) or its children (internal)
+		// Expects the children's extents to be up to date
+		void FitExtent(Node* node)
+		{
+			bool first = true;
+			const auto Merge = [&](const BoundingBox& box, float minObjectSize)
+			{
+				if (first)
+				{
+					node->extent = box;
+					node->minObjectSize = minObjectSize;
+				}
+				else
+				{
+					BoundingBox::CreateMerged(node->extent, node->extent, box);
+					node->minObjectSize = std::min(node->minObjectSize, minObjectSize);
+				}
+
+				first = false;
+			};
+
 			if (node->isLeaf)
 			{
 				// Calculate a bounding box that encompasses all the OBJECTS within the (leaf) node
-				node->extent = node->contents.back()->extent;
-
 				for (const auto& object : node->contents)
-					BoundingBox::CreateMerged(node->extent, node->extent, object->extent);
+					Merge(object->extent, XMVectorGetX(XMVector3LengthSq(XMLoadFloat3(&object->extent.Extents))));
 			}
 			else
 			{
 				// Calculate a bounding box that encompasses all the CHILDREN within the (internal) node
-				for (int childIdx = 0; childIdx < 8; ++childIdx)
+				for (const auto& child : node->children)
 				{
-					if (!node->children[childIdx])
-						continue;
+					if (child)
+						Merge(child->extent, child->minObjectSize);
+				}
+			}
+
+			// An empty node (only ever the root) falls back to its cell
+			if (first)
+			{
+				node->extent = node->cell;
+				node->minObjectSize = 0.f;
+			}
+		}
 
-					BoundingBox childBounds = CalculateChildBounds(childIdx, nodeBounds);
+		// Detach an empty node from the tree, collapsing any ancestors that are left without children
+		void Prune(Node* node)
+		{
+			Node* parent = node->parent;
 
-					Build(node->children[childIdx], childBounds);
-					BoundingBox::CreateMerged(node->extent, nodeBounds, node->children[childIdx]->extent);
-				}
+			// The root is never removed, it is just left as an empty leaf
+			if (!parent)
+			{
+				node->isLeaf = true;
+				MarkDirty(node);
+				return;
 			}
+
+			bool hasChildren = false;
+			for (auto& child : parent->children)
+			{
+				if (child.get() == node)
+					child.reset();
+				else if (child)
+					hasChildren = true;
+			}
+
+			// NOTE: node is destroyed at this point. If it was queued for a refit, it must be removed from the queue
+			auto& bucket = mDirtyNodes[parent->depth + 1];
+			bucket.erase(std::remove(bucket.begin(), bucket.end(), node), bucket.end());
+
+			if (hasChildren)
+				MarkDirty(parent);
+			else
+				Prune(parent);
+		}
+
+		static bool IsSameExtent(const BoundingBox& a, const BoundingBox& b)
+		{
+			return a.Center.x == b.Center.x && a.Center.y == b.Center.y && a.Center.z == b.Center.z &&
+				a.Extents.x == b.Extents.x && a.Extents.y == b.Extents.y && a.Extents.z == b.Extents.z;
 		}
 
 		pointer<Node> mRoot = nullptr;
 		const int mMaxDepth;
 		BoundingBox mSceneExtent;
+
+		// Nodes waiting to be refitted, bucketed by depth
+		std::vector<std::vector<Node*>> mDirtyNodes;
+
+		int mInsertVisits = 0;
+	};
+
+	// Extent is the type that is stored within the leaf nodes of the BVH,
+	// representing a single object
+	struct Extent
+	{
+		// Object's world-space bounding box
+		BoundingBox extent;
+
+		// Pointer to an object within the BVH
+		MeshInstance* object = nullptr;
+
+		// The leaf node the object is currently stored in
+		Octree::Node* leaf = nullptr;
 	};
 
 public:
 	// Max depth stops it from breaking when there are multiple objects with the exact same position
 	static constexpr int MAX_DEPTH = 16;
 
-	BoundingVolume(std::vector<MeshInstance*>& meshes);
-	BoundingVolume(MeshInstance* const meshes, int count);
+	// The type of hierarchy used to organise the objects
+	enum class HierarchyType
+	{
+		// Octree with refittable nodes. Objects may move between cells (see BoundingVolume::Update)
+		OCTREE,
+		// Flat, depth-first BVH built with the surface area heuristic. Best suited to static scenes, as moving
+		// objects only refit the nodes without changing the topology of the tree
+		SAH,
+		// The same flat BVH, built from Morton codes and rebuilt from scratch on every update. For fully dynamic
+		// scenes, where refitting a fixed topology would degrade the tree
+		LBVH
+	};
+
+	BoundingVolume(std::vector<MeshInstance*>& meshes, HierarchyType type = HierarchyType::OCTREE);
+	BoundingVolume(MeshInstance* const meshes, int count, HierarchyType type = HierarchyType::OCTREE);
+
+	// For large static scenes. The SAH hierarchy is mapped from the cache file if it was saved from meshes with the
+	// same transforms, and is otherwise built and saved to it. The octree is made of pointers, so it is always built,
+	// and the LBVH is rebuilt on every update anyway
+	BoundingVolume(MeshInstance* const meshes, int count, HierarchyType type, const std::string& cacheFile);
 
 	BoundingVolume(const BoundingVolume&) = delete;
 	BoundingVolume& operator=(const BoundingVolume&) = delete;
@@ -195,23 +422,172 @@ public:
 	BoundingBox& GetSceneExtent() { return mSceneExtent; }
 	const BoundingBox& GetSceneExtent() const { return mSceneExtent; }
 
+	// Cost of keeping the hierarchy up to date, measured in node operations (insertion visits + refits)
+	struct UpdateStats
+	{
+		int movedObjects = 0;
+		int reinsertedObjects = 0;
+		int refittedNodes = 0;
+
+		// Total node operations spent by the last call to Update
+		int updateCost = 0;
+
+		// Node operations it took to build the hierarchy from scratch in Init
+		int rebuildCost = 0;
+	};
+
+	// Bring the hierarchy up to date after some of its objects have moved
+	// Objects that are still within their cell only cause the extents above them to be refitted;
+	// objects that have left their cell are removed and re-inserted from the root
+	// The LBVH is rebuilt from every object instead, on the pool's workers if one is given, unless nothing moved
+	void Update(MeshInstance* const* movedInstances, int count, WorkerPool* pool = nullptr);
+	void Update(const std::vector<MeshInstance*>& movedInstances, WorkerPool* pool = nullptr) { Update(movedInstances.data(), (int) movedInstances.size(), pool); }
+
+	const UpdateStats& GetUpdateStats() const { return mUpdateStats; }
+
+	HierarchyType GetHierarchyType() const { return mHierarchyType; }
+
+	// Whether the hierarchy was mapped from a cache file rather than built
+	bool IsFromCache() const { return mLinearBVH && mLinearBVH->IsFromCache(); }
+
+	// Number of nodes visited by the last call to GetVisibleGeometry
+	int GetNodesVisited() const { return mCullingStats.nodesVisited; }
+
+	// Number of box-plane tests done by the last call to GetVisibleGeometry
+	int GetPlaneTests() const { return mCullingStats.planeTests; }
+
+	// Number of nodes and objects the last call to GetVisibleGeometry found to be occluded
+	int GetOccludedBoxes() const { return mCullingStats.occludedBoxes; }
+
+	// Number of nodes and objects the last call to GetVisibleGeometry culled for being below the frustum's minimum screen size
+	int GetSmallBoxes() const { return mCullingStats.smallBoxes; }
+
+	// When enabled, nodes only test the planes their parent intersects, whole subtrees inside the frustum are accepted
+	// without testing them, and every node first tries the plane that rejected it in the previous query of the same view
+	void SetPlaneMasking(bool enabled);
+	bool GetPlaneMasking() const { return mPlaneMasking; }
+
 	// Populates a vector of MeshInstance pointers that may be used to render the non-culled objects without instancing
-	int GetVisibleGeometry(BoundingFrustum frustum, std::vector<MeshInstance*>& visibleInstances);
+	// If a WorkerPool is given, subtrees are culled on all of its workers. The order of the visible objects is
+	// the same as when culling on one thread
+	// If an OcclusionBuffer is given, nodes and objects hidden behind its occluders are culled too
+	int GetVisibleGeometry(BoundingFrustum frustum, std::vector<MeshInstance*>& visibleInstances, WorkerPool* pool = nullptr, const OcclusionBuffer* occlusion = nullptr);
+
+	// As above, for volumes a BoundingFrustum cannot represent (e.g. the orthographic volume of a directional light)
+	int GetVisibleGeometry(const CullingFrustum& frustum, std::vector<MeshInstance*>& visibleInstances, WorkerPool* pool = nullptr, const OcclusionBuffer* occlusion = nullptr);
+
+	// As above, packing the transforms of the visible objects straight into a span (e.g. of a mapped instance buffer),
+	// in the same order. With a WorkerPool, the workers still collect pointers, and pack their ranges in parallel
+	int GetVisibleGeometry(const CullingFrustum& frustum, InstanceSpan& visibleInstances, WorkerPool* pool = nullptr, const OcclusionBuffer* occlusion = nullptr);
+
+	// Culls several views in a single traversal of the hierarchy, testing every node against all of the views it may
+	// still be visible in. Fills in a view mask per object, and a list per view that is in the same order as
+	// GetVisibleGeometry would give for that view. Returns the number of objects visible in at least one view
+	int GetVisibleGeometry(const MultiViewFrustum& frustum, MultiViewVisibility& visibility);
+
+	// Finds the nearest object whose bounding box the ray hits within its max distance. With RayQueryMode::ANY_HIT
+	// the search stops at the first hit, which is enough for line of sight tests
+	RayHit Raycast(const Ray& ray, RayQueryMode mode = RayQueryMode::NEAREST);
 
-	// Adds visible geometry to the InstanceShader's internal list do that the objects may be rendered with instancing
-	// Only to be used for objects with the same mesh
-	int GetVisibleGeometry(BoundingFrustum frustum, InstanceShader& shader);
+	// As above, for the segment between two points. The hit distance is in world units from the start
+	RayHit Raycast(const XMFLOAT3& start, const XMFLOAT3& end, RayQueryMode mode = RayQueryMode::NEAREST) { return Raycast(Ray::CreateSegment(start, end), mode); }
+
+	// Traces a number of rays, packetSize (up to RayPacket::MAX_SIZE) consecutive rays at a time. hits[i] receives
+	// the result of rays[i]. Neighbouring rays should be coherent (e.g. neighbouring pixels) to gain from packets
+	void Raycast(const Ray* rays, int count, RayHit* hits, RayQueryMode mode = RayQueryMode::NEAREST, int packetSize = RayPacket::MAX_SIZE);
+
+	// Number of nodes tested by the last call to Raycast
+	int GetRayNodesVisited() const { return mRayStats.nodesVisited; }
+
+	// Adds visible geometry to an InstanceBatcher so that the objects may be rendered with instancing, one draw per
+	// combination of mesh, texture and shader
+	int GetVisibleGeometry(BoundingFrustum frustum, InstanceBatcher& batcher, WorkerPool* pool = nullptr, const OcclusionBuffer* occlusion = nullptr);
 
 	// Adds the bounding volumes of the BVH to an InstanceShader's internal list so that they may be visualised
 	void GetBoundingVolumes(InstanceShader& shader, int depth) const;
 
 private:
-	void Init(MeshInstance* const meshes, int count);
+	void Init(MeshInstance* const meshes, int count, const std::string& cacheFile = std::string());
 
 	void GetBoundingVolumes(pointer<Octree::Node> node, InstanceShader& shader, int depth) const;
+	void GetBoundingVolumes(uint32_t nodeIdx, InstanceShader& shader, int depth) const;
+
+	static int CountNodes(pointer<Octree::Node> node);
+
+	// Subtree of the hierarchy culled by one worker
+	struct CullTask
+	{
+		// Root of the subtree. Which one is used depends on the hierarchy type
+		uint32_t linearNode = 0;
+		Octree::Node* octreeNode = nullptr;
+
+		// The range of the worker's visible list that this task filled in
+		int worker = 0;
+		size_t begin = 0;
+		size_t end = 0;
+
+		// Where the range ends up in the merged list
+		size_t outputOffset = 0;
+
+		// Planes the root of the subtree intersects
+		uint32_t planeMask = CullingFrustum::ALL_PLANES;
+
+		CullingStats stats;
+	};
+
+	// Enough tasks per worker that stealing can even out subtrees of very different sizes
+	static constexpr int TASKS_PER_WORKER = 8;
+
+	// Output is either a std::vector<MeshInstance*> or an InstanceSpan
+	template <typename Output>
+	int CullVisible(const CullingFrustum& frustum, Output& visibleInstances, WorkerPool* pool, const OcclusionBuffer* occlusion);
+
+	template <typename Output>
+	void CullParallel(const CullingFrustum& frustum, uint32_t planeMask, Output& visibleInstances, WorkerPool& pool, const OcclusionBuffer* occlusion);
+
+	// Split the visible part of the hierarchy into (at least) a number of subtrees, stored in traversal order
+	void SplitCullTasks(const CullingFrustum& frustum, uint32_t planeMask, int targetTasks, const OcclusionBuffer* occlusion);
+
+	// Appends the visible objects below an octree node that is already known to intersect the planes in planeMask
+	template <typename Output>
+	CullingStats CullSubtree(const CullingFrustum& frustum, Octree::Node* root, uint32_t planeMask, Output& visibleInstances, const OcclusionBuffer* occlusion) const;
+
+	// Writes out the children (and plane masks) of an octree node that intersect the frustum, in order
+	int GetVisibleChildren(const CullingFrustum& frustum, Octree::Node* node, uint32_t planeMask, Octree::Node* children[8], uint32_t childMasks[8], CullingStats& stats, const OcclusionBuffer* occlusion) const;
+
+	// Adds the objects below an octree node to the lists of the views they are visible in
+	CullingStats CullMultiView(const MultiViewFrustum& frustum, Octree::Node* root, const MultiViewFrustum::ViewMask& rootMask, MultiViewVisibility& visibility) const;
+
+	// Ray queries against the octree. Children are visited nearest first
+	CullingStats Raycast(Octree::Node* root, const Ray& ray, RayQueryMode mode, RayHit& hit) const;
+	CullingStats Raycast(Octree::Node* root, RayPacket& packet, RayQueryMode mode, RayHit hits[RayPacket::MAX_SIZE]) const;
+
+	// Append every object below an octree node
+	template <typename Output>
+	static void AcceptSubtree(Octree::Node* node, Output& visibleInstances);
+	void AcceptSubtree(Octree::Node* node, uint32_t views, MultiViewVisibility& visibility) const;
+
+	HierarchyType mHierarchyType;
 
 	BoundingBox mSceneExtent;
 	Extent* mExtents = nullptr;
+
+	// Only one of these is created, depending on the hierarchy type
 	pointer<Octree> mOctree;
+	pointer<LinearBVH> mLinearBVH;
+
+	// The (contiguous) array of objects the hierarchy was built from. Used to find an object's extent
+	MeshInstance* mMeshes = nullptr;
+	int mNumMeshes = 0;
+
+	UpdateStats mUpdateStats;
+	CullingStats mCullingStats;
+	CullingStats mRayStats;
+	bool mPlaneMasking = true;
+
+	// Scratch space for culling in parallel
+	std::vector<CullTask> mCullTasks;
+	std::vector<CullTask> mNextCullTasks;
+	std::vector< std::vector<MeshInstance*> > mWorkerVisible;
 };
 
@@ -0,0 +1,9 @@
+#include "CommandBackend.h"
+#include "../DXFramework/BaseMesh.h"
+
+void CommandBackend::SetMesh(BaseMesh* mesh)
+{
+	SetVertexBuffer(0, mesh->getVertexBuffer(), mesh->getVertexStride(), 0);
+	SetIndexBuffer(mesh->getIndexBuffer(), IndexFormat::UINT32, 0);
+	SetTopology(Topology::TRIANGLE_LIST);
+}
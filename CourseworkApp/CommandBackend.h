@@ -0,0 +1,109 @@
+// Something draws are submitted to: the device context (D3D11Backend), a CommandBuffer that records them to be
+// replayed later, or a RecordingBackend that only keeps track of them (e.g. to check the draw stream off Windows)
+// Shaders that submit through a CommandBackend work with any of them. Calls mirror the device context's, with one
+// stage argument in place of the VS/HS/DS/GS/PS variants of every call
+
+#pragma once
+#include <cstdint>
+
+#if !defined(CULLING_HEADLESS)
+#include <d3d11.h>
+#else
+// Built without D3D (see CullingBench), where resources are only handles that are never looked into
+struct ID3D11Buffer;
+struct ID3D11ShaderResourceView;
+struct ID3D11SamplerState;
+struct ID3D11InputLayout;
+struct ID3D11VertexShader;
+struct ID3D11HullShader;
+struct ID3D11DomainShader;
+struct ID3D11GeometryShader;
+struct ID3D11PixelShader;
+#endif
+
+class BaseMesh;
+
+class CommandBackend
+{
+public:
+	enum class Stage : uint8_t
+	{
+		VS,
+		HS,
+		DS,
+		GS,
+		PS,
+		NUM_STAGES
+	};
+
+	enum class IndexFormat : uint8_t
+	{
+		UINT16,
+		UINT32
+	};
+
+	// The primitive topologies the app draws with. Values match D3D11_PRIMITIVE_TOPOLOGY
+	enum class Topology : uint8_t
+	{
+		POINT_LIST = 1,
+		TRIANGLE_LIST = 4,
+		PATCH_LIST_3 = 35
+	};
+
+	// Shaders of every stage, bound together the way BaseShader::render does. Null disables a stage
+	struct ShaderSet
+	{
+		ID3D11VertexShader* vs = nullptr;
+		ID3D11HullShader* hs = nullptr;
+		ID3D11DomainShader* ds = nullptr;
+		ID3D11GeometryShader* gs = nullptr;
+		ID3D11PixelShader* ps = nullptr;
+
+		bool operator==(const ShaderSet& other) const { return vs == other.vs && hs == other.hs && ds == other.ds && gs == other.gs && ps == other.ps; }
+	};
+
+	// Most slots that one call binds
+	static constexpr uint32_t MAX_BINDINGS = 8;
+
+	virtual ~CommandBackend() = default;
+
+	virtual void SetInputLayout(ID3D11InputLayout* layout) = 0;
+	virtual void SetShaders(const ShaderSet& shaders) = 0;
+
+	virtual void SetConstantBuffers(Stage stage, uint32_t slot, uint32_t count, ID3D11Buffer* const* buffers) = 0;
+	virtual void SetShaderResources(Stage stage, uint32_t slot, uint32_t count, ID3D11ShaderResourceView* const* views) = 0;
+	virtual void SetSamplers(Stage stage, uint32_t slot, uint32_t count, ID3D11SamplerState* const* samplers) = 0;
+
+	// Replace the whole of a dynamic constant buffer with size bytes of data
+	virtual void UpdateConstantBuffer(ID3D11Buffer* buffer, const void* data, uint32_t size) = 0;
+
+	// Constants that only one draw uses, bound to a single slot. A backend may put them wherever suits it (see
+	// ConstantArena); the rest update buffer with them and bind that, the same as UpdateConstantBuffer would
+	virtual void SetDrawConstants(Stage stage, uint32_t slot, ID3D11Buffer* buffer, const void* data, uint32_t size) = 0;
+
+	virtual void SetVertexBuffer(uint32_t slot, ID3D11Buffer* buffer, uint32_t stride, uint32_t offset) = 0;
+	virtual void SetIndexBuffer(ID3D11Buffer* buffer, IndexFormat format, uint32_t offset) = 0;
+	virtual void SetTopology(Topology topology) = 0;
+
+	virtual void DrawIndexed(uint32_t indexCount, uint32_t startIndex, int32_t baseVertex) = 0;
+	virtual void DrawIndexedInstanced(uint32_t indexCount, uint32_t instanceCount, uint32_t startIndex, int32_t baseVertex, uint32_t startInstance) = 0;
+
+	// UpdateConstantBuffer with the whole of a struct
+	template <typename T>
+	void UpdateConstants(ID3D11Buffer* buffer, const T& data)
+	{
+		UpdateConstantBuffer(buffer, &data, (uint32_t) sizeof(T));
+	}
+
+	// SetDrawConstants with the whole of a struct
+	template <typename T>
+	void SetDrawConstants(Stage stage, uint32_t slot, ID3D11Buffer* buffer, const T& data)
+	{
+		SetDrawConstants(stage, slot, buffer, &data, (uint32_t) sizeof(T));
+	}
+
+#if !defined(CULLING_HEADLESS)
+	// Bind a mesh's vertex and index buffers, the way BaseMesh::sendData does for triangle lists
+	void SetMesh(BaseMesh* mesh);
+#endif
+};
@@ -0,0 +1,339 @@
+#include "CommandBuffer.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace
+{
+	using Stage = CommandBackend::Stage;
+
+	// Arguments of every packet, after its header
+	struct SetInputLayoutArgs
+	{
+		ID3D11InputLayout* layout;
+	};
+
+	struct SetShadersArgs
+	{
+		CommandBackend::ShaderSet shaders;
+	};
+
+	template <typename T>
+	struct SetBindingsArgs
+	{
+		Stage stage;
+		uint8_t slot;
+		uint8_t count;
+
+		// Only count of them are stored
+		T* items[CommandBackend::MAX_BINDINGS];
+	};
+
+	struct UpdateConstantBufferArgs
+	{
+		ID3D11Buffer* buffer;
+		uint32_t size;
+
+		// size bytes of data follow, from the next 8-byte boundary on
+	};
+
+	struct SetDrawConstantsArgs
+	{
+		ID3D11Buffer* buffer;
+		Stage stage;
+		uint8_t slot;
+		uint32_t size;
+
+		// size bytes of data follow, from the next 8-byte boundary on
+	};
+
+	struct SetVertexBufferArgs
+	{
+		ID3D11Buffer* buffer;
+		uint32_t slot;
+		uint32_t stride;
+		uint32_t offset;
+	};
+
+	struct SetIndexBufferArgs
+	{
+		ID3D11Buffer* buffer;
+		CommandBackend::IndexFormat format;
+		uint32_t offset;
+	};
+
+	struct SetTopologyArgs
+	{
+		CommandBackend::Topology topology;
+	};
+
+	struct DrawIndexedArgs
+	{
+		uint32_t indexCount;
+		uint32_t startIndex;
+		int32_t baseVertex;
+	};
+
+	struct DrawIndexedInstancedArgs
+	{
+		uint32_t indexCount;
+		uint32_t instanceCount;
+		uint32_t startIndex;
+		int32_t baseVertex;
+		uint32_t startInstance;
+	};
+
+	constexpr size_t AlignUp(size_t size)
+	{
+		return (size + CommandBuffer::PACKET_ALIGNMENT - 1) & ~(CommandBuffer::PACKET_ALIGNMENT - 1);
+	}
+
+	// Bytes a bindings packet takes up with count items
+	template <typename T>
+	constexpr size_t GetBindingsSize(uint32_t count)
+	{
+		return offsetof(SetBindingsArgs<T>, items) + count * sizeof(T*);
+	}
+}
+
+void CommandBuffer::Clear()
+{
+	mSize = 0;
+	mNumPackets = 0;
+	mNumDraws = 0;
+	mConstantBytes = 0;
+}
+
+template <typename T>
+T* CommandBuffer::Append(Command command, size_t argsSize)
+{
+	const size_t argsOffset = AlignUp(sizeof(PacketHeader));
+	const size_t packetSize = AlignUp(argsOffset + argsSize);
+
+	// Grow by doubling, so recording a frame only allocates until the buffer has seen the largest one
+	const size_t numWords = (mSize + packetSize) / sizeof(uint64_t);
+
+	if (numWords > mStorage.size())
+		mStorage.resize(std::max(numWords, mStorage.size() * 2));
+
+	uint8_t* packet = reinterpret_cast<uint8_t*>(mStorage.data()) + mSize;
+
+	PacketHeader* header = reinterpret_cast<PacketHeader*>(packet);
+	header->command = command;
+	header->padding = 0;
+	header->size = (uint32_t) packetSize;
+
+	mSize += packetSize;
+	++mNumPackets;
+
+	return reinterpret_cast<T*>(packet + argsOffset);
+}
+
+template <typename T>
+void CommandBuffer::AppendBindings(Command command, Stage stage, uint32_t slot, uint32_t count, T* const* items)
+{
+	assert(count <= MAX_BINDINGS);
+
+	// The packet ends after the last item
+	auto* args = Append<SetBindingsArgs<T>>(command, GetBindingsSize<T>(count));
+	args->stage = stage;
+	args->slot = (uint8_t) slot;
+	args->count = (uint8_t) count;
+
+	std::memcpy(args->items, items, count * sizeof(T*));
+}
+
+void CommandBuffer::Execute(CommandBackend& backend) const
+{
+	const uint8_t* packet = reinterpret_cast<const uint8_t*>(mStorage.data());
+	const uint8_t* end = packet + mSize;
+
+	const size_t argsOffset = AlignUp(sizeof(PacketHeader));
+
+	while (packet < end)
+	{
+		const PacketHeader* header = reinterpret_cast<const PacketHeader*>(packet);
+		const uint8_t* args = packet + argsOffset;
+
+		switch (header->command)
+		{
+		case Command::SET_INPUT_LAYOUT:
+			backend.SetInputLayout(reinterpret_cast<const SetInputLayoutArgs*>(args)->layout);
+			break;
+
+		case Command::SET_SHADERS:
+			backend.SetShaders(reinterpret_cast<const SetShadersArgs*>(args)->shaders);
+			break;
+
+		case Command::SET_CONSTANT_BUFFERS:
+		{
+			const auto* bindings = reinterpret_cast<const SetBindingsArgs<ID3D11Buffer>*>(args);
+			backend.SetConstantBuffers(bindings->stage, bindings->slot, bindings->count, bindings->items);
+			break;
+		}
+
+		case Command::SET_SHADER_RESOURCES:
+		{
+			const auto* bindings = reinterpret_cast<const SetBindingsArgs<ID3D11ShaderResourceView>*>(args);
+			backend.SetShaderResources(bindings->stage, bindings->slot, bindings->count, bindings->items);
+			break;
+		}
+
+		case Command::SET_SAMPLERS:
+		{
+			const auto* bindings = reinterpret_cast<const SetBindingsArgs<ID3D11SamplerState>*>(args);
+			backend.SetSamplers(bindings->stage, bindings->slot, bindings->count, bindings->items);
+			break;
+		}
+
+		case Command::UPDATE_CONSTANT_BUFFER:
+		{
+			const auto* update = reinterpret_cast<const UpdateConstantBufferArgs*>(args);
+			backend.UpdateConstantBuffer(update->buffer, args + AlignUp(sizeof(UpdateConstantBufferArgs)), update->size);
+			break;
+		}
+
+		case Command::SET_DRAW_CONSTANTS:
+		{
+			const auto* constants = reinterpret_cast<const SetDrawConstantsArgs*>(args);
+			backend.SetDrawConstants(constants->stage, constants->slot, constants->buffer, args + AlignUp(sizeof(SetDrawConstantsArgs)), constants->size);
+			break;
+		}
+
+		case Command::SET_VERTEX_BUFFER:
+		{
+			const auto* vertexBuffer = reinterpret_cast<const SetVertexBufferArgs*>(args);
+			backend.SetVertexBuffer(vertexBuffer->slot, vertexBuffer->buffer, vertexBuffer->stride, vertexBuffer->offset);
+			break;
+		}
+
+		case Command::SET_INDEX_BUFFER:
+		{
+			const auto* indexBuffer = reinterpret_cast<const SetIndexBufferArgs*>(args);
+			backend.SetIndexBuffer(indexBuffer->buffer, indexBuffer->format, indexBuffer->offset);
+			break;
+		}
+
+		case Command::SET_TOPOLOGY:
+			backend.SetTopology(reinterpret_cast<const SetTopologyArgs*>(args)->topology);
+			break;
+
+		case Command::DRAW_INDEXED:
+		{
+			const auto* draw = reinterpret_cast<const DrawIndexedArgs*>(args);
+			backend.DrawIndexed(draw->indexCount, draw->startIndex, draw->baseVertex);
+			break;
+		}
+
+		case Command::DRAW_INDEXED_INSTANCED:
+		{
+			const auto* draw = reinterpret_cast<const DrawIndexedInstancedArgs*>(args);
+			backend.DrawIndexedInstanced(draw->indexCount, draw->instanceCount, draw->startIndex, draw->baseVertex, draw->startInstance);
+			break;
+		}
+
+		default:
+			assert(false && "Unknown command");
+			return;
+		}
+
+		packet += header->size;
+	}
+}
+
+void CommandBuffer::SetInputLayout(ID3D11InputLayout* layout)
+{
+	Append<SetInputLayoutArgs>(Command::SET_INPUT_LAYOUT)->layout = layout;
+}
+
+void CommandBuffer::SetShaders(const ShaderSet& shaders)
+{
+	Append<SetShadersArgs>(Command::SET_SHADERS)->shaders = shaders;
+}
+
+void CommandBuffer::SetConstantBuffers(Stage stage, uint32_t slot, uint32_t count, ID3D11Buffer* const* buffers)
+{
+	AppendBindings(Command::SET_CONSTANT_BUFFERS, stage, slot, count, buffers);
+}
+
+void CommandBuffer::SetShaderResources(Stage stage, uint32_t slot, uint32_t count, ID3D11ShaderResourceView* const* views)
+{
+	AppendBindings(Command::SET_SHADER_RESOURCES, stage, slot, count, views);
+}
+
+void CommandBuffer::SetSamplers(Stage stage, uint32_t slot, uint32_t count, ID3D11SamplerState* const* samplers)
+{
+	AppendBindings(Command::SET_SAMPLERS, stage, slot, count, samplers);
+}
+
+void CommandBuffer::UpdateConstantBuffer(ID3D11Buffer* buffer, const void* data, uint32_t size)
+{
+	const size_t dataOffset = AlignUp(sizeof(UpdateConstantBufferArgs));
+
+	auto* update = Append<UpdateConstantBufferArgs>(Command::UPDATE_CONSTANT_BUFFER, dataOffset + size);
+	update->buffer = buffer;
+	update->size = size;
+
+	std::memcpy(reinterpret_cast<uint8_t*>(update) + dataOffset, data, size);
+
+	mConstantBytes += size;
+}
+
+void CommandBuffer::SetDrawConstants(Stage stage, uint32_t slot, ID3D11Buffer* buffer, const void* data, uint32_t size)
+{
+	const size_t dataOffset = AlignUp(sizeof(SetDrawConstantsArgs));
+
+	auto* constants = Append<SetDrawConstantsArgs>(Command::SET_DRAW_CONSTANTS, dataOffset + size);
+	constants->buffer = buffer;
+	constants->stage = stage;
+	constants->slot = (uint8_t) slot;
+	constants->size = size;
+
+	std::memcpy(reinterpret_cast<uint8_t*>(constants) + dataOffset, data, size);
+
+	mConstantBytes += size;
+}
+
+void CommandBuffer::SetVertexBuffer(uint32_t slot, ID3D11Buffer* buffer, uint32_t stride, uint32_t offset)
+{
+	auto* vertexBuffer = Append<SetVertexBufferArgs>(Command::SET_VERTEX_BUFFER);
+	vertexBuffer->buffer = buffer;
+	vertexBuffer->slot = slot;
+	vertexBuffer->stride = stride;
+	vertexBuffer->offset = offset;
+}
+
+void CommandBuffer::SetIndexBuffer(ID3D11Buffer* buffer, IndexFormat format, uint32_t offset)
+{
+	auto* indexBuffer = Append<SetIndexBufferArgs>(Command::SET_INDEX_BUFFER);
+	indexBuffer->buffer = buffer;
+	indexBuffer->format = format;
+	indexBuffer->offset = offset;
+}
+
+void CommandBuffer::SetTopology(Topology topology)
+{
+	Append<SetTopologyArgs>(Command::SET_TOPOLOGY)->topology = topology;
+}
+
+void CommandBuffer::DrawIndexed(uint32_t indexCount, uint32_t startIndex, int32_t baseVertex)
+{
+	auto* draw = Append<DrawIndexedArgs>(Command::DRAW_INDEXED);
+	draw->indexCount = indexCount;
+	draw->startIndex = startIndex;
+	draw->baseVertex = baseVertex;
+
+	++mNumDraws;
+}
+
+void CommandBuffer::DrawIndexedInstanced(uint32_t indexCount, uint32_t instanceCount, uint32_t startIndex, int32_t baseVertex, uint32_t startInstance)
+{
+	auto* draw = Append<DrawIndexedInstancedArgs>(Command::DRAW_INDEXED_INSTANCED);
+	draw->indexCount = indexCount;
+	draw->instanceCount = instanceCount;
+	draw->startIndex = startIndex;
+	draw->baseVertex = baseVertex;
+	draw->startInstance = startInstance;
+
+	++mNumDraws;
+}
@@ -0,0 +1,93 @@
+// CommandBackend that records every call into a compact packet, to be replayed onto another backend later
+// Packets are stored back to back in one block of memory, each a header followed by the arguments of the call
+// Constant buffer updates carry their data inline, so the buffer holds everything needed to replay the frame even
+// once the shaders have moved on. Recording never touches the device context, so a buffer can be recorded on any
+// thread and executed on the one that owns the context. Memory is kept from frame to frame
+
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "CommandBackend.h"
+
+class CommandBuffer : public CommandBackend
+{
+public:
+	enum class Command : uint16_t
+	{
+		SET_INPUT_LAYOUT,
+		SET_SHADERS,
+		SET_CONSTANT_BUFFERS,
+		SET_SHADER_RESOURCES,
+		SET_SAMPLERS,
+		UPDATE_CONSTANT_BUFFER,
+		SET_DRAW_CONSTANTS,
+		SET_VERTEX_BUFFER,
+		SET_INDEX_BUFFER,
+		SET_TOPOLOGY,
+		DRAW_INDEXED,
+		DRAW_INDEXED_INSTANCED,
+		NUM_COMMANDS
+	};
+
+	// Packets start on 8-byte boundaries, so that the pointers in them are aligned
+	static constexpr size_t PACKET_ALIGNMENT = 8;
+
+	// Remove every packet. Memory is kept for the next frame
+	void Clear();
+
+	// Replay every packet onto backend, in the order they were recorded in
+	void Execute(CommandBackend& backend) const;
+
+	void SetInputLayout(ID3D11InputLayout* layout) override;
+	void SetShaders(const ShaderSet& shaders) override;
+
+	void SetConstantBuffers(Stage stage, uint32_t slot, uint32_t count, ID3D11Buffer* const* buffers) override;
+	void SetShaderResources(Stage stage, uint32_t slot, uint32_t count, ID3D11ShaderResourceView* const* views) override;
+	void SetSamplers(Stage stage, uint32_t slot, uint32_t count, ID3D11SamplerState* const* samplers) override;
+
+	void UpdateConstantBuffer(ID3D11Buffer* buffer, const void* data, uint32_t size) override;
+	void SetDrawConstants(Stage stage, uint32_t slot, ID3D11Buffer* buffer, const void* data, uint32_t size) override;
+
+	void SetVertexBuffer(uint32_t slot, ID3D11Buffer* buffer, uint32_t stride, uint32_t offset) override;
+	void SetIndexBuffer(ID3D11Buffer* buffer, IndexFormat format, uint32_t offset) override;
+	void SetTopology(Topology topology) override;
+
+	void DrawIndexed(uint32_t indexCount, uint32_t startIndex, int32_t baseVertex) override;
+	void DrawIndexedInstanced(uint32_t indexCount, uint32_t instanceCount, uint32_t startIndex, int32_t baseVertex, uint32_t startInstance) override;
+
+	bool IsEmpty() const { return mNumPackets == 0; }
+	int GetNumPackets() const { return mNumPackets; }
+	int GetNumDraws() const { return mNumDraws; }
+
+	// Bytes recorded since the last clear, and the constant buffer data among them
+	size_t GetSize() const { return mSize; }
+	size_t GetConstantBytes() const { return mConstantBytes; }
+
+private:
+	struct PacketHeader
+	{
+		Command command;
+		uint16_t padding;
+
+		// Bytes to the next packet, including the header
+		uint32_t size;
+	};
+
+	// Append a packet whose arguments, of type T, take up argsSize bytes, and return them to be filled in
+	template <typename T>
+	T* Append(Command command, size_t argsSize = sizeof(T));
+
+	// Binds a range of slots. Only the first count of the items are stored
+	template <typename T>
+	void AppendBindings(Command command, Stage stage, uint32_t slot, uint32_t count, T* const* items);
+
+	// 8-byte words, so that every packet can start on a PACKET_ALIGNMENT boundary
+	std::vector<uint64_t> mStorage;
+	size_t mSize = 0;
+
+	int mNumPackets = 0;
+	int mNumDraws = 0;
+	size_t mConstantBytes = 0;
+};
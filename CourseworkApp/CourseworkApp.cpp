@@ -2,6 +2,8 @@
 #include "MeshManager.h"
 #include "Utility.h"
 #include <sstream>
+#include <chrono>
+#include <algorithm>
 
 void CourseworkApp::init(HINSTANCE hinstance, HWND hwnd, int screenWidth, int screenHeight, Input *in)
 {
@@ -29,6 +31,14 @@ void CourseworkApp::init(HINSTANCE hinstance, HWND hwnd, int screenWidth, int sc
 	// Create and initialise bounding volume
 	initialiseBoundingVolume();
 
+	// The meshes only have to be uploaded again for GPU culling when they move
+	mGpuCullingShader->SetInstances(renderer->getDeviceContext(), mCullableMeshes, TOTAL_MODELS);
+
+	// Threads used for culling
+	mWorkerPool = std::make_unique<WorkerPool>();
+
+	mOcclusionBuffer = std::make_unique<OcclusionBuffer>();
+
 	// Initialise lighting
 	initialiseLights();
 
@@ -40,6 +50,8 @@ void CourseworkApp::init(HINSTANCE hinstance, HWND hwnd, int screenWidth, int sc
 
 	// Initialise culling settings
 	initialiseCullingMatrix(screenWidth, screenHeight);
+
+	mScreenHeight = (float) screenHeight;
 }
 
 bool CourseworkApp::frame()
@@ -55,6 +67,13 @@ bool CourseworkApp::frame()
 	// Have particle system follow the camera
 	mParticleSystem->SetEmitPos(camera->getPosition());
 
+	// Record the camera for CullingBench to replay
+	if (mRecordCameraPath)
+	{
+		XMFLOAT3 position = camera->getPosition();
+		mCameraPath.push_back(CullingBenchmark::CreatePose(mBoundingVolume->GetSceneExtent(), XMLoadFloat3(&position), camera->getRotation()));
+	}
+
 	// Rotate cube
 	static float angle = 0.f;
 	angle += timer->getFrameTime();
@@ -62,6 +81,10 @@ bool CourseworkApp::frame()
 
 	mCubeMesh.SetRotation(XMQuaternionRotationNormal(XMVectorSet(0.f, 1.f, 0.f, 0.f), sinf(angle)));
 
+	// Move the cullable meshes and keep the bounding volume up to date
+	if (mAnimateModels)
+		updateCullableMeshInstances();
+
 	// Move light around
 	updateDirectionalLight();
 	updatePointLights();
@@ -80,12 +103,21 @@ bool CourseworkApp::render()
 	//// Clear the screen
 	renderer->beginScene(CLEAR_COLOUR);
 
+	mInstanceShader->beginFrame();
+	mLightingShader->beginFrame();
+	mFilterStats = FilteringBackend::Stats();
+	mLightingShadowShader->beginFrame();
+	mWaveShader->beginFrame();
+
+	// Both passes are culled and recorded up front, and their draws are executed where the passes would draw them
+	mPassesRecorded = false;
+
+	if (mParallelRecording && canRecordInParallel())
+		recordPasses();
+
 	// Generate shadow map
 	if (mDoShadows)
-	{
-		auto directionalLight = mLightingShadowShader->getLight(mDirectionalLight);
-		createShadowMap(*directionalLight);
-	}
+		createShadowMap();
 
 	//// Render the scene
 	XMMATRIX viewMatrix = camera->getViewMatrix();
@@ -137,6 +169,10 @@ void CourseworkApp::gui()
 	ImGui::Text("Frame time: %.2f ms", timer->getFrameTime());
 	ImGui::Text("Visible models: %d / %d", mRenderedModels, TOTAL_MODELS);
 
+	// Shadow casters culled on the GPU are not read back
+	if (mDoShadows && !(mDoCulling && mGpuCulling))
+		ImGui::Text("Shadow casters: %d / %d", mShadowCastersRendered, TOTAL_MODELS);
+
 	// Fog settings
 	ImGui::NewLine();
 	if (ImGui::CollapsingHeader("Fog"))
@@ -182,6 +218,318 @@ void CourseworkApp::gui()
 
 		ImGui::Checkbox("Culling", &mDoCulling);
 		ImGui::Checkbox("Hardware instancing", &mUseInstancing);
+
+		// Moving meshes are only uploaded while GPU culling is on, so they are uploaded again when it is turned on
+		if (!mHasSharedInstanceKey)
+			ImGui::Text("GPU culling: unavailable, the cullable meshes do not share a mesh, texture and shader");
+		else if (ImGui::Checkbox("GPU culling", &mGpuCulling) && mGpuCulling)
+			mGpuCullingShader->SetInstances(renderer->getDeviceContext(), mCullableMeshes, TOTAL_MODELS);
+
+		if (mGpuCulling)
+		{
+			ImGui::Text("GPU culling: %u instances, uploaded %d times, camera count read back a frame late", mGpuCullingShader->GetNumInstances(),
+				mGpuCullingShader->GetUploads());
+		}
+
+		if (mUseInstancing)
+		{
+			// Instance format
+			for (int i = 0; i < InstancePacker::NUM_FORMATS; ++i)
+			{
+				const auto format = static_cast<InstancePacker::Format>(i);
+
+				if (i > 0)
+					ImGui::SameLine();
+
+				if (ImGui::RadioButton(InstancePacker::GetName(format), mInstanceShader->getFormat() == format))
+					mInstanceShader->setFormat(format);
+			}
+
+			const auto& instanceBuffer = mInstanceShader->getInstanceBuffer();
+
+			ImGui::Text("Instances: %u in %d draws, %d maps (%d discards), buffer %u (%d resizes)", instanceBuffer.GetWrittenInstances(),
+				mInstanceShader->getDrawCalls(), instanceBuffer.GetMaps(), instanceBuffer.GetDiscards(), instanceBuffer.GetCapacity(), instanceBuffer.GetResizes());
+			ImGui::Text("Batches (mesh, texture, shader): %d", mInstanceBatcher.GetNumBatches());
+			ImGui::Text("Instance data: %u bytes each, %.1f KB per frame", instanceBuffer.GetStride(), instanceBuffer.GetWrittenInstances() * instanceBuffer.GetStride() / 1024.f);
+
+			// The quantisation bounds are only kept up to date while it is on, so they are updated when it is turned on
+			if (ImGui::Checkbox("Cull into instance buffer", &mCullIntoInstances) && mCullIntoInstances)
+				updateInstanceBounds();
+
+			if (mCullIntoInstances && !canCullIntoInstances())
+				ImGui::Text("Needs LOD selection, occlusion and contribution culling off");
+		}
+		else
+		{
+			const auto& submitted = mRenderQueue.GetSubmittedRebinds();
+			const auto& sorted = mRenderQueue.GetSortedRebinds();
+
+			ImGui::Text("Rebinds (shader/texture/mesh): %d/%d/%d submitted, %d/%d/%d sorted", submitted.shaders, submitted.textures, submitted.meshes,
+				sorted.shaders, sorted.textures, sorted.meshes);
+
+			const auto& uploads = mLightingShader->getUploadStats();
+
+			ImGui::Text("Constant uploads: %d maps, %.1f KB, %d skipped", uploads.maps, uploads.bytes / 1024.f, uploads.skipped);
+
+			if (ImGui::Checkbox("Skip unchanged constants", &mSkipUnchangedConstants))
+			{
+				mLightingShader->setSkipUnchanged(mSkipUnchangedConstants);
+				mLightingShadowShader->setSkipUnchanged(mSkipUnchangedConstants);
+				mWaveShader->setSkipUnchanged(mSkipUnchangedConstants);
+				mInstanceShader->setSkipUnchanged(mSkipUnchangedConstants);
+			}
+
+			const ConstantArena* arena = renderer->getConstantArena();
+
+			if (arena->isSupported())
+			{
+				ImGui::Checkbox("Constant arena", &mUseConstantArena);
+
+				ImGui::Text("Arena: %d allocations, %.1f KB of %u KB, %d frames in flight, %d discards", arena->getAllocations(),
+					arena->getFrameBytes() / 1024.f, arena->getCapacity() / 1024, arena->getFramesInFlight(), arena->getDiscards());
+			}
+			else
+				ImGui::Text("Constant arena needs D3D11.1 constant buffer offsets");
+
+			ImGui::Checkbox("Filter redundant state", &mFilterState);
+
+			if (mFilterState)
+			{
+				ImGui::Text("State calls: %d issued, %d filtered", mFilterStats.GetIssued(), mFilterStats.GetFiltered());
+
+				if (ImGui::IsItemHovered())
+				{
+					ImGui::BeginTooltip();
+
+					for (int i = 0; i < (int) FilteringBackend::Call::NUM_CALLS; ++i)
+						ImGui::Text("%s: %d issued, %d filtered", FilteringBackend::GetName((FilteringBackend::Call) i), mFilterStats.issued[i], mFilterStats.filtered[i]);
+
+					ImGui::EndTooltip();
+				}
+			}
+
+			ImGui::Checkbox("Record passes in parallel", &mParallelRecording);
+
+			if (mParallelRecording)
+			{
+				ImGui::SliderInt("Draws per chunk", &mDrawsPerChunk, 8, 256);
+
+				if (mPassesRecorded)
+				{
+					ImGui::Text("Both passes: %d chunks on %d threads, %.1f KB, culled and recorded in %.2f ms", mPassRecorder.GetNumChunks(),
+						mWorkerPool->GetNumWorkers(), mPassRecorder.GetSize() / 1024.f, mRecordingTime);
+				}
+				else
+					ImGui::Text("Needs CPU culling");
+			}
+			else
+			{
+				ImGui::Checkbox("Record draw commands", &mRecordCommands);
+
+				if (mRecordCommands)
+				{
+					ImGui::Text("Last pass: %d packets, %d draws, %.1f KB (%.1f KB of constants)", mCommandBuffer.GetNumPackets(), mCommandBuffer.GetNumDraws(),
+						mCommandBuffer.GetSize() / 1024.f, mCommandBuffer.GetConstantBytes() / 1024.f);
+				}
+			}
+		}
+
+		// Hierarchy
+		bool changedHierarchy = false;
+		if (ImGui::RadioButton("Octree", mHierarchyType == BoundingVolume::HierarchyType::OCTREE))
+		{
+			mHierarchyType = BoundingVolume::HierarchyType::OCTREE;
+			changedHierarchy = true;
+		}
+
+		ImGui::SameLine();
+		if (ImGui::RadioButton("SAH BVH", mHierarchyType == BoundingVolume::HierarchyType::SAH))
+		{
+			mHierarchyType = BoundingVolume::HierarchyType::SAH;
+			changedHierarchy = true;
+		}
+
+		ImGui::SameLine();
+		if (ImGui::RadioButton("Morton LBVH", mHierarchyType == BoundingVolume::HierarchyType::LBVH))
+		{
+			mHierarchyType = BoundingVolume::HierarchyType::LBVH;
+			changedHierarchy = true;
+		}
+
+		if (ImGui::IsItemHovered())
+			ImGui::SetTooltip("Rebuilt from scratch every frame, on the culling threads");
+
+		if (changedHierarchy && mHierarchyType != mBoundingVolume->GetHierarchyType())
+			initialiseBoundingVolume();
+
+		ImGui::Checkbox("Parallel culling", &mParallelCulling);
+		ImGui::SameLine();
+		ImGui::Text("(%d threads, %d tasks stolen)", mWorkerPool->GetNumWorkers(), mWorkerPool->GetStolenTasks());
+
+		ImGui::Checkbox("Occlusion culling", &mOcclusionCulling);
+		ImGui::SliderInt("Occluder budget", &mOccluderBudget, 0, 128);
+
+		if (mOcclusionCulling)
+		{
+			ImGui::Text("Occluders: %d (%d triangles), occluded nodes/objects: %d", mOcclusionBuffer->GetOccludersRendered(),
+				mOcclusionBuffer->GetTrianglesRendered(), mBoundingVolume->GetOccludedBoxes());
+		}
+
+		// Level of detail
+		ImGui::Checkbox("LOD selection", &mLodSelection);
+		ImGui::SliderFloat("LOD 1 size (pixels)", &mLodPixels, 16.f, 512.f);
+		ImGui::SliderFloat("LOD hysteresis", &mLodHysteresis, 0.f, 0.5f);
+
+		if (ImGui::IsItemHovered())
+			ImGui::SetTooltip("How far past a LOD's size a mesh has to get before it switches LOD");
+
+		ImGui::Text("Meshes per LOD: %d / %d / %d / %d", (int) mLodBuckets[0].size(), (int) mLodBuckets[1].size(), (int) mLodBuckets[2].size(), (int) mLodBuckets[3].size());
+		ImGui::Text("Triangles: %d (%d without LODs)", mTrianglesRendered, mTrianglesWithoutLods);
+
+		// Small-feature culling
+		ImGui::Checkbox("Contribution culling", &mContributionCulling);
+		ImGui::SliderFloat("Min screen size (pixels)", &mMinScreenSize, 0.f, 32.f);
+
+		if (ImGui::IsItemHovered())
+			ImGui::SetTooltip("Meshes and nodes smaller than this on screen are culled");
+
+		if (mContributionCulling)
+		{
+			ImGui::Checkbox("Measure savings", &mMeasureContribution);
+
+			if (ImGui::IsItemHovered())
+				ImGui::SetTooltip("Culls the camera a second time without the size threshold, to count the meshes it saves");
+
+			if (mMeasureContribution)
+			{
+				ImGui::Text("Small nodes/objects culled: %d, saving %d meshes (%d triangles)", mBoundingVolume->GetSmallBoxes(),
+					mInstancesSaved, mTrianglesSaved);
+			}
+			else
+				ImGui::Text("Small nodes/objects culled: %d", mBoundingVolume->GetSmallBoxes());
+		}
+
+		if (ImGui::Checkbox("Plane masking", &mPlaneMasking))
+			mBoundingVolume->SetPlaneMasking(mPlaneMasking);
+
+		if (ImGui::IsItemHovered())
+			ImGui::SetTooltip("Skip planes a node's parent is fully inside of, and try the plane that rejected a node last frame first");
+
+		// Dynamic objects
+		ImGui::Checkbox("Animate models", &mAnimateModels);
+		ImGui::SliderFloat("Moved fraction", &mMovedFraction, 0.f, 1.f);
+
+		const auto& updateStats = mBoundingVolume->GetUpdateStats();
+		ImGui::Text("BVH update: %d moved, %d re-inserted, %d refitted", updateStats.movedObjects, updateStats.reinsertedObjects, updateStats.refittedNodes);
+		ImGui::Text("BVH update cost: %d / %d (rebuild) node ops", updateStats.updateCost, updateStats.rebuildCost);
+		ImGui::Text("BVH nodes visited: %d, plane tests: %d", mBoundingVolume->GetNodesVisited(), mBoundingVolume->GetPlaneTests());
+
+		// Camera paths for the headless benchmark
+		if (ImGui::Checkbox("Record camera path", &mRecordCameraPath))
+		{
+			if (mRecordCameraPath)
+				mCameraPath.clear();
+			else
+				CullingBenchmark::SaveCameraPath(CAMERA_PATH_FILE, mCameraPath);
+		}
+
+		if (ImGui::IsItemHovered())
+			ImGui::SetTooltip("Records the camera every frame, and writes the path to %s once unticked.\nReplay it with CullingBench --path %s", CAMERA_PATH_FILE, CAMERA_PATH_FILE);
+
+		if (mRecordCameraPath)
+		{
+			ImGui::SameLine();
+			ImGui::Text("(%d frames)", (int) mCameraPath.size());
+		}
+
+		// Compare the hierarchies on synthetic scenes
+		if (ImGui::Button("Benchmark hierarchies"))
+			mHierarchyBenchmark = CullingBenchmark::CompareHierarchies({ 1'000, 100'000, 1'000'000 }, 32);
+
+		if (ImGui::IsItemHovered())
+			ImGui::SetTooltip("Builds scenes of 1k, 100k and 1M objects with each hierarchy.\nStalls the application for several seconds");
+
+		for (const auto& result : mHierarchyBenchmark)
+		{
+			ImGui::Text("%-6s %7d objects: build %8.2f ms, query %6.3f ms, %6d nodes, %6d visible", CullingBenchmark::GetName(result.type),
+				result.objectCount, result.buildMs, result.queryMs, result.nodesVisited, result.visibleObjects);
+		}
+
+		// Compare plane tests with and without plane masking as the camera moves
+		if (ImGui::Button("Benchmark plane masking"))
+			mPlaneMaskingBenchmark = CullingBenchmark::ComparePlaneMasking(mHierarchyType, 1'000'000, 600);
+
+		if (ImGui::IsItemHovered())
+			ImGui::SetTooltip("Moves a camera through a scene of 1M objects over 600 frames, with plane masking off and on.\nStalls the application for several seconds");
+
+		for (const auto& result : mPlaneMaskingBenchmark)
+		{
+			ImGui::Text("Plane masking %-3s: query %6.3f ms, %8d plane tests, %6d nodes, %6d visible", result.planeMasking ? "on" : "off",
+				result.queryMs, result.planeTests, result.nodesVisited, result.visibleObjects);
+		}
+
+		// Compare frustum culling alone against frustum and occlusion culling
+		if (ImGui::Button("Benchmark occlusion culling"))
+			mOcclusionBenchmark = CullingBenchmark::CompareOcclusion(mHierarchyType, 1'000'000, 120, mOccluderBudget);
+
+		if (ImGui::IsItemHovered())
+			ImGui::SetTooltip("Moves a camera through a scene of 1M objects over 120 frames, with occlusion culling off and on.\nStalls the application for several seconds");
+
+		for (const auto& result : mOcclusionBenchmark)
+		{
+			ImGui::Text("Occlusion %-3s: raster %6.3f ms, query %6.3f ms, %6d visible, %6d occluded", result.occlusionCulling ? "on" : "off",
+				result.rasteriseMs, result.queryMs, result.visibleObjects, result.occludedBoxes);
+		}
+
+		// Compare culling several views in one traversal against culling them one at a time
+		if (ImGui::Button("Benchmark multi-view culling"))
+			mMultiViewBenchmark = CullingBenchmark::CompareMultiView(mHierarchyType, 1'000'000, { 2, 4, 8 }, 120);
+
+		if (ImGui::IsItemHovered())
+			ImGui::SetTooltip("Culls 2, 4 and 8 views per frame over 120 frames of a scene of 1M objects, one query per view and then all in one.\nStalls the application for several seconds");
+
+		for (const auto& result : mMultiViewBenchmark)
+		{
+			ImGui::Text("%d views: separate %6.3f ms (%6d nodes), multi-view %6.3f ms (%6d nodes), %s", result.numViews, result.separateMs,
+				result.separateNodes, result.multiViewMs, result.multiViewNodes, result.matchesSeparate ? "same output" : "DIFFERENT OUTPUT");
+		}
+
+		// Compare ray queries traced one at a time, in packets and with a linear scan
+		if (ImGui::Button("Benchmark ray queries"))
+			mRayBenchmark = CullingBenchmark::CompareRayQueries(mHierarchyType, 1'000'000, 1 << 16);
+
+		if (ImGui::IsItemHovered())
+			ImGui::SetTooltip("Traces 64k camera rays and 64k random segments through a scene of 1M objects, one at a time and in packets of 4 and 8.\nStalls the application for several seconds");
+
+		for (const auto& result : mRayBenchmark)
+		{
+			ImGui::Text("%s %-7s packet %d: %8.3f Mrays/s per core, %7.1f nodes/ray, %6d hits, %s", result.coherent ? "Camera" : "Random",
+				CullingBenchmark::GetName(result.mode), result.packetSize, result.raysPerSecond * 1e-6, result.nodesPerRay, result.hits,
+				result.matchesSingle ? "same hits" : "DIFFERENT HITS");
+		}
+
+		// Measure how parallel culling scales with the number of threads
+		if (ImGui::Button("Benchmark parallel culling"))
+			mScalingBenchmark = CullingBenchmark::MeasureScaling(mHierarchyType, 1'000'000, 32, { 1, 2, 4, 8 });
+
+		if (ImGui::IsItemHovered())
+			ImGui::SetTooltip("Culls a scene of 1M objects with the selected hierarchy on 1, 2, 4 and 8 threads.\nStalls the application for several seconds");
+
+		for (const auto& result : mScalingBenchmark)
+		{
+			ImGui::Text("%d threads: query %6.3f ms (%.2fx), %s", result.numThreads, result.queryMs,
+				mScalingBenchmark[0].queryMs / result.queryMs, result.matchesSerial ? "matches serial output" : "DIFFERS FROM SERIAL OUTPUT");
+		}
+
+		// Check the batched frustum test against DirectXCollision
+		if (ImGui::Button("Verify frustum tests"))
+			mFrustumTestResult = CullingBenchmark::VerifyFrustumTests(100'000, 32);
+
+		if (mFrustumTestResult.boxesTested > 0)
+		{
+			ImGui::Text("%d boxes, %d mismatches: batched %.2f ms, scalar %.2f ms, DirectXCollision %.2f ms", mFrustumTestResult.boxesTested,
+				mFrustumTestResult.mismatches, mFrustumTestResult.batchedMs, mFrustumTestResult.scalarMs, mFrustumTestResult.collisionMs);
+		}
 	}
 
 	// Debug render textures
@@ -239,51 +587,55 @@ void XM_CALLCONV CourseworkApp::renderScene(FXMMATRIX viewMatrix, CXMMATRIX proj
 	mCubeMesh.Draw(renderer->getDeviceContext(), mLightingShader);
 
 	// Render cullable meshes
-	if (mDoCulling)
+	if (mPassesRecorded)
 	{
-		// Projection matrix that is used for culling
-		XMMATRIX cullingMatrix = XMLoadFloat4x4(&mCullingMatrix);
-
-		BoundingFrustum cameraFrustum;
-		BoundingFrustum::CreateFromMatrix(cameraFrustum, cullingMatrix);
-
-		// Transform frustum to view space
-		XMMATRIX invView = XMMatrixInverse(&XMMatrixDeterminant(viewMatrix), viewMatrix);
-		cameraFrustum.Transform(cameraFrustum, invView);
+		executePass(isShadowPass);
+	}
+	else if (mDoCulling && mGpuCulling)
+	{
+		renderGpuCulled(viewMatrix, projectionMatrix, isShadowPass);
+	}
+	else if (mDoCulling)
+	{
+		// The shadow pass keeps its own visible set, so that the camera's is still around to pick occluders from
+		std::vector<MeshInstance*> cameraVisible;
+		std::vector<MeshInstance*>& visibleInstances = isShadowPass ? mShadowCasters : cameraVisible;
 
-		if (mUseInstancing)
-		{
-			mRenderedModels = mBoundingVolume->GetVisibleGeometry(cameraFrustum, *mInstanceShader);
+		const bool drawn = cullMeshes(viewMatrix, projectionMatrix, isShadowPass, visibleInstances);
 
-			mMeshToInstance->sendData(renderer->getDeviceContext());
-			mInstanceShader->setShaderParameters(renderer->getDeviceContext(), viewMatrix, projectionMatrix, camera, textureMgr->getTexture("bricks"));
-			mInstanceShader->render(renderer->getDeviceContext(), mMeshToInstance->getIndexCount());
-		}
-		else
+		if (!drawn)
 		{
-			std::vector<MeshInstance*> visibleInstances;
-			visibleInstances.reserve(TOTAL_MODELS);
-
-			mBoundingVolume->GetVisibleGeometry(cameraFrustum, visibleInstances);
+			bucketLods(visibleInstances, projectionMatrix, isShadowPass);
 
-			for (auto& mesh : visibleInstances)
+			if (mUseInstancing)
 			{
-				worldMatrix = mesh->GetWorldMatrix();
-				mLightingShader->setShaderParameters(renderer->getDeviceContext(), worldMatrix, viewMatrix, projectionMatrix, camera, textureMgr->getTexture("bricks"));
-				mesh->Draw(renderer->getDeviceContext(), mLightingShader);
+				// Group the visible objects by mesh (i.e. LOD), texture and shader, and render every group in one draw call
+				mInstanceBatcher.Clear();
+				mInstanceBatcher.Add(visibleInstances);
+				mInstanceBatcher.Draw(renderer->getDeviceContext(), viewMatrix, projectionMatrix, camera);
+			}
+			else
+			{
+				for (auto& mesh : visibleInstances)
+					queueMesh(mesh, viewMatrix, isShadowPass);
+
+				drawQueue(viewMatrix, projectionMatrix);
 			}
 		}
+
+		// What the camera saw this frame makes for good occluders next frame
+		if (!isShadowPass)
+			mOccluderCandidates.swap(cameraVisible);
 	}
 	else
 	{
 		mRenderedModels = TOTAL_MODELS;
+		mShadowCastersRendered = TOTAL_MODELS;
 
 		for (auto& mesh : mCullableMeshes)
-		{
-			worldMatrix = mesh.GetWorldMatrix();
-			mLightingShader->setShaderParameters(renderer->getDeviceContext(), worldMatrix, viewMatrix, projectionMatrix, camera, textureMgr->getTexture("bricks"));
-			mesh.Draw(renderer->getDeviceContext(), mLightingShader);
-		}
+			queueMesh(&mesh, viewMatrix, isShadowPass);
+
+		drawQueue(viewMatrix, projectionMatrix);
 	}
 
 	// This stuff should not cast shadows
@@ -306,6 +658,356 @@ void XM_CALLCONV CourseworkApp::renderScene(FXMMATRIX viewMatrix, CXMMATRIX proj
 	}
 }
 
+bool XM_CALLCONV CourseworkApp::cullMeshes(FXMMATRIX viewMatrix, CXMMATRIX projectionMatrix, bool isShadowPass, std::vector<MeshInstance*>& visibleInstances)
+{
+	WorkerPool* cullingPool = mParallelCulling ? mWorkerPool.get() : nullptr;
+
+	visibleInstances.clear();
+	visibleInstances.reserve(TOTAL_MODELS);
+
+	const bool cullIntoInstances = mCullIntoInstances && canCullIntoInstances();
+	bool drawn = false;
+
+	if (isShadowPass)
+	{
+		// Cull with the volume the light actually renders, rather than the camera's frustum
+		// Casters between the light and its near plane can still throw shadows into the volume, so it is
+		// extruded towards the light by dropping the near plane
+		CullingFrustum lightVolume = CullingFrustum::CreateFromMatrix(viewMatrix * projectionMatrix);
+		lightVolume.RemovePlane(CullingFrustum::NEAR_PLANE);
+		lightVolume.SetViewId(LIGHT_VIEW);
+
+		if (cullIntoInstances)
+			drawn = renderCulledInstances(lightVolume, viewMatrix, projectionMatrix, cullingPool, isShadowPass);
+
+		// Occlusion only applies to the camera. The count is -1 when the volume misses the scene altogether
+		if (!drawn)
+			mShadowCastersRendered = std::max(mBoundingVolume->GetVisibleGeometry(lightVolume, visibleInstances, cullingPool), 0);
+	}
+	else
+	{
+		// Projection matrix that is used for culling
+		XMMATRIX cullingMatrix = XMLoadFloat4x4(&mCullingMatrix);
+
+		BoundingFrustum cameraFrustum;
+		BoundingFrustum::CreateFromMatrix(cameraFrustum, cullingMatrix);
+
+		// Transform frustum to view space
+		XMMATRIX invView = XMMatrixInverse(&XMMatrixDeterminant(viewMatrix), viewMatrix);
+		cameraFrustum.Transform(cameraFrustum, invView);
+
+		const OcclusionBuffer* occlusion = nullptr;
+
+		if (mOcclusionCulling)
+		{
+			renderOccluders(viewMatrix * projectionMatrix);
+			occlusion = mOcclusionBuffer.get();
+		}
+
+		// The reference cull of contribution culling is the same view, so it shares the camera's cache
+		CullingFrustum cullingFrustum(cameraFrustum);
+		cullingFrustum.SetViewId(CAMERA_VIEW);
+
+		const bool measureContribution = mContributionCulling && mMeasureContribution;
+
+		if (mContributionCulling)
+		{
+			// Cull once without the size threshold first, to see what it saves
+			if (measureContribution)
+			{
+				mContributionReference.clear();
+				mBoundingVolume->GetVisibleGeometry(cullingFrustum, mContributionReference, cullingPool, occlusion);
+			}
+
+			XMFLOAT3 eye = camera->getPosition();
+			cullingFrustum.SetMinScreenSize(XMLoadFloat3(&eye), LodSelector::GetPixelScale(projectionMatrix, mScreenHeight), mMinScreenSize);
+		}
+
+		if (cullIntoInstances)
+			drawn = renderCulledInstances(cullingFrustum, viewMatrix, projectionMatrix, cullingPool, isShadowPass);
+
+		if (!drawn)
+			mRenderedModels = std::max(mBoundingVolume->GetVisibleGeometry(cullingFrustum, visibleInstances, cullingPool, occlusion), 0);
+
+		mInstancesSaved = 0;
+		mTrianglesSaved = 0;
+
+		if (measureContribution)
+		{
+			// Both sets are counted at the LODs the meshes used last frame
+			mInstancesSaved = (int) (mContributionReference.size() - visibleInstances.size());
+
+			for (MeshInstance* instance : mContributionReference)
+				mTrianglesSaved += LodSelector::GetTriangles(*instance, instance->GetLod());
+
+			for (MeshInstance* instance : visibleInstances)
+				mTrianglesSaved -= LodSelector::GetTriangles(*instance, instance->GetLod());
+		}
+	}
+
+	return drawn;
+}
+
+void XM_CALLCONV CourseworkApp::renderGpuCulled(FXMMATRIX viewMatrix, CXMMATRIX projectionMatrix, bool isShadowPass)
+{
+	ID3D11DeviceContext* context = renderer->getDeviceContext();
+
+	// The same volumes as the hierarchy is culled with
+	CullingFrustum frustum;
+
+	if (isShadowPass)
+	{
+		frustum = CullingFrustum::CreateFromMatrix(viewMatrix * projectionMatrix);
+		frustum.RemovePlane(CullingFrustum::NEAR_PLANE);
+	}
+	else
+		frustum = CullingFrustum::CreateFromMatrix(viewMatrix * XMLoadFloat4x4(&mCullingMatrix));
+
+	// Only ever on when every cullable mesh shares a key, so one draw covers them all
+	BaseMesh* mesh = mSharedInstanceKey.mesh;
+	InstanceShader* shader = mSharedInstanceKey.shader;
+
+	mGpuCullingShader->Execute(context, frustum, mesh->getIndexCount());
+
+	mesh->sendData(context);
+	shader->setShaderParameters(context, viewMatrix, projectionMatrix, camera, mSharedInstanceKey.texture);
+	shader->renderIndirect(context, mGpuCullingShader->GetVisibleInstances(), mGpuCullingShader->GetArguments());
+
+	// Only the camera's count is read back
+	if (!isShadowPass)
+	{
+		mGpuCullingShader->UpdateVisibleCount(context);
+		mRenderedModels = mGpuCullingShader->GetVisibleCount();
+	}
+}
+
+bool CourseworkApp::canCullIntoInstances() const
+{
+	// Every cullable mesh is drawn with the same key once LODs are off, as long as they all share one, and neither
+	// occlusion nor contribution culling needs the list of visible meshes
+	return mUseInstancing && mHasSharedInstanceKey && !mLodSelection && !mOcclusionCulling && !mContributionCulling;
+}
+
+bool XM_CALLCONV CourseworkApp::renderCulledInstances(const CullingFrustum& frustum, FXMMATRIX viewMatrix, CXMMATRIX projectionMatrix, WorkerPool* pool, bool isShadowPass)
+{
+	ID3D11DeviceContext* context = renderer->getDeviceContext();
+
+	BaseMesh* mesh = mSharedInstanceKey.mesh;
+	InstanceShader* shader = mSharedInstanceKey.shader;
+
+	// Room for every mesh, as any of them may be visible
+	InstanceSpan instances = shader->mapInstances(context, TOTAL_MODELS, mInstanceBounds);
+
+	// -1 when the frustum misses the scene altogether
+	const int numVisible = std::max(mBoundingVolume->GetVisibleGeometry(frustum, instances, pool), 0);
+
+	mesh->sendData(context);
+	shader->setShaderParameters(context, viewMatrix, projectionMatrix, camera, mSharedInstanceKey.texture);
+
+	// The instance buffer was too small to take them all. It has grown by next frame
+	if (!shader->renderMapped(context, mesh->getIndexCount(), instances))
+		return false;
+
+	if (isShadowPass)
+	{
+		mShadowCastersRendered = numVisible;
+	}
+	else
+	{
+		mRenderedModels = numVisible;
+		mTrianglesRendered = numVisible * (int) (mesh->getIndexCount() / 3);
+		mTrianglesWithoutLods = mTrianglesRendered;
+	}
+
+	return true;
+}
+
+void CourseworkApp::updateInstanceBounds()
+{
+	std::vector<XMFLOAT4X4> worlds(TOTAL_MODELS);
+
+	for (int i = 0; i < TOTAL_MODELS; ++i)
+		XMStoreFloat4x4(&worlds[i], mCullableMeshes[i].GetWorldMatrix());
+
+	mInstanceBounds = InstancePacker::GetQuantisationBounds(worlds.data(), worlds.size());
+}
+
+void XM_CALLCONV CourseworkApp::queueMesh(MeshInstance* instance, FXMMATRIX viewMatrix, bool isShadowPass)
+{
+	const RenderQueue::Pass pass = isShadowPass ? RenderQueue::Pass::SHADOW : RenderQueue::Pass::MAIN;
+	const float depth = XMVectorGetZ(XMVector3TransformCoord(instance->GetPositionXM(), viewMatrix));
+
+	mRenderQueue.Submit(pass, false, depth, { instance, mLightingShader.get(), instance->GetTexture(), instance->GetMesh() });
+}
+
+void XM_CALLCONV CourseworkApp::drawQueue(FXMMATRIX viewMatrix, CXMMATRIX projectionMatrix)
+{
+	mRenderQueue.SetMaxDepth(SCREEN_DEPTH);
+	mRenderQueue.Sort();
+
+	// Draws go straight to the device context, or are recorded first and replayed onto it in one go
+	D3D11Backend immediate(renderer->getDeviceContext(), mUseConstantArena ? renderer->getConstantArena() : nullptr);
+
+	// Other shaders bind to the context between passes, so every pass starts out knowing nothing about what is bound
+	FilteringBackend filter(immediate);
+	CommandBackend& target = mFilterState ? static_cast<CommandBackend&>(filter) : immediate;
+
+	mCommandBuffer.Clear();
+	CommandBackend& commands = mRecordCommands ? static_cast<CommandBackend&>(mCommandBuffer) : target;
+
+	// Neighbouring draws mostly share a mesh, which only has to be bound once
+	BaseMesh* boundMesh = nullptr;
+
+	for (size_t i = 0; i < mRenderQueue.GetNumPackets(); ++i)
+	{
+		const auto& packet = mRenderQueue.GetPacket(i);
+
+		mLightingShader->setShaderParameters(commands, packet.instance->GetWorldMatrix(), viewMatrix, projectionMatrix, camera, packet.texture);
+
+		if (packet.mesh != boundMesh)
+		{
+			commands.SetMesh(packet.mesh);
+			boundMesh = packet.mesh;
+		}
+
+		mLightingShader->render(commands, packet.mesh->getIndexCount());
+	}
+
+	if (mRecordCommands)
+		mCommandBuffer.Execute(target);
+
+	mFilterStats += filter.GetStats();
+
+	mRenderQueue.Clear();
+}
+
+bool CourseworkApp::canRecordInParallel() const
+{
+	// Instanced and GPU-culled meshes are drawn without the render queue
+	return !mUseInstancing && !(mDoCulling && mGpuCulling);
+}
+
+void CourseworkApp::recordPasses()
+{
+	const auto start = std::chrono::high_resolution_clock::now();
+
+	XMMATRIX viewMatrices[2], projectionMatrices[2];
+	getShadowMatrices(viewMatrices[(int) RenderQueue::Pass::SHADOW], projectionMatrices[(int) RenderQueue::Pass::SHADOW]);
+
+	viewMatrices[(int) RenderQueue::Pass::MAIN] = camera->getViewMatrix();
+	projectionMatrices[(int) RenderQueue::Pass::MAIN] = renderer->getProjectionMatrix();
+
+	// Cull and queue both passes in the order renderScene would, so the camera still sees the LODs it picked last frame
+	// from the shadow pass. The culling itself is spread across the workers already
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		const bool isShadowPass = pass == (int) RenderQueue::Pass::SHADOW;
+
+		if (isShadowPass && !mDoShadows)
+			continue;
+
+		const XMMATRIX viewMatrix = viewMatrices[pass];
+
+		if (mDoCulling)
+		{
+			std::vector<MeshInstance*> cameraVisible;
+			std::vector<MeshInstance*>& visibleInstances = isShadowPass ? mShadowCasters : cameraVisible;
+
+			// Never drawn straight away, as that needs instancing
+			cullMeshes(viewMatrix, projectionMatrices[pass], isShadowPass, visibleInstances);
+			bucketLods(visibleInstances, projectionMatrices[pass], isShadowPass);
+
+			for (auto& mesh : visibleInstances)
+				queueMesh(mesh, viewMatrix, isShadowPass);
+
+			if (!isShadowPass)
+				mOccluderCandidates.swap(cameraVisible);
+		}
+		else
+		{
+			mRenderedModels = TOTAL_MODELS;
+			mShadowCastersRendered = TOTAL_MODELS;
+
+			for (auto& mesh : mCullableMeshes)
+				queueMesh(&mesh, viewMatrix, isShadowPass);
+		}
+	}
+
+	// The pass is the top of the sort key, so the shadow pass's draws come first
+	mRenderQueue.SetMaxDepth(SCREEN_DEPTH);
+	mRenderQueue.Sort(mWorkerPool.get());
+
+	size_t numDraws[2] = {};
+
+	for (size_t i = 0; i < mRenderQueue.GetNumPackets(); ++i)
+		++numDraws[(int) RenderQueue::GetPass(mRenderQueue.GetKey(i))];
+
+	const size_t passStart[2] = { 0, numDraws[(int) RenderQueue::Pass::SHADOW] };
+
+	mPassRecorder.Split(numDraws, 2, (size_t) mDrawsPerChunk);
+	mChunkUploads.resize(mPassRecorder.GetNumChunks());
+
+	// Every chunk tracks its own uploads, so nothing is written to the shader while the workers read it
+	mPassRecorder.Record([&](const ParallelRecorder::Chunk& chunk, int chunkIdx, CommandBackend& commands)
+	{
+		LightingShader::UploadState& uploads = mChunkUploads[chunkIdx];
+		uploads = LightingShader::UploadState();
+
+		const XMMATRIX viewMatrix = viewMatrices[chunk.pass];
+		const XMMATRIX projectionMatrix = projectionMatrices[chunk.pass];
+
+		BaseMesh* boundMesh = nullptr;
+
+		for (size_t i = passStart[chunk.pass] + chunk.first; i < passStart[chunk.pass] + chunk.first + chunk.count; ++i)
+		{
+			const auto& packet = mRenderQueue.GetPacket(i);
+
+			mLightingShader->setShaderParameters(commands, uploads, packet.instance->GetWorldMatrix(), viewMatrix, projectionMatrix, camera, packet.texture);
+
+			if (packet.mesh != boundMesh)
+			{
+				commands.SetMesh(packet.mesh);
+				boundMesh = packet.mesh;
+			}
+
+			mLightingShader->render(commands, packet.mesh->getIndexCount());
+		}
+	}, mWorkerPool.get());
+
+	// The chunks hold everything they need
+	mRenderQueue.Clear();
+	mPassesRecorded = true;
+
+	mRecordingTime = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void CourseworkApp::executePass(bool isShadowPass)
+{
+	const int pass = (int) (isShadowPass ? RenderQueue::Pass::SHADOW : RenderQueue::Pass::MAIN);
+
+	D3D11Backend immediate(renderer->getDeviceContext(), mUseConstantArena ? renderer->getConstantArena() : nullptr);
+
+	// One filter across the chunks of the pass drops what every chunk binds again at its start
+	FilteringBackend filter(immediate);
+	CommandBackend& target = mFilterState ? static_cast<CommandBackend&>(filter) : immediate;
+
+	mPassRecorder.Execute(pass, target);
+
+	mFilterStats += filter.GetStats();
+
+	for (int i = 0; i < mPassRecorder.GetNumChunks(); ++i)
+	{
+		if (mPassRecorder.GetChunk(i).pass == pass)
+			mLightingShader->resolveUploads(mChunkUploads[i]);
+	}
+}
+
+void CourseworkApp::getShadowMatrices(XMMATRIX& viewMatrix, XMMATRIX& projectionMatrix) const
+{
+	viewMatrix = mLightingShader->generateLightViewMatrix(mDirectionalLight);
+	projectionMatrix = XMMatrixOrthographicLH(LIGHT_PROJECTION_FRUSTUM_DIM, LIGHT_PROJECTION_FRUSTUM_DIM, SCREEN_NEAR, SCREEN_DEPTH);
+}
+
 void CourseworkApp::postProcessing()
 {
 	// Unbind back buffer as render target (mShadowMap chosen arbitrarily--as long as it's not the back buffer)
@@ -375,6 +1077,7 @@ void CourseworkApp::initialiseShaders(int screenWidth, int screenHeight, HWND hw
 	mBlurShader = std::make_unique<BlurShader>(renderer->getDevice(), screenWidth, screenHeight, hwnd);
 	mTextureShader = std::make_unique<TextureShader>(renderer->getDevice(), hwnd);
 	mInstanceShader = std::make_unique<InstanceShader>(renderer->getDevice(), renderer->getDeviceContext(), hwnd);
+	mGpuCullingShader = std::make_unique<GpuCullingShader>(renderer->getDevice(), hwnd);
 
 	WCHAR cocFilename[] = L"coc_cs.cso";
 	mCoCShader = std::make_unique<InOutComputeShader>(renderer->getDevice(), screenWidth, screenHeight, cocFilename, hwnd);
@@ -391,6 +1094,48 @@ void CourseworkApp::initialiseRenderTextures(int screenWidth, int screenHeight)
 	mCoCMap = std::make_unique<RenderTexture>(renderer->getDevice(), screenWidth, screenHeight, SCREEN_NEAR, SCREEN_DEPTH);
 }
 
+void XM_CALLCONV CourseworkApp::bucketLods(const std::vector<MeshInstance*>& visibleInstances, CXMMATRIX projectionMatrix, bool isShadowPass)
+{
+	for (auto& bucket : mLodBuckets)
+		bucket.clear();
+
+	if (mLodSelection && !isShadowPass)
+	{
+		XMFLOAT3 eye = camera->getPosition();
+
+		mLodSelector.SetView(XMLoadFloat3(&eye), projectionMatrix, mScreenHeight);
+		mLodSelector.SetLodPixels(mLodPixels);
+		mLodSelector.SetHysteresis(mLodHysteresis);
+
+		mTrianglesRendered = mLodSelector.SelectLods(visibleInstances, mLodBuckets);
+	}
+	else
+	{
+		// Shadows are drawn at the LOD the camera picked, so that a mesh doesn't shadow itself with a different shape
+		int triangles = 0;
+
+		for (MeshInstance* instance : visibleInstances)
+		{
+			if (!mLodSelection)
+				instance->SetLod(0);
+
+			mLodBuckets[instance->GetLod()].push_back(instance);
+			triangles += LodSelector::GetTriangles(*instance, instance->GetLod());
+		}
+
+		if (!isShadowPass)
+			mTrianglesRendered = triangles;
+	}
+
+	if (!isShadowPass)
+	{
+		mTrianglesWithoutLods = 0;
+
+		for (MeshInstance* instance : visibleInstances)
+			mTrianglesWithoutLods += LodSelector::GetTriangles(*instance, 0);
+	}
+}
+
 void CourseworkApp::initialiseTextures()
 {
 	textureMgr->loadTexture("bunny", L"../res/bunny.png");
@@ -405,6 +1150,11 @@ void CourseworkApp::initialiseMeshes(int screenWidth, int screenHeight)
 	MeshManager::LoadMesh<PlaneMesh>("Plane", renderer->getDevice(), renderer->getDeviceContext());
 	MeshManager::LoadMesh<PointMesh>("Point", renderer->getDevice(), renderer->getDeviceContext());
 	MeshManager::LoadMesh<SphereMesh>("Sphere", renderer->getDevice(), renderer->getDeviceContext());
+
+	// Lower resolution spheres for the LODs of the cullable meshes
+	MeshManager::LoadMesh<SphereMesh>("SphereLod1", renderer->getDevice(), renderer->getDeviceContext(), 10);
+	MeshManager::LoadMesh<SphereMesh>("SphereLod2", renderer->getDevice(), renderer->getDeviceContext(), 5);
+	MeshManager::LoadMesh<SphereMesh>("SphereLod3", renderer->getDevice(), renderer->getDeviceContext(), 2);
 	MeshManager::LoadMesh<OrthoMesh>("OrthoMesh", renderer->getDevice(), renderer->getDeviceContext(), screenWidth * 0.25f, screenHeight * 0.25f, screenWidth * 0.35f, screenHeight * 0.35f);
 	MeshManager::LoadMesh<TessellatedPlane>("TessellatedPlane", renderer->getDevice(), renderer->getDeviceContext(), 100);
 }
@@ -423,12 +1173,16 @@ void CourseworkApp::initialiseMeshInstances()
 	mTessellatedPlaneMesh.SetPosition(-20.f, -3.f, -20.f);
 
 	initialiseCullableMeshInstances();
+	updateInstanceBounds();
 }
 
 void CourseworkApp::initialiseCullableMeshInstances()
 {
 	// Spawn a bunch of meshes for use with frustum culling
-	mMeshToInstance = MeshManager::GetMesh("Sphere");
+	mMeshLods[0] = MeshManager::GetMesh("Sphere");
+	mMeshLods[1] = MeshManager::GetMesh("SphereLod1");
+	mMeshLods[2] = MeshManager::GetMesh("SphereLod2");
+	mMeshLods[3] = MeshManager::GetMesh("SphereLod3");
 
 	constexpr float SPACING = 8.f;
 	for (int x = 0; x < NUM_MODELS_X; ++x)
@@ -438,7 +1192,9 @@ void CourseworkApp::initialiseCullableMeshInstances()
 			for (int z = 0; z < NUM_MODELS_Z; ++z)
 			{
 				int idx = (z * NUM_MODELS_X * NUM_MODELS_Y) + y * NUM_MODELS_X + x;
-				mCullableMeshes[idx].SetMesh(mMeshToInstance);
+				mCullableMeshes[idx].SetLods(mMeshLods, MeshInstance::MAX_LODS);
+				mCullableMeshes[idx].SetTexture(textureMgr->getTexture("bricks"));
+				mCullableMeshes[idx].SetShader(mInstanceShader.get());
 
 				// Pick a pseudo-random position
 				float offsetX = (rand() / (float) RAND_MAX) * 40.f;
@@ -448,9 +1204,27 @@ void CourseworkApp::initialiseCullableMeshInstances()
 				mCullableMeshes[idx].SetPosition(offsetX + (x * SPACING),
 												 offsetY + (y * SPACING),
 												 -5.f + offsetZ + (z * SPACING));
+
+				// Remember where the mesh was spawned so that it can be animated around that position
+				mCullableMeshOrigins[idx] = mCullableMeshes[idx].GetPosition();
 			}
 		}
 	}
+
+	mSharedInstanceKey = { mCullableMeshes[0].GetMesh(0), mCullableMeshes[0].GetTexture(), mCullableMeshes[0].GetShader() };
+	mHasSharedInstanceKey = true;
+
+	for (int i = 1; i < TOTAL_MODELS; ++i)
+	{
+		const InstanceBatcher::Key key = { mCullableMeshes[i].GetMesh(0), mCullableMeshes[i].GetTexture(), mCullableMeshes[i].GetShader() };
+
+		if (!(key == mSharedInstanceKey))
+			mHasSharedInstanceKey = false;
+	}
+
+	// GPU culling draws every visible mesh with a single indirect draw
+	if (!mHasSharedInstanceKey)
+		mGpuCulling = false;
 }
 
 void CourseworkApp::initialiseLights()
@@ -519,7 +1293,30 @@ void CourseworkApp::initialiseBoundingVolume()
 	for (int i = 0; i < TOTAL_MODELS; ++i)
 		cullableMeshes[i] = &mCullableMeshes[i];
 
-	mBoundingVolume = std::make_unique<BoundingVolume>(cullableMeshes);
+	// The previous hierarchy may still have the cache file mapped, and it is about to be written again
+	mBoundingVolume.reset();
+
+	if (mHierarchyType == BoundingVolume::HierarchyType::SAH)
+		mBoundingVolume = std::make_unique<BoundingVolume>(mCullableMeshes, TOTAL_MODELS, mHierarchyType, BVH_CACHE_FILE);
+	else
+		mBoundingVolume = std::make_unique<BoundingVolume>(cullableMeshes, mHierarchyType);
+
+	mBoundingVolume->SetPlaneMasking(mPlaneMasking);
+}
+
+void XM_CALLCONV CourseworkApp::renderOccluders(FXMMATRIX viewProjection)
+{
+	const XMFLOAT3 eye = camera->getPosition();
+
+	mOccluders.clear();
+	OcclusionBuffer::SelectOccluders(mOccluderCandidates, XMLoadFloat3(&eye), mOccluderBudget, OCCLUDER_SCALE, mOccluders);
+
+	mOcclusionBuffer->Begin(viewProjection);
+
+	for (const auto& occluder : mOccluders)
+		mOcclusionBuffer->AddOccluder(occluder);
+
+	mOcclusionBuffer->Finish();
 }
 
 void CourseworkApp::updateDirectionalLight()
@@ -583,11 +1380,38 @@ void CourseworkApp::updateCullingMatrix()
 	XMStoreFloat4x4(&mCullingMatrix, cullingMatrix);
 }
 
-void CourseworkApp::createShadowMap(const LightingShader::ShaderLight& light)
+void CourseworkApp::updateCullableMeshInstances()
+{
+	// Bob a fraction of the meshes up and down. The amplitude is large enough for some of them to leave their cell
+	// in the bounding volume, so both the refit and the re-insert path are exercised
+	constexpr float AMPLITUDE = 6.f;
+
+	const int numMoved = static_cast<int>(mMovedFraction * TOTAL_MODELS);
+
+	mMovedMeshes.clear();
+
+	for (int i = 0; i < numMoved; ++i)
+	{
+		const XMFLOAT3& origin = mCullableMeshOrigins[i];
+		mCullableMeshes[i].SetPositionY(origin.y + AMPLITUDE * sinf(mTotalTime + (float) i));
+
+		mMovedMeshes.push_back(&mCullableMeshes[i]);
+	}
+
+	mBoundingVolume->Update(mMovedMeshes, mWorkerPool.get());
+
+	if (mGpuCulling && numMoved > 0)
+		mGpuCullingShader->SetInstances(renderer->getDeviceContext(), mCullableMeshes, TOTAL_MODELS);
+
+	if (mCullIntoInstances && numMoved > 0)
+		updateInstanceBounds();
+}
+
+void CourseworkApp::createShadowMap()
 {
 	// Create light's view and projection matrices
-	XMMATRIX viewMatrix = mLightingShader->generateLightViewMatrix(mDirectionalLight);
-	XMMATRIX projectionMatrix = XMMatrixOrthographicLH(LIGHT_PROJECTION_FRUSTUM_DIM, LIGHT_PROJECTION_FRUSTUM_DIM, SCREEN_NEAR, SCREEN_DEPTH);
+	XMMATRIX viewMatrix, projectionMatrix;
+	getShadowMatrices(viewMatrix, projectionMatrix);
 
 	// Set render target
 	mShadowMap->setRenderTarget(renderer->getDeviceContext());
@@ -19,6 +19,7 @@
 #include "InOutComputeShader.h"
 #include "TextureShader.h"
 #include "InstanceShader.h"
+#include "GpuCullingShader.h"
 
 // Meshes
 #include "MeshInstance.h"
@@ -27,6 +28,15 @@
 // Misc.
 #include "ParticleSystem.h"
 #include "BoundingVolume.h"
+#include "InstanceBatcher.h"
+#include "RenderQueue.h"
+#include "CommandBuffer.h"
+#include "D3D11Backend.h"
+#include "FilteringBackend.h"
+#include "ParallelRecorder.h"
+#include "CullingBenchmark.h"
+#include "OcclusionBuffer.h"
+#include "LodSelector.h"
 
 #define CLEAR_COLOUR	0.39f, 0.58f, 0.92f, 1.0f
 
@@ -44,6 +54,19 @@ public:
 	static constexpr int NUM_MODELS_Z = 6;
 	static constexpr int TOTAL_MODELS = NUM_MODELS_X * NUM_MODELS_Y * NUM_MODELS_Z;
 
+	// The cullable meshes are spheres, and a box inscribed in a sphere has 1/sqrt(3) of its extents
+	// Slightly less than that, so that the box stays inside the tessellated sphere too
+	static constexpr float OCCLUDER_SCALE = 0.55f;
+
+	static constexpr const char* CAMERA_PATH_FILE = "camera_path.txt";
+
+	// The SAH hierarchy is mapped from here on start-up instead of being built, while the meshes start where they did
+	static constexpr const char* BVH_CACHE_FILE = "scene_bvh.cache";
+
+	// Caches of rejecting planes the hierarchy keeps for each view (see CullingFrustum::SetViewId)
+	static constexpr uint32_t CAMERA_VIEW = 0;
+	static constexpr uint32_t LIGHT_VIEW = 1;
+
 	void init(HINSTANCE hinstance, HWND hwnd, int screenWidth, int screenHeight, Input* in) override;
 
 	bool frame() override;
@@ -75,8 +98,46 @@ protected:
 	void synchroniseLights();
 
 	void updateCullingMatrix();
+	void updateCullableMeshInstances();
+
+	void createShadowMap();
+	void getShadowMatrices(XMMATRIX& viewMatrix, XMMATRIX& projectionMatrix) const;
+
+	// Cull the cullable meshes of a pass into visibleInstances, or straight into the instance buffer where they can be
+	// Returns whether they were drawn already
+	bool XM_CALLCONV cullMeshes(FXMMATRIX viewMatrix, CXMMATRIX projectionMatrix, bool isShadowPass, std::vector<MeshInstance*>& visibleInstances);
+
+	// Render the occluders for the frame into the occlusion buffer
+	void XM_CALLCONV renderOccluders(FXMMATRIX viewProjection);
+
+	// Sort the visible cullable meshes into mLodBuckets. Only the camera picks LODs; the shadow pass reuses them
+	void XM_CALLCONV bucketLods(const std::vector<MeshInstance*>& visibleInstances, CXMMATRIX projectionMatrix, bool isShadowPass);
+
+	// Whether the cullable meshes can be culled straight into the instance buffer, i.e. are drawn with one batch
+	bool canCullIntoInstances() const;
 
-	void createShadowMap(const LightingShader::ShaderLight& light);
+	// Cull the hierarchy straight into the instance buffer and draw the visible meshes with one call
+	// Returns false, with nothing drawn, if they did not fit, for the caller to cull them the usual way
+	bool XM_CALLCONV renderCulledInstances(const CullingFrustum& frustum, FXMMATRIX viewMatrix, CXMMATRIX projectionMatrix, WorkerPool* pool, bool isShadowPass);
+
+	// Bounds of every cullable mesh, that the quantised instance format is relative to when culling into the instance buffer
+	void updateInstanceBounds();
+
+	// Cull and draw the cullable meshes on the GPU, with a single indirect draw
+	void XM_CALLCONV renderGpuCulled(FXMMATRIX viewMatrix, CXMMATRIX projectionMatrix, bool isShadowPass);
+
+	// Queue a cullable mesh to be drawn without instancing, and draw the queue sorted by state and depth
+	void XM_CALLCONV queueMesh(MeshInstance* instance, FXMMATRIX viewMatrix, bool isShadowPass);
+	void XM_CALLCONV drawQueue(FXMMATRIX viewMatrix, CXMMATRIX projectionMatrix);
+
+	// Whether the cullable meshes of both passes go through the render queue, and so can be recorded ahead of them
+	bool canRecordInParallel() const;
+
+	// Cull and queue the cullable meshes of both passes, and record their draws in chunks across the worker threads
+	void recordPasses();
+
+	// Execute the recorded chunks of a pass on the device context, in order
+	void executePass(bool isShadowPass);
 
 private:
 	// Shaders
@@ -91,12 +152,14 @@ private:
 	Pointer<InOutComputeShader> mMergeBuffersShader;
 	Pointer<TextureShader> mTextureShader;
 	Pointer<InstanceShader> mInstanceShader;
+	Pointer<GpuCullingShader> mGpuCullingShader;
 
 	// Meshes
 	MeshInstance mCubeMesh;
 	MeshInstance mTessellatedPlaneMesh;
 	MeshInstance mBillboardPoint;
 	MeshInstance mCullableMeshes[TOTAL_MODELS];
+	XMFLOAT3 mCullableMeshOrigins[TOTAL_MODELS];
 
 	// Render Textures
 	Pointer<RenderTexture> mShadowMap;
@@ -140,15 +203,110 @@ private:
 	bool mDoCulling = true;
 	bool mUseInstancing = true;
 
+	// Cull with a compute shader instead of the hierarchy. Skips occlusion, contribution culling and LODs
+	bool mGpuCulling = false;
+
+	// The key of every cullable mesh at LOD 0. Paths that draw all of them with one instanced draw, rather than
+	// through the batcher, are only available if they share it
+	InstanceBatcher::Key mSharedInstanceKey = {};
+	bool mHasSharedInstanceKey = false;
+
+	// Cull the hierarchy straight into the mapped instance buffer, rather than into a list that is gathered and copied
+	bool mCullIntoInstances = false;
+	InstancePacker::QuantisationBounds mInstanceBounds;
+
 	float mCullingFov = XM_PIDIV2;
 	float mAspectRatio;
 	XMFLOAT4X4 mCullingMatrix;
 
 	int mRenderedModels = 0;
+
+	// Visible set of the shadow pass, culled against the light's volume
+	int mShadowCastersRendered = 0;
+	std::vector<MeshInstance*> mShadowCasters;
 	Pointer<BoundingVolume> mBoundingVolume;
+	BoundingVolume::HierarchyType mHierarchyType = BoundingVolume::HierarchyType::OCTREE;
+
+	// Culls the hierarchy on several threads
+	Pointer<WorkerPool> mWorkerPool;
+	bool mParallelCulling = true;
+
+	bool mPlaneMasking = true;
+
+	// Software occlusion culling. Occluders are picked from the meshes that were visible last frame
+	Pointer<OcclusionBuffer> mOcclusionBuffer;
+	bool mOcclusionCulling = true;
+	int mOccluderBudget = 32;
+	std::vector<MeshInstance*> mOccluderCandidates;
+	std::vector<BoundingBox> mOccluders;
+
+	// Level of detail, picked from how large each visible mesh is on screen
+	LodSelector mLodSelector;
+	bool mLodSelection = true;
+	float mLodPixels = LodSelector::DEFAULT_LOD_PIXELS;
+	float mLodHysteresis = LodSelector::DEFAULT_HYSTERESIS;
+	float mScreenHeight = 0.f;
+	std::vector<MeshInstance*> mLodBuckets[MeshInstance::MAX_LODS];
+	int mTrianglesRendered = 0;
+	int mTrianglesWithoutLods = 0;
+
+	// Visible meshes grouped by mesh, texture and shader, one instanced draw per group
+	InstanceBatcher mInstanceBatcher;
+
+	// Visible meshes drawn one at a time, in the order of their sort keys
+	RenderQueue mRenderQueue;
+
+	// Light, fog, camera and material buffers are only uploaded when they changed
+	bool mSkipUnchangedConstants = true;
+
+	// Per-draw matrices are sub-allocated from the renderer's ConstantArena, where it is supported
+	bool mUseConstantArena = true;
+
+	// Draws of the render queue, recorded before they are replayed onto the device context
+	CommandBuffer mCommandBuffer;
+	bool mRecordCommands = false;
+
+	// Bindings of the render queue that would not change anything are dropped before they reach the device context
+	bool mFilterState = true;
+	FilteringBackend::Stats mFilterStats;
+
+	// Draws of both passes, recorded in chunks on the worker threads before the shadow pass, and executed in order
+	// where each pass draws the render queue. Every chunk tracks its own constant uploads
+	bool mParallelRecording = false;
+	bool mPassesRecorded = false;
+	int mDrawsPerChunk = ParallelRecorder::DEFAULT_CHUNK_SIZE;
+	ParallelRecorder mPassRecorder;
+	std::vector<LightingShader::UploadState> mChunkUploads;
+	float mRecordingTime = 0.f;
+
+	// Small-feature culling: meshes and nodes below a size on screen are culled along with the rest
+	// To report what it saves, the camera can also be culled without the threshold, at the cost of a second cull
+	bool mContributionCulling = false;
+	bool mMeasureContribution = false;
+	float mMinScreenSize = 2.f;
+	std::vector<MeshInstance*> mContributionReference;
+	int mInstancesSaved = 0;
+	int mTrianglesSaved = 0;
+
+	std::vector<CullingBenchmark::HierarchyResult> mHierarchyBenchmark;
+	std::vector<CullingBenchmark::ScalingResult> mScalingBenchmark;
+	std::vector<CullingBenchmark::CameraPathResult> mPlaneMaskingBenchmark;
+	std::vector<CullingBenchmark::OcclusionResult> mOcclusionBenchmark;
+	std::vector<CullingBenchmark::MultiViewResult> mMultiViewBenchmark;
+	std::vector<CullingBenchmark::RayResult> mRayBenchmark;
+	CullingBenchmark::FrustumTestResult mFrustumTestResult;
+
+	// Camera poses recorded every frame, saved for CullingBench to replay
+	bool mRecordCameraPath = false;
+	std::vector<CullingBenchmark::CameraPose> mCameraPath;
+
+	// Dynamic objects within the bounding volume
+	bool mAnimateModels = false;
+	float mMovedFraction = 0.25f;
+	std::vector<MeshInstance*> mMovedMeshes;
 
-	// Pointer to the mesh contained within the bounding volume that will be drawn with the InstanceShader
-	BaseMesh* mMeshToInstance = nullptr;
+	// LOD chain of the meshes contained within the bounding volume, drawn with the InstanceShader
+	BaseMesh* mMeshLods[MeshInstance::MAX_LODS] = {};
 };
 
 #endif
@@ -0,0 +1,2072 @@
+#include "CullingBenchmark.h"
+#include <chrono>
+#include <random>
+#include <memory>
+#include <cmath>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+	// Average distance between neighbouring objects
+	constexpr float SPACING = 4.f;
+
+	// Matches the camera's culling frustum
+	constexpr float QUERY_FOV = XM_PIDIV2;
+	constexpr float QUERY_NEAR = 0.1f;
+	constexpr float QUERY_FAR = 200.f;
+
+	// Scenes are made of unit boxes standing in for spheres. Occluders are the boxes inscribed in them
+	constexpr float OCCLUDER_SCALE = 0.55f;
+
+	// Screen the projected sizes are measured on, when culling small objects
+	constexpr float CONTRIBUTION_SCREEN_HEIGHT = 1080.f;
+
+	// Clustered scenes: objects per cluster, and the spread of a cluster relative to the spacing of the objects
+	constexpr int CLUSTER_SIZE = 1'000;
+	constexpr float CLUSTER_SPREAD = 2.f;
+
+	// City scenes: buildings along the side of a block, width of the streets in between, and the tallest building
+	constexpr int BLOCK_SIZE = 4;
+	constexpr int STREET_WIDTH = 2;
+	constexpr int MAX_FLOORS = 16;
+
+	// Matches the shadow-casting directional light
+	constexpr float LIGHT_VOLUME_SIZE = 256.f;
+	constexpr float LIGHT_DISTANCE = 180.f;
+
+	// Camera rays: width and height of the tiles consecutive rays are taken from
+	constexpr int RAY_TILE_WIDTH = 4;
+	constexpr int RAY_TILE_HEIGHT = 2;
+
+	// Ray-box tests the linear scan is allowed, so that it does not stall for minutes on large scenes
+	constexpr long long SCAN_TESTS = 100'000'000;
+
+	// Render queue: shaders, textures and kinds of mesh the objects are spread over, how many LODs each mesh has (and
+	// the distance between them), and one in how many objects is translucent
+	constexpr int QUEUE_SHADERS = 2;
+	constexpr int QUEUE_TEXTURES = 8;
+	constexpr int QUEUE_MESHES = 3;
+	constexpr int QUEUE_LODS = 4;
+	constexpr float QUEUE_LOD_DISTANCE = 40.f;
+	constexpr int QUEUE_TRANSLUCENT_RATIO = 16;
+
+	// Command buffer: the constant buffers LightingShader updates for every draw (see ShaderBuffers.h), and the lights
+	// it holds
+	struct LightingMatrices
+	{
+		XMFLOAT4X4 world;
+		XMFLOAT4X4 view;
+		XMFLOAT4X4 projection;
+	};
+
+	struct LightingLights
+	{
+		XMFLOAT4 globalAmbient;
+
+		// LightingShader::MAX_LIGHTS lights of 80 bytes each
+		XMFLOAT4 lights[5 * 8];
+	};
+
+	static_assert(sizeof(LightingMatrices) == 192, "LightingMatrices expected to be 192 bytes");
+	static_assert(sizeof(LightingLights) == 656, "LightingLights expected to be 656 bytes");
+
+	// Stand-ins for the state objects a LightingShader draw binds. Backends only look at their addresses
+	struct LightingStandIns
+	{
+		struct StateObject { int unused; };
+
+		StateObject matrixBuffer, lightBuffer, cameraBuffer, materialBuffer, fogBuffer;
+		StateObject vertexShader, pixelShader, layout, sampler;
+		StateObject textures[QUEUE_TEXTURES];
+		StateObject vertexBuffers[QUEUE_MESHES], indexBuffers[QUEUE_MESHES];
+
+		template <typename T>
+		static T* Get(StateObject& object) { return reinterpret_cast<T*>(&object); }
+	};
+
+	// What LightingShader::setShaderParameters, CommandBackend::SetMesh and LightingShader::render submit for a draw
+	void XM_CALLCONV SubmitLightingDraw(CommandBackend& commands, LightingStandIns& standIns, const LightingLights& lights, FXMMATRIX world,
+		CXMMATRIX view, CXMMATRIX projection, int texture, int mesh, bool bindMesh)
+	{
+		using Stage = CommandBackend::Stage;
+		using StandIns = LightingStandIns;
+
+		ID3D11Buffer* matrixBuffer = StandIns::Get<ID3D11Buffer>(standIns.matrixBuffer);
+		ID3D11Buffer* lightBuffer = StandIns::Get<ID3D11Buffer>(standIns.lightBuffer);
+		ID3D11Buffer* cameraBuffer = StandIns::Get<ID3D11Buffer>(standIns.cameraBuffer);
+		ID3D11Buffer* materialBuffer = StandIns::Get<ID3D11Buffer>(standIns.materialBuffer);
+		ID3D11Buffer* fogBuffer = StandIns::Get<ID3D11Buffer>(standIns.fogBuffer);
+
+		LightingMatrices matrices;
+		XMStoreFloat4x4(&matrices.world, world);
+		XMStoreFloat4x4(&matrices.view, view);
+		XMStoreFloat4x4(&matrices.projection, projection);
+
+		commands.SetDrawConstants(Stage::VS, 0, matrixBuffer, matrices);
+		commands.UpdateConstants(lightBuffer, lights);
+
+		XMFLOAT4 camera;
+		XMStoreFloat4(&camera, XMVectorSetW(view.r[3], 0.f));
+		commands.UpdateConstants(cameraBuffer, camera);
+
+		const uint32_t material[4] = {};
+		commands.UpdateConstants(materialBuffer, material);
+
+		ID3D11Buffer* vsBuffers[2] = { cameraBuffer, materialBuffer };
+		commands.SetConstantBuffers(Stage::VS, 1, 2, vsBuffers);
+
+		ID3D11Buffer* psBuffers[3] = { lightBuffer, fogBuffer, materialBuffer };
+		commands.SetConstantBuffers(Stage::PS, 0, 3, psBuffers);
+
+		ID3D11ShaderResourceView* heightMap = nullptr;
+		ID3D11ShaderResourceView* textureView = StandIns::Get<ID3D11ShaderResourceView>(standIns.textures[texture]);
+		commands.SetShaderResources(Stage::VS, 0, 1, &heightMap);
+		commands.SetShaderResources(Stage::PS, 0, 1, &textureView);
+
+		if (bindMesh)
+		{
+			commands.SetVertexBuffer(0, StandIns::Get<ID3D11Buffer>(standIns.vertexBuffers[mesh]), 32, 0);
+			commands.SetIndexBuffer(StandIns::Get<ID3D11Buffer>(standIns.indexBuffers[mesh]), CommandBackend::IndexFormat::UINT32, 0);
+			commands.SetTopology(CommandBackend::Topology::TRIANGLE_LIST);
+		}
+
+		ID3D11SamplerState* sampler = StandIns::Get<ID3D11SamplerState>(standIns.sampler);
+		commands.SetSamplers(Stage::VS, 0, 1, &sampler);
+		commands.SetSamplers(Stage::PS, 0, 1, &sampler);
+
+		CommandBackend::ShaderSet shaders;
+		shaders.vs = StandIns::Get<ID3D11VertexShader>(standIns.vertexShader);
+		shaders.ps = StandIns::Get<ID3D11PixelShader>(standIns.pixelShader);
+
+		commands.SetInputLayout(StandIns::Get<ID3D11InputLayout>(standIns.layout));
+		commands.SetShaders(shaders);
+
+		// Sphere LODs are a few thousand indices
+		commands.DrawIndexed(2880 >> mesh, 0, 0);
+	}
+
+	using Clock = std::chrono::high_resolution_clock;
+
+	double ElapsedMs(Clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	// Ties between objects at the same distance may be broken either way, depending on the order nodes are visited in
+	bool IsSameHit(const RayHit& hit, const RayHit& reference, RayQueryMode mode)
+	{
+		if (hit.IsHit() != reference.IsHit())
+			return false;
+
+		return mode == RayQueryMode::ANY_HIT || hit.distance == reference.distance;
+	}
+}
+
+auto CullingBenchmark::RunHierarchy(BoundingVolume::HierarchyType type, int objectCount, int numQueries) -> HierarchyResult
+{
+	HierarchyResult result;
+	result.type = type;
+	result.objectCount = objectCount;
+
+	std::unique_ptr<MeshInstance[]> meshes(new MeshInstance[objectCount]);
+	CreateUniformScene(meshes.get(), objectCount);
+
+	// Build
+	auto start = Clock::now();
+	BoundingVolume boundingVolume(meshes.get(), objectCount, type);
+	result.buildMs = ElapsedMs(start);
+
+	// Query
+	std::vector<MeshInstance*> visibleInstances;
+	visibleInstances.reserve(objectCount);
+
+	long long totalVisible = 0, totalNodes = 0;
+	double totalQueryMs = 0.0;
+
+	for (int i = 0; i < numQueries; ++i)
+	{
+		BoundingFrustum frustum = CreateQueryFrustum(boundingVolume.GetSceneExtent(), XM_2PI * i / (float) numQueries);
+
+		visibleInstances.clear();
+
+		start = Clock::now();
+		int visible = boundingVolume.GetVisibleGeometry(frustum, visibleInstances);
+		totalQueryMs += ElapsedMs(start);
+
+		totalVisible += std::max(visible, 0);
+		totalNodes += boundingVolume.GetNodesVisited();
+	}
+
+	if (numQueries > 0)
+	{
+		result.queryMs = totalQueryMs / numQueries;
+		result.visibleObjects = static_cast<int>(totalVisible / numQueries);
+		result.nodesVisited = static_cast<int>(totalNodes / numQueries);
+	}
+
+	return result;
+}
+
+auto CullingBenchmark::CompareHierarchies(const std::vector<int>& objectCounts, int numQueries) -> std::vector<HierarchyResult>
+{
+	std::vector<HierarchyResult> results;
+
+	for (int count : objectCounts)
+	{
+		results.push_back(RunHierarchy(BoundingVolume::HierarchyType::OCTREE, count, numQueries));
+		results.push_back(RunHierarchy(BoundingVolume::HierarchyType::SAH, count, numQueries));
+	}
+
+	return results;
+}
+
+auto CullingBenchmark::ComparePlaneMasking(BoundingVolume::HierarchyType type, int objectCount, int numFrames) -> std::vector<CameraPathResult>
+{
+	std::vector<CameraPathResult> results;
+
+	std::unique_ptr<MeshInstance[]> meshes(new MeshInstance[objectCount]);
+	CreateUniformScene(meshes.get(), objectCount);
+
+	BoundingVolume boundingVolume(meshes.get(), objectCount, type);
+
+	std::vector<MeshInstance*> visibleInstances;
+	visibleInstances.reserve(objectCount);
+
+	for (bool planeMasking : { false, true })
+	{
+		CameraPathResult result;
+		result.planeMasking = planeMasking;
+
+		boundingVolume.SetPlaneMasking(planeMasking);
+
+		long long totalVisible = 0, totalNodes = 0, totalPlaneTests = 0;
+		double totalQueryMs = 0.0;
+
+		for (int i = 0; i < numFrames; ++i)
+		{
+			BoundingFrustum frustum = CreatePathFrustum(boundingVolume.GetSceneExtent(), i / (float) numFrames);
+
+			visibleInstances.clear();
+
+			auto start = Clock::now();
+			int visible = boundingVolume.GetVisibleGeometry(frustum, visibleInstances);
+			totalQueryMs += ElapsedMs(start);
+
+			totalVisible += std::max(visible, 0);
+			totalNodes += boundingVolume.GetNodesVisited();
+			totalPlaneTests += boundingVolume.GetPlaneTests();
+		}
+
+		if (numFrames > 0)
+		{
+			result.queryMs = totalQueryMs / numFrames;
+			result.visibleObjects = static_cast<int>(totalVisible / numFrames);
+			result.nodesVisited = static_cast<int>(totalNodes / numFrames);
+			result.planeTests = static_cast<int>(totalPlaneTests / numFrames);
+		}
+
+		results.push_back(result);
+	}
+
+	return results;
+}
+
+auto CullingBenchmark::CompareOcclusion(BoundingVolume::HierarchyType type, int objectCount, int numFrames, int occluderBudget) -> std::vector<OcclusionResult>
+{
+	std::vector<OcclusionResult> results;
+
+	std::unique_ptr<MeshInstance[]> meshes(new MeshInstance[objectCount]);
+	CreateUniformScene(meshes.get(), objectCount);
+
+	BoundingVolume boundingVolume(meshes.get(), objectCount, type);
+	OcclusionBuffer occlusionBuffer;
+
+	const XMMATRIX projection = XMMatrixPerspectiveFovLH(QUERY_FOV, 16.f / 9.f, QUERY_NEAR, QUERY_FAR);
+
+	std::vector<MeshInstance*> visibleInstances, candidates;
+	std::vector<BoundingBox> occluders;
+	visibleInstances.reserve(objectCount);
+
+	for (bool occlusionCulling : { false, true })
+	{
+		OcclusionResult result;
+		result.occlusionCulling = occlusionCulling;
+
+		candidates.clear();
+
+		long long totalVisible = 0, totalOccluded = 0, totalOccluders = 0;
+		double totalRasteriseMs = 0.0, totalQueryMs = 0.0;
+
+		for (int i = 0; i < numFrames; ++i)
+		{
+			const float t = i / (float) numFrames;
+			const XMMATRIX world = GetPathTransform(boundingVolume.GetSceneExtent(), t);
+			const BoundingFrustum frustum = CreatePathFrustum(boundingVolume.GetSceneExtent(), t);
+
+			const OcclusionBuffer* occlusion = nullptr;
+
+			if (occlusionCulling)
+			{
+				auto start = Clock::now();
+
+				occluders.clear();
+				OcclusionBuffer::SelectOccluders(candidates, world.r[3], occluderBudget, OCCLUDER_SCALE, occluders);
+
+				occlusionBuffer.Begin(XMMatrixInverse(nullptr, world) * projection);
+
+				for (const auto& occluder : occluders)
+					occlusionBuffer.AddOccluder(occluder);
+
+				occlusionBuffer.Finish();
+
+				totalRasteriseMs += ElapsedMs(start);
+				totalOccluders += occlusionBuffer.GetOccludersRendered();
+
+				occlusion = &occlusionBuffer;
+			}
+
+			visibleInstances.clear();
+
+			auto start = Clock::now();
+			int visible = boundingVolume.GetVisibleGeometry(frustum, visibleInstances, nullptr, occlusion);
+			totalQueryMs += ElapsedMs(start);
+
+			totalVisible += std::max(visible, 0);
+			totalOccluded += boundingVolume.GetOccludedBoxes();
+
+			candidates.swap(visibleInstances);
+		}
+
+		if (numFrames > 0)
+		{
+			result.rasteriseMs = totalRasteriseMs / numFrames;
+			result.queryMs = totalQueryMs / numFrames;
+			result.occluders = static_cast<int>(totalOccluders / numFrames);
+			result.visibleObjects = static_cast<int>(totalVisible / numFrames);
+			result.occludedBoxes = static_cast<int>(totalOccluded / numFrames);
+		}
+
+		results.push_back(result);
+	}
+
+	return results;
+}
+
+auto CullingBenchmark::CompareContributionCulling(BoundingVolume::HierarchyType type, int objectCount, const std::vector<float>& minPixels, int numFrames) -> std::vector<ContributionResult>
+{
+	std::vector<ContributionResult> results;
+
+	std::unique_ptr<MeshInstance[]> meshes(new MeshInstance[objectCount]);
+	CreateUniformScene(meshes.get(), objectCount);
+
+	BoundingVolume boundingVolume(meshes.get(), objectCount, type);
+
+	// Same as LodSelector::GetPixelScale, which is not part of headless builds
+	const float pixelScale = 0.5f * CONTRIBUTION_SCREEN_HEIGHT / std::tan(0.5f * QUERY_FOV);
+
+	std::vector<MeshInstance*> visibleInstances, reference;
+	visibleInstances.reserve(objectCount);
+	reference.reserve(objectCount);
+
+	for (float pixels : minPixels)
+	{
+		ContributionResult result;
+		result.minPixels = pixels;
+
+		long long totalVisible = 0, totalNodes = 0, totalSmall = 0, totalSaved = 0;
+		double totalQueryMs = 0.0;
+
+		for (int i = 0; i < numFrames; ++i)
+		{
+			const float t = i / (float) numFrames;
+			const XMMATRIX world = GetPathTransform(boundingVolume.GetSceneExtent(), t);
+
+			const CullingFrustum frustumOnly(CreatePathFrustum(boundingVolume.GetSceneExtent(), t));
+			CullingFrustum frustum = frustumOnly;
+
+			if (pixels > 0.f)
+				frustum.SetMinScreenSize(world.r[3], pixelScale, pixels);
+
+			reference.clear();
+			boundingVolume.GetVisibleGeometry(frustumOnly, reference);
+
+			visibleInstances.clear();
+
+			auto start = Clock::now();
+			boundingVolume.GetVisibleGeometry(frustum, visibleInstances);
+			totalQueryMs += ElapsedMs(start);
+
+			totalVisible += visibleInstances.size();
+			totalNodes += boundingVolume.GetNodesVisited();
+			totalSmall += boundingVolume.GetSmallBoxes();
+			totalSaved += reference.size() - visibleInstances.size();
+
+			// Test the objects of the frustum-only query on their own. The traversal visits them in the same order
+			size_t next = 0;
+
+			for (MeshInstance* instance : reference)
+			{
+				BoundingBox extent;
+				instance->GetBoundingBox().Transform(extent, instance->GetWorldMatrix());
+
+				CullingFrustum::BoxBatch batch;
+				batch.Add(extent);
+
+				uint32_t visible = 1;
+				frustum.CullSmallBoxes(batch, visible);
+
+				if (!visible)
+					continue;
+
+				if (next == visibleInstances.size() || visibleInstances[next] != instance)
+					result.matchesPerObject = false;
+
+				++next;
+			}
+
+			if (next != visibleInstances.size())
+				result.matchesPerObject = false;
+		}
+
+		if (numFrames > 0)
+		{
+			result.queryMs = totalQueryMs / numFrames;
+			result.nodesVisited = static_cast<int>(totalNodes / numFrames);
+			result.visibleObjects = static_cast<int>(totalVisible / numFrames);
+			result.smallBoxes = static_cast<int>(totalSmall / numFrames);
+			result.instancesSaved = static_cast<int>(totalSaved / numFrames);
+		}
+
+		results.push_back(result);
+	}
+
+	return results;
+}
+
+auto CullingBenchmark::CompareMultiView(BoundingVolume::HierarchyType type, int objectCount, const std::vector<int>& viewCounts, int numFrames) -> std::vector<MultiViewResult>
+{
+	std::vector<MultiViewResult> results;
+
+	std::unique_ptr<MeshInstance[]> meshes(new MeshInstance[objectCount]);
+	CreateUniformScene(meshes.get(), objectCount);
+
+	BoundingVolume boundingVolume(meshes.get(), objectCount, type);
+
+	std::vector<MeshInstance*> separateVisible[MultiViewFrustum::MAX_VIEWS];
+	MultiViewVisibility visibility;
+
+	for (int numViews : viewCounts)
+	{
+		MultiViewResult result;
+		result.numViews = numViews = std::min(std::max(numViews, 1), MultiViewFrustum::MAX_VIEWS);
+
+		long long totalVisible = 0, totalSeparateNodes = 0, totalMultiViewNodes = 0;
+		double totalSeparateMs = 0.0, totalMultiViewMs = 0.0;
+
+		for (int i = 0; i < numFrames; ++i)
+		{
+			CullingFrustum views[MultiViewFrustum::MAX_VIEWS];
+			CreatePathViews(boundingVolume.GetSceneExtent(), i / (float) numFrames, numViews, views);
+
+			// One query per view
+			auto start = Clock::now();
+
+			for (int view = 0; view < numViews; ++view)
+			{
+				separateVisible[view].clear();
+				boundingVolume.GetVisibleGeometry(views[view], separateVisible[view]);
+
+				totalSeparateNodes += boundingVolume.GetNodesVisited();
+			}
+
+			totalSeparateMs += ElapsedMs(start);
+
+			// All of the views at once
+			const MultiViewFrustum multiView(views, numViews);
+
+			start = Clock::now();
+			boundingVolume.GetVisibleGeometry(multiView, visibility);
+			totalMultiViewMs += ElapsedMs(start);
+
+			totalMultiViewNodes += boundingVolume.GetNodesVisited();
+
+			for (int view = 0; view < numViews; ++view)
+			{
+				totalVisible += visibility.visibleInstances[view].size();
+
+				if (visibility.visibleInstances[view] != separateVisible[view])
+					result.matchesSeparate = false;
+			}
+		}
+
+		if (numFrames > 0)
+		{
+			result.separateMs = totalSeparateMs / numFrames;
+			result.multiViewMs = totalMultiViewMs / numFrames;
+			result.separateNodes = static_cast<int>(totalSeparateNodes / numFrames);
+			result.multiViewNodes = static_cast<int>(totalMultiViewNodes / numFrames);
+			result.visibleObjects = static_cast<int>(totalVisible / numFrames);
+		}
+
+		results.push_back(result);
+	}
+
+	return results;
+}
+
+auto CullingBenchmark::CompareRayQueries(BoundingVolume::HierarchyType type, int objectCount, int numRays) -> std::vector<RayResult>
+{
+	std::vector<RayResult> results;
+
+	std::unique_ptr<MeshInstance[]> meshes(new MeshInstance[objectCount]);
+	CreateUniformScene(meshes.get(), objectCount);
+
+	BoundingVolume boundingVolume(meshes.get(), objectCount, type);
+
+	// World-space boxes for the linear scan
+	std::vector<BoundingBox> extents(objectCount);
+	for (int i = 0; i < objectCount; ++i)
+		meshes[i].GetBoundingBox().Transform(extents[i], meshes[i].GetWorldMatrix());
+
+	std::vector<Ray> rays;
+	std::vector<RayHit> hits, singleHits;
+
+	for (bool coherent : { true, false })
+	{
+		if (coherent)
+			CreateCameraRays(boundingVolume.GetSceneExtent(), 0.f, numRays, rays);
+		else
+			CreateRandomSegments(boundingVolume.GetSceneExtent(), numRays, rays);
+
+		const int rayCount = (int) rays.size();
+
+		for (RayQueryMode mode : { RayQueryMode::NEAREST, RayQueryMode::ANY_HIT })
+		{
+			// Single rays go first, so that the packets can be checked against them
+			for (int packetSize : { 1, 4, RayPacket::MAX_SIZE })
+			{
+				RayResult result;
+				result.packetSize = packetSize;
+				result.mode = mode;
+				result.coherent = coherent;
+				result.numRays = rayCount;
+
+				hits.assign(rayCount, RayHit());
+
+				auto start = Clock::now();
+				boundingVolume.Raycast(rays.data(), rayCount, hits.data(), mode, packetSize);
+				const double ms = ElapsedMs(start);
+
+				if (ms > 0.0)
+					result.raysPerSecond = rayCount / (0.001 * ms);
+
+				if (rayCount > 0)
+					result.nodesPerRay = boundingVolume.GetRayNodesVisited() / (double) rayCount;
+
+				if (packetSize == 1)
+					singleHits = hits;
+
+				for (int i = 0; i < rayCount; ++i)
+				{
+					result.hits += hits[i].IsHit();
+
+					if (!IsSameHit(hits[i], singleHits[i], mode))
+						result.matchesSingle = false;
+				}
+
+				results.push_back(result);
+			}
+
+			// What the hierarchy replaces: testing every object
+			RayResult scan;
+			scan.packetSize = 0;
+			scan.mode = mode;
+			scan.coherent = coherent;
+			scan.numRays = (int) std::min<long long>(rayCount, std::max<long long>(SCAN_TESTS / objectCount, 1));
+			scan.nodesPerRay = objectCount;
+
+			auto start = Clock::now();
+
+			for (int i = 0; i < scan.numRays; ++i)
+			{
+				PreparedRay preparedRay(rays[i]);
+				RayHit& hit = hits[i];
+				hit = RayHit();
+
+				float tNear;
+				for (int j = 0; j < objectCount; ++j)
+				{
+					if (!preparedRay.Intersect(extents[j].Center, extents[j].Extents, tNear) || tNear >= hit.distance)
+						continue;
+
+					hit.instance = &meshes[j];
+					hit.distance = tNear;
+
+					if (mode == RayQueryMode::ANY_HIT)
+						break;
+
+					preparedRay.SetMaxDistance(tNear);
+				}
+			}
+
+			const double ms = ElapsedMs(start);
+
+			if (ms > 0.0)
+				scan.raysPerSecond = scan.numRays / (0.001 * ms);
+
+			for (int i = 0; i < scan.numRays; ++i)
+			{
+				scan.hits += hits[i].IsHit();
+
+				if (!IsSameHit(hits[i], singleHits[i], mode))
+					scan.matchesSingle = false;
+			}
+
+			results.push_back(scan);
+		}
+	}
+
+	return results;
+}
+
+auto CullingBenchmark::MeasureCache(SceneType scene, int objectCount, const std::string& filename, int numFrames) -> CacheResult
+{
+	CacheResult result;
+	result.scene = scene;
+	result.objectCount = objectCount;
+
+	std::unique_ptr<MeshInstance[]> meshes(new MeshInstance[objectCount]);
+	CreateScene(scene, meshes.get(), objectCount);
+
+	// Start from a cold cache
+	std::remove(filename.c_str());
+
+	auto start = Clock::now();
+	LinearBVH built(meshes.get(), objectCount);
+	result.buildMs = ElapsedMs(start);
+
+	start = Clock::now();
+	if (!built.SaveCache(filename))
+	{
+		result.matchesBuilt = false;
+		return result;
+	}
+	result.saveMs = ElapsedMs(start);
+
+	start = Clock::now();
+	auto mapped = LinearBVH::LoadCache(filename, meshes.get(), objectCount);
+	result.loadMs = ElapsedMs(start);
+
+	if (!mapped)
+	{
+		result.matchesBuilt = false;
+		return result;
+	}
+
+	std::ifstream file(filename, std::ios::binary | std::ios::ate);
+	result.fileBytes = static_cast<long long>(file.tellg());
+
+	std::vector<MeshInstance*> builtVisible, mappedVisible;
+	builtVisible.reserve(objectCount);
+	mappedVisible.reserve(objectCount);
+
+	for (int i = 0; i < numFrames; ++i)
+	{
+		const CullingFrustum frustum(CreatePathFrustum(built.GetSceneExtent(), i / (float) numFrames));
+
+		builtVisible.clear();
+		mappedVisible.clear();
+
+		start = Clock::now();
+		built.GetVisibleGeometry(frustum, builtVisible);
+		const double builtMs = ElapsedMs(start);
+
+		start = Clock::now();
+		mapped->GetVisibleGeometry(frustum, mappedVisible);
+		const double mappedMs = ElapsedMs(start);
+
+		if (i == 0)
+		{
+			result.firstQueryMs = builtMs;
+			result.firstQueryMappedMs = mappedMs;
+		}
+
+		if (builtVisible != mappedVisible)
+			result.matchesBuilt = false;
+	}
+
+	return result;
+}
+
+auto CullingBenchmark::RunCameraPath(SceneType scene, BoundingVolume::HierarchyType type, int objectCount, const std::vector<CameraPose>& path, long long (*countAllocations)()) -> SceneResult
+{
+	SceneResult result;
+	result.scene = scene;
+	result.type = type;
+	result.objectCount = objectCount;
+
+	std::unique_ptr<MeshInstance[]> meshes(new MeshInstance[objectCount]);
+	CreateScene(scene, meshes.get(), objectCount);
+
+	auto start = Clock::now();
+	BoundingVolume boundingVolume(meshes.get(), objectCount, type);
+	result.buildMs = ElapsedMs(start);
+
+	// Grown up front, so that only allocations made by the hierarchy itself are counted
+	std::vector<MeshInstance*> visibleInstances;
+	visibleInstances.reserve(objectCount);
+
+	long long totalVisible = 0, totalNodes = 0, totalAllocations = 0;
+	double totalQueryMs = 0.0;
+
+	for (const auto& pose : path)
+	{
+		const BoundingFrustum frustum = CreatePoseFrustum(boundingVolume.GetSceneExtent(), pose);
+
+		visibleInstances.clear();
+
+		const long long allocationsBefore = countAllocations ? countAllocations() : 0;
+
+		start = Clock::now();
+		int visible = boundingVolume.GetVisibleGeometry(frustum, visibleInstances);
+		totalQueryMs += ElapsedMs(start);
+
+		if (countAllocations)
+			totalAllocations += countAllocations() - allocationsBefore;
+
+		totalVisible += std::max(visible, 0);
+		totalNodes += boundingVolume.GetNodesVisited();
+	}
+
+	const int numFrames = (int) path.size();
+
+	if (numFrames > 0)
+	{
+		result.queryMs = totalQueryMs / numFrames;
+		result.nsPerObject = result.queryMs * 1e6 / std::max(objectCount, 1);
+		result.nodesVisited = static_cast<int>(totalNodes / numFrames);
+		result.visibleObjects = static_cast<int>(totalVisible / numFrames);
+
+		if (countAllocations)
+			result.allocationsPerFrame = totalAllocations / (double) numFrames;
+	}
+
+	return result;
+}
+
+void CullingBenchmark::CreateScene(SceneType scene, MeshInstance* meshes, int count)
+{
+	switch (scene)
+	{
+		case SceneType::UNIFORM:
+			CreateUniformScene(meshes, count);
+			break;
+		case SceneType::CLUSTERED:
+			CreateClusteredScene(meshes, count);
+			break;
+		case SceneType::CITY:
+			CreateCityScene(meshes, count);
+			break;
+	}
+}
+
+auto CullingBenchmark::CreateOrbitPath(int numFrames) -> std::vector<CameraPose>
+{
+	std::vector<CameraPose> path(numFrames);
+
+	// Same loop as GetPathTransform
+	for (int i = 0; i < numFrames; ++i)
+	{
+		const float angle = XM_2PI * i / (float) numFrames;
+
+		path[i].position = XMFLOAT3(0.25f * std::cos(angle), 0.f, 0.25f * std::sin(angle));
+		path[i].rotation = XMFLOAT3(0.f, XMConvertToDegrees(-angle - XM_PIDIV4), 0.f);
+	}
+
+	return path;
+}
+
+bool CullingBenchmark::SaveCameraPath(const std::string& filename, const std::vector<CameraPose>& path)
+{
+	std::ofstream file(filename);
+
+	if (!file)
+		return false;
+
+	file << "# position (relative to the scene) x y z, rotation (degrees) x y z\n";
+
+	for (const auto& pose : path)
+	{
+		file << pose.position.x << ' ' << pose.position.y << ' ' << pose.position.z << ' '
+			<< pose.rotation.x << ' ' << pose.rotation.y << ' ' << pose.rotation.z << '\n';
+	}
+
+	return (bool) file;
+}
+
+bool CullingBenchmark::LoadCameraPath(const std::string& filename, std::vector<CameraPose>& path)
+{
+	std::ifstream file(filename);
+
+	if (!file)
+		return false;
+
+	path.clear();
+
+	std::string line;
+
+	while (std::getline(file, line))
+	{
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		std::istringstream iss(line);
+
+		CameraPose pose;
+		if (!(iss >> pose.position.x >> pose.position.y >> pose.position.z >> pose.rotation.x >> pose.rotation.y >> pose.rotation.z))
+			return false;
+
+		path.push_back(pose);
+	}
+
+	return true;
+}
+
+auto XM_CALLCONV CullingBenchmark::CreatePose(const BoundingBox& sceneExtent, FXMVECTOR position, FXMVECTOR rotation) -> CameraPose
+{
+	CameraPose pose;
+
+	XMVECTOR relative = (position - XMLoadFloat3(&sceneExtent.Center)) / XMLoadFloat3(&sceneExtent.Extents);
+	XMStoreFloat3(&pose.position, relative);
+	XMStoreFloat3(&pose.rotation, rotation);
+
+	return pose;
+}
+
+auto CullingBenchmark::MeasureScaling(BoundingVolume::HierarchyType type, int objectCount, int numQueries, const std::vector<int>& threadCounts) -> std::vector<ScalingResult>
+{
+	std::vector<ScalingResult> results;
+
+	std::unique_ptr<MeshInstance[]> meshes(new MeshInstance[objectCount]);
+	CreateUniformScene(meshes.get(), objectCount);
+
+	BoundingVolume boundingVolume(meshes.get(), objectCount, type);
+
+	std::vector<BoundingFrustum> frustums;
+
+	for (int i = 0; i < numQueries; ++i)
+		frustums.push_back(CreateQueryFrustum(boundingVolume.GetSceneExtent(), XM_2PI * i / (float) numQueries));
+
+	// Reference results, culled on this thread only
+	std::vector< std::vector<MeshInstance*> > serialVisible(numQueries);
+
+	for (int i = 0; i < numQueries; ++i)
+		boundingVolume.GetVisibleGeometry(frustums[i], serialVisible[i]);
+
+	std::vector<MeshInstance*> visibleInstances;
+	visibleInstances.reserve(objectCount);
+
+	for (int numThreads : threadCounts)
+	{
+		ScalingResult result;
+		result.numThreads = numThreads;
+
+		WorkerPool pool(numThreads);
+
+		double totalQueryMs = 0.0;
+
+		for (int i = 0; i < numQueries; ++i)
+		{
+			visibleInstances.clear();
+
+			auto start = Clock::now();
+			boundingVolume.GetVisibleGeometry(frustums[i], visibleInstances, &pool);
+			totalQueryMs += ElapsedMs(start);
+
+			if (visibleInstances != serialVisible[i])
+				result.matchesSerial = false;
+		}
+
+		if (numQueries > 0)
+			result.queryMs = totalQueryMs / numQueries;
+
+		results.push_back(result);
+	}
+
+	return results;
+}
+
+auto CullingBenchmark::MeasureRebuild(SceneType scene, int objectCount, int numRebuilds, const std::vector<int>& threadCounts) -> std::vector<RebuildResult>
+{
+	std::vector<RebuildResult> results;
+
+	std::unique_ptr<MeshInstance[]> meshes(new MeshInstance[objectCount]);
+	CreateScene(scene, meshes.get(), objectCount);
+
+	// Reference hierarchy, built on this thread only
+	const auto serial = LinearBVH::BuildMorton(meshes.get(), objectCount);
+	const auto bvh = LinearBVH::BuildMorton(meshes.get(), objectCount);
+
+	const auto MatchesSerial = [&]()
+	{
+		if (bvh->GetNumNodes() != serial->GetNumNodes())
+			return false;
+
+		if (std::memcmp(bvh->GetNodes(), serial->GetNodes(), serial->GetNumNodes() * sizeof(LinearBVH::Node)) != 0)
+			return false;
+
+		for (int i = 0; i < objectCount; ++i)
+		{
+			if (bvh->GetObjects()[i].meshIdx != serial->GetObjects()[i].meshIdx)
+				return false;
+		}
+
+		return true;
+	};
+
+	for (int numThreads : threadCounts)
+	{
+		RebuildResult result;
+		result.numThreads = numThreads;
+
+		WorkerPool pool(numThreads);
+
+		// Warm up the pool's threads and the builder's scratch space
+		bvh->RebuildMorton(&pool);
+
+		double totalRebuildMs = 0.0;
+
+		for (int i = 0; i < numRebuilds; ++i)
+		{
+			auto start = Clock::now();
+			bvh->RebuildMorton(&pool);
+			totalRebuildMs += ElapsedMs(start);
+
+			if (!MatchesSerial())
+				result.matchesSerial = false;
+		}
+
+		if (numRebuilds > 0)
+			result.rebuildMs = totalRebuildMs / numRebuilds;
+
+		results.push_back(result);
+	}
+
+	return results;
+}
+
+auto CullingBenchmark::MeasureInstancePacking(SceneType scene, int objectCount, int numFrames) -> std::vector<PackResult>
+{
+	std::vector<PackResult> results;
+
+	std::unique_ptr<MeshInstance[]> meshes(new MeshInstance[objectCount]);
+	CreateScene(scene, meshes.get(), objectCount);
+
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> angle(-XM_PI, XM_PI);
+	std::uniform_real_distribution<float> scale(0.5f, 2.f);
+
+	std::vector<XMFLOAT4X4> worlds(objectCount);
+
+	for (int i = 0; i < objectCount; ++i)
+	{
+		meshes[i].SetRotation(XMQuaternionRotationRollPitchYaw(angle(rng), angle(rng), angle(rng)));
+
+		const float uniformScale = scale(rng);
+		meshes[i].SetScale(uniformScale, uniformScale, uniformScale);
+
+		XMStoreFloat4x4(&worlds[i], meshes[i].GetWorldMatrix());
+	}
+
+	std::vector<uint8_t> packed;
+
+	for (int i = 0; i < InstancePacker::NUM_FORMATS; ++i)
+	{
+		PackResult result;
+		result.format = static_cast<InstancePacker::Format>(i);
+		result.stride = InstancePacker::GetStride(result.format);
+		result.bytesPerFrame = (long long) objectCount * result.stride;
+
+		packed.resize(result.bytesPerFrame);
+
+		// The bounds are worked out every frame, as InstanceShader does for every batch
+		InstancePacker::QuantisationBounds bounds;
+		double totalPackMs = 0.0;
+
+		for (int frame = 0; frame < numFrames; ++frame)
+		{
+			auto start = Clock::now();
+
+			if (result.format == InstancePacker::Format::QUANTISED)
+				bounds = InstancePacker::GetQuantisationBounds(worlds.data(), worlds.size());
+
+			InstancePacker::Pack(result.format, worlds.data(), worlds.size(), bounds, packed.data());
+			totalPackMs += ElapsedMs(start);
+		}
+
+		if (numFrames > 0)
+		{
+			result.packMs = totalPackMs / numFrames;
+			result.nsPerInstance = result.packMs * 1e6 / std::max(objectCount, 1);
+		}
+
+		for (int j = 0; j < objectCount; ++j)
+		{
+			XMFLOAT4X4 decoded;
+			XMStoreFloat4x4(&decoded, InstancePacker::Unpack(result.format, packed.data(), j, bounds));
+
+			for (int row = 0; row < 4; ++row)
+			{
+				for (int column = 0; column < 4; ++column)
+					result.maxError = std::max(result.maxError, std::abs(decoded.m[row][column] - worlds[j].m[row][column]));
+			}
+		}
+
+		results.push_back(result);
+	}
+
+	return results;
+}
+
+auto CullingBenchmark::MeasureInstanceOutput(SceneType scene, int objectCount, int numFrames) -> std::vector<InstanceOutputResult>
+{
+	std::vector<InstanceOutputResult> results;
+
+	std::unique_ptr<MeshInstance[]> meshes(new MeshInstance[objectCount]);
+	CreateScene(scene, meshes.get(), objectCount);
+
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> angle(-XM_PI, XM_PI);
+	std::uniform_real_distribution<float> scale(0.5f, 2.f);
+
+	std::vector<XMFLOAT4X4> worlds(objectCount);
+
+	for (int i = 0; i < objectCount; ++i)
+	{
+		meshes[i].SetRotation(XMQuaternionRotationRollPitchYaw(angle(rng), angle(rng), angle(rng)));
+
+		const float uniformScale = scale(rng);
+		meshes[i].SetScale(uniformScale, uniformScale, uniformScale);
+
+		XMStoreFloat4x4(&worlds[i], meshes[i].GetWorldMatrix());
+	}
+
+	BoundingVolume boundingVolume(meshes.get(), objectCount, BoundingVolume::HierarchyType::SAH);
+
+	// A span is written before the visible objects are known, so quantised instances are stored relative to the bounds
+	// of the whole scene. Both ways use them, so that their output can be compared
+	const InstancePacker::QuantisationBounds bounds = InstancePacker::GetQuantisationBounds(worlds.data(), worlds.size());
+
+	std::vector<MeshInstance*> visibleInstances;
+	visibleInstances.reserve(objectCount);
+
+	std::vector<XMFLOAT4X4> gathered;
+	gathered.reserve(objectCount);
+
+	std::vector<uint8_t> packed, gatheredBuffer, spanBuffer;
+
+	for (int i = 0; i < InstancePacker::NUM_FORMATS; ++i)
+	{
+		InstanceOutputResult result;
+		result.format = static_cast<InstancePacker::Format>(i);
+
+		const uint32_t stride = InstancePacker::GetStride(result.format);
+
+		packed.resize((size_t) objectCount * stride);
+		gatheredBuffer.assign((size_t) objectCount * stride, 0);
+		spanBuffer.assign((size_t) objectCount * stride, 0);
+
+		long long totalVisible = 0;
+		double totalCullMs = 0.0, totalGatherMs = 0.0, totalSpanMs = 0.0;
+
+		for (int frame = 0; frame < numFrames; ++frame)
+		{
+			const CullingFrustum frustum(CreatePathFrustum(boundingVolume.GetSceneExtent(), frame / (float) numFrames));
+
+			// Culling on its own
+			visibleInstances.clear();
+
+			auto start = Clock::now();
+			boundingVolume.GetVisibleGeometry(frustum, visibleInstances);
+			totalCullMs += ElapsedMs(start);
+
+			// Culling, gathering the matrices, packing them and copying them into the instance buffer
+			visibleInstances.clear();
+			gathered.clear();
+
+			start = Clock::now();
+			boundingVolume.GetVisibleGeometry(frustum, visibleInstances);
+
+			for (MeshInstance* instance : visibleInstances)
+			{
+				gathered.emplace_back();
+				XMStoreFloat4x4(&gathered.back(), instance->GetWorldMatrix());
+			}
+
+			InstancePacker::Pack(result.format, gathered.data(), gathered.size(), bounds, packed.data());
+			std::memcpy(gatheredBuffer.data(), packed.data(), gathered.size() * stride);
+			totalGatherMs += ElapsedMs(start);
+
+			// Culling straight into the instance buffer
+			InstanceSpan span(spanBuffer.data(), objectCount, result.format, bounds);
+
+			start = Clock::now();
+			boundingVolume.GetVisibleGeometry(frustum, span);
+			totalSpanMs += ElapsedMs(start);
+
+			totalVisible += visibleInstances.size();
+
+			if (span.size() != visibleInstances.size() || std::memcmp(spanBuffer.data(), gatheredBuffer.data(), span.GetWritten() * stride) != 0)
+				result.matchesGathered = false;
+		}
+
+		if (numFrames > 0)
+		{
+			result.visibleObjects = static_cast<int>(totalVisible / numFrames);
+			result.cullMs = totalCullMs / numFrames;
+			result.gatherMs = totalGatherMs / numFrames;
+			result.spanMs = totalSpanMs / numFrames;
+
+			const double visible = std::max(result.visibleObjects, 1);
+			result.gatherNsPerInstance = (result.gatherMs - result.cullMs) * 1e6 / visible;
+			result.spanNsPerInstance = (result.spanMs - result.cullMs) * 1e6 / visible;
+		}
+
+		results.push_back(result);
+	}
+
+	return results;
+}
+
+auto CullingBenchmark::MeasureRenderQueue(SceneType scene, int objectCount, int numFrames) -> RenderQueueResult
+{
+	RenderQueueResult result;
+
+	std::unique_ptr<MeshInstance[]> meshes(new MeshInstance[objectCount]);
+	CreateScene(scene, meshes.get(), objectCount);
+
+	BoundingVolume boundingVolume(meshes.get(), objectCount, BoundingVolume::HierarchyType::SAH);
+
+	// Stand-ins for the state objects. The queue only looks at their addresses
+	struct StateObject { int unused; };
+	StateObject shaders[QUEUE_SHADERS], textures[QUEUE_TEXTURES], meshLods[QUEUE_MESHES][QUEUE_LODS];
+
+	std::mt19937 rng(1);
+	std::uniform_int_distribution<int> shaderIdx(0, QUEUE_SHADERS - 1);
+	std::uniform_int_distribution<int> textureIdx(0, QUEUE_TEXTURES - 1);
+	std::uniform_int_distribution<int> meshIdx(0, QUEUE_MESHES - 1);
+	std::uniform_int_distribution<int> translucent(0, QUEUE_TRANSLUCENT_RATIO - 1);
+
+	std::vector<RenderQueue::DrawPacket> materials(objectCount);
+	std::vector<uint8_t> isTranslucent(objectCount), kinds(objectCount);
+
+	for (int i = 0; i < objectCount; ++i)
+	{
+		materials[i].instance = &meshes[i];
+		materials[i].shader = reinterpret_cast<BaseShader*>(&shaders[shaderIdx(rng)]);
+		materials[i].texture = reinterpret_cast<ID3D11ShaderResourceView*>(&textures[textureIdx(rng)]);
+		kinds[i] = static_cast<uint8_t>(meshIdx(rng));
+		isTranslucent[i] = translucent(rng) == 0;
+	}
+
+	RenderQueue queue;
+	queue.SetMaxDepth(QUERY_FAR);
+
+	std::vector<MeshInstance*> visibleInstances;
+	visibleInstances.reserve(objectCount);
+
+	std::vector<float> depths(objectCount);
+
+	// Depths of draws that were sorted next to each other may be out of order by up to one step of the quantisation
+	const float depthStep = QUERY_FAR / ((1u << RenderQueue::DEPTH_BITS) - 1);
+
+	long long totalDraws = 0;
+	long long submitted[3] = {}, sorted[3] = {};
+	double totalSortMs = 0.0;
+
+	for (int frame = 0; frame < numFrames; ++frame)
+	{
+		const float t = frame / (float) numFrames;
+		const XMMATRIX view = GetPathTransform(boundingVolume.GetSceneExtent(), t);
+
+		visibleInstances.clear();
+		boundingVolume.GetVisibleGeometry(CreatePathFrustum(boundingVolume.GetSceneExtent(), t), visibleInstances);
+
+		queue.Clear();
+
+		for (MeshInstance* instance : visibleInstances)
+		{
+			const int idx = static_cast<int>(instance - meshes.get());
+
+			const float depth = XMVectorGetX(XMVector3Dot(XMVectorSubtract(instance->GetPositionXM(), view.r[3]), view.r[2]));
+
+			// Objects that stick out of the near or far plane are drawn as if they were at it
+			depths[idx] = std::min(std::max(depth, 0.f), QUERY_FAR);
+
+			RenderQueue::DrawPacket packet = materials[idx];
+			const int lod = std::min(std::max(static_cast<int>(depth / QUEUE_LOD_DISTANCE), 0), QUEUE_LODS - 1);
+			packet.mesh = reinterpret_cast<BaseMesh*>(&meshLods[kinds[idx]][lod]);
+
+			queue.Submit(RenderQueue::Pass::MAIN, isTranslucent[idx] != 0, depth, packet);
+		}
+
+		auto start = Clock::now();
+		queue.Sort();
+		totalSortMs += ElapsedMs(start);
+
+		totalDraws += queue.GetNumPackets();
+
+		submitted[0] += queue.GetSubmittedRebinds().shaders;
+		submitted[1] += queue.GetSubmittedRebinds().textures;
+		submitted[2] += queue.GetSubmittedRebinds().meshes;
+		sorted[0] += queue.GetSortedRebinds().shaders;
+		sorted[1] += queue.GetSortedRebinds().textures;
+		sorted[2] += queue.GetSortedRebinds().meshes;
+
+		// Opaque draws are compared to the previous draw of the same state, translucent ones to the previous translucent draw
+		for (size_t i = 1; i < queue.GetNumPackets(); ++i)
+		{
+			const RenderQueue::DrawPacket& previous = queue.GetPacket(i - 1);
+			const RenderQueue::DrawPacket& packet = queue.GetPacket(i);
+
+			const float previousDepth = depths[previous.instance - meshes.get()];
+			const float depth = depths[packet.instance - meshes.get()];
+
+			const bool previousTranslucent = RenderQueue::IsTranslucent(queue.GetKey(i - 1));
+
+			if (previousTranslucent && !RenderQueue::IsTranslucent(queue.GetKey(i)))
+				result.isOrdered = false;
+
+			if (RenderQueue::IsTranslucent(queue.GetKey(i)))
+			{
+				if (previousTranslucent && depth > previousDepth + depthStep)
+					result.isOrdered = false;
+			}
+			else if (packet.shader == previous.shader && packet.texture == previous.texture && packet.mesh == previous.mesh)
+			{
+				if (depth < previousDepth - depthStep)
+					result.isOrdered = false;
+			}
+		}
+	}
+
+	if (numFrames > 0)
+	{
+		result.draws = static_cast<int>(totalDraws / numFrames);
+		result.sortMs = totalSortMs / numFrames;
+
+		result.submittedRebinds.shaders = static_cast<int>(submitted[0] / numFrames);
+		result.submittedRebinds.textures = static_cast<int>(submitted[1] / numFrames);
+		result.submittedRebinds.meshes = static_cast<int>(submitted[2] / numFrames);
+		result.sortedRebinds.shaders = static_cast<int>(sorted[0] / numFrames);
+		result.sortedRebinds.textures = static_cast<int>(sorted[1] / numFrames);
+		result.sortedRebinds.meshes = static_cast<int>(sorted[2] / numFrames);
+	}
+
+	return result;
+}
+
+auto CullingBenchmark::MeasureCommandBuffer(SceneType scene, int objectCount, int numFrames) -> CommandBufferResult
+{
+	CommandBufferResult result;
+
+	std::unique_ptr<MeshInstance[]> meshes(new MeshInstance[objectCount]);
+	CreateScene(scene, meshes.get(), objectCount);
+
+	BoundingVolume boundingVolume(meshes.get(), objectCount, BoundingVolume::HierarchyType::SAH);
+
+	std::mt19937 rng(1);
+	std::uniform_int_distribution<int> textureIdx(0, QUEUE_TEXTURES - 1);
+	std::uniform_int_distribution<int> meshIdx(0, QUEUE_MESHES - 1);
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+	std::vector<uint8_t> textures(objectCount), kinds(objectCount);
+
+	for (int i = 0; i < objectCount; ++i)
+	{
+		textures[i] = static_cast<uint8_t>(textureIdx(rng));
+		kinds[i] = static_cast<uint8_t>(meshIdx(rng));
+	}
+
+	LightingStandIns standIns;
+
+	LightingLights lights;
+	lights.globalAmbient = XMFLOAT4(0.1f, 0.1f, 0.1f, 1.f);
+
+	for (auto& light : lights.lights)
+		light = XMFLOAT4(unit(rng), unit(rng), unit(rng), unit(rng));
+
+	const XMMATRIX projection = XMMatrixPerspectiveFovLH(QUERY_FOV, 1.f, QUERY_NEAR, QUERY_FAR);
+
+	std::vector<MeshInstance*> visibleInstances;
+	visibleInstances.reserve(objectCount);
+
+	CommandBuffer commands;
+	RecordingBackend nullBackend(false);
+	RecordingBackend immediateStream, replayedStream, filteredStream;
+
+	// Submit every visible object, binding its mesh when it differs from the previous one's
+	auto submitFrame = [&](CommandBackend& backend, FXMMATRIX view)
+	{
+		int boundMesh = -1;
+
+		for (MeshInstance* instance : visibleInstances)
+		{
+			const int idx = static_cast<int>(instance - meshes.get());
+
+			SubmitLightingDraw(backend, standIns, lights, instance->GetWorldMatrix(), view, projection, textures[idx], kinds[idx], kinds[idx] != boundMesh);
+			boundMesh = kinds[idx];
+		}
+	};
+
+	long long totalDraws = 0, totalPackets = 0, totalBytes = 0, totalConstantBytes = 0;
+	double totalImmediateMs = 0.0, totalRecordMs = 0.0, totalReplayMs = 0.0, totalFilteredMs = 0.0;
+	FilteringBackend::Stats filterStats;
+
+	for (int frame = 0; frame < numFrames; ++frame)
+	{
+		const float t = frame / (float) numFrames;
+		const XMMATRIX view = GetPathTransform(boundingVolume.GetSceneExtent(), t);
+
+		visibleInstances.clear();
+		boundingVolume.GetVisibleGeometry(CreatePathFrustum(boundingVolume.GetSceneExtent(), t), visibleInstances);
+
+		auto start = Clock::now();
+		submitFrame(nullBackend, view);
+		totalImmediateMs += ElapsedMs(start);
+
+		start = Clock::now();
+		commands.Clear();
+		submitFrame(commands, view);
+		totalRecordMs += ElapsedMs(start);
+
+		start = Clock::now();
+		commands.Execute(nullBackend);
+		totalReplayMs += ElapsedMs(start);
+
+		// A new filter every frame, as nothing is known to be bound at the start of a pass
+		FilteringBackend filter(nullBackend);
+
+		start = Clock::now();
+		commands.Execute(filter);
+		totalFilteredMs += ElapsedMs(start);
+
+		filterStats += filter.GetStats();
+
+		totalDraws += commands.GetNumDraws();
+		totalPackets += commands.GetNumPackets();
+		totalBytes += commands.GetSize();
+		totalConstantBytes += commands.GetConstantBytes();
+
+		// Replaying has to leave the backend with the same draws, in the same state, as submitting straight to it
+		immediateStream.Clear();
+		submitFrame(immediateStream, view);
+
+		replayedStream.Clear();
+		commands.Execute(replayedStream);
+
+		filteredStream.Clear();
+		FilteringBackend streamFilter(filteredStream);
+		commands.Execute(streamFilter);
+
+		if (immediateStream.GetDraws() != replayedStream.GetDraws() || immediateStream.GetDraws() != filteredStream.GetDraws() ||
+			(int) immediateStream.GetDraws().size() != (int) visibleInstances.size())
+			result.matchesImmediate = false;
+	}
+
+	if (numFrames > 0)
+	{
+		result.draws = static_cast<int>(totalDraws / numFrames);
+		result.packets = static_cast<int>(totalPackets / numFrames);
+	}
+
+	if (totalDraws > 0)
+	{
+		result.bytesPerDraw = totalBytes / (double) totalDraws;
+		result.constantBytesPerDraw = totalConstantBytes / (double) totalDraws;
+		result.immediateNsPerDraw = totalImmediateMs * 1e6 / totalDraws;
+		result.recordNsPerDraw = totalRecordMs * 1e6 / totalDraws;
+		result.replayNsPerDraw = totalReplayMs * 1e6 / totalDraws;
+		result.filteredReplayNsPerDraw = totalFilteredMs * 1e6 / totalDraws;
+		result.issuedPerDraw = filterStats.GetIssued() / (double) totalDraws;
+		result.filteredPerDraw = filterStats.GetFiltered() / (double) totalDraws;
+	}
+
+	return result;
+}
+
+auto CullingBenchmark::MeasureParallelRecording(SceneType scene, int objectCount, int numFrames, size_t chunkSize,
+	const std::vector<int>& threadCounts) -> std::vector<ParallelRecordingResult>
+{
+	std::vector<ParallelRecordingResult> results;
+
+	std::unique_ptr<MeshInstance[]> meshes(new MeshInstance[objectCount]);
+	CreateScene(scene, meshes.get(), objectCount);
+
+	BoundingVolume boundingVolume(meshes.get(), objectCount, BoundingVolume::HierarchyType::SAH);
+
+	std::mt19937 rng(1);
+	std::uniform_int_distribution<int> textureIdx(0, QUEUE_TEXTURES - 1);
+	std::uniform_int_distribution<int> meshIdx(0, QUEUE_MESHES - 1);
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+	std::vector<uint8_t> textures(objectCount), kinds(objectCount);
+
+	for (int i = 0; i < objectCount; ++i)
+	{
+		textures[i] = static_cast<uint8_t>(textureIdx(rng));
+		kinds[i] = static_cast<uint8_t>(meshIdx(rng));
+	}
+
+	LightingStandIns standIns;
+
+	LightingLights lights;
+	lights.globalAmbient = XMFLOAT4(0.1f, 0.1f, 0.1f, 1.f);
+
+	for (auto& light : lights.lights)
+		light = XMFLOAT4(unit(rng), unit(rng), unit(rng), unit(rng));
+
+	const XMMATRIX projection = XMMatrixPerspectiveFovLH(QUERY_FOV, 1.f, QUERY_NEAR, QUERY_FAR);
+
+	// The shadow pass, then the camera's
+	constexpr int NUM_PASSES = 2;
+	std::vector<MeshInstance*> visibleInstances[NUM_PASSES];
+
+	CommandBuffer serial;
+	ParallelRecorder recorder;
+	RecordingBackend serialStream, parallelStream;
+
+	// Submit draws [first, first + count) of a pass, binding the mesh when it differs from the previous draw's
+	// Only the bytes of the matrices are recorded, so the camera's stand in for the light's as well
+	auto submitDraws = [&](CommandBackend& backend, int pass, size_t first, size_t count, FXMMATRIX view)
+	{
+		int boundMesh = -1;
+
+		for (size_t i = first; i < first + count; ++i)
+		{
+			MeshInstance* instance = visibleInstances[pass][i];
+			const int idx = static_cast<int>(instance - meshes.get());
+
+			SubmitLightingDraw(backend, standIns, lights, instance->GetWorldMatrix(), view, projection, textures[idx], kinds[idx], kinds[idx] != boundMesh);
+			boundMesh = kinds[idx];
+		}
+	};
+
+	for (int numThreads : threadCounts)
+	{
+		ParallelRecordingResult result;
+		result.numThreads = numThreads;
+
+		WorkerPool pool(numThreads);
+
+		long long totalDraws = 0, totalChunks = 0;
+		double totalSerialMs = 0.0, totalParallelMs = 0.0;
+
+		for (int frame = 0; frame < numFrames; ++frame)
+		{
+			const float t = frame / (float) numFrames;
+			const XMMATRIX view = GetPathTransform(boundingVolume.GetSceneExtent(), t);
+
+			CullingFrustum views[NUM_PASSES];
+			CreatePathViews(boundingVolume.GetSceneExtent(), t, NUM_PASSES, views);
+
+			size_t numDraws[NUM_PASSES];
+
+			// views[0] is the camera's, which is drawn last
+			for (int pass = 0; pass < NUM_PASSES; ++pass)
+			{
+				visibleInstances[pass].clear();
+				boundingVolume.GetVisibleGeometry(views[NUM_PASSES - 1 - pass], visibleInstances[pass]);
+
+				numDraws[pass] = visibleInstances[pass].size();
+			}
+
+			auto start = Clock::now();
+			serial.Clear();
+
+			for (int pass = 0; pass < NUM_PASSES; ++pass)
+				submitDraws(serial, pass, 0, numDraws[pass], view);
+
+			totalSerialMs += ElapsedMs(start);
+
+			start = Clock::now();
+			recorder.Split(numDraws, NUM_PASSES, chunkSize);
+			recorder.Record([&](const ParallelRecorder::Chunk& chunk, int, CommandBackend& commands)
+			{
+				submitDraws(commands, chunk.pass, chunk.first, chunk.count, view);
+			}, &pool);
+			totalParallelMs += ElapsedMs(start);
+
+			totalDraws += serial.GetNumDraws();
+			totalChunks += recorder.GetNumChunks();
+
+			// Every chunk binds its first mesh again, which only changes the calls, not the state any draw sees
+			serialStream.Clear();
+			serial.Execute(serialStream);
+
+			parallelStream.Clear();
+
+			for (int pass = 0; pass < NUM_PASSES; ++pass)
+				recorder.Execute(pass, parallelStream);
+
+			if (serialStream.GetDraws() != parallelStream.GetDraws())
+				result.matchesSerial = false;
+		}
+
+		if (numFrames > 0)
+		{
+			result.draws = static_cast<int>(totalDraws / numFrames);
+			result.chunks = static_cast<int>(totalChunks / numFrames);
+			result.serialMs = totalSerialMs / numFrames;
+			result.parallelMs = totalParallelMs / numFrames;
+		}
+
+		results.push_back(result);
+	}
+
+	return results;
+}
+
+auto CullingBenchmark::MeasureGpuCulling(SceneType scene, int objectCount, int numFrames) -> GpuCullingResult
+{
+	GpuCullingResult result;
+
+	std::unique_ptr<MeshInstance[]> meshes(new MeshInstance[objectCount]);
+	CreateScene(scene, meshes.get(), objectCount);
+
+	BoundingVolume boundingVolume(meshes.get(), objectCount, BoundingVolume::HierarchyType::SAH);
+
+	// Uploaded once, as the scene is static
+	std::vector<GpuCulling::Instance> instances(objectCount);
+	std::vector<BoundingBox> worldBoxes(objectCount);
+
+	for (int i = 0; i < objectCount; ++i)
+	{
+		instances[i] = GpuCulling::MakeInstance(meshes[i]);
+		meshes[i].GetBoundingBox().Transform(worldBoxes[i], meshes[i].GetWorldMatrix());
+	}
+
+	result.uploadBytes = static_cast<long long>(objectCount) * sizeof(GpuCulling::Instance);
+	result.bytesPerFrame = sizeof(GpuCulling::CullBufferType) + sizeof(GpuCulling::DrawArguments);
+
+	std::vector<XMFLOAT4X4> visibleInstances(objectCount);
+
+	std::vector<MeshInstance*> hierarchyVisible;
+	hierarchyVisible.reserve(objectCount);
+
+	long long totalVisible = 0, totalHierarchyVisible = 0;
+	double totalEmulateMs = 0.0, totalHierarchyMs = 0.0;
+
+	for (int frame = 0; frame < numFrames; ++frame)
+	{
+		const CullingFrustum frustum(CreatePathFrustum(boundingVolume.GetSceneExtent(), frame / (float) numFrames));
+		const GpuCulling::CullBufferType cullBuffer = GpuCulling::MakeCullBuffer(frustum, static_cast<uint32_t>(objectCount));
+
+		GpuCulling::DrawArguments arguments = GpuCulling::MakeDrawArguments(0);
+
+		auto start = Clock::now();
+		GpuCulling::Emulate(cullBuffer, instances.data(), visibleInstances.data(), arguments);
+		totalEmulateMs += ElapsedMs(start);
+
+		hierarchyVisible.clear();
+
+		start = Clock::now();
+		boundingVolume.GetVisibleGeometry(frustum, hierarchyVisible);
+		totalHierarchyMs += ElapsedMs(start);
+
+		totalVisible += arguments.instanceCount;
+		totalHierarchyVisible += hierarchyVisible.size();
+
+		// The groups run in order here, so the output is in the order of the objects
+		uint32_t visibleIdx = 0;
+
+		for (int i = 0; i < objectCount; ++i)
+		{
+			if (!frustum.IsVisible(worldBoxes[i]))
+				continue;
+
+			if (visibleIdx >= arguments.instanceCount || std::memcmp(&visibleInstances[visibleIdx], &instances[i].world, sizeof(XMFLOAT4X4)) != 0)
+				result.matchesReference = false;
+
+			++visibleIdx;
+		}
+
+		if (visibleIdx != arguments.instanceCount || arguments.indexCountPerInstance != 0 || arguments.startInstanceLocation != 0)
+			result.matchesReference = false;
+	}
+
+	if (numFrames > 0)
+	{
+		result.visibleObjects = static_cast<int>(totalVisible / numFrames);
+		result.hierarchyVisible = static_cast<int>(totalHierarchyVisible / numFrames);
+		result.emulateMs = totalEmulateMs / numFrames;
+		result.hierarchyMs = totalHierarchyMs / numFrames;
+		result.cpuBytesPerFrame = static_cast<long long>(result.visibleObjects) * sizeof(XMFLOAT4X4);
+	}
+
+	return result;
+}
+
+auto CullingBenchmark::VerifyFrameAllocator(size_t capacity, int numFrames, const std::vector<int>& latencies) -> std::vector<FrameAllocatorResult>
+{
+	// Frames of a few hundred draws, most of them one 256-byte block of matrices (the alignment of a constant buffer
+	// offset), and some with the lights too. A few smaller allocations only ask for 16 bytes of alignment
+	struct Request
+	{
+		size_t size;
+		size_t alignment;
+	};
+
+	std::mt19937 rng(1);
+	std::uniform_int_distribution<int> drawsPerFrame(50, 400);
+	std::uniform_int_distribution<int> kind(0, 15);
+
+	std::vector<std::vector<Request>> frames(numFrames);
+
+	for (auto& frame : frames)
+	{
+		frame.resize(drawsPerFrame(rng));
+
+		for (auto& request : frame)
+		{
+			const int k = kind(rng);
+			request.size = k == 0 ? 768 : (k == 1 ? 48 : 256);
+			request.alignment = k == 1 ? 16 : 256;
+		}
+	}
+
+	std::vector<FrameAllocatorResult> results;
+
+	for (int latency : latencies)
+	{
+		FrameAllocatorResult result;
+		result.latency = latency;
+
+		FrameAllocator allocator(capacity);
+
+		// Frame (1-based, as fences are) that each byte belongs to, 0 for free bytes, and the ranges of every frame
+		std::vector<int> owner(capacity, 0);
+		std::vector<std::vector<std::pair<size_t, size_t>>> ranges(numFrames + 1);
+
+		for (int frame = 1; frame <= numFrames; ++frame)
+		{
+			// The GPU has finished every frame up to latency frames behind this one
+			const int completed = frame - 1 - latency;
+
+			if (completed > 0)
+			{
+				allocator.retireFrames(completed);
+
+				for (const auto& range : ranges[completed])
+				{
+					for (size_t b = range.first; b < range.first + range.second; ++b)
+					{
+						if (owner[b] == completed)
+							owner[b] = 0;
+					}
+				}
+			}
+
+			for (const Request& request : frames[frame - 1])
+			{
+				size_t offset = allocator.allocate(request.size, request.alignment);
+
+				// A discarded buffer is renamed by the driver, so nothing in flight is in the way any more
+				if (offset == FrameAllocator::INVALID_OFFSET)
+				{
+					++result.discards;
+
+					allocator.reset();
+					std::fill(owner.begin(), owner.end(), 0);
+
+					offset = allocator.allocate(request.size, request.alignment);
+				}
+
+				++result.allocations;
+
+				if (offset == FrameAllocator::INVALID_OFFSET || offset % request.alignment != 0 || offset + request.size > capacity)
+				{
+					++result.errors;
+					continue;
+				}
+
+				bool overlaps = false;
+
+				for (size_t b = offset; b < offset + request.size; ++b)
+				{
+					overlaps |= owner[b] != 0;
+					owner[b] = frame;
+				}
+
+				if (overlaps)
+					++result.errors;
+
+				ranges[frame].push_back(std::make_pair(offset, request.size));
+			}
+
+			result.peakUsed = std::max(result.peakUsed, allocator.getUsed());
+			allocator.endFrame(frame);
+		}
+
+		result.wraps = allocator.getWraps();
+
+		// Once more, timing only the allocator
+		FrameAllocator timed(capacity);
+
+		auto start = Clock::now();
+		for (int frame = 1; frame <= numFrames; ++frame)
+		{
+			if (frame - 1 - latency > 0)
+				timed.retireFrames(frame - 1 - latency);
+
+			for (const Request& request : frames[frame - 1])
+			{
+				if (timed.allocate(request.size, request.alignment) == FrameAllocator::INVALID_OFFSET)
+				{
+					timed.reset();
+					timed.allocate(request.size, request.alignment);
+				}
+			}
+
+			timed.endFrame(frame);
+		}
+		const double ms = ElapsedMs(start);
+
+		if (result.allocations > 0)
+			result.nsPerAllocation = ms * 1e6 / result.allocations;
+
+		results.push_back(result);
+	}
+
+	return results;
+}
+
+auto CullingBenchmark::VerifyFrustumTests(int numBoxes, int numQueries) -> FrustumTestResult
+{
+	FrustumTestResult result;
+
+	std::mt19937 rng(1);
+
+	// Boxes of varying size spread over the range of the query frustums, so that plenty of them straddle a plane
+	std::uniform_real_distribution<float> position(-QUERY_FAR, QUERY_FAR);
+	std::uniform_real_distribution<float> size(0.01f, 8.f);
+
+	std::vector<BoundingBox> boxes(numBoxes);
+
+	for (auto& box : boxes)
+	{
+		box.Center = XMFLOAT3(position(rng), position(rng) * 0.25f, position(rng));
+		box.Extents = XMFLOAT3(size(rng), size(rng), size(rng));
+	}
+
+	const BoundingBox origin;
+
+	std::vector<uint32_t> batched, scalar;
+	std::vector<bool> collision(numBoxes);
+
+	for (int i = 0; i < numQueries; ++i)
+	{
+		const BoundingFrustum frustum = CreateQueryFrustum(origin, XM_2PI * i / (float) numQueries);
+		const CullingFrustum cullingFrustum(frustum);
+
+		batched.clear();
+		scalar.clear();
+
+		CullingFrustum::BoxBatch batch;
+		CullingFrustum::BatchResult batchResult;
+
+		auto start = Clock::now();
+		for (int first = 0; first < numBoxes; first += CullingFrustum::BATCH_SIZE)
+		{
+			batch.Clear();
+			for (int j = first; j < std::min(first + CullingFrustum::BATCH_SIZE, numBoxes); ++j)
+				batch.Add(boxes[j]);
+
+			batched.push_back(cullingFrustum.Test(batch));
+		}
+		result.batchedMs += ElapsedMs(start);
+
+		start = Clock::now();
+		for (int first = 0; first < numBoxes; first += CullingFrustum::BATCH_SIZE)
+		{
+			batch.Clear();
+			for (int j = first; j < std::min(first + CullingFrustum::BATCH_SIZE, numBoxes); ++j)
+				batch.Add(boxes[j]);
+
+			scalar.push_back(cullingFrustum.TestScalar(batch, CullingFrustum::ALL_PLANES, batchResult));
+		}
+		result.scalarMs += ElapsedMs(start);
+
+		start = Clock::now();
+		for (int j = 0; j < numBoxes; ++j)
+			collision[j] = frustum.Contains(boxes[j]) != ContainmentType::DISJOINT;
+		result.collisionMs += ElapsedMs(start);
+
+		for (int j = 0; j < numBoxes; ++j)
+		{
+			const uint32_t bit = 1u << (j % CullingFrustum::BATCH_SIZE);
+			const bool batchedVisible = (batched[j / CullingFrustum::BATCH_SIZE] & bit) != 0;
+			const bool scalarVisible = (scalar[j / CullingFrustum::BATCH_SIZE] & bit) != 0;
+
+			if (batchedVisible != collision[j] || scalarVisible != collision[j])
+				++result.mismatches;
+		}
+
+		result.boxesTested += numBoxes;
+	}
+
+	return result;
+}
+
+const char* CullingBenchmark::GetName(SceneType scene)
+{
+	switch (scene)
+	{
+		case SceneType::UNIFORM:
+			return "Uniform";
+		case SceneType::CLUSTERED:
+			return "Clustered";
+		case SceneType::CITY:
+			return "City";
+	}
+
+	return "Unknown";
+}
+
+const char* CullingBenchmark::GetName(BoundingVolume::HierarchyType type)
+{
+	switch (type)
+	{
+		case BoundingVolume::HierarchyType::OCTREE:
+			return "Octree";
+		case BoundingVolume::HierarchyType::SAH:
+			return "SAH";
+		case BoundingVolume::HierarchyType::LBVH:
+			return "LBVH";
+	}
+
+	return "Unknown";
+}
+
+const char* CullingBenchmark::GetName(RayQueryMode mode)
+{
+	switch (mode)
+	{
+		case RayQueryMode::NEAREST:
+			return "Nearest";
+		case RayQueryMode::ANY_HIT:
+			return "Any hit";
+	}
+
+	return "Unknown";
+}
+
+void CullingBenchmark::CreateUniformScene(MeshInstance* meshes, int count)
+{
+	// Fixed seed so that every run (and every hierarchy) sees the same scene
+	std::mt19937 rng(1);
+
+	const float sceneSize = SPACING * std::cbrt((float) count);
+	std::uniform_real_distribution<float> position(-0.5f * sceneSize, 0.5f * sceneSize);
+
+	for (int i = 0; i < count; ++i)
+		meshes[i].SetPosition(position(rng), position(rng), position(rng));
+}
+
+void CullingBenchmark::CreateClusteredScene(MeshInstance* meshes, int count)
+{
+	std::mt19937 rng(1);
+
+	// Clusters are spread over the same cube as a uniform scene of the same count
+	const float sceneSize = SPACING * std::cbrt((float) count);
+	std::uniform_real_distribution<float> position(-0.5f * sceneSize, 0.5f * sceneSize);
+
+	const int numClusters = std::max(count / CLUSTER_SIZE, 1);
+	std::vector<XMFLOAT3> centres(numClusters);
+
+	for (auto& centre : centres)
+		centre = XMFLOAT3(position(rng), position(rng), position(rng));
+
+	std::uniform_int_distribution<int> cluster(0, numClusters - 1);
+	std::normal_distribution<float> offset(0.f, CLUSTER_SPREAD * SPACING);
+
+	for (int i = 0; i < count; ++i)
+	{
+		const XMFLOAT3& centre = centres[cluster(rng)];
+		meshes[i].SetPosition(centre.x + offset(rng), centre.y + offset(rng), centre.z + offset(rng));
+	}
+}
+
+void CullingBenchmark::CreateCityScene(MeshInstance* meshes, int count)
+{
+	std::mt19937 rng(1);
+	std::uniform_int_distribution<int> floors(1, MAX_FLOORS);
+
+	// Lay the buildings out on a square grid, leaving every few rows and columns empty for the streets
+	// The grid is sized for buildings of average height, and carries on row by row if that runs out
+	const int period = BLOCK_SIZE + STREET_WIDTH;
+	const float numBuildings = count / (0.5f * (1 + MAX_FLOORS));
+	const int gridSide = std::max(static_cast<int>(std::ceil(std::sqrt(numBuildings) * period / BLOCK_SIZE)), 1);
+
+	int placed = 0;
+
+	for (int cell = 0; placed < count; ++cell)
+	{
+		const int x = cell % gridSide;
+		const int z = cell / gridSide;
+
+		if (x % period >= BLOCK_SIZE || z % period >= BLOCK_SIZE)
+			continue;
+
+		const int height = std::min(floors(rng), count - placed);
+
+		for (int floor = 0; floor < height; ++floor)
+			meshes[placed++].SetPosition(SPACING * (x - 0.5f * gridSide), SPACING * floor, SPACING * (z - 0.5f * gridSide));
+	}
+}
+
+BoundingFrustum CullingBenchmark::CreateQueryFrustum(const BoundingBox& sceneExtent, float angle)
+{
+	BoundingFrustum frustum;
+	BoundingFrustum::CreateFromMatrix(frustum, XMMatrixPerspectiveFovLH(QUERY_FOV, 16.f / 9.f, QUERY_NEAR, QUERY_FAR));
+
+	// Place the frustum in the middle of the scene, looking along the horizon
+	XMMATRIX world = XMMatrixRotationY(angle);
+	world *= XMMatrixTranslationFromVector(XMLoadFloat3(&sceneExtent.Center));
+
+	frustum.Transform(frustum, world);
+
+	return frustum;
+}
+
+XMMATRIX XM_CALLCONV CullingBenchmark::GetPathTransform(const BoundingBox& sceneExtent, float t)
+{
+	// Walk a circle around the centre of the scene, looking a little inwards of the direction of travel
+	const float angle = XM_2PI * t;
+	const float radius = 0.25f * sceneExtent.Extents.x;
+
+	XMVECTOR position = XMLoadFloat3(&sceneExtent.Center) + XMVectorSet(radius * std::cos(angle), 0.f, radius * std::sin(angle), 0.f);
+
+	XMMATRIX world = XMMatrixRotationY(-angle - XM_PIDIV4);
+	world *= XMMatrixTranslationFromVector(position);
+
+	return world;
+}
+
+BoundingFrustum CullingBenchmark::CreatePathFrustum(const BoundingBox& sceneExtent, float t)
+{
+	BoundingFrustum frustum;
+	BoundingFrustum::CreateFromMatrix(frustum, XMMatrixPerspectiveFovLH(QUERY_FOV, 16.f / 9.f, QUERY_NEAR, QUERY_FAR));
+
+	frustum.Transform(frustum, GetPathTransform(sceneExtent, t));
+
+	return frustum;
+}
+
+void CullingBenchmark::CreateCameraRays(const BoundingBox& sceneExtent, float t, int numRays, std::vector<Ray>& rays)
+{
+	constexpr float ASPECT_RATIO = 16.f / 9.f;
+
+	// Round the resolution to whole tiles
+	const int tilesX = std::max(static_cast<int>(std::sqrt(numRays * ASPECT_RATIO)) / RAY_TILE_WIDTH, 1);
+	const int tilesY = std::max(numRays / (tilesX * RAY_TILE_WIDTH * RAY_TILE_HEIGHT), 1);
+
+	const int width = tilesX * RAY_TILE_WIDTH;
+	const int height = tilesY * RAY_TILE_HEIGHT;
+
+	const XMMATRIX world = GetPathTransform(sceneExtent, t);
+	const float tanHalfFov = std::tan(0.5f * QUERY_FOV);
+
+	Ray ray;
+	XMStoreFloat3(&ray.origin, world.r[3]);
+	ray.maxDistance = QUERY_FAR;
+
+	rays.clear();
+	rays.reserve(width * height);
+
+	for (int tileY = 0; tileY < tilesY; ++tileY)
+	{
+		for (int tileX = 0; tileX < tilesX; ++tileX)
+		{
+			for (int y = tileY * RAY_TILE_HEIGHT; y < (tileY + 1) * RAY_TILE_HEIGHT; ++y)
+			{
+				for (int x = tileX * RAY_TILE_WIDTH; x < (tileX + 1) * RAY_TILE_WIDTH; ++x)
+				{
+					// Through the centre of the pixel, in view space
+					const float viewX = (2.f * (x + 0.5f) / width - 1.f) * tanHalfFov * ASPECT_RATIO;
+					const float viewY = (1.f - 2.f * (y + 0.5f) / height) * tanHalfFov;
+
+					XMStoreFloat3(&ray.direction, XMVector3Normalize(XMVector3TransformNormal(XMVectorSet(viewX, viewY, 1.f, 0.f), world)));
+					rays.push_back(ray);
+				}
+			}
+		}
+	}
+}
+
+void CullingBenchmark::CreateRandomSegments(const BoundingBox& sceneExtent, int numRays, std::vector<Ray>& rays)
+{
+	std::mt19937 rng(1);
+
+	std::uniform_real_distribution<float> x(sceneExtent.Center.x - sceneExtent.Extents.x, sceneExtent.Center.x + sceneExtent.Extents.x);
+	std::uniform_real_distribution<float> y(sceneExtent.Center.y - sceneExtent.Extents.y, sceneExtent.Center.y + sceneExtent.Extents.y);
+	std::uniform_real_distribution<float> z(sceneExtent.Center.z - sceneExtent.Extents.z, sceneExtent.Center.z + sceneExtent.Extents.z);
+
+	rays.clear();
+	rays.reserve(numRays);
+
+	for (int i = 0; i < numRays; ++i)
+	{
+		const XMFLOAT3 start(x(rng), y(rng), z(rng));
+		const XMFLOAT3 end(x(rng), y(rng), z(rng));
+
+		rays.push_back(Ray::CreateSegment(start, end));
+	}
+}
+
+void CullingBenchmark::CreatePathViews(const BoundingBox& sceneExtent, float t, int numViews, CullingFrustum* views)
+{
+	// The camera
+	views[0] = CullingFrustum(CreatePathFrustum(sceneExtent, t));
+
+	// A directional light covering the area around the camera, extruded towards the light like the shadow pass' volume
+	if (numViews > 1)
+	{
+		const XMVECTOR target = GetPathTransform(sceneExtent, t).r[3];
+		const XMVECTOR direction = XMVectorSet(0.f, -0.7071f, 0.7071f, 0.f);
+
+		XMMATRIX lightView = XMMatrixLookToLH(target - direction * LIGHT_DISTANCE, direction, XMVectorSet(0.f, 1.f, 0.f, 0.f));
+		XMMATRIX lightProjection = XMMatrixOrthographicLH(LIGHT_VOLUME_SIZE, LIGHT_VOLUME_SIZE, QUERY_NEAR, 2.f * LIGHT_DISTANCE);
+
+		views[1] = CullingFrustum::CreateFromMatrix(lightView * lightProjection);
+		views[1].RemovePlane(CullingFrustum::NEAR_PLANE);
+	}
+
+	// Stand-ins for cascades and probes: cameras a little further along the path, overlapping the first one
+	for (int i = 2; i < numViews; ++i)
+		views[i] = CullingFrustum(CreatePathFrustum(sceneExtent, t + 0.01f * (i - 1)));
+
+	// Views past the cached ones share the last cache
+	for (int i = 0; i < numViews; ++i)
+		views[i].SetViewId(std::min<uint32_t>(i, CullingFrustum::MAX_CACHED_VIEWS - 1));
+}
+
+BoundingFrustum CullingBenchmark::CreatePoseFrustum(const BoundingBox& sceneExtent, const CameraPose& pose)
+{
+	BoundingFrustum frustum;
+	BoundingFrustum::CreateFromMatrix(frustum, XMMatrixPerspectiveFovLH(QUERY_FOV, 16.f / 9.f, QUERY_NEAR, QUERY_FAR));
+
+	// Rotated the same way as Camera
+	XMVECTOR position = XMLoadFloat3(&sceneExtent.Center) + XMLoadFloat3(&pose.position) * XMLoadFloat3(&sceneExtent.Extents);
+
+	XMMATRIX world = XMMatrixRotationRollPitchYaw(XMConvertToRadians(pose.rotation.x), XMConvertToRadians(pose.rotation.y), XMConvertToRadians(pose.rotation.z));
+	world *= XMMatrixTranslationFromVector(position);
+
+	frustum.Transform(frustum, world);
+
+	return frustum;
+}
@@ -0,0 +1,476 @@
+// Benchmarks for the hierarchies used by BoundingVolume
+// Builds synthetic scenes of spheres without any GPU resources, so they can be run at any scale
+// Also built without D3D (with CULLING_HEADLESS defined) by the CullingBench command line tool
+
+#pragma once
+#include <vector>
+#include <string>
+
+#include "BoundingVolume.h"
+#include "OcclusionBuffer.h"
+#include "InstancePacker.h"
+#include "RenderQueue.h"
+#include "GpuCulling.h"
+#include "InstanceSpan.h"
+#include "CommandBuffer.h"
+#include "RecordingBackend.h"
+#include "FilteringBackend.h"
+#include "ParallelRecorder.h"
+#include "../DXFramework/FrameAllocator.h"
+
+class CullingBenchmark
+{
+public:
+	// How the objects of a synthetic scene are laid out
+	enum class SceneType
+	{
+		// Spread evenly over a cube
+		UNIFORM,
+
+		// Dense clumps of objects with mostly empty space in between
+		CLUSTERED,
+
+		// Blocks of buildings separated by streets, each building a stack of objects. Wide and flat
+		CITY
+	};
+
+	// A camera pose, either recorded in the application or generated
+	// The position is relative to the scene's bounding box, so that a path can be replayed through scenes of any size
+	struct CameraPose
+	{
+		// In [-1, 1] along each axis of the scene's bounding box
+		XMFLOAT3 position;
+
+		// Pitch, yaw and roll in degrees, as used by Camera
+		XMFLOAT3 rotation;
+	};
+
+	struct SceneResult
+	{
+		SceneType scene;
+		BoundingVolume::HierarchyType type;
+		int objectCount = 0;
+
+		double buildMs = 0.0;
+
+		// Averages over every frame of the path
+		double queryMs = 0.0;
+		double nsPerObject = 0.0;
+		int nodesVisited = 0;
+		int visibleObjects = 0;
+
+		// Heap allocations made by the queries, or -1 if they were not counted
+		double allocationsPerFrame = -1.0;
+	};
+
+	struct HierarchyResult
+	{
+		BoundingVolume::HierarchyType type;
+		int objectCount = 0;
+
+		// Time taken to build the hierarchy
+		double buildMs = 0.0;
+
+		// Averages over all the frustum queries
+		double queryMs = 0.0;
+		int visibleObjects = 0;
+		int nodesVisited = 0;
+	};
+
+	struct CameraPathResult
+	{
+		bool planeMasking = false;
+
+		// Averages over every frame of the path
+		double queryMs = 0.0;
+		int planeTests = 0;
+		int nodesVisited = 0;
+		int visibleObjects = 0;
+	};
+
+	struct OcclusionResult
+	{
+		bool occlusionCulling = false;
+
+		// Averages over every frame of the path
+		double rasteriseMs = 0.0;
+		double queryMs = 0.0;
+		int occluders = 0;
+		int visibleObjects = 0;
+		int occludedBoxes = 0;
+	};
+
+	struct ScalingResult
+	{
+		int numThreads = 0;
+
+		// Average time taken by a frustum query
+		double queryMs = 0.0;
+
+		// Whether every query produced exactly the same list of visible objects as culling on one thread
+		bool matchesSerial = true;
+	};
+
+	struct RebuildResult
+	{
+		int numThreads = 0;
+
+		// Average time taken to rebuild the LBVH from scratch
+		double rebuildMs = 0.0;
+
+		// Whether every rebuild produced exactly the same nodes and objects as building on one thread
+		bool matchesSerial = true;
+	};
+
+	struct PackResult
+	{
+		InstancePacker::Format format = InstancePacker::Format::MATRIX;
+
+		// Bytes per instance, and uploaded per frame
+		uint32_t stride = 0;
+		long long bytesPerFrame = 0;
+
+		// Average time taken to pack every object of the scene, on one thread
+		double packMs = 0.0;
+		double nsPerInstance = 0.0;
+
+		// Largest difference between an element of an object's world matrix and the one decoded from its instance
+		float maxError = 0.f;
+	};
+
+	struct InstanceOutputResult
+	{
+		InstancePacker::Format format = InstancePacker::Format::MATRIX;
+
+		// Averages over every frame of the path, on one thread
+		int visibleObjects = 0;
+
+		// Culling into a list of pointers and nothing else, then also gathering, packing and copying the transforms
+		// into the instance buffer, and culling into an InstanceSpan over the instance buffer instead
+		double cullMs = 0.0;
+		double gatherMs = 0.0;
+		double spanMs = 0.0;
+
+		// Cost of getting each visible object's transform into the instance buffer, on top of culling it
+		double gatherNsPerInstance = 0.0;
+		double spanNsPerInstance = 0.0;
+
+		// Whether both ways left exactly the same bytes in the instance buffer
+		bool matchesGathered = true;
+	};
+
+	struct RenderQueueResult
+	{
+		// Averages over every frame of the path
+		int draws = 0;
+		double sortMs = 0.0;
+
+		// Rebinds in the order the hierarchy returned the objects in, and in sorted order
+		RenderQueue::RebindStats submittedRebinds;
+		RenderQueue::RebindStats sortedRebinds;
+
+		// Whether every group of opaque draws with the same state was sorted front-to-back, and every pass's translucent
+		// draws back-to-front
+		bool isOrdered = true;
+	};
+
+	struct CommandBufferResult
+	{
+		// Averages over every frame of the path
+		int draws = 0;
+		int packets = 0;
+		double bytesPerDraw = 0.0;
+		double constantBytesPerDraw = 0.0;
+
+		// Submitting every draw straight to a null backend, recording it into a CommandBuffer, and replaying the
+		// buffer onto the null backend
+		double immediateNsPerDraw = 0.0;
+		double recordNsPerDraw = 0.0;
+		double replayNsPerDraw = 0.0;
+
+		// Replaying through a FilteringBackend, and the binding calls per draw it passed on and left out
+		double filteredReplayNsPerDraw = 0.0;
+		double issuedPerDraw = 0.0;
+		double filteredPerDraw = 0.0;
+
+		// Whether replaying, straight and through the filter, gave a RecordingBackend exactly the draw stream that
+		// submitting straight to it did
+		bool matchesImmediate = true;
+	};
+
+	struct ParallelRecordingResult
+	{
+		int numThreads = 0;
+
+		// Averages over every frame of the path, of both passes together
+		int draws = 0;
+		int chunks = 0;
+
+		// Recording both passes one after the other into one CommandBuffer, and in chunks across the pool
+		double serialMs = 0.0;
+		double parallelMs = 0.0;
+
+		// Whether executing the chunks of every pass in order gave a RecordingBackend exactly the draw stream that the
+		// serial recording did
+		bool matchesSerial = true;
+	};
+
+	struct GpuCullingResult
+	{
+		// Averages over every frame of the path
+		int visibleObjects = 0;
+		int hierarchyVisible = 0;
+
+		// Culling with the emulated kernel, and with the SAH hierarchy, on one thread
+		double emulateMs = 0.0;
+		double hierarchyMs = 0.0;
+
+		// Instance data uploaded once, and then every frame. Instancing on the CPU uploads the visible matrices instead
+		long long uploadBytes = 0;
+		long long bytesPerFrame = 0;
+		long long cpuBytesPerFrame = 0;
+
+		// Whether every frame's output held exactly the world matrices of the objects CullingFrustum finds visible, in
+		// order, and its draw arguments counted them
+		bool matchesReference = true;
+	};
+
+	struct MultiViewResult
+	{
+		int numViews = 0;
+
+		// Averages over every frame of the path, culling each view with a query of its own, and then all of the views
+		// in a single traversal
+		double separateMs = 0.0;
+		double multiViewMs = 0.0;
+		int separateNodes = 0;
+		int multiViewNodes = 0;
+
+		// Summed over the views
+		int visibleObjects = 0;
+
+		// Whether every view's list was exactly the same as the one from its own query
+		bool matchesSeparate = true;
+	};
+
+	struct RayResult
+	{
+		// Rays per packet, 1 for rays traced one at a time, or 0 for a linear scan over every object
+		int packetSize = 0;
+
+		RayQueryMode mode = RayQueryMode::NEAREST;
+
+		// Camera rays through neighbouring pixels, or segments between random points of the scene
+		bool coherent = false;
+
+		int numRays = 0;
+
+		// On a single thread, i.e. per core
+		double raysPerSecond = 0.0;
+
+		// Nodes tested per ray. The linear scan tests every object instead
+		double nodesPerRay = 0.0;
+
+		int hits = 0;
+
+		// Whether every ray found the same hit (or, for RayQueryMode::NEAREST, a hit at the same distance) as when the
+		// rays are traced through the hierarchy one at a time
+		bool matchesSingle = true;
+	};
+
+	struct ContributionResult
+	{
+		// Projected size (in pixels) below which objects and nodes are culled. 0 culls with the frustum only
+		float minPixels = 0.f;
+
+		// Averages over every frame of the path
+		double queryMs = 0.0;
+		int nodesVisited = 0;
+		int visibleObjects = 0;
+		int smallBoxes = 0;
+
+		// Objects in the frustum that were culled for being too small
+		int instancesSaved = 0;
+
+		// Whether every query kept exactly the objects of the frustum-only query that are large enough on their own,
+		// i.e. culling whole nodes never dropped an object that was large enough
+		bool matchesPerObject = true;
+	};
+
+	struct CacheResult
+	{
+		SceneType scene;
+		int objectCount = 0;
+
+		// Building the SAH hierarchy and saving it, against mapping the saved file
+		double buildMs = 0.0;
+		double saveMs = 0.0;
+		double loadMs = 0.0;
+		long long fileBytes = 0;
+
+		// The first query touches every page it needs, so it includes the cost of faulting them in from the file
+		double firstQueryMs = 0.0;
+		double firstQueryMappedMs = 0.0;
+
+		// Whether the mapped hierarchy culls exactly the same objects, in the same order, as the one it was saved from
+		bool matchesBuilt = true;
+	};
+
+	struct FrameAllocatorResult
+	{
+		// Frames the simulated GPU runs behind the CPU
+		int latency = 0;
+
+		int allocations = 0;
+		int wraps = 0;
+
+		// Allocations that found the buffer full of frames in flight, after which it was reset as if discarded
+		int discards = 0;
+
+		// Most bytes in use at once, including what was skipped to align or wrap
+		size_t peakUsed = 0;
+
+		// Allocations that were misaligned, outside of the buffer, or overlapped one the GPU could still be reading
+		int errors = 0;
+
+		// Allocating alone, without the checks
+		double nsPerAllocation = 0.0;
+	};
+
+	struct FrustumTestResult
+	{
+		int boxesTested = 0;
+
+		// Boxes where the batched test disagrees with BoundingFrustum::Contains
+		int mismatches = 0;
+
+		double batchedMs = 0.0;
+		double scalarMs = 0.0;
+		double collisionMs = 0.0;
+	};
+
+	// Build a scene of uniformly distributed objects and time building the hierarchy, followed by a number of
+	// frustum queries from a camera spinning around the centre of the scene
+	static HierarchyResult RunHierarchy(BoundingVolume::HierarchyType type, int objectCount, int numQueries);
+
+	// Run RunHierarchy for both hierarchy types, for each of the given object counts
+	static std::vector<HierarchyResult> CompareHierarchies(const std::vector<int>& objectCounts, int numQueries);
+
+	// Move a camera along a smooth path through a scene of uniformly distributed objects, a small step per frame,
+	// culling with plane masking off and then on
+	static std::vector<CameraPathResult> ComparePlaneMasking(BoundingVolume::HierarchyType type, int objectCount, int numFrames);
+
+	// Move a camera along the same path as ComparePlaneMasking, culling with frustum culling only, and then with occlusion
+	// culling too. Occluders are picked from the objects that were visible in the previous frame
+	static std::vector<OcclusionResult> CompareOcclusion(BoundingVolume::HierarchyType type, int objectCount, int numFrames, int occluderBudget);
+
+	// Move a camera along the same path as ComparePlaneMasking, culling a number of views every frame: the camera, a
+	// directional light and further cameras standing in for cascades and probes. Each of the view counts is culled with
+	// one query per view, and then with a single multi-view query
+	static std::vector<MultiViewResult> CompareMultiView(BoundingVolume::HierarchyType type, int objectCount, const std::vector<int>& viewCounts, int numFrames);
+
+	// Trace camera rays and random segments through a scene of uniformly distributed objects, one ray at a time, in
+	// packets of 4 and 8, and with a linear scan over the objects. The scan only traces as many rays as it can get
+	// through in a reasonable time
+	static std::vector<RayResult> CompareRayQueries(BoundingVolume::HierarchyType type, int objectCount, int numRays);
+
+	// Move a camera along the same path as ComparePlaneMasking, culling with the frustum only, and then also culling
+	// the objects and nodes that are smaller than each of the given sizes on a 1080 pixel high screen
+	static std::vector<ContributionResult> CompareContributionCulling(BoundingVolume::HierarchyType type, int objectCount, const std::vector<float>& minPixels, int numFrames);
+
+	// Build a scene's SAH hierarchy, save it to a cache file and map it back in, timing each step and comparing
+	// the results of culling along the orbit path with both hierarchies
+	static CacheResult MeasureCache(SceneType scene, int objectCount, const std::string& filename, int numFrames);
+
+	// Time the same frustum queries as RunHierarchy, culling with WorkerPools of each of the given sizes
+	static std::vector<ScalingResult> MeasureScaling(BoundingVolume::HierarchyType type, int objectCount, int numQueries, const std::vector<int>& threadCounts);
+
+	// Rebuild a scene's LBVH from scratch a number of times, with WorkerPools of each of the given sizes
+	static std::vector<RebuildResult> MeasureRebuild(SceneType scene, int objectCount, int numRebuilds, const std::vector<int>& threadCounts);
+
+	// Pack the world matrices of every object of a scene into each instance format a number of times, as if every
+	// object was drawn every frame. Objects are given random rotations and uniform scales
+	static std::vector<PackResult> MeasureInstancePacking(SceneType scene, int objectCount, int numFrames);
+
+	// Move a camera along the same path as ComparePlaneMasking, getting the transforms of the visible objects into an
+	// instance buffer in each instance format: once the way InstanceShader did, through lists of pointers and matrices,
+	// and once culling straight into an InstanceSpan. Objects are given random rotations and uniform scales, and a heap
+	// buffer stands in for the mapped instance buffer
+	static std::vector<InstanceOutputResult> MeasureInstanceOutput(SceneType scene, int objectCount, int numFrames);
+
+	// Move a camera along the same path as ComparePlaneMasking, submitting every visible object to a RenderQueue and
+	// sorting it. Objects are given one of a few shaders, textures and meshes (with a LOD picked by distance), and a
+	// few of them are translucent
+	static RenderQueueResult MeasureRenderQueue(SceneType scene, int objectCount, int numFrames);
+
+	// Move a camera along the same path as ComparePlaneMasking, submitting every visible object the way the app's render
+	// queue does with LightingShader: four constant buffer updates, the bindings and a draw, plus the mesh whenever it
+	// changes. Submission straight to a null backend is timed against recording into a CommandBuffer and replaying it
+	static CommandBufferResult MeasureCommandBuffer(SceneType scene, int objectCount, int numFrames);
+
+	// Move a camera along the same path as ComparePlaneMasking, culling a shadow pass and a camera pass every frame and
+	// recording their draws the same way as MeasureCommandBuffer. Recording both passes on one thread is timed against
+	// recording them with a ParallelRecorder, in chunks of chunkSize draws, with WorkerPools of each of the given sizes
+	static std::vector<ParallelRecordingResult> MeasureParallelRecording(SceneType scene, int objectCount, int numFrames, size_t chunkSize,
+		const std::vector<int>& threadCounts);
+
+	// Move a camera along the same path as ComparePlaneMasking, culling every object with the emulation of the GPU
+	// culling kernel, and checking the output against testing each object's box with CullingFrustum
+	static GpuCullingResult MeasureGpuCulling(SceneType scene, int objectCount, int numFrames);
+
+	// Sub-allocate per-draw constants from a FrameAllocator of the given capacity, the way ConstantArena does, with a
+	// simulated GPU that finishes every frame latency frames after the CPU ended it. Every allocation is checked against
+	// the bytes of the frames still in flight, for each of the latencies
+	static std::vector<FrameAllocatorResult> VerifyFrameAllocator(size_t capacity, int numFrames, const std::vector<int>& latencies);
+
+	// Test random boxes against a number of frustums using CullingFrustum (both SSE and scalar paths) and
+	// DirectXCollision, timing each of them and counting the boxes they disagree on
+	static FrustumTestResult VerifyFrustumTests(int numBoxes, int numQueries);
+
+	// Build a scene and replay a camera path through it, one query per pose
+	// If countAllocations is given, it is called before and after every query to count the heap allocations made by it
+	static SceneResult RunCameraPath(SceneType scene, BoundingVolume::HierarchyType type, int objectCount, const std::vector<CameraPose>& path, long long (*countAllocations)() = nullptr);
+
+	// Fill the array with objects laid out according to the scene type. The same count always gives the same scene
+	static void CreateScene(SceneType scene, MeshInstance* meshes, int count);
+
+	// The loop around the scene used by ComparePlaneMasking, as a list of poses
+	static std::vector<CameraPose> CreateOrbitPath(int numFrames);
+
+	// Camera paths are stored as text, one pose per line
+	static bool SaveCameraPath(const std::string& filename, const std::vector<CameraPose>& path);
+	static bool LoadCameraPath(const std::string& filename, std::vector<CameraPose>& path);
+
+	// Pose of a camera at the given position and rotation (in degrees), relative to the scene's bounding box
+	static CameraPose XM_CALLCONV CreatePose(const BoundingBox& sceneExtent, FXMVECTOR position, FXMVECTOR rotation);
+
+	static const char* GetName(BoundingVolume::HierarchyType type);
+	static const char* GetName(SceneType scene);
+	static const char* GetName(RayQueryMode mode);
+
+private:
+	// Fill the array with objects spread over a cube, at a constant density regardless of the count
+	static void CreateUniformScene(MeshInstance* meshes, int count);
+	static void CreateClusteredScene(MeshInstance* meshes, int count);
+	static void CreateCityScene(MeshInstance* meshes, int count);
+
+	// Frustum of a camera at the given pose
+	static BoundingFrustum CreatePoseFrustum(const BoundingBox& sceneExtent, const CameraPose& pose);
+
+	// Frustum at the centre of the scene, rotated around the Y-axis
+	static BoundingFrustum CreateQueryFrustum(const BoundingBox& sceneExtent, float angle);
+
+	// Camera (world) transform and frustum at point t (in [0, 1)) of a loop around the scene
+	static XMMATRIX XM_CALLCONV GetPathTransform(const BoundingBox& sceneExtent, float t);
+	static BoundingFrustum CreatePathFrustum(const BoundingBox& sceneExtent, float t);
+
+	// Rays through the pixels of the camera at point t of the path. The pixels are ordered in tiles of 4x2, so that
+	// consecutive rays make for coherent packets
+	static void CreateCameraRays(const BoundingBox& sceneExtent, float t, int numRays, std::vector<Ray>& rays);
+
+	// Segments between random points within the scene, e.g. projectiles or line of sight tests
+	static void CreateRandomSegments(const BoundingBox& sceneExtent, int numRays, std::vector<Ray>& rays);
+
+	// The views rendered at point t of the path. views must have room for numViews frustums
+	static void CreatePathViews(const BoundingBox& sceneExtent, float t, int numViews, CullingFrustum* views);
+};
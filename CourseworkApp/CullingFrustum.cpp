@@ -0,0 +1,277 @@
+#include "CullingFrustum.h"
+#include <cmath>
+#include <cassert>
+#include <limits>
+#include <algorithm>
+
+CullingFrustum::CullingFrustum(const BoundingFrustum& frustum)
+{
+	XMVECTOR planes[NUM_PLANES];
+	frustum.GetPlanes(&planes[0], &planes[1], &planes[2], &planes[3], &planes[4], &planes[5]);
+
+	for (int i = 0; i < NUM_PLANES; ++i)
+		XMStoreFloat4(&mPlanes[i], planes[i]);
+}
+
+CullingFrustum XM_CALLCONV CullingFrustum::CreateFromMatrix(FXMMATRIX viewProjection)
+{
+	// A point p is inside the clip volume if -w <= x <= w, -w <= y <= w and 0 <= z <= w, where (x, y, z, w) = p * M
+	// Each of those is a dot product with a column of M, so the columns give the (inward facing) planes
+	XMMATRIX columns = XMMatrixTranspose(viewProjection);
+
+	XMVECTOR planes[NUM_PLANES] = {
+		columns.r[2],					// Near
+		columns.r[3] - columns.r[2],	// Far
+		columns.r[3] - columns.r[0],	// Right
+		columns.r[3] + columns.r[0],	// Left
+		columns.r[3] - columns.r[1],	// Top
+		columns.r[3] + columns.r[1]		// Bottom
+	};
+
+	CullingFrustum frustum;
+
+	for (int i = 0; i < NUM_PLANES; ++i)
+	{
+		// Flip the planes to face outwards, like the planes of a BoundingFrustum
+		XMVECTOR plane = -planes[i] / XMVector3Length(planes[i]);
+		XMStoreFloat4(&frustum.mPlanes[i], plane);
+	}
+
+	return frustum;
+}
+
+void CullingFrustum::RemovePlane(uint32_t plane)
+{
+	assert(plane < NUM_PLANES);
+
+	// Every box is then fully inside the plane, so the plane is masked out after the first test
+	mPlanes[plane] = XMFLOAT4(0.f, 0.f, 0.f, -std::numeric_limits<float>::max());
+}
+
+void XM_CALLCONV CullingFrustum::SetMinScreenSize(FXMVECTOR eye, float pixelScale, float minPixels)
+{
+	XMStoreFloat3(&mEye, eye);
+
+	// 2 * |extents| * pixelScale / distance >= minPixels, squared and rearranged
+	const float ratio = minPixels / (2.f * pixelScale);
+	mScreenSizeFactor = std::max(ratio * ratio, 0.f);
+}
+
+int CullingFrustum::CullSmallBoxes(const BoxBatch& boxes, uint32_t& visible) const
+{
+	if (!HasMinScreenSize() || !visible)
+		return 0;
+
+	uint32_t large = 0;
+
+#if defined(_XM_SSE_INTRINSICS_)
+	const __m128 signMask = _mm_set1_ps(-0.f);
+
+	const __m128 extentsX = _mm_load_ps(boxes.extentsX);
+	const __m128 extentsY = _mm_load_ps(boxes.extentsY);
+	const __m128 extentsZ = _mm_load_ps(boxes.extentsZ);
+
+	// Distance from the eye to the closest point of the boxes, along each axis
+	__m128 distanceX = _mm_andnot_ps(signMask, _mm_sub_ps(_mm_load_ps(boxes.centerX), _mm_set1_ps(mEye.x)));
+	__m128 distanceY = _mm_andnot_ps(signMask, _mm_sub_ps(_mm_load_ps(boxes.centerY), _mm_set1_ps(mEye.y)));
+	__m128 distanceZ = _mm_andnot_ps(signMask, _mm_sub_ps(_mm_load_ps(boxes.centerZ), _mm_set1_ps(mEye.z)));
+
+	distanceX = _mm_max_ps(_mm_sub_ps(distanceX, extentsX), _mm_setzero_ps());
+	distanceY = _mm_max_ps(_mm_sub_ps(distanceY, extentsY), _mm_setzero_ps());
+	distanceZ = _mm_max_ps(_mm_sub_ps(distanceZ, extentsZ), _mm_setzero_ps());
+
+	__m128 distanceSq = _mm_add_ps(_mm_mul_ps(distanceX, distanceX), _mm_mul_ps(distanceY, distanceY));
+	distanceSq = _mm_add_ps(distanceSq, _mm_mul_ps(distanceZ, distanceZ));
+
+	__m128 extentsSq = _mm_add_ps(_mm_mul_ps(extentsX, extentsX), _mm_mul_ps(extentsY, extentsY));
+	extentsSq = _mm_add_ps(extentsSq, _mm_mul_ps(extentsZ, extentsZ));
+
+	large = static_cast<uint32_t>(_mm_movemask_ps(_mm_cmpge_ps(extentsSq, _mm_mul_ps(_mm_set1_ps(mScreenSizeFactor), distanceSq))));
+#else
+	for (int i = 0; i < boxes.count; ++i)
+	{
+		const float distanceX = std::max(std::fabs(boxes.centerX[i] - mEye.x) - boxes.extentsX[i], 0.f);
+		const float distanceY = std::max(std::fabs(boxes.centerY[i] - mEye.y) - boxes.extentsY[i], 0.f);
+		const float distanceZ = std::max(std::fabs(boxes.centerZ[i] - mEye.z) - boxes.extentsZ[i], 0.f);
+
+		const float distanceSq = distanceX * distanceX + distanceY * distanceY + distanceZ * distanceZ;
+		const float extentsSq = boxes.extentsX[i] * boxes.extentsX[i] + boxes.extentsY[i] * boxes.extentsY[i] + boxes.extentsZ[i] * boxes.extentsZ[i];
+
+		if (extentsSq >= mScreenSizeFactor * distanceSq)
+			large |= 1u << i;
+	}
+#endif
+
+	const uint32_t small = visible & ~large;
+	visible &= large;
+
+	return CountPlanes(small);
+}
+
+uint32_t CullingFrustum::Test(const BoxBatch& boxes) const
+{
+	BatchResult result;
+	return Test(boxes, ALL_PLANES, result);
+}
+
+uint32_t CullingFrustum::Test(const BoxBatch& boxes, uint32_t planeMask, BatchResult& result) const
+{
+	assert(boxes.count > 0 && boxes.count <= BATCH_SIZE);
+
+#if defined(_XM_SSE_INTRINSICS_)
+	const __m128 centerX = _mm_load_ps(boxes.centerX);
+	const __m128 centerY = _mm_load_ps(boxes.centerY);
+	const __m128 centerZ = _mm_load_ps(boxes.centerZ);
+
+	const __m128 extentsX = _mm_load_ps(boxes.extentsX);
+	const __m128 extentsY = _mm_load_ps(boxes.extentsY);
+	const __m128 extentsZ = _mm_load_ps(boxes.extentsZ);
+
+	// Lanes are set once the box is found to be entirely outside a plane
+	__m128 outside = _mm_setzero_ps();
+
+	__m128i undecided = _mm_setzero_si128();
+	__m128i rejectingPlane = _mm_set1_epi32(NO_PLANE);
+
+	for (uint32_t i = 0; i < NUM_PLANES; ++i)
+	{
+		if (!(planeMask & (1u << i)))
+			continue;
+
+		const XMFLOAT4& plane = mPlanes[i];
+
+		// Signed distance from the plane to the centre of the boxes
+		__m128 distance = _mm_add_ps(_mm_mul_ps(centerX, _mm_set1_ps(plane.x)), _mm_mul_ps(centerY, _mm_set1_ps(plane.y)));
+		distance = _mm_add_ps(distance, _mm_mul_ps(centerZ, _mm_set1_ps(plane.z)));
+		distance = _mm_add_ps(distance, _mm_set1_ps(plane.w));
+
+		// Extents of the boxes projected onto the plane normal
+		__m128 radius = _mm_add_ps(_mm_mul_ps(extentsX, _mm_set1_ps(std::fabs(plane.x))), _mm_mul_ps(extentsY, _mm_set1_ps(std::fabs(plane.y))));
+		radius = _mm_add_ps(radius, _mm_mul_ps(extentsZ, _mm_set1_ps(std::fabs(plane.z))));
+
+		const __m128 outsidePlane = _mm_cmpgt_ps(distance, radius);
+		const __m128 insidePlane = _mm_cmplt_ps(distance, _mm_sub_ps(_mm_setzero_ps(), radius));
+
+		// Remember the first plane each box was rejected by
+		const __m128i firstRejection = _mm_castps_si128(_mm_andnot_ps(outside, outsidePlane));
+		rejectingPlane = _mm_or_si128(_mm_andnot_si128(firstRejection, rejectingPlane), _mm_and_si128(firstRejection, _mm_set1_epi32(i)));
+
+		undecided = _mm_or_si128(undecided, _mm_andnot_si128(_mm_castps_si128(insidePlane), _mm_set1_epi32(1 << i)));
+		outside = _mm_or_ps(outside, outsidePlane);
+	}
+
+	_mm_store_si128(reinterpret_cast<__m128i*>(result.undecidedPlanes), undecided);
+	_mm_store_si128(reinterpret_cast<__m128i*>(result.rejectingPlane), rejectingPlane);
+
+	const uint32_t usedLanes = (1u << boxes.count) - 1;
+	const uint32_t visible = ~static_cast<uint32_t>(_mm_movemask_ps(outside)) & usedLanes;
+
+#if defined(_DEBUG)
+	BatchResult scalarResult;
+	assert(visible == TestScalar(boxes, planeMask, scalarResult));
+
+	for (int i = 0; i < boxes.count; ++i)
+	{
+		assert(result.rejectingPlane[i] == scalarResult.rejectingPlane[i]);
+		assert(!(visible & (1u << i)) || result.undecidedPlanes[i] == scalarResult.undecidedPlanes[i]);
+	}
+#endif
+
+	return visible;
+#else
+	return TestScalar(boxes, planeMask, result);
+#endif
+}
+
+uint32_t CullingFrustum::TestScalar(const BoxBatch& boxes, uint32_t planeMask, BatchResult& result) const
+{
+	uint32_t visible = 0;
+
+	for (int i = 0; i < boxes.count; ++i)
+	{
+		result.undecidedPlanes[i] = 0;
+		result.rejectingPlane[i] = NO_PLANE;
+
+		// Same order of operations as the SSE path, so that both give bit-identical results
+		for (uint32_t p = 0; p < NUM_PLANES; ++p)
+		{
+			if (!(planeMask & (1u << p)))
+				continue;
+
+			const XMFLOAT4& plane = mPlanes[p];
+
+			const float distance = boxes.centerX[i] * plane.x + boxes.centerY[i] * plane.y + boxes.centerZ[i] * plane.z + plane.w;
+			const float radius = boxes.extentsX[i] * std::fabs(plane.x) + boxes.extentsY[i] * std::fabs(plane.y) + boxes.extentsZ[i] * std::fabs(plane.z);
+
+			if (distance > radius)
+			{
+				result.rejectingPlane[i] = p;
+				break;
+			}
+
+			if (!(distance < -radius))
+				result.undecidedPlanes[i] |= 1u << p;
+		}
+
+		if (result.rejectingPlane[i] == NO_PLANE)
+			visible |= 1u << i;
+	}
+
+	return visible;
+}
+
+bool CullingFrustum::IsOutside(const XMFLOAT3& center, const XMFLOAT3& extents, uint32_t plane) const
+{
+	assert(plane < NUM_PLANES);
+	const XMFLOAT4& p = mPlanes[plane];
+
+	const float distance = center.x * p.x + center.y * p.y + center.z * p.z + p.w;
+	const float radius = extents.x * std::fabs(p.x) + extents.y * std::fabs(p.y) + extents.z * std::fabs(p.z);
+
+	return distance > radius;
+}
+
+bool CullingFrustum::IsAboveMinScreenSize(const XMFLOAT3& center, const XMFLOAT3& extents, float minExtentsSq) const
+{
+	if (!HasMinScreenSize())
+		return true;
+
+	// No box inside this one has its closest point further from the eye than this one's furthest corner
+	const float distanceX = std::fabs(center.x - mEye.x) + extents.x;
+	const float distanceY = std::fabs(center.y - mEye.y) + extents.y;
+	const float distanceZ = std::fabs(center.z - mEye.z) + extents.z;
+
+	const float distanceSq = distanceX * distanceX + distanceY * distanceY + distanceZ * distanceZ;
+
+	return minExtentsSq >= mScreenSizeFactor * distanceSq;
+}
+
+bool CullingFrustum::IsVisible(const BoundingBox& box) const
+{
+	BoxBatch batch;
+	batch.Add(box);
+
+	BatchResult result;
+	return TestScalar(batch, ALL_PLANES, result) != 0;
+}
+
+int CullingFrustum::CountPlanes(uint32_t planeMask)
+{
+	int count = 0;
+
+	for (; planeMask; planeMask &= planeMask - 1)
+		++count;
+
+	return count;
+}
+
+uint32_t CullingFrustum::LowestBit(uint32_t mask)
+{
+	assert(mask != 0);
+
+	uint32_t bit = 0;
+	while (!(mask & (1u << bit)))
+		++bit;
+
+	return bit;
+}
@@ -0,0 +1,166 @@
+// A frustum stored as six planes, used to test several bounding boxes at once
+// Boxes are tested in batches laid out as a structure of arrays, so one SSE instruction handles one component
+// of four boxes. Gives the same results as BoundingFrustum::Contains(BoundingBox) != DISJOINT
+
+#pragma once
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+#include <cstdint>
+
+using namespace DirectX;
+
+// Work done by a culling traversal
+struct CullingStats
+{
+	int nodesVisited = 0;
+
+	// Number of box-plane tests
+	int planeTests = 0;
+
+	// Nodes and objects inside the frustum, but hidden behind occluders
+	int occludedBoxes = 0;
+
+	// Nodes and objects inside the frustum, but below the minimum screen size
+	int smallBoxes = 0;
+
+	CullingStats& operator+=(const CullingStats& other)
+	{
+		nodesVisited += other.nodesVisited;
+		planeTests += other.planeTests;
+		occludedBoxes += other.occludedBoxes;
+		smallBoxes += other.smallBoxes;
+
+		return *this;
+	}
+};
+
+class CullingFrustum
+{
+public:
+	static constexpr int NUM_PLANES = 6;
+
+	// A plane mask has bit i set if a box still has to be tested against plane i
+	// A box that is entirely inside a plane does not need to be tested against it again; neither do its children
+	static constexpr uint32_t ALL_PLANES = (1u << NUM_PLANES) - 1;
+
+	// Stands in for a plane index when no plane rejected a box
+	static constexpr uint32_t NO_PLANE = 0xff;
+
+	// Views the hierarchies keep a cache of rejecting planes for. A frustum is given one of these with SetViewId, so
+	// that queries of different views (e.g. the camera and a light) do not overwrite each other's cached planes
+	static constexpr uint32_t MAX_CACHED_VIEWS = 4;
+
+	// Planes are in the same order as BoundingFrustum::GetPlanes
+	static constexpr uint32_t NEAR_PLANE = 0;
+
+	// Number of boxes tested by one call to CullingFrustum::Test
+	static constexpr int BATCH_SIZE = 4;
+
+	// Up to BATCH_SIZE bounding boxes, stored as a structure of arrays
+	struct alignas(16) BoxBatch
+	{
+		float centerX[BATCH_SIZE];
+		float centerY[BATCH_SIZE];
+		float centerZ[BATCH_SIZE];
+
+		float extentsX[BATCH_SIZE];
+		float extentsY[BATCH_SIZE];
+		float extentsZ[BATCH_SIZE];
+
+		// Number of lanes in use
+		int count = 0;
+
+		void Add(const XMFLOAT3& center, const XMFLOAT3& extents)
+		{
+			centerX[count] = center.x;
+			centerY[count] = center.y;
+			centerZ[count] = center.z;
+
+			extentsX[count] = extents.x;
+			extentsY[count] = extents.y;
+			extentsZ[count] = extents.z;
+
+			++count;
+		}
+
+		void Add(const BoundingBox& box) { Add(box.Center, box.Extents); }
+
+		bool IsFull() const { return count == BATCH_SIZE; }
+		void Clear() { count = 0; }
+	};
+
+	// Per-box results of testing a batch
+	struct alignas(16) BatchResult
+	{
+		// Planes that box i intersects, out of those it was tested against. 0 if the box is fully inside them all
+		uint32_t undecidedPlanes[BATCH_SIZE];
+
+		// First plane that box i was found to be outside of, or NO_PLANE if it is visible
+		uint32_t rejectingPlane[BATCH_SIZE];
+	};
+
+	CullingFrustum() = default;
+	explicit CullingFrustum(const BoundingFrustum& frustum);
+
+	// Extract the planes of a (world to clip space) view-projection matrix
+	// Unlike BoundingFrustum::CreateFromMatrix, this also works for orthographic projections
+	static CullingFrustum XM_CALLCONV CreateFromMatrix(FXMMATRIX viewProjection);
+
+	// Move a plane out to infinity, so that it no longer rejects anything
+	void RemovePlane(uint32_t plane);
+
+	// Small-feature culling: boxes that cover fewer than minPixels (in diameter) on screen are culled too
+	// pixelScale is the size in pixels of one unit at a distance of one unit (see LodSelector::GetPixelScale)
+	// The size used is an upper bound: the box's diagonal over the distance from the eye to the box's closest point.
+	// A box inside another is never larger by that measure, so a node below the size culls its whole subtree
+	// Only single-view queries use it; MultiViewFrustum ignores it
+	void XM_CALLCONV SetMinScreenSize(FXMVECTOR eye, float pixelScale, float minPixels);
+	bool HasMinScreenSize() const { return mScreenSizeFactor > 0.f; }
+
+	// Clear the bits of visible for the boxes that are below the minimum screen size. Returns how many were cleared
+	int CullSmallBoxes(const BoxBatch& boxes, uint32_t& visible) const;
+
+	// Whether every box inside the given box with extents at least sqrt(minExtentsSq) long is above the minimum
+	// screen size, so that a subtree fully inside the frustum can be accepted without testing what is below it
+	bool IsAboveMinScreenSize(const XMFLOAT3& center, const XMFLOAT3& extents, float minExtentsSq) const;
+
+	// Test a batch of boxes against all six planes
+	// Bit i of the returned mask is set if box i is inside or intersecting the frustum
+	uint32_t Test(const BoxBatch& boxes) const;
+
+	// Test a batch of boxes against the planes in planeMask only, which are assumed to be all that the boxes
+	// (e.g. the children of the same node) may be outside of
+	uint32_t Test(const BoxBatch& boxes, uint32_t planeMask, BatchResult& result) const;
+
+	// Scalar fallback of CullingFrustum::Test. Used when SSE is not available, and to validate the SSE path
+	uint32_t TestScalar(const BoxBatch& boxes, uint32_t planeMask, BatchResult& result) const;
+
+	// Test a single box against a single plane
+	bool IsOutside(const XMFLOAT3& center, const XMFLOAT3& extents, uint32_t plane) const;
+
+	// Test a single box
+	bool IsVisible(const BoundingBox& box) const;
+
+	static int CountPlanes(uint32_t planeMask);
+
+	// Index of the lowest set bit of a non-zero mask
+	static uint32_t LowestBit(uint32_t mask);
+
+	const XMFLOAT4& GetPlane(int idx) const { return mPlanes[idx]; }
+
+	// Which of the hierarchies' caches of rejecting planes queries with this frustum use, below MAX_CACHED_VIEWS
+	// Frustums of the same view from one frame to the next should share an id. Defaults to 0
+	void SetViewId(uint32_t viewId) { mViewId = viewId; }
+	uint32_t GetViewId() const { return mViewId; }
+
+private:
+	// Plane normals point out of the frustum, so a point is outside a plane if dot(normal, point) + d > 0
+	XMFLOAT4 mPlanes[NUM_PLANES];
+
+	// A box is large enough if |extents|^2 >= factor * distance^2, which needs neither a square root nor a division
+	// 0 when small-feature culling is off
+	XMFLOAT3 mEye = { 0.f, 0.f, 0.f };
+	float mScreenSizeFactor = 0.f;
+
+	uint32_t mViewId = 0;
+};
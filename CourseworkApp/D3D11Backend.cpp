@@ -0,0 +1,184 @@
+#include "D3D11Backend.h"
+#include <cstring>
+
+D3D11Backend::D3D11Backend(ID3D11DeviceContext* context, ConstantArena* arena)
+	:	mContext(context), mArena(arena && arena->isSupported() ? arena : nullptr)
+{
+}
+
+void D3D11Backend::SetInputLayout(ID3D11InputLayout* layout)
+{
+	mContext->IASetInputLayout(layout);
+}
+
+void D3D11Backend::SetShaders(const ShaderSet& shaders)
+{
+	mContext->VSSetShader(shaders.vs, NULL, 0);
+	mContext->PSSetShader(shaders.ps, NULL, 0);
+	mContext->HSSetShader(shaders.hs, NULL, 0);
+	mContext->DSSetShader(shaders.ds, NULL, 0);
+	mContext->GSSetShader(shaders.gs, NULL, 0);
+}
+
+void D3D11Backend::SetConstantBuffers(Stage stage, uint32_t slot, uint32_t count, ID3D11Buffer* const* buffers)
+{
+	switch (stage)
+	{
+	case Stage::VS:
+		mContext->VSSetConstantBuffers(slot, count, buffers);
+		break;
+
+	case Stage::HS:
+		mContext->HSSetConstantBuffers(slot, count, buffers);
+		break;
+
+	case Stage::DS:
+		mContext->DSSetConstantBuffers(slot, count, buffers);
+		break;
+
+	case Stage::GS:
+		mContext->GSSetConstantBuffers(slot, count, buffers);
+		break;
+
+	case Stage::PS:
+		mContext->PSSetConstantBuffers(slot, count, buffers);
+		break;
+
+	default:
+		break;
+	}
+}
+
+void D3D11Backend::SetShaderResources(Stage stage, uint32_t slot, uint32_t count, ID3D11ShaderResourceView* const* views)
+{
+	switch (stage)
+	{
+	case Stage::VS:
+		mContext->VSSetShaderResources(slot, count, views);
+		break;
+
+	case Stage::HS:
+		mContext->HSSetShaderResources(slot, count, views);
+		break;
+
+	case Stage::DS:
+		mContext->DSSetShaderResources(slot, count, views);
+		break;
+
+	case Stage::GS:
+		mContext->GSSetShaderResources(slot, count, views);
+		break;
+
+	case Stage::PS:
+		mContext->PSSetShaderResources(slot, count, views);
+		break;
+
+	default:
+		break;
+	}
+}
+
+void D3D11Backend::SetSamplers(Stage stage, uint32_t slot, uint32_t count, ID3D11SamplerState* const* samplers)
+{
+	switch (stage)
+	{
+	case Stage::VS:
+		mContext->VSSetSamplers(slot, count, samplers);
+		break;
+
+	case Stage::HS:
+		mContext->HSSetSamplers(slot, count, samplers);
+		break;
+
+	case Stage::DS:
+		mContext->DSSetSamplers(slot, count, samplers);
+		break;
+
+	case Stage::GS:
+		mContext->GSSetSamplers(slot, count, samplers);
+		break;
+
+	case Stage::PS:
+		mContext->PSSetSamplers(slot, count, samplers);
+		break;
+
+	default:
+		break;
+	}
+}
+
+void D3D11Backend::UpdateConstantBuffer(ID3D11Buffer* buffer, const void* data, uint32_t size)
+{
+	D3D11_MAPPED_SUBRESOURCE map;
+	mContext->Map(buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &map);
+	std::memcpy(map.pData, data, size);
+	mContext->Unmap(buffer, 0);
+}
+
+void D3D11Backend::SetDrawConstants(Stage stage, uint32_t slot, ID3D11Buffer* buffer, const void* data, uint32_t size)
+{
+	ConstantArena::Allocation allocation;
+
+	if (!mArena || !mArena->allocate(data, size, allocation))
+	{
+		UpdateConstantBuffer(buffer, data, size);
+		SetConstantBuffers(stage, slot, 1, &buffer);
+		return;
+	}
+
+	ID3D11DeviceContext1* context = mArena->getContext();
+
+	switch (stage)
+	{
+	case Stage::VS:
+		context->VSSetConstantBuffers1(slot, 1, &allocation.buffer, &allocation.firstConstant, &allocation.numConstants);
+		break;
+
+	case Stage::HS:
+		context->HSSetConstantBuffers1(slot, 1, &allocation.buffer, &allocation.firstConstant, &allocation.numConstants);
+		break;
+
+	case Stage::DS:
+		context->DSSetConstantBuffers1(slot, 1, &allocation.buffer, &allocation.firstConstant, &allocation.numConstants);
+		break;
+
+	case Stage::GS:
+		context->GSSetConstantBuffers1(slot, 1, &allocation.buffer, &allocation.firstConstant, &allocation.numConstants);
+		break;
+
+	case Stage::PS:
+		context->PSSetConstantBuffers1(slot, 1, &allocation.buffer, &allocation.firstConstant, &allocation.numConstants);
+		break;
+
+	default:
+		break;
+	}
+}
+
+void D3D11Backend::SetVertexBuffer(uint32_t slot, ID3D11Buffer* buffer, uint32_t stride, uint32_t offset)
+{
+	UINT strides[1] = { stride };
+	UINT offsets[1] = { offset };
+
+	mContext->IASetVertexBuffers(slot, 1, &buffer, strides, offsets);
+}
+
+void D3D11Backend::SetIndexBuffer(ID3D11Buffer* buffer, IndexFormat format, uint32_t offset)
+{
+	mContext->IASetIndexBuffer(buffer, format == IndexFormat::UINT32 ? DXGI_FORMAT_R32_UINT : DXGI_FORMAT_R16_UINT, offset);
+}
+
+void D3D11Backend::SetTopology(Topology topology)
+{
+	mContext->IASetPrimitiveTopology(static_cast<D3D11_PRIMITIVE_TOPOLOGY>(topology));
+}
+
+void D3D11Backend::DrawIndexed(uint32_t indexCount, uint32_t startIndex, int32_t baseVertex)
+{
+	mContext->DrawIndexed(indexCount, startIndex, baseVertex);
+}
+
+void D3D11Backend::DrawIndexedInstanced(uint32_t indexCount, uint32_t instanceCount, uint32_t startIndex, int32_t baseVertex, uint32_t startInstance)
+{
+	mContext->DrawIndexedInstanced(indexCount, instanceCount, startIndex, baseVertex, startInstance);
+}
@@ -0,0 +1,39 @@
+// CommandBackend that submits straight to a D3D11 device context
+// Used to replay CommandBuffers, and by shaders that are drawn right away through their CommandBackend interface
+// Given a ConstantArena that is supported, per-draw constants are sub-allocated from it and bound with an offset
+
+#pragma once
+#include "CommandBackend.h"
+#include "../DXFramework/ConstantArena.h"
+
+class D3D11Backend : public CommandBackend
+{
+public:
+	explicit D3D11Backend(ID3D11DeviceContext* context, ConstantArena* arena = nullptr);
+
+	ID3D11DeviceContext* GetContext() const { return mContext; }
+
+	void SetInputLayout(ID3D11InputLayout* layout) override;
+	void SetShaders(const ShaderSet& shaders) override;
+
+	void SetConstantBuffers(Stage stage, uint32_t slot, uint32_t count, ID3D11Buffer* const* buffers) override;
+	void SetShaderResources(Stage stage, uint32_t slot, uint32_t count, ID3D11ShaderResourceView* const* views) override;
+	void SetSamplers(Stage stage, uint32_t slot, uint32_t count, ID3D11SamplerState* const* samplers) override;
+
+	// Maps the buffer with D3D11_MAP_WRITE_DISCARD
+	void UpdateConstantBuffer(ID3D11Buffer* buffer, const void* data, uint32_t size) override;
+	void SetDrawConstants(Stage stage, uint32_t slot, ID3D11Buffer* buffer, const void* data, uint32_t size) override;
+
+	void SetVertexBuffer(uint32_t slot, ID3D11Buffer* buffer, uint32_t stride, uint32_t offset) override;
+	void SetIndexBuffer(ID3D11Buffer* buffer, IndexFormat format, uint32_t offset) override;
+	void SetTopology(Topology topology) override;
+
+	void DrawIndexed(uint32_t indexCount, uint32_t startIndex, int32_t baseVertex) override;
+	void DrawIndexedInstanced(uint32_t indexCount, uint32_t instanceCount, uint32_t startIndex, int32_t baseVertex, uint32_t startInstance) override;
+
+private:
+	ID3D11DeviceContext* mContext;
+
+	// Null when constants go through their own buffers
+	ConstantArena* mArena;
+};
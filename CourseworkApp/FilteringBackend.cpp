@@ -0,0 +1,283 @@
+#include "FilteringBackend.h"
+
+namespace
+{
+	// Bits of FilteringBackend::mKnown
+	enum KnownState : uint32_t
+	{
+		KNOWN_LAYOUT = 1 << 0,
+		KNOWN_SHADERS = 1 << 1,
+		KNOWN_VERTEX_BUFFER_0 = 1 << 2,
+		KNOWN_VERTEX_BUFFER_1 = 1 << 3,
+		KNOWN_INDEX_BUFFER = 1 << 4,
+		KNOWN_TOPOLOGY = 1 << 5
+	};
+}
+
+int FilteringBackend::Stats::GetIssued() const
+{
+	int total = 0;
+
+	for (int count : issued)
+		total += count;
+
+	return total;
+}
+
+int FilteringBackend::Stats::GetFiltered() const
+{
+	int total = 0;
+
+	for (int count : filtered)
+		total += count;
+
+	return total;
+}
+
+auto FilteringBackend::Stats::operator+=(const Stats& other) -> Stats&
+{
+	for (int i = 0; i < (int) Call::NUM_CALLS; ++i)
+	{
+		issued[i] += other.issued[i];
+		filtered[i] += other.filtered[i];
+	}
+
+	return *this;
+}
+
+FilteringBackend::FilteringBackend(CommandBackend& target)
+	:	mTarget(target)
+{
+	Invalidate();
+}
+
+void FilteringBackend::Invalidate()
+{
+	mKnown = 0;
+
+	for (int stage = 0; stage < (int) Stage::NUM_STAGES; ++stage)
+	{
+		mConstantBuffers.known[stage] = 0;
+		mShaderResources.known[stage] = 0;
+		mSamplers.known[stage] = 0;
+	}
+}
+
+const char* FilteringBackend::GetName(Call call)
+{
+	switch (call)
+	{
+	case Call::INPUT_LAYOUT:
+		return "Layout";
+
+	case Call::SHADERS:
+		return "Shaders";
+
+	case Call::CONSTANT_BUFFERS:
+		return "CBs";
+
+	case Call::SHADER_RESOURCES:
+		return "SRVs";
+
+	case Call::SAMPLERS:
+		return "Samplers";
+
+	case Call::VERTEX_BUFFER:
+		return "VB";
+
+	case Call::INDEX_BUFFER:
+		return "IB";
+
+	case Call::TOPOLOGY:
+		return "Topology";
+
+	default:
+		return "Unknown";
+	}
+}
+
+template <typename T>
+bool FilteringBackend::Filter(SlotState<T>& state, Stage stage, uint32_t& slot, uint32_t& count, T* const*& items)
+{
+	// Slots past the shadowed ones are never known to be bound, so the whole call goes through
+	if (slot + count > NUM_SLOTS)
+	{
+		for (uint32_t i = slot; i < NUM_SLOTS; ++i)
+			state.known[(int) stage] &= ~(1u << i);
+
+		return true;
+	}
+
+	T** bound = state.items[(int) stage];
+	uint32_t& known = state.known[(int) stage];
+
+	uint32_t first = count, last = 0;
+
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		const uint32_t bit = 1u << (slot + i);
+
+		if ((known & bit) && bound[slot + i] == items[i])
+			continue;
+
+		first = (i < first) ? i : first;
+		last = i;
+
+		bound[slot + i] = items[i];
+		known |= bit;
+	}
+
+	if (first == count)
+		return false;
+
+	// Unchanged slots in between the first and last that differ are bound again, which keeps it to one call
+	slot += first;
+	items += first;
+	count = last - first + 1;
+
+	return true;
+}
+
+void FilteringBackend::SetInputLayout(ID3D11InputLayout* layout)
+{
+	if ((mKnown & KNOWN_LAYOUT) && mLayout == layout)
+	{
+		++mStats.filtered[(int) Call::INPUT_LAYOUT];
+		return;
+	}
+
+	mLayout = layout;
+	mKnown |= KNOWN_LAYOUT;
+
+	++mStats.issued[(int) Call::INPUT_LAYOUT];
+	mTarget.SetInputLayout(layout);
+}
+
+void FilteringBackend::SetShaders(const ShaderSet& shaders)
+{
+	if ((mKnown & KNOWN_SHADERS) && mShaders == shaders)
+	{
+		++mStats.filtered[(int) Call::SHADERS];
+		return;
+	}
+
+	mShaders = shaders;
+	mKnown |= KNOWN_SHADERS;
+
+	++mStats.issued[(int) Call::SHADERS];
+	mTarget.SetShaders(shaders);
+}
+
+void FilteringBackend::SetConstantBuffers(Stage stage, uint32_t slot, uint32_t count, ID3D11Buffer* const* buffers)
+{
+	if (!Filter(mConstantBuffers, stage, slot, count, buffers))
+	{
+		++mStats.filtered[(int) Call::CONSTANT_BUFFERS];
+		return;
+	}
+
+	++mStats.issued[(int) Call::CONSTANT_BUFFERS];
+	mTarget.SetConstantBuffers(stage, slot, count, buffers);
+}
+
+void FilteringBackend::SetShaderResources(Stage stage, uint32_t slot, uint32_t count, ID3D11ShaderResourceView* const* views)
+{
+	if (!Filter(mShaderResources, stage, slot, count, views))
+	{
+		++mStats.filtered[(int) Call::SHADER_RESOURCES];
+		return;
+	}
+
+	++mStats.issued[(int) Call::SHADER_RESOURCES];
+	mTarget.SetShaderResources(stage, slot, count, views);
+}
+
+void FilteringBackend::SetSamplers(Stage stage, uint32_t slot, uint32_t count, ID3D11SamplerState* const* samplers)
+{
+	if (!Filter(mSamplers, stage, slot, count, samplers))
+	{
+		++mStats.filtered[(int) Call::SAMPLERS];
+		return;
+	}
+
+	++mStats.issued[(int) Call::SAMPLERS];
+	mTarget.SetSamplers(stage, slot, count, samplers);
+}
+
+void FilteringBackend::UpdateConstantBuffer(ID3D11Buffer* buffer, const void* data, uint32_t size)
+{
+	mTarget.UpdateConstantBuffer(buffer, data, size);
+}
+
+void FilteringBackend::SetDrawConstants(Stage stage, uint32_t slot, ID3D11Buffer* buffer, const void* data, uint32_t size)
+{
+	if (slot < NUM_SLOTS)
+		mConstantBuffers.known[(int) stage] &= ~(1u << slot);
+
+	mTarget.SetDrawConstants(stage, slot, buffer, data, size);
+}
+
+void FilteringBackend::SetVertexBuffer(uint32_t slot, ID3D11Buffer* buffer, uint32_t stride, uint32_t offset)
+{
+	if (slot < 2)
+	{
+		const uint32_t bit = KNOWN_VERTEX_BUFFER_0 << slot;
+		VertexBufferState& bound = mVertexBuffers[slot];
+
+		if ((mKnown & bit) && bound.buffer == buffer && bound.stride == stride && bound.offset == offset)
+		{
+			++mStats.filtered[(int) Call::VERTEX_BUFFER];
+			return;
+		}
+
+		bound.buffer = buffer;
+		bound.stride = stride;
+		bound.offset = offset;
+		mKnown |= bit;
+	}
+
+	++mStats.issued[(int) Call::VERTEX_BUFFER];
+	mTarget.SetVertexBuffer(slot, buffer, stride, offset);
+}
+
+void FilteringBackend::SetIndexBuffer(ID3D11Buffer* buffer, IndexFormat format, uint32_t offset)
+{
+	if ((mKnown & KNOWN_INDEX_BUFFER) && mIndexBuffer == buffer && mIndexFormat == format && mIndexOffset == offset)
+	{
+		++mStats.filtered[(int) Call::INDEX_BUFFER];
+		return;
+	}
+
+	mIndexBuffer = buffer;
+	mIndexFormat = format;
+	mIndexOffset = offset;
+	mKnown |= KNOWN_INDEX_BUFFER;
+
+	++mStats.issued[(int) Call::INDEX_BUFFER];
+	mTarget.SetIndexBuffer(buffer, format, offset);
+}
+
+void FilteringBackend::SetTopology(Topology topology)
+{
+	if ((mKnown & KNOWN_TOPOLOGY) && mTopology == topology)
+	{
+		++mStats.filtered[(int) Call::TOPOLOGY];
+		return;
+	}
+
+	mTopology = topology;
+	mKnown |= KNOWN_TOPOLOGY;
+
+	++mStats.issued[(int) Call::TOPOLOGY];
+	mTarget.SetTopology(topology);
+}
+
+void FilteringBackend::DrawIndexed(uint32_t indexCount, uint32_t startIndex, int32_t baseVertex)
+{
+	mTarget.DrawIndexed(indexCount, startIndex, baseVertex);
+}
+
+void FilteringBackend::DrawIndexedInstanced(uint32_t indexCount, uint32_t instanceCount, uint32_t startIndex, int32_t baseVertex, uint32_t startInstance)
+{
+	mTarget.DrawIndexedInstanced(indexCount, instanceCount, startIndex, baseVertex, startInstance);
+}
@@ -0,0 +1,115 @@
+// CommandBackend that sits in front of another and drops the calls that would not change anything
+// It shadows what it has bound: shaders, input layout, constant buffers, shader resources and samplers of every stage,
+// vertex and index buffers and the topology. A binding that matches what is bound is left out, and a range of slots
+// is trimmed to the slots that differ. Nothing is known to be bound until it was bound through the filter, so the first
+// call of every kind goes through; if anything else binds state in between, call Invalidate
+// Calls are counted per kind, issued and filtered, until the stats are reset
+
+#pragma once
+#include <cstdint>
+
+#include "CommandBackend.h"
+
+class FilteringBackend : public CommandBackend
+{
+public:
+	// Slots shadowed per stage. Bindings past them are always passed on
+	static constexpr uint32_t NUM_SLOTS = 16;
+
+	// The kinds of calls that bind state
+	enum class Call : uint8_t
+	{
+		INPUT_LAYOUT,
+		SHADERS,
+		CONSTANT_BUFFERS,
+		SHADER_RESOURCES,
+		SAMPLERS,
+		VERTEX_BUFFER,
+		INDEX_BUFFER,
+		TOPOLOGY,
+		NUM_CALLS
+	};
+
+	struct Stats
+	{
+		int issued[(int) Call::NUM_CALLS] = {};
+		int filtered[(int) Call::NUM_CALLS] = {};
+
+		int GetIssued() const;
+		int GetFiltered() const;
+
+		Stats& operator+=(const Stats& other);
+	};
+
+	explicit FilteringBackend(CommandBackend& target);
+
+	// Forget everything that was bound
+	void Invalidate();
+
+	const Stats& GetStats() const { return mStats; }
+	void ResetStats() { mStats = Stats(); }
+
+	static const char* GetName(Call call);
+
+	void SetInputLayout(ID3D11InputLayout* layout) override;
+	void SetShaders(const ShaderSet& shaders) override;
+
+	void SetConstantBuffers(Stage stage, uint32_t slot, uint32_t count, ID3D11Buffer* const* buffers) override;
+	void SetShaderResources(Stage stage, uint32_t slot, uint32_t count, ID3D11ShaderResourceView* const* views) override;
+	void SetSamplers(Stage stage, uint32_t slot, uint32_t count, ID3D11SamplerState* const* samplers) override;
+
+	// Binds nothing, so it is always passed on
+	void UpdateConstantBuffer(ID3D11Buffer* buffer, const void* data, uint32_t size) override;
+
+	// Always passed on. The slot may be bound to another buffer, or at another offset, so it stops being known
+	void SetDrawConstants(Stage stage, uint32_t slot, ID3D11Buffer* buffer, const void* data, uint32_t size) override;
+
+	void SetVertexBuffer(uint32_t slot, ID3D11Buffer* buffer, uint32_t stride, uint32_t offset) override;
+	void SetIndexBuffer(ID3D11Buffer* buffer, IndexFormat format, uint32_t offset) override;
+	void SetTopology(Topology topology) override;
+
+	void DrawIndexed(uint32_t indexCount, uint32_t startIndex, int32_t baseVertex) override;
+	void DrawIndexedInstanced(uint32_t indexCount, uint32_t instanceCount, uint32_t startIndex, int32_t baseVertex, uint32_t startInstance) override;
+
+private:
+	// What is bound to the slots of every stage, and which of the slots are known (one bit per slot)
+	template <typename T>
+	struct SlotState
+	{
+		T* items[(int) Stage::NUM_STAGES][NUM_SLOTS];
+		uint32_t known[(int) Stage::NUM_STAGES];
+	};
+
+	// Narrow a binding of count items down to the slots that differ from what is bound, and update what is bound
+	// Returns false if nothing differs
+	template <typename T>
+	bool Filter(SlotState<T>& state, Stage stage, uint32_t& slot, uint32_t& count, T* const*& items);
+
+	struct VertexBufferState
+	{
+		ID3D11Buffer* buffer;
+		uint32_t stride;
+		uint32_t offset;
+	};
+
+	CommandBackend& mTarget;
+	Stats mStats;
+
+	ID3D11InputLayout* mLayout;
+	ShaderSet mShaders;
+
+	SlotState<ID3D11Buffer> mConstantBuffers;
+	SlotState<ID3D11ShaderResourceView> mShaderResources;
+	SlotState<ID3D11SamplerState> mSamplers;
+
+	VertexBufferState mVertexBuffers[2];
+
+	ID3D11Buffer* mIndexBuffer;
+	IndexFormat mIndexFormat;
+	uint32_t mIndexOffset;
+
+	Topology mTopology;
+
+	// Known bit of the layout, the shaders, both vertex buffers, the index buffer and the topology
+	uint32_t mKnown;
+};
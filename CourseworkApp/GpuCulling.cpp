@@ -0,0 +1,103 @@
+#include "GpuCulling.h"
+#include <cmath>
+
+static_assert(sizeof(GpuCulling::Instance) == 96, "GpuCulling::Instance is expected to be 96 bytes");
+static_assert(sizeof(GpuCulling::CullBufferType) == 112, "GpuCulling::CullBufferType is expected to be 112 bytes");
+static_assert(sizeof(GpuCulling::DrawArguments) == 20, "GpuCulling::DrawArguments is expected to be 20 bytes");
+
+auto GpuCulling::MakeInstance(const MeshInstance& instance) -> Instance
+{
+	const XMMATRIX world = instance.GetWorldMatrix();
+
+	BoundingBox worldBox;
+	instance.GetBoundingBox().Transform(worldBox, world);
+
+	Instance result;
+	XMStoreFloat4x4(&result.world, world);
+	result.center = worldBox.Center;
+	result.padding0 = 0.f;
+	result.extents = worldBox.Extents;
+	result.padding1 = 0.f;
+
+	return result;
+}
+
+auto GpuCulling::MakeCullBuffer(const CullingFrustum& frustum, uint32_t numInstances) -> CullBufferType
+{
+	CullBufferType cullBuffer;
+
+	for (int i = 0; i < CullingFrustum::NUM_PLANES; ++i)
+		cullBuffer.planes[i] = frustum.GetPlane(i);
+
+	cullBuffer.numInstances = numInstances;
+	cullBuffer.padding[0] = cullBuffer.padding[1] = cullBuffer.padding[2] = 0;
+
+	return cullBuffer;
+}
+
+auto GpuCulling::MakeDrawArguments(uint32_t indexCount) -> DrawArguments
+{
+	return { indexCount, 0, 0, 0, 0 };
+}
+
+uint32_t GpuCulling::GetNumGroups(uint32_t numInstances)
+{
+	return (numInstances + THREAD_GROUP_SIZE - 1) / THREAD_GROUP_SIZE;
+}
+
+void GpuCulling::Emulate(const CullBufferType& cullBuffer, const Instance* instances, XMFLOAT4X4* visibleInstances, DrawArguments& arguments)
+{
+	const uint32_t numGroups = GetNumGroups(cullBuffer.numInstances);
+
+	for (uint32_t group = 0; group < numGroups; ++group)
+	{
+		// Each thread's visibility flag, turned into its offset within the group's range, as in gVisible
+		bool visible[THREAD_GROUP_SIZE];
+		uint32_t offsets[THREAD_GROUP_SIZE];
+
+		for (uint32_t thread = 0; thread < THREAD_GROUP_SIZE; ++thread)
+		{
+			const uint32_t idx = group * THREAD_GROUP_SIZE + thread;
+			visible[thread] = idx < cullBuffer.numInstances && IsVisible(cullBuffer, instances[idx]);
+		}
+
+		uint32_t count = 0;
+
+		for (uint32_t thread = 0; thread < THREAD_GROUP_SIZE; ++thread)
+		{
+			offsets[thread] = count;
+			count += visible[thread] ? 1 : 0;
+		}
+
+		// InterlockedAdd on InstanceCount
+		const uint32_t groupStart = arguments.instanceCount;
+		arguments.instanceCount += count;
+
+		for (uint32_t thread = 0; thread < THREAD_GROUP_SIZE; ++thread)
+		{
+			if (visible[thread])
+				visibleInstances[groupStart + offsets[thread]] = instances[group * THREAD_GROUP_SIZE + thread].world;
+		}
+	}
+}
+
+bool GpuCulling::IsVisible(const CullBufferType& cullBuffer, const Instance& instance)
+{
+	const XMFLOAT3& center = instance.center;
+	const XMFLOAT3& extents = instance.extents;
+
+	// Evaluated left to right without fused multiply-adds, like the precise expressions of the shader. Both round every
+	// operation to nearest even, so as long as no value is denormal (which D3D flushes to zero) the results are identical
+	for (int i = 0; i < CullingFrustum::NUM_PLANES; ++i)
+	{
+		const XMFLOAT4& plane = cullBuffer.planes[i];
+
+		const float distance = center.x * plane.x + center.y * plane.y + center.z * plane.z + plane.w;
+		const float radius = extents.x * std::fabs(plane.x) + extents.y * std::fabs(plane.y) + extents.z * std::fabs(plane.z);
+
+		if (distance > radius)
+			return false;
+	}
+
+	return true;
+}
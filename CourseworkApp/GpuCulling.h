@@ -0,0 +1,73 @@
+// Frustum culling on the GPU, for scenes whose instances are uploaded once and culled every frame without the CPU
+// cull_instances_cs.hlsl tests the world-space bounding box of every instance against the frustum, compacts the world
+// matrices of the visible ones into a buffer laid out like InstancePacker::Format::MATRIX, and counts them into the
+// arguments of a DrawIndexedInstancedIndirect call
+// This file holds the layouts shared with the shader, and an emulation of it that gives bit-identical results on the CPU.
+// The GPU side is GpuCullingShader
+//
+// Every thread group keeps its visible instances in order, and reserves its range of the output with an atomic add.
+// Groups may reserve their ranges in any order on the GPU; the emulation runs them in dispatch order, so its output is
+// the same ranges in that order. The draw arguments are the same either way
+
+#pragma once
+#include <DirectXMath.h>
+#include <cstdint>
+#include <cstddef>
+
+#include "CullingFrustum.h"
+#include "MeshInstance.h"
+
+using namespace DirectX;
+
+class GpuCulling
+{
+public:
+	// Must match THREAD_GROUP_SIZE in cull_instances_cs.hlsl
+	static constexpr uint32_t THREAD_GROUP_SIZE = 64;
+
+	// Element of the instance buffer. Matches Instance in cull_instances_cs.hlsl
+	struct Instance
+	{
+		XMFLOAT4X4 world;
+
+		// World-space bounding box
+		XMFLOAT3 center;
+		float padding0;
+		XMFLOAT3 extents;
+		float padding1;
+	};
+
+	// Matches CullBuffer in cull_instances_cs.hlsl. Planes face out of the frustum, as in CullingFrustum
+	struct CullBufferType
+	{
+		XMFLOAT4 planes[CullingFrustum::NUM_PLANES];
+		uint32_t numInstances;
+		uint32_t padding[3];
+	};
+
+	// Same layout as D3D11_DRAW_INDEXED_INSTANCED_INDIRECT_ARGS
+	struct DrawArguments
+	{
+		uint32_t indexCountPerInstance;
+		uint32_t instanceCount;
+		uint32_t startIndexLocation;
+		int32_t baseVertexLocation;
+		uint32_t startInstanceLocation;
+	};
+
+	static Instance MakeInstance(const MeshInstance& instance);
+	static CullBufferType MakeCullBuffer(const CullingFrustum& frustum, uint32_t numInstances);
+
+	// Arguments to draw no instances of a mesh. The arguments buffer is reset to these before every dispatch
+	static DrawArguments MakeDrawArguments(uint32_t indexCount);
+
+	// Thread groups dispatched to cull a number of instances
+	static uint32_t GetNumGroups(uint32_t numInstances);
+
+	// Run the kernel on the CPU. visibleInstances needs room for every instance of the cull buffer, and arguments starts
+	// out the way the arguments buffer does, i.e. from MakeDrawArguments
+	static void Emulate(const CullBufferType& cullBuffer, const Instance* instances, XMFLOAT4X4* visibleInstances, DrawArguments& arguments);
+
+	// The test one thread makes, in the same order of operations as the shader
+	static bool IsVisible(const CullBufferType& cullBuffer, const Instance& instance);
+};
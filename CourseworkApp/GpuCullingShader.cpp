@@ -0,0 +1,187 @@
+#include "GpuCullingShader.h"
+#include "Utility.h"
+
+GpuCullingShader::GpuCullingShader(ID3D11Device* device, HWND hwnd)
+	:	ComputeShader(device, hwnd)
+{
+	WCHAR csoFilename[] = L"cull_instances_cs.cso";
+
+	ID3DBlob* shaderBlob = ShaderToBlob(csoFilename, hwnd);
+	device->CreateComputeShader(shaderBlob->GetBufferPointer(), shaderBlob->GetBufferSize(), NULL, &mComputeShader);
+
+	shaderBlob->Release();
+
+	D3D11_BUFFER_DESC cullDesc;
+	ZeroMemory(&cullDesc, sizeof(D3D11_BUFFER_DESC));
+	cullDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	cullDesc.ByteWidth = sizeof(GpuCulling::CullBufferType);
+	cullDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	cullDesc.Usage = D3D11_USAGE_DYNAMIC;
+
+	device->CreateBuffer(&cullDesc, 0, &mCullBuffer);
+
+	// The arguments do not depend on the number of instances, so they are only created once
+	D3D11_BUFFER_DESC argumentsDesc;
+	ZeroMemory(&argumentsDesc, sizeof(D3D11_BUFFER_DESC));
+	argumentsDesc.BindFlags = D3D11_BIND_UNORDERED_ACCESS;
+	argumentsDesc.ByteWidth = sizeof(GpuCulling::DrawArguments);
+	argumentsDesc.MiscFlags = D3D11_RESOURCE_MISC_DRAWINDIRECT_ARGS | D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS;
+	argumentsDesc.Usage = D3D11_USAGE_DEFAULT;
+
+	device->CreateBuffer(&argumentsDesc, 0, &mArguments);
+
+	D3D11_UNORDERED_ACCESS_VIEW_DESC argumentsViewDesc;
+	ZeroMemory(&argumentsViewDesc, sizeof(D3D11_UNORDERED_ACCESS_VIEW_DESC));
+	argumentsViewDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+	argumentsViewDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+	argumentsViewDesc.Buffer.NumElements = sizeof(GpuCulling::DrawArguments) / 4;
+	argumentsViewDesc.Buffer.Flags = D3D11_BUFFER_UAV_FLAG_RAW;
+
+	device->CreateUnorderedAccessView(mArguments, &argumentsViewDesc, &mArgumentsView);
+
+	D3D11_BUFFER_DESC readbackDesc;
+	ZeroMemory(&readbackDesc, sizeof(D3D11_BUFFER_DESC));
+	readbackDesc.ByteWidth = sizeof(GpuCulling::DrawArguments);
+	readbackDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+	readbackDesc.Usage = D3D11_USAGE_STAGING;
+
+	device->CreateBuffer(&readbackDesc, 0, &mArgumentsReadback);
+}
+
+GpuCullingShader::~GpuCullingShader()
+{
+	ReleaseBuffers();
+
+	mArgumentsReadback->Release();
+	mArgumentsView->Release();
+	mArguments->Release();
+	mCullBuffer->Release();
+	mComputeShader->Release();
+}
+
+void GpuCullingShader::SetInstances(ID3D11DeviceContext* context, const MeshInstance* instances, UINT count)
+{
+	if (count > mCapacity)
+		CreateBuffers(count);
+
+	mUploadData.resize(count);
+
+	for (UINT i = 0; i < count; ++i)
+		mUploadData[i] = GpuCulling::MakeInstance(instances[i]);
+
+	if (count > 0)
+	{
+		D3D11_BOX box = { 0, 0, 0, count * (UINT) sizeof(GpuCulling::Instance), 1, 1 };
+		context->UpdateSubresource(mInstances, 0, &box, mUploadData.data(), 0, 0);
+	}
+
+	mNumInstances = count;
+	++mUploads;
+}
+
+void GpuCullingShader::Execute(ID3D11DeviceContext* context, const CullingFrustum& frustum, UINT indexCount)
+{
+	if (mNumInstances == 0)
+		return;
+
+	D3D11_MAPPED_SUBRESOURCE map;
+	context->Map(mCullBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &map);
+	*static_cast<GpuCulling::CullBufferType*>(map.pData) = GpuCulling::MakeCullBuffer(frustum, mNumInstances);
+	context->Unmap(mCullBuffer, 0);
+
+	// The shader counts the visible instances into the arguments
+	const GpuCulling::DrawArguments arguments = GpuCulling::MakeDrawArguments(indexCount);
+	context->UpdateSubresource(mArguments, 0, nullptr, &arguments, 0, 0);
+
+	ID3D11UnorderedAccessView* outputs[2] = { mVisibleInstancesView, mArgumentsView };
+
+	context->CSSetShader(mComputeShader, NULL, 0);
+	context->CSSetConstantBuffers(0, 1, &mCullBuffer);
+	context->CSSetShaderResources(0, 1, &mInstancesView);
+	context->CSSetUnorderedAccessViews(0, 2, outputs, NULL);
+
+	context->Dispatch(GpuCulling::GetNumGroups(mNumInstances), 1, 1);
+
+	// Cleanup, so the outputs can be bound as inputs to the draw
+	UnsetCSShaderInputsAndOutputs(context);
+	context->CSSetShader(NULL, NULL, 0);
+}
+
+void GpuCullingShader::UpdateVisibleCount(ID3D11DeviceContext* context)
+{
+	if (mReadbackPending)
+	{
+		D3D11_MAPPED_SUBRESOURCE map;
+
+		if (context->Map(mArgumentsReadback, 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &map) != S_OK)
+			return;
+
+		mVisibleCount = (int) static_cast<const GpuCulling::DrawArguments*>(map.pData)->instanceCount;
+		context->Unmap(mArgumentsReadback, 0);
+	}
+
+	context->CopyResource(mArgumentsReadback, mArguments);
+	mReadbackPending = true;
+}
+
+void GpuCullingShader::CreateBuffers(UINT capacity)
+{
+	ReleaseBuffers();
+
+	// Instances
+	D3D11_BUFFER_DESC instancesDesc;
+	ZeroMemory(&instancesDesc, sizeof(D3D11_BUFFER_DESC));
+	instancesDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	instancesDesc.ByteWidth = capacity * sizeof(GpuCulling::Instance);
+	instancesDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	instancesDesc.StructureByteStride = sizeof(GpuCulling::Instance);
+	instancesDesc.Usage = D3D11_USAGE_DEFAULT;
+
+	mDevice->CreateBuffer(&instancesDesc, 0, &mInstances);
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC instancesViewDesc;
+	ZeroMemory(&instancesViewDesc, sizeof(D3D11_SHADER_RESOURCE_VIEW_DESC));
+	instancesViewDesc.Format = DXGI_FORMAT_UNKNOWN;
+	instancesViewDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+	instancesViewDesc.Buffer.NumElements = capacity;
+
+	mDevice->CreateShaderResourceView(mInstances, &instancesViewDesc, &mInstancesView);
+
+	// Visible instances, written by the shader and read by the input assembler
+	D3D11_BUFFER_DESC visibleDesc;
+	ZeroMemory(&visibleDesc, sizeof(D3D11_BUFFER_DESC));
+	visibleDesc.BindFlags = D3D11_BIND_UNORDERED_ACCESS | D3D11_BIND_VERTEX_BUFFER;
+	visibleDesc.ByteWidth = capacity * sizeof(XMFLOAT4X4);
+	visibleDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS;
+	visibleDesc.Usage = D3D11_USAGE_DEFAULT;
+
+	mDevice->CreateBuffer(&visibleDesc, 0, &mVisibleInstances);
+
+	D3D11_UNORDERED_ACCESS_VIEW_DESC visibleViewDesc;
+	ZeroMemory(&visibleViewDesc, sizeof(D3D11_UNORDERED_ACCESS_VIEW_DESC));
+	visibleViewDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+	visibleViewDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+	visibleViewDesc.Buffer.NumElements = visibleDesc.ByteWidth / 4;
+	visibleViewDesc.Buffer.Flags = D3D11_BUFFER_UAV_FLAG_RAW;
+
+	mDevice->CreateUnorderedAccessView(mVisibleInstances, &visibleViewDesc, &mVisibleInstancesView);
+
+	mCapacity = capacity;
+}
+
+void GpuCullingShader::ReleaseBuffers()
+{
+	if (!mInstances)
+		return;
+
+	mVisibleInstancesView->Release();
+	mVisibleInstances->Release();
+	mInstancesView->Release();
+	mInstances->Release();
+
+	mInstances = nullptr;
+	mInstancesView = nullptr;
+	mVisibleInstances = nullptr;
+	mVisibleInstancesView = nullptr;
+	mCapacity = 0;
+}
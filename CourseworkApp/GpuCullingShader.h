@@ -0,0 +1,63 @@
+// Runs cull_instances_cs.hlsl over a set of instances that is uploaded once, and kept on the GPU until it changes
+// Produces an instance buffer (in InstancePacker::Format::MATRIX) and the arguments to draw it with, which
+// InstanceShader::renderIndirect takes. See GpuCulling for the layouts and the CPU emulation
+
+#pragma once
+#include "ComputeShader.h"
+#include "GpuCulling.h"
+#include <vector>
+
+class GpuCullingShader : public ComputeShader
+{
+public:
+	GpuCullingShader(ID3D11Device* device, HWND hwnd);
+	GpuCullingShader(const GpuCullingShader&) = delete;
+	GpuCullingShader& operator=(const GpuCullingShader&) = delete;
+	~GpuCullingShader();
+
+	// Upload the transforms and bounding boxes of the instances. Only needs to be called again when they change
+	void SetInstances(ID3D11DeviceContext* context, const MeshInstance* instances, UINT count);
+
+	// Cull the instances against the frustum, and reset the draw arguments to draw the survivors of a mesh with
+	// indexCount indices
+	void Execute(ID3D11DeviceContext* context, const CullingFrustum& frustum, UINT indexCount);
+
+	ID3D11Buffer* GetVisibleInstances() const { return mVisibleInstances; }
+	ID3D11Buffer* GetArguments() const { return mArguments; }
+
+	UINT GetNumInstances() const { return mNumInstances; }
+	int GetUploads() const { return mUploads; }
+
+	// Copy the arguments of the last Execute to be read back, and pick up an earlier copy if the GPU is done with it
+	// The count is a frame or more old, but reading it never stalls. -1 until the first one arrives
+	void UpdateVisibleCount(ID3D11DeviceContext* context);
+	int GetVisibleCount() const { return mVisibleCount; }
+
+private:
+	// Recreate the instance buffers with room for capacity instances
+	void CreateBuffers(UINT capacity);
+	void ReleaseBuffers();
+
+	ID3D11ComputeShader* mComputeShader = nullptr;
+	ID3D11Buffer* mCullBuffer = nullptr;
+
+	ID3D11Buffer* mInstances = nullptr;
+	ID3D11ShaderResourceView* mInstancesView = nullptr;
+
+	// Raw buffers, so that the visible instances can be bound as a vertex buffer and the arguments used for indirect draws
+	ID3D11Buffer* mVisibleInstances = nullptr;
+	ID3D11UnorderedAccessView* mVisibleInstancesView = nullptr;
+	ID3D11Buffer* mArguments = nullptr;
+	ID3D11UnorderedAccessView* mArgumentsView = nullptr;
+
+	// Copy of the arguments, mapped once the GPU has written it
+	ID3D11Buffer* mArgumentsReadback = nullptr;
+	bool mReadbackPending = false;
+	int mVisibleCount = -1;
+
+	UINT mCapacity = 0;
+	UINT mNumInstances = 0;
+	int mUploads = 0;
+
+	std::vector<GpuCulling::Instance> mUploadData;
+};
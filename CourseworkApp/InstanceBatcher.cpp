@@ -0,0 +1,70 @@
+#include "InstanceBatcher.h"
+#include "InstanceShader.h"
+#include <cassert>
+#include <functional>
+
+void InstanceBatcher::Clear()
+{
+	for (int batchIdx : mActiveBatches)
+		mBatches[batchIdx].instances.clear();
+
+	mActiveBatches.clear();
+	mNumInstances = 0;
+}
+
+void InstanceBatcher::Add(MeshInstance* instance)
+{
+	assert(instance->GetShader());
+
+	const Key key = { instance->GetMesh(), instance->GetTexture(), instance->GetShader() };
+
+	auto it = mBatchIndices.find(key);
+
+	if (it == mBatchIndices.end())
+	{
+		it = mBatchIndices.emplace(key, (int) mBatches.size()).first;
+		mBatches.push_back({ key, {} });
+	}
+
+	Batch& batch = mBatches[it->second];
+
+	if (batch.instances.empty())
+		mActiveBatches.push_back(it->second);
+
+	batch.instances.push_back(instance);
+	++mNumInstances;
+}
+
+void InstanceBatcher::Add(const std::vector<MeshInstance*>& instances)
+{
+	for (MeshInstance* instance : instances)
+		Add(instance);
+}
+
+int XM_CALLCONV InstanceBatcher::Draw(ID3D11DeviceContext* context, FXMMATRIX view, CXMMATRIX projection, Camera* camera)
+{
+	for (int batchIdx : mActiveBatches)
+	{
+		const Batch& batch = mBatches[batchIdx];
+		InstanceShader* shader = batch.key.shader;
+
+		for (const auto& instance : batch.instances)
+			shader->addInstance(instance->GetWorldMatrix());
+
+		batch.key.mesh->sendData(context);
+		shader->setShaderParameters(context, view, projection, camera, batch.key.texture);
+		shader->render(context, batch.key.mesh->getIndexCount());
+	}
+
+	return (int) mActiveBatches.size();
+}
+
+size_t InstanceBatcher::KeyHash::operator()(const Key& key) const
+{
+	// Combine the hashes the same way as boost::hash_combine
+	size_t hash = std::hash<BaseMesh*>()(key.mesh);
+	hash ^= std::hash<ID3D11ShaderResourceView*>()(key.texture) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+	hash ^= std::hash<InstanceShader*>()(key.shader) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+
+	return hash;
+}
@@ -0,0 +1,63 @@
+// Groups visible MeshInstances by what they are drawn with, so that every group can be drawn with one instanced draw
+// The key of a group is the mesh of the instance's current LOD, its texture and its shader, so scenes of many kinds
+// of objects are instanced without having to know what is in them. Groups are drawn in the order they were first seen
+// in, and are kept from frame to frame, so batching does not allocate once it has warmed up
+
+#pragma once
+#include <DirectXMath.h>
+#include <vector>
+#include <unordered_map>
+#include <cstddef>
+
+#include "MeshInstance.h"
+
+using namespace DirectX;
+
+class Camera;
+
+class InstanceBatcher
+{
+public:
+	struct Key
+	{
+		BaseMesh* mesh;
+		ID3D11ShaderResourceView* texture;
+		InstanceShader* shader;
+
+		bool operator==(const Key& other) const { return mesh == other.mesh && texture == other.texture && shader == other.shader; }
+	};
+
+	// Start collecting the instances of a new pass
+	void Clear();
+
+	// Add an instance to the group of its key. The instance must have a shader
+	void Add(MeshInstance* instance);
+	void Add(const std::vector<MeshInstance*>& instances);
+
+	// Draw every group that has instances with a single instanced draw. Returns the number of groups drawn
+	int XM_CALLCONV Draw(ID3D11DeviceContext* context, FXMMATRIX view, CXMMATRIX projection, Camera* camera);
+
+	// Groups that have instances since the last InstanceBatcher::Clear
+	int GetNumBatches() const { return (int) mActiveBatches.size(); }
+	int GetNumInstances() const { return mNumInstances; }
+
+private:
+	struct KeyHash
+	{
+		size_t operator()(const Key& key) const;
+	};
+
+	struct Batch
+	{
+		Key key;
+		std::vector<MeshInstance*> instances;
+	};
+
+	std::unordered_map<Key, int, KeyHash> mBatchIndices;
+	std::vector<Batch> mBatches;
+
+	// Batches that have instances, in the order they got their first one
+	std::vector<int> mActiveBatches;
+
+	int mNumInstances = 0;
+};
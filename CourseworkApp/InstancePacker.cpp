@@ -0,0 +1,238 @@
+#include "InstancePacker.h"
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+static_assert(sizeof(InstancePacker::MatrixInstance) == 64, "InstancePacker::MatrixInstance is expected to be 64 bytes");
+static_assert(sizeof(InstancePacker::AffineInstance) == 48, "InstancePacker::AffineInstance is expected to be 48 bytes");
+static_assert(sizeof(InstancePacker::QuaternionInstance) == 32, "InstancePacker::QuaternionInstance is expected to be 32 bytes");
+static_assert(sizeof(InstancePacker::QuantisedInstance) == 16, "InstancePacker::QuantisedInstance is expected to be 16 bytes");
+
+namespace
+{
+	// Largest values of 16-bit unsigned and signed normalised integers
+	constexpr float UNORM16_MAX = 65535.f;
+	constexpr float SNORM16_MAX = 32767.f;
+}
+
+uint32_t InstancePacker::GetStride(Format format)
+{
+	switch (format)
+	{
+	case Format::MATRIX:		return sizeof(MatrixInstance);
+	case Format::AFFINE:		return sizeof(AffineInstance);
+	case Format::QUATERNION:	return sizeof(QuaternionInstance);
+	case Format::QUANTISED:		return sizeof(QuantisedInstance);
+	}
+
+	return 0;
+}
+
+const char* InstancePacker::GetName(Format format)
+{
+	switch (format)
+	{
+	case Format::MATRIX:		return "Matrix";
+	case Format::AFFINE:		return "Affine";
+	case Format::QUATERNION:	return "Quaternion";
+	case Format::QUANTISED:		return "Quantised";
+	}
+
+	return "";
+}
+
+auto InstancePacker::GetQuantisationBounds(const XMFLOAT4X4* worlds, size_t count) -> QuantisationBounds
+{
+	QuantisationBounds bounds;
+
+	if (count == 0)
+		return bounds;
+
+	XMVECTOR positionMin = XMVectorReplicate(FLT_MAX);
+	XMVECTOR positionMax = XMVectorReplicate(-FLT_MAX);
+	XMVECTOR maxScaleSq = XMVectorZero();
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		const XMVECTOR position = XMLoadFloat3(reinterpret_cast<const XMFLOAT3*>(worlds[i].m[3]));
+
+		positionMin = XMVectorMin(positionMin, position);
+		positionMax = XMVectorMax(positionMax, position);
+		maxScaleSq = XMVectorMax(maxScaleSq, XMVector3LengthSq(XMLoadFloat3(reinterpret_cast<const XMFLOAT3*>(worlds[i].m[0]))));
+	}
+
+	XMStoreFloat3(&bounds.positionMin, positionMin);
+	XMStoreFloat3(&bounds.positionRange, XMVectorSubtract(positionMax, positionMin));
+	bounds.maxScale = XMVectorGetX(XMVectorSqrt(maxScaleSq));
+
+	return bounds;
+}
+
+void InstancePacker::Pack(Format format, const XMFLOAT4X4* worlds, size_t count, const QuantisationBounds& bounds, void* out)
+{
+	switch (format)
+	{
+	case Format::MATRIX:
+		std::memcpy(out, worlds, count * sizeof(MatrixInstance));
+		break;
+
+	case Format::AFFINE:
+		PackAffine(worlds, count, static_cast<AffineInstance*>(out));
+		break;
+
+	case Format::QUATERNION:
+		PackQuaternion(worlds, count, static_cast<QuaternionInstance*>(out));
+		break;
+
+	case Format::QUANTISED:
+		PackQuantised(worlds, count, bounds, static_cast<QuantisedInstance*>(out));
+		break;
+	}
+}
+
+XMMATRIX InstancePacker::Unpack(Format format, const void* packed, size_t idx, const QuantisationBounds& bounds)
+{
+	switch (format)
+	{
+	case Format::MATRIX:
+		return XMLoadFloat4x4(&static_cast<const MatrixInstance*>(packed)[idx].world);
+
+	case Format::AFFINE:
+	{
+		const AffineInstance& instance = static_cast<const AffineInstance*>(packed)[idx];
+
+		XMMATRIX transposed(XMLoadFloat4(&instance.columns[0]), XMLoadFloat4(&instance.columns[1]), XMLoadFloat4(&instance.columns[2]), g_XMIdentityR3);
+		return XMMatrixTranspose(transposed);
+	}
+
+	case Format::QUATERNION:
+	{
+		const QuaternionInstance& instance = static_cast<const QuaternionInstance*>(packed)[idx];
+		return Compose(XMLoadFloat4(&instance.positionScale), XMLoadFloat4(&instance.rotation));
+	}
+
+	case Format::QUANTISED:
+	{
+		const QuantisedInstance& instance = static_cast<const QuantisedInstance*>(packed)[idx];
+
+		// Decoded the way DXGI_FORMAT_R16G16B16A16_UNORM and _SNORM are
+		XMVECTOR unorm = XMVectorSet(instance.positionScale[0], instance.positionScale[1], instance.positionScale[2], instance.positionScale[3]);
+		unorm = XMVectorScale(unorm, 1.f / UNORM16_MAX);
+
+		XMVECTOR snorm = XMVectorSet(instance.rotation[0], instance.rotation[1], instance.rotation[2], instance.rotation[3]);
+		snorm = XMVectorMax(XMVectorScale(snorm, 1.f / SNORM16_MAX), XMVectorReplicate(-1.f));
+
+		const XMVECTOR minimum = XMVectorSetW(XMLoadFloat3(&bounds.positionMin), 0.f);
+		const XMVECTOR range = XMVectorSetW(XMLoadFloat3(&bounds.positionRange), bounds.maxScale);
+
+		return Compose(XMVectorMultiplyAdd(unorm, range, minimum), XMVector4Normalize(snorm));
+	}
+	}
+
+	return XMMatrixIdentity();
+}
+
+void InstancePacker::PackAffine(const XMFLOAT4X4* worlds, size_t count, AffineInstance* out)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		const XMMATRIX transposed = XMMatrixTranspose(XMLoadFloat4x4(&worlds[i]));
+
+		XMStoreFloat4(&out[i].columns[0], transposed.r[0]);
+		XMStoreFloat4(&out[i].columns[1], transposed.r[1]);
+		XMStoreFloat4(&out[i].columns[2], transposed.r[2]);
+	}
+}
+
+void InstancePacker::PackQuaternion(const XMFLOAT4X4* worlds, size_t count, QuaternionInstance* out)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		XMVECTOR positionScale, rotation;
+		Decompose(XMLoadFloat4x4(&worlds[i]), positionScale, rotation);
+
+		XMStoreFloat4(&out[i].positionScale, positionScale);
+		XMStoreFloat4(&out[i].rotation, rotation);
+	}
+}
+
+void InstancePacker::PackQuantised(const XMFLOAT4X4* worlds, size_t count, const QuantisationBounds& bounds, QuantisedInstance* out)
+{
+	const XMVECTOR minimum = XMVectorSetW(XMLoadFloat3(&bounds.positionMin), 0.f);
+	const XMVECTOR range = XMVectorSetW(XMLoadFloat3(&bounds.positionRange), bounds.maxScale);
+
+	// Axes without any range (e.g. a batch of one) are stored as 0
+	const XMVECTOR invRange = XMVectorSelect(XMVectorReciprocal(range), XMVectorZero(), XMVectorEqual(range, XMVectorZero()));
+
+	const XMVECTOR unormMax = XMVectorReplicate(UNORM16_MAX);
+	const XMVECTOR snormMax = XMVectorReplicate(SNORM16_MAX);
+
+#if defined(_XM_SSE_INTRINSICS_)
+	// Unsigned values are biased into the signed range, so that both halves can be packed with signed saturation, and
+	// the bias is flipped back afterwards
+	const __m128i unormBias = _mm_set1_epi32(32768);
+	const __m128i unormFlip = _mm_set_epi16(0, 0, 0, 0, -32768, -32768, -32768, -32768);
+#endif
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		XMVECTOR positionScale, rotation;
+		Decompose(XMLoadFloat4x4(&worlds[i]), positionScale, rotation);
+
+		const XMVECTOR unorm = XMVectorMultiply(XMVectorSaturate(XMVectorMultiply(XMVectorSubtract(positionScale, minimum), invRange)), unormMax);
+		const XMVECTOR snorm = XMVectorMultiply(rotation, snormMax);
+
+#if defined(_XM_SSE_INTRINSICS_)
+		// Conversions round to nearest, the same as std::nearbyint below
+		const __m128i unormInt = _mm_sub_epi32(_mm_cvtps_epi32(unorm), unormBias);
+		const __m128i snormInt = _mm_cvtps_epi32(snorm);
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(&out[i]), _mm_xor_si128(_mm_packs_epi32(unormInt, snormInt), unormFlip));
+#else
+		XMFLOAT4 unormValues, snormValues;
+		XMStoreFloat4(&unormValues, unorm);
+		XMStoreFloat4(&snormValues, snorm);
+
+		out[i].positionScale[0] = static_cast<uint16_t>(std::nearbyint(unormValues.x));
+		out[i].positionScale[1] = static_cast<uint16_t>(std::nearbyint(unormValues.y));
+		out[i].positionScale[2] = static_cast<uint16_t>(std::nearbyint(unormValues.z));
+		out[i].positionScale[3] = static_cast<uint16_t>(std::nearbyint(unormValues.w));
+
+		out[i].rotation[0] = static_cast<int16_t>(std::nearbyint(snormValues.x));
+		out[i].rotation[1] = static_cast<int16_t>(std::nearbyint(snormValues.y));
+		out[i].rotation[2] = static_cast<int16_t>(std::nearbyint(snormValues.z));
+		out[i].rotation[3] = static_cast<int16_t>(std::nearbyint(snormValues.w));
+#endif
+	}
+}
+
+void XM_CALLCONV InstancePacker::Decompose(FXMMATRIX world, XMVECTOR& positionScale, XMVECTOR& rotation)
+{
+	const XMVECTOR scale = XMVector3Length(world.r[0]);
+	const XMVECTOR invScale = XMVectorSelect(XMVectorReciprocal(scale), XMVectorZero(), XMVectorEqual(scale, XMVectorZero()));
+
+	XMMATRIX unscaled;
+	unscaled.r[0] = XMVectorMultiply(world.r[0], invScale);
+	unscaled.r[1] = XMVectorMultiply(world.r[1], invScale);
+	unscaled.r[2] = XMVectorMultiply(world.r[2], invScale);
+	unscaled.r[3] = g_XMIdentityR3;
+
+	// q and -q are the same rotation. Keeping w positive makes instances of the same orientation pack identically
+	rotation = XMQuaternionNormalize(XMQuaternionRotationMatrix(unscaled));
+	rotation = XMVectorSelect(rotation, XMVectorNegate(rotation), XMVectorLess(XMVectorSplatW(rotation), XMVectorZero()));
+
+	positionScale = XMVectorSelect(scale, world.r[3], g_XMSelect1110);
+}
+
+XMMATRIX XM_CALLCONV InstancePacker::Compose(FXMVECTOR positionScale, FXMVECTOR rotation)
+{
+	const XMVECTOR scale = XMVectorSplatW(positionScale);
+
+	XMMATRIX world = XMMatrixRotationQuaternion(rotation);
+	world.r[0] = XMVectorMultiply(world.r[0], scale);
+	world.r[1] = XMVectorMultiply(world.r[1], scale);
+	world.r[2] = XMVectorMultiply(world.r[2], scale);
+	world.r[3] = XMVectorSelect(g_XMIdentityR3, positionScale, g_XMSelect1110);
+
+	return world;
+}
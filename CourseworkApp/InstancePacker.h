@@ -0,0 +1,92 @@
+// Packs instance transforms into the per-instance vertex formats InstanceShader can draw with
+// The last column of a world matrix is always (0, 0, 0, 1), so uploading all 64 bytes of it wastes a quarter of the
+// bandwidth. Instead, instances can be stored as:
+//	AFFINE:		the first three columns of the matrix (48 bytes), which is exact
+//	QUATERNION:	position, uniform scale and a rotation quaternion (32 bytes)
+//	QUANTISED:	the same as QUATERNION in 16-bit integers (16 bytes), with positions relative to the bounds of the batch
+// QUATERNION and QUANTISED take the scale of the X-axis for the whole transform, so they cannot store non-uniform scale
+// Every format is decoded by a permutation of instance_vs_header.hlsl, and by InstancePacker::Unpack on the CPU
+
+#pragma once
+#include <DirectXMath.h>
+#include <cstdint>
+#include <cstddef>
+
+using namespace DirectX;
+
+class InstancePacker
+{
+public:
+	enum class Format
+	{
+		MATRIX,
+		AFFINE,
+		QUATERNION,
+		QUANTISED
+	};
+
+	static constexpr int NUM_FORMATS = 4;
+
+	struct MatrixInstance
+	{
+		XMFLOAT4X4 world;
+	};
+
+	struct AffineInstance
+	{
+		// Columns of the matrix, i.e. the rows of its transpose
+		XMFLOAT4 columns[3];
+	};
+
+	struct QuaternionInstance
+	{
+		// Scale in w
+		XMFLOAT4 positionScale;
+		XMFLOAT4 rotation;
+	};
+
+	struct QuantisedInstance
+	{
+		// Unsigned normalised, within QuantisationBounds. Scale in w
+		uint16_t positionScale[4];
+
+		// Signed normalised
+		int16_t rotation[4];
+	};
+
+	// Range the positions and scales of quantised instances are stored in. Matches QuantisationBuffer in the VS
+	struct QuantisationBounds
+	{
+		XMFLOAT3 positionMin = { 0.f, 0.f, 0.f };
+		float maxScale = 0.f;
+
+		XMFLOAT3 positionRange = { 0.f, 0.f, 0.f };
+		float padding = 0.f;
+	};
+
+	// Size of one instance in the instance buffer
+	static uint32_t GetStride(Format format);
+
+	static const char* GetName(Format format);
+
+	// Bounds of the positions and scales of a batch of world matrices
+	static QuantisationBounds GetQuantisationBounds(const XMFLOAT4X4* worlds, size_t count);
+
+	// Pack count world matrices into out, which needs room for count * GetStride(format) bytes
+	// bounds are only used by QUANTISED
+	static void Pack(Format format, const XMFLOAT4X4* worlds, size_t count, const QuantisationBounds& bounds, void* out);
+
+	// The world matrix that the vertex shader decodes instance idx of a packed batch to
+	static XMMATRIX Unpack(Format format, const void* packed, size_t idx, const QuantisationBounds& bounds);
+
+private:
+	static void PackAffine(const XMFLOAT4X4* worlds, size_t count, AffineInstance* out);
+	static void PackQuaternion(const XMFLOAT4X4* worlds, size_t count, QuaternionInstance* out);
+	static void PackQuantised(const XMFLOAT4X4* worlds, size_t count, const QuantisationBounds& bounds, QuantisedInstance* out);
+
+	// Position in xyz and uniform scale in w, and the rotation of the matrix without its scale
+	static void XM_CALLCONV Decompose(FXMMATRIX world, XMVECTOR& positionScale, XMVECTOR& rotation);
+
+	// Rotation, scale and position put back together, the same way as in the VS
+	static XMMATRIX XM_CALLCONV Compose(FXMVECTOR positionScale, FXMVECTOR rotation);
+};
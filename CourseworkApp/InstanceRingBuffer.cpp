@@ -0,0 +1,110 @@
+#include "InstanceRingBuffer.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+InstanceRingBuffer::InstanceRingBuffer(ID3D11Device* device, UINT stride, UINT initialCapacity, UINT maxCapacity)
+	:	mDevice(device),
+		mStride(stride),
+		mMaxCapacity(maxCapacity)
+{
+	assert(initialCapacity > 0 && initialCapacity <= maxCapacity);
+
+	CreateBuffer(initialCapacity);
+}
+
+InstanceRingBuffer::~InstanceRingBuffer()
+{
+	if (mBuffer)
+		mBuffer->Release();
+}
+
+void InstanceRingBuffer::BeginFrame()
+{
+	// Grow to the next power of two that held the whole of the last frame, so a scene that keeps growing only
+	// recreates the buffer a handful of times
+	if (mFrameInstances > mCapacity && mCapacity < mMaxCapacity)
+	{
+		UINT capacity = mCapacity;
+
+		while (capacity < mFrameInstances && capacity < mMaxCapacity)
+			capacity *= 2;
+
+		CreateBuffer(std::min(capacity, mMaxCapacity));
+	}
+
+	mFrameInstances = 0;
+	mFrameMaps = 0;
+	mFrameDiscards = 0;
+}
+
+InstanceRingBuffer::Allocation InstanceRingBuffer::Write(ID3D11DeviceContext* context, const void* instances, UINT count)
+{
+	Allocation allocation;
+	void* data = Map(context, count, allocation);
+
+	std::memcpy(data, instances, allocation.count * mStride);
+
+	Unmap(context, allocation.count);
+
+	return allocation;
+}
+
+void* InstanceRingBuffer::Map(ID3D11DeviceContext* context, UINT count, Allocation& allocation)
+{
+	assert(count > 0 && !mIsMapped);
+
+	D3D11_MAP mapType = D3D11_MAP_WRITE_NO_OVERWRITE;
+
+	// Start over once the rest of the buffer is too small for the batch. Batches larger than the whole buffer are
+	// split, but only once they have the whole buffer to themselves
+	if (mCursor == 0 || mCursor + count > mCapacity)
+	{
+		mapType = D3D11_MAP_WRITE_DISCARD;
+		mCursor = 0;
+		++mFrameDiscards;
+	}
+
+	allocation.first = mCursor;
+	allocation.count = std::min(count, mCapacity - mCursor);
+
+	D3D11_MAPPED_SUBRESOURCE map;
+	context->Map(mBuffer, 0, mapType, 0, &map);
+
+	mMapped = allocation;
+	mIsMapped = true;
+	++mFrameMaps;
+
+	return static_cast<uint8_t*>(map.pData) + allocation.first * mStride;
+}
+
+void InstanceRingBuffer::Unmap(ID3D11DeviceContext* context, UINT written)
+{
+	assert(mIsMapped);
+
+	context->Unmap(mBuffer, 0);
+
+	// Only what was written is kept, so the rest of the allocation goes to the next write
+	mCursor += std::min(written, mMapped.count);
+	mFrameInstances += written;
+	mIsMapped = false;
+}
+
+void InstanceRingBuffer::CreateBuffer(UINT capacity)
+{
+	if (mBuffer)
+		mBuffer->Release();
+
+	D3D11_BUFFER_DESC desc;
+	ZeroMemory(&desc, sizeof(D3D11_BUFFER_DESC));
+	desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	desc.ByteWidth = mStride * capacity;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	desc.Usage = D3D11_USAGE_DYNAMIC;
+
+	mDevice->CreateBuffer(&desc, 0, &mBuffer);
+
+	mCapacity = capacity;
+	mCursor = 0;
+	++mResizes;
+}
@@ -0,0 +1,76 @@
+// Dynamic vertex buffer that instance data is streamed through, used as a ring
+// Every write is appended after the previous one with MAP_WRITE_NO_OVERWRITE, so the GPU can keep reading what was
+// written before. Once the end is reached, the buffer is mapped with MAP_WRITE_DISCARD and writing starts over from the
+// beginning, which lets the driver hand out a fresh copy instead of waiting for the GPU
+// A batch larger than the buffer is written in several parts, to be drawn with one call each (see StartInstanceLocation)
+// Instances can also be written in place, between Map and Unmap, e.g. by a culling query (see InstanceSpan)
+// The buffer is only ever recreated at the start of a frame, when the previous frame did not fit into it
+
+#pragma once
+#include <d3d11.h>
+#include <cstdint>
+
+class InstanceRingBuffer
+{
+public:
+	// Part of a batch that was written, in instances
+	struct Allocation
+	{
+		UINT first;
+		UINT count;
+	};
+
+	InstanceRingBuffer(ID3D11Device* device, UINT stride, UINT initialCapacity, UINT maxCapacity);
+	InstanceRingBuffer(const InstanceRingBuffer&) = delete;
+	InstanceRingBuffer& operator=(const InstanceRingBuffer&) = delete;
+	~InstanceRingBuffer();
+
+	// Grow the buffer if the previous frame wrote more instances than it holds, up to the maximum capacity
+	void BeginFrame();
+
+	// Write as many of count instances as fit into one contiguous range of the buffer
+	// Call again with the rest until the whole batch is written
+	Allocation Write(ID3D11DeviceContext* context, const void* instances, UINT count);
+
+	// Map room for as many of count instances as fit into one contiguous range of the buffer, and return where the
+	// first of them goes. The buffer stays mapped until Unmap
+	void* Map(ID3D11DeviceContext* context, UINT count, Allocation& allocation);
+
+	// Unmap the buffer after written instances were written to the last Map. written may be more than the allocation
+	// held, in which case only the allocation is kept, and the buffer grows to fit them next frame
+	void Unmap(ID3D11DeviceContext* context, UINT written);
+
+	ID3D11Buffer* GetBuffer() const { return mBuffer; }
+	UINT GetStride() const { return mStride; }
+	UINT GetCapacity() const { return mCapacity; }
+
+	// Work done in the current frame
+	UINT GetWrittenInstances() const { return mFrameInstances; }
+	int GetMaps() const { return mFrameMaps; }
+	int GetDiscards() const { return mFrameDiscards; }
+
+	// Number of times the buffer was created, including the first
+	int GetResizes() const { return mResizes; }
+
+private:
+	void CreateBuffer(UINT capacity);
+
+	ID3D11Device* mDevice;
+	ID3D11Buffer* mBuffer = nullptr;
+
+	UINT mStride;
+	UINT mCapacity = 0;
+	UINT mMaxCapacity;
+
+	// Where the next write goes, in instances
+	UINT mCursor = 0;
+
+	// Allocation of the Map that is waiting for its Unmap
+	Allocation mMapped = {};
+	bool mIsMapped = false;
+
+	UINT mFrameInstances = 0;
+	int mFrameMaps = 0;
+	int mFrameDiscards = 0;
+	int mResizes = 0;
+};
@@ -1,103 +1,215 @@
 #include "InstanceShader.h"
 #include "Utility.h"
+#include "D3D11Backend.h"
 #include "../DXFramework/Camera.h"
 
+namespace
+{
+	// Vertex shader permutation of every instance format, in the order of InstancePacker::Format
+	WCHAR* const FORMAT_SHADERS[InstancePacker::NUM_FORMATS] = {
+		L"instance_vs.cso",
+		L"instance_affine_vs.cso",
+		L"instance_quaternion_vs.cso",
+		L"instance_quantised_vs.cso"
+	};
+}
+
 InstanceShader::InstanceShader(ID3D11Device * device, ID3D11DeviceContext * context, HWND hwnd)
 	:	LightingShader(device, context, hwnd, L"lighting_ps.cso", true)
 {
-	initShader(L"instance_vs.cso");
+	initShader();
 }
 
 InstanceShader::~InstanceShader()
 {
-	instanceBuffer->Release();
+	for (int i = 0; i < InstancePacker::NUM_FORMATS; ++i)
+	{
+		formatShaders[i]->Release();
+		formatLayouts[i]->Release();
+	}
+
+	quantisationBuffer->Release();
+}
+
+void InstanceShader::setFormat(InstancePacker::Format newFormat)
+{
+	if (newFormat == format)
+		return;
+
+	format = newFormat;
+	instanceBuffer = std::make_unique<InstanceRingBuffer>(renderer, InstancePacker::GetStride(format), INITIAL_INSTANCE_CAPACITY, MAX_INSTANCE_CAPACITY);
 }
 
-void XM_CALLCONV InstanceShader::addInstance(FXMMATRIX world)
+void InstanceShader::beginFrame()
 {
-	assert(usedInstances + 1 <= MAX_INSTANCES);
+	LightingShader::beginFrame();
 
-	instances[usedInstances++].world = world;
+	instanceBuffer->BeginFrame();
+	drawCalls = 0;
+}
+
+void XM_CALLCONV InstanceShader::addInstance(FXMMATRIX world)
+{
+	instances.emplace_back();
+	XMStoreFloat4x4(&instances.back(), world);
 }
 
 void XM_CALLCONV InstanceShader::setShaderParameters(ID3D11DeviceContext * context, FXMMATRIX view, CXMMATRIX projection, Camera* camera, ID3D11ShaderResourceView * texture)
 {
-	D3D11_MAPPED_SUBRESOURCE map;
-	context->Map(matrixBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &map);
+	D3D11Backend backend(context);
 
 	// Update matrix buffer
-	MatrixBufferType* matrixPtr = static_cast<MatrixBufferType*>(map.pData);
-	matrixPtr->view = view;
-	matrixPtr->projection = projection;
+	MatrixBufferType matrices;
+	matrices.view = view;
+	matrices.projection = projection;
 
-	context->Unmap(matrixBuffer, 0);
+	upload(backend, uploads, matrixBuffer, matrices);
 
-	// Update light buffer
-	context->Map(lightBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &map);
+	// Update light and camera buffers, if they changed
+	uploadSharedBuffers(backend, uploads, camera);
 
-	LightBufferType* lightPtr = static_cast<LightBufferType*>(map.pData);
+	// Set constant buffer
+	ID3D11Buffer* vsBuffers[2] = { matrixBuffer, cameraBuffer };
+	context->VSSetConstantBuffers(0, 2, vsBuffers);
 
-	lightPtr->globalAmbient = mAmbient;
+	ID3D11Buffer* psBuffers[2] = { lightBuffer, fogBuffer };
+	context->PSSetConstantBuffers(0, 2, psBuffers);
 
-	memcpy_s(lightPtr->lights, sizeof(ShaderLight) * MAX_LIGHTS, lights, sizeof(ShaderLight) * MAX_LIGHTS);
+	// Set textures
+	context->PSSetShaderResources(0, 1, &texture);
+}
 
-	context->Unmap(lightBuffer, 0);
+void InstanceShader::render(ID3D11DeviceContext * context, int vertexCount)
+{
+	setInstanceShaders(context);
 
-	// Update camera buffer
-	context->Map(cameraBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &map);
+	const UINT numInstances = (UINT) instances.size();
+	const UINT instanceStride = InstancePacker::GetStride(format);
 
-	CameraBufferType* cameraPtr = static_cast<CameraBufferType*>(map.pData);
-	ZeroMemory(cameraPtr, sizeof(CameraBufferType));
-	cameraPtr->position = camera->getPosition();
+	// Quantised positions are relative to the bounds of the batch
+	InstancePacker::QuantisationBounds bounds;
 
-	context->Unmap(cameraBuffer, 0);
+	if (format == InstancePacker::Format::QUANTISED)
+	{
+		bounds = InstancePacker::GetQuantisationBounds(instances.data(), instances.size());
+		setQuantisationBounds(context, bounds);
+	}
 
-	// Update instance buffer
-	context->Map(instanceBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &map);
+	packedInstances.resize(numInstances * instanceStride);
+	InstancePacker::Pack(format, instances.data(), instances.size(), bounds, packedInstances.data());
 
-	InstanceBufferType* instancePtr = static_cast<InstanceBufferType*>(map.pData);
-	memcpy_s(instancePtr, sizeof(InstanceBufferType) * MAX_INSTANCES, instances, sizeof(InstanceBufferType) * usedInstances);
+	// Every part of the batch is drawn from where it was written to in the instance buffer
+	for (UINT written = 0; written < numInstances; )
+	{
+		const auto allocation = instanceBuffer->Write(context, packedInstances.data() + written * instanceStride, numInstances - written);
 
-	context->Unmap(instanceBuffer, 0);
+		UINT stride[1] = { instanceStride };
+		UINT offset[1] = { 0 };
 
-	// Set constant buffer
-	ID3D11Buffer* vsBuffers[2] = { matrixBuffer, cameraBuffer };
-	context->VSSetConstantBuffers(0, 2, vsBuffers);
+		// VB slot 0 is set by BaseMesh::sendData
+		// VS slot 1 contains instance data. Growing the instance buffer replaces it, so it is bound every time
+		ID3D11Buffer* buffer = instanceBuffer->GetBuffer();
+		context->IASetVertexBuffers(1, 1, &buffer, stride, offset);
 
-	ID3D11Buffer* psBuffers[2] = { lightBuffer, fogBuffer };
-	context->PSSetConstantBuffers(0, 2, psBuffers);
+		context->DrawIndexedInstanced(vertexCount, allocation.count, 0, 0, allocation.first);
 
-	// Set textures
-	context->PSSetShaderResources(0, 1, &texture);
+		written += allocation.count;
+		++drawCalls;
+	}
+
+	// Clear instances to prepare for next render call. The memory is kept for the next frame
+	instances.clear();
 }
 
-void InstanceShader::render(ID3D11DeviceContext * context, int vertexCount)
+InstanceSpan InstanceShader::mapInstances(ID3D11DeviceContext* context, UINT maxInstances, const InstancePacker::QuantisationBounds& bounds)
+{
+	void* data = instanceBuffer->Map(context, maxInstances, mappedInstances);
+
+	return InstanceSpan(data, mappedInstances.count, format, bounds);
+}
+
+bool InstanceShader::renderMapped(ID3D11DeviceContext* context, int vertexCount, const InstanceSpan& span)
 {
-	UINT stride[1] = { sizeof(InstanceBufferType) };
+	instanceBuffer->Unmap(context, (UINT) span.size());
+
+	if (span.IsOverflowed())
+		return false;
+
+	if (span.size() == 0)
+		return true;
+
+	setInstanceShaders(context);
+
+	if (format == InstancePacker::Format::QUANTISED)
+		setQuantisationBounds(context, span.GetBounds());
+
+	UINT stride[1] = { instanceBuffer->GetStride() };
 	UINT offset[1] = { 0 };
 
 	// VB slot 0 is set by BaseMesh::sendData
-	// VS slot 1 contains instance data
-	context->IASetVertexBuffers(1, 1, &instanceBuffer, stride, offset);
-	context->IASetInputLayout(layout);
+	ID3D11Buffer* buffer = instanceBuffer->GetBuffer();
+	context->IASetVertexBuffers(1, 1, &buffer, stride, offset);
+
+	context->DrawIndexedInstanced(vertexCount, (UINT) span.size(), 0, 0, mappedInstances.first);
+
+	++drawCalls;
+	return true;
+}
+
+void InstanceShader::renderIndirect(ID3D11DeviceContext* context, ID3D11Buffer* instances, ID3D11Buffer* arguments)
+{
+	const int matrixFormat = (int) InstancePacker::Format::MATRIX;
+
+	context->IASetInputLayout(formatLayouts[matrixFormat]);
 
 	context->PSSetSamplers(0, 1, &sampleState);
 
-	context->VSSetShader(vertexShader, NULL, 0);
+	context->VSSetShader(formatShaders[matrixFormat], NULL, 0);
 	context->PSSetShader(pixelShader, NULL, 0);
 	context->HSSetShader(hullShader, NULL, 0);
 	context->DSSetShader(domainShader, NULL, 0);
 	context->GSSetShader(geometryShader, NULL, 0);
 
-	context->DrawIndexedInstanced(vertexCount, usedInstances, 0, 0, 0);
+	UINT stride[1] = { InstancePacker::GetStride(InstancePacker::Format::MATRIX) };
+	UINT offset[1] = { 0 };
+
+	// VB slot 0 is set by BaseMesh::sendData
+	context->IASetVertexBuffers(1, 1, &instances, stride, offset);
+
+	context->DrawIndexedInstancedIndirect(arguments, 0);
 
-	// Reset instance count to prepare for next render call
-	usedInstances = 0;
+	// Unbind the instances, so the next dispatch can write to them
+	ID3D11Buffer* noBuffer = nullptr;
+	context->IASetVertexBuffers(1, 1, &noBuffer, stride, offset);
+
+	++drawCalls;
 }
 
-void InstanceShader::initShader(WCHAR * vs)
+void InstanceShader::setInstanceShaders(ID3D11DeviceContext* context)
 {
-	loadVertexShader(vs);
+	context->IASetInputLayout(formatLayouts[(int) format]);
+
+	context->PSSetSamplers(0, 1, &sampleState);
+
+	context->VSSetShader(formatShaders[(int) format], NULL, 0);
+	context->PSSetShader(pixelShader, NULL, 0);
+	context->HSSetShader(hullShader, NULL, 0);
+	context->DSSetShader(domainShader, NULL, 0);
+	context->GSSetShader(geometryShader, NULL, 0);
+}
+
+void InstanceShader::setQuantisationBounds(ID3D11DeviceContext* context, const InstancePacker::QuantisationBounds& bounds)
+{
+	D3D11Backend backend(context);
+	upload(backend, uploads, quantisationBuffer, bounds);
+
+	context->VSSetConstantBuffers(2, 1, &quantisationBuffer);
+}
+
+void InstanceShader::initShader()
+{
+	for (int i = 0; i < InstancePacker::NUM_FORMATS; ++i)
+		loadVertexShader(FORMAT_SHADERS[i], (InstancePacker::Format) i);
 
 	// HACK: Lighting shader initialises the matrix buffer with invalid bytewidth (LightingShader::MatrixBufferType != InstanceShader::MatrixBufferType)
 	matrixBuffer->Release();
@@ -113,21 +225,21 @@ void InstanceShader::initShader(WCHAR * vs)
 
 	renderer->CreateBuffer(&matrixDesc, 0, &matrixBuffer);
 
+	// Set up the quantisation buffer, used by the quantised format only
+	D3D11_BUFFER_DESC quantisationDesc = matrixDesc;
+	quantisationDesc.ByteWidth = sizeof(QuantisationBufferType);
+
+	renderer->CreateBuffer(&quantisationDesc, 0, &quantisationBuffer);
+
 	// Create vertex buffer containing instance data
-	D3D11_BUFFER_DESC instanceDesc;
-	ZeroMemory(&instanceDesc, sizeof(D3D11_BUFFER_DESC));
-	instanceDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-	instanceDesc.ByteWidth = sizeof(InstanceBufferType) * MAX_INSTANCES;
-	instanceDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-	instanceDesc.Usage = D3D11_USAGE_DYNAMIC;
-
-	renderer->CreateBuffer(&instanceDesc, 0, &instanceBuffer);
+	instanceBuffer = std::make_unique<InstanceRingBuffer>(renderer, InstancePacker::GetStride(format), INITIAL_INSTANCE_CAPACITY, MAX_INSTANCE_CAPACITY);
+	instances.reserve(INITIAL_INSTANCE_CAPACITY);
 }
 
-void InstanceShader::loadVertexShader(WCHAR * vs)
+void InstanceShader::loadVertexShader(WCHAR * vs, InstancePacker::Format vsFormat)
 {
 	ID3DBlob* bytecode = ShaderToBlob(vs, hwnd);
-	renderer->CreateVertexShader(bytecode->GetBufferPointer(), bytecode->GetBufferSize(), NULL, &vertexShader);
+	renderer->CreateVertexShader(bytecode->GetBufferPointer(), bytecode->GetBufferSize(), NULL, &formatShaders[(int) vsFormat]);
 
 	// Create input layout that also takes per-instance data
 	D3D11_INPUT_ELEMENT_DESC inputDesc[7] = {
@@ -140,7 +252,30 @@ void InstanceShader::loadVertexShader(WCHAR * vs)
 		{ "WORLD",    3, DXGI_FORMAT_R32G32B32A32_FLOAT,	1, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_INSTANCE_DATA, 1 }
 	};
 
-	renderer->CreateInputLayout(inputDesc, sizeof(inputDesc) / sizeof(inputDesc[0]), bytecode->GetBufferPointer(), bytecode->GetBufferSize(), &layout);
+	// The matrix takes four rows, the affine transform three columns, and the quaternion formats two elements each
+	UINT numElements = 7;
+
+	switch (vsFormat)
+	{
+	case InstancePacker::Format::AFFINE:
+		numElements = 6;
+		break;
+
+	case InstancePacker::Format::QUATERNION:
+		numElements = 5;
+		break;
+
+	case InstancePacker::Format::QUANTISED:
+		numElements = 5;
+		inputDesc[3].Format = DXGI_FORMAT_R16G16B16A16_UNORM;
+		inputDesc[4].Format = DXGI_FORMAT_R16G16B16A16_SNORM;
+		break;
+
+	default:
+		break;
+	}
+
+	renderer->CreateInputLayout(inputDesc, numElements, bytecode->GetBufferPointer(), bytecode->GetBufferSize(), &formatLayouts[(int) vsFormat]);
 
 	bytecode->Release();
 }
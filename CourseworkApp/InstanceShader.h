@@ -3,43 +3,91 @@
 #pragma once
 #include "LightingShader.h"
 #include "ShaderBuffers.h"
+#include "InstanceRingBuffer.h"
+#include "InstancePacker.h"
+#include "InstanceSpan.h"
+#include <vector>
+#include <memory>
 
-// 16-byte aligned because it stores XMMATRIX
-__declspec(align(16))
 class InstanceShader : public LightingShader
 {
 public:
-	static constexpr int MAX_INSTANCES = 100'000;
-	using MatrixBufferType = BufferType::MatrixBufferWithoutWorldType;
+	// Instances the instance buffer starts out holding, and the most it grows to
+	// Larger batches are drawn in several calls
+	static constexpr UINT INITIAL_INSTANCE_CAPACITY = 16 * 1024;
+	static constexpr UINT MAX_INSTANCE_CAPACITY = 256 * 1024;
 
-	// Instance-unique data
-	struct InstanceBufferType
-	{
-		XMMATRIX world;
-	};
+	using MatrixBufferType = BufferType::MatrixBufferWithoutWorldType;
+	using QuantisationBufferType = InstancePacker::QuantisationBounds;
 
 	InstanceShader(ID3D11Device* device, ID3D11DeviceContext* context, HWND hwnd);
 	InstanceShader(const InstanceShader&) = delete;
 	InstanceShader& operator=(const InstanceShader&) = delete;
 	~InstanceShader();
 
+	// Per-instance vertex format the instances are uploaded in. Changing it recreates the instance buffer
+	void setFormat(InstancePacker::Format newFormat);
+	InstancePacker::Format getFormat() const { return format; }
+
+	// Call at the start of every frame, before any instances are drawn
+	void beginFrame();
+
 	// Store an object's transform matrix(instance data)
 	void XM_CALLCONV addInstance(FXMMATRIX world);
 
 	void XM_CALLCONV setShaderParameters(ID3D11DeviceContext* context, FXMMATRIX view, CXMMATRIX projection, Camera* camera, ID3D11ShaderResourceView* texture);
 
 	// Called once to render all instances added via InstanceShader::addInstance
+	// The instances are streamed into the instance buffer, and drawn in as many calls as it takes
 	void render(ID3D11DeviceContext* context, int vertexCount) override;
 
+	// Map room for up to maxInstances instances in the current format, to be written straight into the instance buffer
+	// bounds are used by the quantised format, and have to cover every instance that is written
+	InstanceSpan mapInstances(ID3D11DeviceContext* context, UINT maxInstances, const InstancePacker::QuantisationBounds& bounds);
+
+	// Unmap the instances written to the span from mapInstances, and draw them in one call
+	// Returns false, without drawing anything, if they did not all fit; the instance buffer grows to fit them next frame
+	bool renderMapped(ID3D11DeviceContext* context, int vertexCount, const InstanceSpan& span);
+
+	// Draw instances that are already on the GPU, e.g. culled by GpuCullingShader, in the MATRIX format whatever the
+	// current one is. The instance count comes from the arguments buffer
+	void renderIndirect(ID3D11DeviceContext* context, ID3D11Buffer* instances, ID3D11Buffer* arguments);
+
+	const InstanceRingBuffer& getInstanceBuffer() const { return *instanceBuffer; }
+	int getDrawCalls() const { return drawCalls; }
+
 protected:
-	void initShader(WCHAR* vs);
+	void initShader();
 
 	// InstanceShader needs a unique input layout, and does therefore not use the one provided by BaseShader
-	void loadVertexShader(WCHAR* vs);
+	// Every instance format has a vertex shader and input layout of its own
+	void loadVertexShader(WCHAR* vs, InstancePacker::Format vsFormat);
+
+	// Bind the shaders and input layout of the current format
+	void setInstanceShaders(ID3D11DeviceContext* context);
+
+	// Upload the bounds that the quantised format's positions are relative to
+	void setQuantisationBounds(ID3D11DeviceContext* context, const InstancePacker::QuantisationBounds& bounds);
+
+	InstancePacker::Format format = InstancePacker::Format::MATRIX;
+
+	ID3D11VertexShader* formatShaders[InstancePacker::NUM_FORMATS] = {};
+	ID3D11InputLayout* formatLayouts[InstancePacker::NUM_FORMATS] = {};
+
+	ID3D11Buffer* quantisationBuffer = nullptr;
+
+	// Part of the instance buffer that mapInstances handed out
+	InstanceRingBuffer::Allocation mappedInstances = {};
+
+	std::unique_ptr<InstanceRingBuffer> instanceBuffer;
+
+	// Instances added since the last render call. Stored unaligned, as vectors do not guarantee XMMATRIX's alignment
+	std::vector<XMFLOAT4X4> instances;
+
+	// Instances packed into the current format, before they are written to the instance buffer
+	std::vector<uint8_t> packedInstances;
 
-	ID3D11Buffer* instanceBuffer;
-	
-	int usedInstances = 0;
-	InstanceBufferType instances[MAX_INSTANCES];
+	// Draw calls issued this frame
+	int drawCalls = 0;
 };
 
@@ -0,0 +1,58 @@
+#include "InstanceSpan.h"
+
+InstanceSpan::InstanceSpan(void* data, size_t capacity, InstancePacker::Format format, const InstancePacker::QuantisationBounds& bounds)
+	:	mData(static_cast<uint8_t*>(data)),
+		mCapacity(capacity),
+		mFormat(format),
+		mStride(InstancePacker::GetStride(format)),
+		mBounds(bounds)
+{
+}
+
+void InstanceSpan::push_back(MeshInstance* instance)
+{
+	// Matrices are stored as they are, without a copy on the stack
+	if (mFormat == InstancePacker::Format::MATRIX)
+	{
+		if (mSize < mCapacity)
+			XMStoreFloat4x4(reinterpret_cast<XMFLOAT4X4*>(mData + mSize * mStride), instance->GetWorldMatrix());
+
+		++mSize;
+		return;
+	}
+
+	XMStoreFloat4x4(&mStaging[mNumStaged++], instance->GetWorldMatrix());
+	++mSize;
+
+	if (mNumStaged == STAGING_SIZE)
+		Flush();
+}
+
+void InstanceSpan::Write(size_t offset, MeshInstance* const* instances, size_t count)
+{
+	XMFLOAT4X4 worlds[STAGING_SIZE];
+
+	for (size_t first = 0; first < count; first += STAGING_SIZE)
+	{
+		const size_t batchSize = std::min(count - first, STAGING_SIZE);
+
+		for (size_t i = 0; i < batchSize; ++i)
+			XMStoreFloat4x4(&worlds[i], instances[first + i]->GetWorldMatrix());
+
+		Pack(offset + first, worlds, batchSize);
+	}
+}
+
+void InstanceSpan::Flush()
+{
+	Pack(mSize - mNumStaged, mStaging, mNumStaged);
+	mNumStaged = 0;
+}
+
+void InstanceSpan::Pack(size_t offset, const XMFLOAT4X4* worlds, size_t count)
+{
+	if (offset >= mCapacity)
+		return;
+
+	InstancePacker::Pack(mFormat, worlds, std::min(count, mCapacity - offset), mBounds, mData + offset * mStride);
+}
@@ -0,0 +1,60 @@
+// Output of a culling query that packs the world matrix of every visible object straight into memory, e.g. a mapped
+// instance buffer, in one of the InstancePacker formats
+// BoundingVolume culls into it in place of a std::vector<MeshInstance*>, which would have to be walked again to
+// gather the matrices, before they are packed and copied into the instance buffer
+// Objects past the capacity are counted but not written, so that the caller can tell the span was too small
+// Matrices are stored as soon as they are added. The other formats pack a few matrices at a time, so that the set-up
+// of InstancePacker::Pack is shared between them; those have to be flushed once the last object is added
+
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+#include "InstancePacker.h"
+#include "MeshInstance.h"
+
+class InstanceSpan
+{
+public:
+	// Matrices waiting to be packed into a format other than MATRIX
+	static constexpr size_t STAGING_SIZE = 32;
+
+	InstanceSpan() = default;
+
+	// bounds are only used by QUANTISED, and have to cover every object that may be written
+	InstanceSpan(void* data, size_t capacity, InstancePacker::Format format, const InstancePacker::QuantisationBounds& bounds = InstancePacker::QuantisationBounds());
+
+	// The parts of std::vector<MeshInstance*> that BoundingVolume uses, so that it can cull into either
+	void push_back(MeshInstance* instance);
+	size_t size() const { return mSize; }
+	void resize(size_t size) { mSize = size; }
+
+	// Pack count instances into the slots from offset on
+	void Write(size_t offset, MeshInstance* const* instances, size_t count);
+
+	// Pack the instances added since the last flush. BoundingVolume calls it at the end of every query
+	void Flush();
+
+	size_t GetCapacity() const { return mCapacity; }
+	size_t GetWritten() const { return std::min(mSize, mCapacity); }
+	bool IsOverflowed() const { return mSize > mCapacity; }
+
+	InstancePacker::Format GetFormat() const { return mFormat; }
+	const InstancePacker::QuantisationBounds& GetBounds() const { return mBounds; }
+
+private:
+	// Pack count matrices into the slots from offset on, leaving out any past the capacity
+	void Pack(size_t offset, const XMFLOAT4X4* worlds, size_t count);
+
+	uint8_t* mData = nullptr;
+	size_t mCapacity = 0;
+	size_t mSize = 0;
+
+	InstancePacker::Format mFormat = InstancePacker::Format::MATRIX;
+	uint32_t mStride = 0;
+	InstancePacker::QuantisationBounds mBounds;
+
+	XMFLOAT4X4 mStaging[STAGING_SIZE];
+	size_t mNumStaged = 0;
+};
@@ -1,6 +1,7 @@
 #include "LightingShader.h"
 #include "..\DXFramework\Light.h"
 #include "..\DXFramework\Camera.h"
+#include "D3D11Backend.h"
 
 /* static */ const XMFLOAT4 LightingShader::DEFAULT_FOG_COLOUR = { 0.39f, 0.58f, 0.92f, 1.0f };
 
@@ -40,6 +41,8 @@ int LightingShader::addLight(LightType type)
 	lights[idx].type = type;
 	lights[idx].enabled = true;
 
+	++lightVersion;
+
 	return idx;
 }
 
@@ -51,18 +54,28 @@ int LightingShader::copyLight(ShaderLight * light)
 		return idx;
 
 	lights[idx] = *light;
+	++lightVersion;
+
 	return idx;
 }
 
 void LightingShader::update(ID3D11DeviceContext* context, const LightingShader & other)
 {
-	mAmbient = other.mAmbient;
+	// Called every frame, so the lights only count as changed when the other shader's differ from them
+	const bool lightsChanged = numLights != other.numLights || memcmp(&mAmbient, &other.mAmbient, sizeof(XMFLOAT4)) != 0 ||
+		memcmp(lights, other.lights, sizeof(ShaderLight) * MAX_LIGHTS) != 0;
+
+	if (lightsChanged)
+	{
+		mAmbient = other.mAmbient;
+
+		numLights = other.numLights;
+		memcpy_s(lights, sizeof(ShaderLight) * MAX_LIGHTS, other.lights, sizeof(ShaderLight) * MAX_LIGHTS);
+
+		++lightVersion;
+	}
 
-	// NOTE: Calling this function every frame is rather wasteful
 	setFogProperties(context, other.mFogColour, other.mFogMin, other.mFogRange);
-	
-	numLights = other.numLights;
-	memcpy_s(lights, sizeof(ShaderLight) * MAX_LIGHTS, other.lights, sizeof(ShaderLight) * MAX_LIGHTS);
 }
 
 XMMATRIX LightingShader::generateLightViewMatrix(int lightHandle) const
@@ -94,6 +107,16 @@ XMMATRIX LightingShader::generateOrthoShadowTransform(int lightHandle, float fru
 }
 
 auto LightingShader::getLight(int idx) -> ShaderLight*
+{
+	if (idx >= MAX_LIGHTS)
+		return nullptr;
+
+	++lightVersion;
+
+	return lights[idx].enabled ? &lights[idx] : nullptr;
+}
+
+auto LightingShader::getLight(int idx) const -> const ShaderLight*
 {
 	if (idx >= MAX_LIGHTS)
 		return nullptr;
@@ -103,82 +126,162 @@ auto LightingShader::getLight(int idx) -> ShaderLight*
 
 void LightingShader::setFogProperties(ID3D11DeviceContext* context, XMFLOAT4 fogColour, float fogMin, float fogRange)
 {
-	D3D11_MAPPED_SUBRESOURCE mappedRes;
-	context->Map(fogBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedRes);
+	if (memcmp(&fogColour, &mFogColour, sizeof(XMFLOAT4)) != 0 || fogMin != mFogMin || fogRange != mFogRange)
+	{
+		mFogColour = fogColour;
+		mFogMin = fogMin;
+		mFogRange = fogRange;
+
+		++fogVersion;
+	}
+
+	if (skipUnchanged && fogVersion == uploadedFogVersion)
+	{
+		++uploads.stats.skipped;
+		return;
+	}
 
-	FogBufferType* fog = static_cast<FogBufferType*>(mappedRes.pData);
-	ZeroMemory(fog, sizeof(FogBufferType));
+	FogBufferType fog;
+	ZeroMemory(&fog, sizeof(FogBufferType));
 
-	fog->fogColour = fogColour;
-	fog->fogMin = fogMin;
-	fog->fogRange = fogRange;
+	fog.fogColour = fogColour;
+	fog.fogMin = fogMin;
+	fog.fogRange = fogRange;
 
-	context->Unmap(fogBuffer, 0);
+	D3D11Backend backend(context);
+	upload(backend, uploads, fogBuffer, fog);
 
-	mFogColour = fogColour;
-	mFogMin = fogMin;
-	mFogRange = fogRange;
+	uploadedFogVersion = fogVersion;
 }
 
 void XM_CALLCONV LightingShader::setShaderParameters(ID3D11DeviceContext* context, FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection, Camera* camera, ID3D11ShaderResourceView* texture, ID3D11ShaderResourceView* heightMap)
 {
-	D3D11_MAPPED_SUBRESOURCE map;
-	context->Map(matrixBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &map);
+	D3D11Backend backend(context);
+	setShaderParameters(backend, world, view, projection, camera, texture, heightMap);
+}
+
+void LightingShader::render(ID3D11DeviceContext * context, int vertexCount)
+{
+	D3D11Backend backend(context);
+	render(backend, vertexCount);
+}
+
+void XM_CALLCONV LightingShader::setShaderParameters(CommandBackend& commands, FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection, Camera* camera, ID3D11ShaderResourceView* texture, ID3D11ShaderResourceView* heightMap)
+{
+	setShaderParameters(commands, uploads, world, view, projection, camera, texture, heightMap);
+}
+
+void XM_CALLCONV LightingShader::setShaderParameters(CommandBackend& commands, UploadState& state, FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection, Camera* camera, ID3D11ShaderResourceView* texture, ID3D11ShaderResourceView* heightMap)
+{
+	using Stage = CommandBackend::Stage;
 
 	// Update matrix buffer
-	MatrixBufferType* matrixPtr = static_cast<MatrixBufferType*>(map.pData);
-	matrixPtr->world = world;
-	matrixPtr->view = view;
-	matrixPtr->projection = projection;
+	MatrixBufferType matrices;
+	matrices.world = world;
+	matrices.view = view;
+	matrices.projection = projection;
 
-	context->Unmap(matrixBuffer, 0);
+	// The matrices change with every draw, so they may go to the backend's constant arena instead of the buffer
+	uploadDrawConstants(commands, state, Stage::VS, 0, matrixBuffer, matrices);
 
-	// Update light buffer
-	context->Map(lightBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &map);
+	// Update light, camera and material buffers, if they changed
+	uploadSharedBuffers(commands, state, camera);
+	uploadMaterial(commands, state, heightMap != nullptr);
 
-	LightBufferType* lightPtr = static_cast<LightBufferType*>(map.pData);
+	// 'Dispatch' constant buffer
+	ID3D11Buffer* vsBuffers[2] = { cameraBuffer, materialBuffer };
+	commands.SetConstantBuffers(Stage::VS, 1, 2, vsBuffers);
 
-	lightPtr->globalAmbient = mAmbient;
+	ID3D11Buffer* psBuffers[3] = { lightBuffer, fogBuffer, materialBuffer };
+	commands.SetConstantBuffers(Stage::PS, 0, 3, psBuffers);
 
-	memcpy_s(lightPtr->lights, sizeof(ShaderLight) * MAX_LIGHTS, lights, sizeof(ShaderLight) * MAX_LIGHTS);
+	// Send textures
+	commands.SetShaderResources(Stage::VS, 0, 1, &heightMap);
+	commands.SetShaderResources(Stage::PS, 0, 1, &texture);
+}
 
-	context->Unmap(lightBuffer, 0);
+void LightingShader::render(CommandBackend& commands, int vertexCount)
+{
+	using Stage = CommandBackend::Stage;
 
-	// Update camera buffer
-	context->Map(cameraBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &map);
+	commands.SetSamplers(Stage::VS, 0, 1, &sampleState);
+	commands.SetSamplers(Stage::PS, 0, 1, &sampleState);
 
-	CameraBufferType* cameraPtr = static_cast<CameraBufferType*>(map.pData);
-	ZeroMemory(cameraPtr, sizeof(CameraBufferType));
-	cameraPtr->position = camera->getPosition();
+	// What BaseShader::render binds
+	CommandBackend::ShaderSet shaders;
+	shaders.vs = vertexShader;
+	shaders.hs = hullShader;
+	shaders.ds = domainShader;
+	shaders.gs = geometryShader;
+	shaders.ps = pixelShader;
 
-	context->Unmap(cameraBuffer, 0);
+	commands.SetInputLayout(layout);
+	commands.SetShaders(shaders);
 
-	// Update material properties
-	context->Map(materialBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &map);
+	commands.DrawIndexed(vertexCount, 0, 0);
+}
 
-	MaterialPropertiesType* materialPtr = static_cast<MaterialPropertiesType*>(map.pData);
-	materialPtr->gUseHeightMap = (heightMap != nullptr);
+void LightingShader::resolveUploads(const UploadState& state)
+{
+	uploads.stats.maps += state.stats.maps;
+	uploads.stats.bytes += state.stats.bytes;
+	uploads.stats.skipped += state.stats.skipped;
 
-	context->Unmap(materialBuffer, 0);
+	const UploadStats stats = uploads.stats;
 
-	// 'Dispatch' constant buffer
-	ID3D11Buffer* vsBuffers[3] = { matrixBuffer, cameraBuffer, materialBuffer };
-	context->VSSetConstantBuffers(0, 3, vsBuffers);
+	uploads = UploadState();
+	uploads.stats = stats;
+}
 
-	ID3D11Buffer* psBuffers[3] = { lightBuffer, fogBuffer, materialBuffer };
-	context->PSSetConstantBuffers(0, 3, psBuffers);
+void LightingShader::uploadSharedBuffers(CommandBackend& commands, UploadState& state, Camera* camera)
+{
+	// Update light buffer
+	if (!skipUnchanged || lightVersion != state.lightVersion)
+	{
+		LightBufferType lightData;
+		lightData.globalAmbient = mAmbient;
 
-	// Send textures
-	context->VSSetShaderResources(0, 1, &heightMap);
-	context->PSSetShaderResources(0, 1, &texture);
+		memcpy_s(lightData.lights, sizeof(ShaderLight) * MAX_LIGHTS, lights, sizeof(ShaderLight) * MAX_LIGHTS);
+
+		upload(commands, state, lightBuffer, lightData);
+		state.lightVersion = lightVersion;
+	}
+	else
+		++state.stats.skipped;
+
+	// Update camera buffer
+	const XMFLOAT3 position = camera->getPosition();
+
+	if (!skipUnchanged || !state.hasCamera || position.x != state.cameraPosition.x || position.y != state.cameraPosition.y ||
+		position.z != state.cameraPosition.z)
+	{
+		CameraBufferType cameraData;
+		ZeroMemory(&cameraData, sizeof(CameraBufferType));
+		cameraData.position = position;
+
+		upload(commands, state, cameraBuffer, cameraData);
+
+		state.cameraPosition = position;
+		state.hasCamera = true;
+	}
+	else
+		++state.stats.skipped;
 }
 
-void LightingShader::render(ID3D11DeviceContext * context, int vertexCount)
+void LightingShader::uploadMaterial(CommandBackend& commands, UploadState& state, bool useHeightMap)
 {
-	context->VSSetSamplers(0, 1, &sampleState);
-	context->PSSetSamplers(0, 1, &sampleState);
+	if (skipUnchanged && state.material == (int) useHeightMap)
+	{
+		++state.stats.skipped;
+		return;
+	}
+
+	MaterialPropertiesType material;
+	ZeroMemory(&material, sizeof(MaterialPropertiesType));
+	material.gUseHeightMap = useHeightMap;
 
-	BaseShader::render(context, vertexCount);
+	upload(commands, state, materialBuffer, material);
+	state.material = (int) useHeightMap;
 }
 
 void LightingShader::initShader(WCHAR * vsFilename, WCHAR * psFilename)
@@ -1,8 +1,14 @@
 // Shader that performs basic ambient, diffuse and specular lighting--as well as fog and displacement mapping
+// The light, fog, camera and material buffers are only uploaded when what they hold has changed since the last upload.
+// Lights and fog carry version counters, which are bumped by anything that may change them, and the camera's position
+// is compared against the one last uploaded. Uploads are counted, to see what that saves
+// What was last uploaded through a stream of commands is kept in an UploadState. The shader keeps one for what it
+// submits itself, and draws recorded on other threads each take their own, to be resolved once they were executed
 
 #pragma once
 #include "..\DXFramework\BaseShader.h"
 #include "ShaderBuffers.h"
+#include "CommandBackend.h"
 
 class Camera;
 
@@ -28,6 +34,31 @@ public:
 		SPOT_LIGHT
 	};
 
+	// Constant buffer uploads since the last beginFrame
+	struct UploadStats
+	{
+		int maps = 0;
+		size_t bytes = 0;
+
+		// Uploads of unchanged buffers that were left out
+		int skipped = 0;
+	};
+
+	// What the light, camera and material buffers were last given through one stream of commands, and what it cost
+	struct UploadState
+	{
+		// Version of the lights, 0 before the first upload
+		unsigned lightVersion = 0;
+
+		XMFLOAT3 cameraPosition = { 0.f, 0.f, 0.f };
+		bool hasCamera = false;
+
+		// gUseHeightMap of the last material upload, -1 before the first
+		int material = -1;
+
+		UploadStats stats;
+	};
+
 	LightingShader(ID3D11Device* device, ID3D11DeviceContext* context, HWND hwnd, WCHAR* vs = L"lighting_vs.cso", WCHAR* ps = L"lighting_ps.cso");
 	LightingShader(const LightingShader&) = delete;
 	LightingShader& operator=(const LightingShader&) = delete;
@@ -48,24 +79,75 @@ public:
 	XMMATRIX generateOrthoShadowTransform(int lightHandle, float frustumDim, float n, float f) const;
 
 	// Get a pointer to a light source with the handle returned by addLight
+	// The lights count as changed, as they may be written through the pointer. The const versions are for reading only
 	ShaderLight* getLight(int idx);
-	ShaderLight* getLights() { return lights[0].enabled ? &lights[0] : nullptr; }
+	const ShaderLight* getLight(int idx) const;
+	ShaderLight* getLights() { ++lightVersion; return lights[0].enabled ? &lights[0] : nullptr; }
+	const ShaderLight* getLights() const { return lights[0].enabled ? &lights[0] : nullptr; }
+
+	void disableLight(int idx) { lights[idx].enabled = false; ++lightVersion; }
 
-	void disableLight(int idx) { lights[idx].enabled = false; }
+	void setAmbient(float r, float g, float b, float a = 1.f) { mAmbient = { r, g, b, a }; ++lightVersion; }
 
-	void setAmbient(float r, float g, float b, float a = 1.f) { mAmbient = { r, g, b, a }; }
+	// Uploads the fog buffer right away, unless it already holds these properties
 	void setFogProperties(ID3D11DeviceContext* context, XMFLOAT4 fogColour, float fogMin, float fogRange);
 
+	// Call at the start of every frame
+	void beginFrame() { uploads.stats = UploadStats(); }
+	const UploadStats& getUploadStats() const { return uploads.stats; }
+
+	// Upload every buffer for every draw, whether it changed or not, to compare against
+	void setSkipUnchanged(bool skip) { skipUnchanged = skip; }
+
 	virtual void XM_CALLCONV setShaderParameters(ID3D11DeviceContext* context, FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection, Camera* camera, ID3D11ShaderResourceView* texture, ID3D11ShaderResourceView* heightMap = nullptr);
 	
 	virtual void render(ID3D11DeviceContext* context, int vertexCount) override;
 
+	// The same, submitted through a CommandBackend, e.g. to be recorded into a CommandBuffer and replayed later
+	// The contents of the constant buffers are passed on when this is called, so the shader can change before the replay
+	void XM_CALLCONV setShaderParameters(CommandBackend& commands, FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection, Camera* camera, ID3D11ShaderResourceView* texture, ID3D11ShaderResourceView* heightMap = nullptr);
+	void render(CommandBackend& commands, int vertexCount);
+
+	// The same, tracked in the given state instead of the shader's own. Only reads the shader, so draws can be recorded
+	// on several threads at once, each with its own state, as long as nothing changes the lights in the meantime
+	void XM_CALLCONV setShaderParameters(CommandBackend& commands, UploadState& state, FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection, Camera* camera, ID3D11ShaderResourceView* texture, ID3D11ShaderResourceView* heightMap = nullptr);
+
+	// Call once the draws recorded with state were executed. Their uploads are counted, and as they overwrote the
+	// buffers, the shader's own draws upload everything again
+	void resolveUploads(const UploadState& state);
+
 protected:
 	// Constructor that does not call LightingShader::initShaders (for custom input layout--used by InstanceShader)
 	LightingShader(ID3D11Device * device, ID3D11DeviceContext * context, HWND hwnd, WCHAR * ps, bool);
 
 	virtual void initShader(WCHAR* vsFilename, WCHAR* psFilename) override;
 
+	// Replace the contents of a dynamic constant buffer, and count the upload
+	template <typename T>
+	void upload(CommandBackend& commands, UploadState& state, ID3D11Buffer* buffer, const T& data)
+	{
+		commands.UpdateConstants(buffer, data);
+
+		++state.stats.maps;
+		state.stats.bytes += sizeof(T);
+	}
+
+	// Upload constants that only one draw uses, and bind them to a single slot (see CommandBackend::SetDrawConstants)
+	template <typename T>
+	void uploadDrawConstants(CommandBackend& commands, UploadState& state, CommandBackend::Stage stage, uint32_t slot, ID3D11Buffer* buffer, const T& data)
+	{
+		commands.SetDrawConstants(stage, slot, buffer, data);
+
+		++state.stats.maps;
+		state.stats.bytes += sizeof(T);
+	}
+
+	// Upload the light and camera buffers, if they changed since their last upload
+	void uploadSharedBuffers(CommandBackend& commands, UploadState& state, Camera* camera);
+
+	// Upload the material buffer, if it changed since its last upload
+	void uploadMaterial(CommandBackend& commands, UploadState& state, bool useHeightMap);
+
 	ID3D11Buffer* lightBuffer = nullptr;
 	ID3D11Buffer* fogBuffer = nullptr;
 	ID3D11Buffer* cameraBuffer = nullptr;
@@ -80,6 +162,16 @@ protected:
 	XMFLOAT4 mFogColour;
 	float mFogMin = 0.f, mFogRange = 0.f;
 
+	// Bumped whenever the lights (including the ambient) or the fog may have changed. The fog is only uploaded by the
+	// shader itself, so its uploaded version is kept here
+	unsigned lightVersion = 1, fogVersion = 1;
+	unsigned uploadedFogVersion = 0;
+
+	bool skipUnchanged = true;
+
+	// What the shader's own draws uploaded
+	UploadState uploads;
+
 private:
 	// The "actual" initShader function. Made private so that it will not be accidentally used by derived classes,
 	// such as the InstanceShader
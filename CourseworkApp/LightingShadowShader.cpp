@@ -2,6 +2,7 @@
 #include "..\DXFramework\Light.h"
 #include "..\DXFramework\Camera.h"
 #include "Utility.h"
+#include "D3D11Backend.h"
 
 LightingShadowShader::LightingShadowShader(ID3D11Device* device, ID3D11DeviceContext* context, HWND hwnd, WCHAR* vs, WCHAR* ps)
 	: LightingShader(device, context, hwnd, vs, ps)
@@ -17,38 +18,20 @@ LightingShadowShader::~LightingShadowShader()
 
 void XM_CALLCONV LightingShadowShader::setShaderParameters(ID3D11DeviceContext* context, FXMMATRIX world, CXMMATRIX view, CXMMATRIX proj, CXMMATRIX shadowTransform, Camera* camera, ID3D11ShaderResourceView* texture, ID3D11ShaderResourceView* shadowMap)
 {
-	D3D11_MAPPED_SUBRESOURCE map;
-	context->Map(matrixBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &map);
+	D3D11Backend backend(context);
 
 	// Update matrix buffer
-	MatrixBufferType* matrixPtr = static_cast<MatrixBufferType*>(map.pData);
-	matrixPtr->world = world;
-	matrixPtr->view = view;
-	matrixPtr->projection = proj;
+	MatrixBufferType matrices;
+	matrices.world = world;
+	matrices.view = view;
+	matrices.projection = proj;
 
-	matrixPtr->shadowTransform = shadowTransform;
+	matrices.shadowTransform = shadowTransform;
 
-	context->Unmap(matrixBuffer, 0);
+	upload(backend, uploads, matrixBuffer, matrices);
 
-	// Update light buffer
-	context->Map(lightBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &map);
-
-	LightBufferType* lightPtr = static_cast<LightBufferType*>(map.pData);
-
-	lightPtr->globalAmbient = mAmbient;
-	
-	memcpy_s(lightPtr->lights, sizeof(ShaderLight) * MAX_LIGHTS, lights, sizeof(ShaderLight) * MAX_LIGHTS);
-
-	context->Unmap(lightBuffer, 0);
-
-	// Update camera buffer
-	context->Map(cameraBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &map);
-
-	CameraBufferType* cameraPtr = static_cast<CameraBufferType*>(map.pData);
-	ZeroMemory(cameraPtr, sizeof(CameraBufferType));
-	cameraPtr->position = camera->getPosition();
-
-	context->Unmap(cameraBuffer, 0);
+	// Update light and camera buffers, if they changed
+	uploadSharedBuffers(backend, uploads, camera);
 
 	// 'Dispatch' constant buffer
 	ID3D11Buffer* vsBuffers[2] = { matrixBuffer, cameraBuffer };
@@ -0,0 +1,1033 @@
+#include "LinearBVH.h"
+#include "OcclusionBuffer.h"
+#include "MortonBuilder.h"
+#include "InstanceSpan.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+
+namespace
+{
+	// Cost of traversing an internal node, relative to testing a single object
+	constexpr float TRAVERSAL_COST = 1.f;
+
+	float GetAxis(const XMFLOAT3& v, int axis) { return (&v.x)[axis]; }
+
+	// Half the surface area of a box, which is all the SAH needs since it only compares ratios of areas
+	float HalfArea(FXMVECTOR boundsMin, FXMVECTOR boundsMax)
+	{
+		XMFLOAT3 size;
+		XMStoreFloat3(&size, XMVectorMax(boundsMax - boundsMin, XMVectorZero()));
+
+		return size.x * size.y + size.y * size.z + size.z * size.x;
+	}
+
+	void StoreExtent(LinearBVH::Node& node, FXMVECTOR boundsMin, FXMVECTOR boundsMax)
+	{
+		XMStoreFloat3(&node.center, (boundsMin + boundsMax) * 0.5f);
+		XMStoreFloat3(&node.extents, (boundsMax - boundsMin) * 0.5f);
+	}
+
+	void MergeExtent(XMVECTOR& boundsMin, XMVECTOR& boundsMax, const XMFLOAT3& center, const XMFLOAT3& extents)
+	{
+		XMVECTOR c = XMLoadFloat3(&center);
+		XMVECTOR e = XMLoadFloat3(&extents);
+
+		boundsMin = XMVectorMin(boundsMin, c - e);
+		boundsMax = XMVectorMax(boundsMax, c + e);
+	}
+
+	constexpr char CACHE_MAGIC[4] = { 'L', 'B', 'V', 'H' };
+
+	size_t AlignUp(size_t offset, size_t alignment)
+	{
+		return (offset + alignment - 1) / alignment * alignment;
+	}
+
+	// 64-bit FNV-1a
+	constexpr uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+	constexpr uint64_t FNV_PRIME = 1099511628211ull;
+
+	// Hashes 32-bit words rather than bytes, as everything hashed is made of floats and ints. Quarter the work on
+	// scenes of millions of objects, where hashing has to stay well below the cost of building
+	uint64_t Hash(uint64_t hash, const void* data, size_t size)
+	{
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+
+		for (size_t i = 0; i + sizeof(uint32_t) <= size; i += sizeof(uint32_t))
+		{
+			uint32_t word;
+			std::memcpy(&word, bytes + i, sizeof(word));
+
+			hash = (hash ^ word) * FNV_PRIME;
+		}
+
+		return hash;
+	}
+
+	// Index of the bin an object's centre falls into along an axis
+	int GetBin(float centroid, float centroidMin, float binScale)
+	{
+		int bin = static_cast<int>((centroid - centroidMin) * binScale);
+		return std::min(std::max(bin, 0), LinearBVH::NUM_BINS - 1);
+	}
+}
+
+LinearBVH::LinearBVH(MeshInstance* const meshes, int count)
+	:	mMeshes(meshes)
+{
+	// A leaf is identified by having a non-zero object count, so the hierarchy cannot be empty
+	assert(count > 0);
+
+	mObjectStorage.resize(count);
+	mObjects = mObjectStorage.data();
+	mNumObjects = (uint32_t) count;
+
+	for (int i = 0; i < count; ++i)
+	{
+		// Build the hierarchy in world space
+		BoundingBox boundingBox = meshes[i].GetBoundingBox();
+		boundingBox.Transform(mObjects[i].extent, meshes[i].GetWorldMatrix());
+
+		mObjects[i].meshIdx = (uint32_t) i;
+	}
+
+	// A binary tree with at least one object per leaf never has more than 2n - 1 nodes
+	// Reserving that many up front means mNodes stays valid while nodes are appended
+	mNodeStorage.reserve(2 * count - 1);
+	mNodes = mNodeStorage.data();
+
+	Build(0, count, 0);
+
+	mNumNodes = (uint32_t) mNodeStorage.size();
+	mRejectingPlanes.assign(mNumNodes * CullingFrustum::MAX_CACHED_VIEWS, CullingFrustum::NO_PLANE);
+	FitMinObjectSizes();
+
+	// Building reorders the objects, so remember where each mesh ended up
+	mObjectSlotStorage.resize(count);
+	mObjectSlots = mObjectSlotStorage.data();
+
+	for (int i = 0; i < count; ++i)
+		mObjectSlots[mObjects[i].meshIdx] = i;
+}
+
+std::shared_ptr<LinearBVH> LinearBVH::LoadCache(const std::string& filename, MeshInstance* const meshes, int count)
+{
+	std::shared_ptr<LinearBVH> bvh(new LinearBVH(meshes));
+
+	if (count <= 0 || !bvh->mCacheFile.Open(filename))
+		return nullptr;
+
+	char* data = bvh->mCacheFile.GetData();
+	const size_t size = bvh->mCacheFile.GetSize();
+
+	if (size < sizeof(CacheHeader))
+		return nullptr;
+
+	CacheHeader header;
+	std::memcpy(&header, data, sizeof(CacheHeader));
+
+	if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header.version != CACHE_VERSION ||
+		header.nodeSize != sizeof(Node) || header.objectSize != sizeof(Object))
+		return nullptr;
+
+	if (header.numObjects != (uint32_t) count || header.numNodes == 0 || header.numNodes > 2 * header.numObjects - 1)
+		return nullptr;
+
+	// A file cut short (e.g. by a crash while saving) must not be read past its end
+	const bool isAligned = header.nodesOffset % CACHE_ALIGNMENT == 0 && header.objectsOffset % CACHE_ALIGNMENT == 0 && header.objectSlotsOffset % CACHE_ALIGNMENT == 0;
+	const bool isInside = header.nodesOffset + header.numNodes * sizeof(Node) <= size && header.objectsOffset + header.numObjects * sizeof(Object) <= size &&
+		header.objectSlotsOffset + header.numObjects * sizeof(uint32_t) <= size;
+
+	if (!isAligned || !isInside)
+		return nullptr;
+
+	if (header.transformHash != HashTransforms(meshes, count))
+		return nullptr;
+
+	// Use the arrays in place. The mapping is copy-on-write, so refitting only touches this process' copy
+	bvh->mNodes = reinterpret_cast<Node*>(data + header.nodesOffset);
+	bvh->mNumNodes = header.numNodes;
+	bvh->mObjects = reinterpret_cast<Object*>(data + header.objectsOffset);
+	bvh->mNumObjects = header.numObjects;
+	bvh->mObjectSlots = reinterpret_cast<uint32_t*>(data + header.objectSlotsOffset);
+	bvh->mBuildCost = header.buildCost;
+
+	// The hash only covers the meshes, not the payload, so a damaged file could still send traversal outside the
+	// arrays. Every node has to be reached exactly once and every object has to be in exactly one leaf
+	uint32_t nextNode = 0, nextObject = 0;
+
+	if (!bvh->CheckLayout(0, 0, nextNode, nextObject) || nextNode != bvh->mNumNodes || nextObject != bvh->mNumObjects)
+		return nullptr;
+
+	for (uint32_t i = 0; i < bvh->mNumObjects; ++i)
+	{
+		const uint32_t meshIdx = bvh->mObjects[i].meshIdx;
+
+		if (meshIdx >= bvh->mNumObjects || bvh->mObjectSlots[meshIdx] != i)
+			return nullptr;
+	}
+
+	bvh->mRejectingPlanes.assign(header.numNodes * CullingFrustum::MAX_CACHED_VIEWS, CullingFrustum::NO_PLANE);
+	bvh->mParentsLinked = false;
+	bvh->FitMinObjectSizes();
+
+	return bvh;
+}
+
+std::shared_ptr<LinearBVH> LinearBVH::BuildMorton(MeshInstance* const meshes, int count, WorkerPool* pool)
+{
+	assert(count > 0);
+
+	std::shared_ptr<LinearBVH> bvh(new LinearBVH(meshes));
+	bvh->mNumObjects = (uint32_t) count;
+	bvh->RebuildMorton(pool);
+
+	return bvh;
+}
+
+void LinearBVH::RebuildMorton(WorkerPool* pool)
+{
+	if (!mMortonBuilder)
+		mMortonBuilder = std::make_shared<MortonBuilder>();
+
+	// The arrays are rebuilt in storage of their own
+	mCacheFile.Close();
+
+	mMortonBuilder->Build(mMeshes, (int) mNumObjects, pool, mNodeStorage, mObjectStorage);
+
+	mNodes = mNodeStorage.data();
+	mNumNodes = (uint32_t) mNodeStorage.size();
+	mObjects = mObjectStorage.data();
+
+	mObjectSlotStorage.resize(mNumObjects);
+	mObjectSlots = mObjectSlotStorage.data();
+
+	for (uint32_t i = 0; i < mNumObjects; ++i)
+		mObjectSlots[mObjects[i].meshIdx] = i;
+
+	// Node indices mean something else in the new tree
+	mRejectingPlanes.assign(mNumNodes * CullingFrustum::MAX_CACHED_VIEWS, CullingFrustum::NO_PLANE);
+	mParentsLinked = false;
+	FitMinObjectSizes();
+
+	mBuildCost = (int) (mNumNodes + mNumObjects);
+}
+
+bool LinearBVH::SaveCache(const std::string& filename) const
+{
+	CacheHeader header = {};
+	std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	header.version = CACHE_VERSION;
+	header.transformHash = HashTransforms(mMeshes, (int) mNumObjects);
+	header.nodeSize = sizeof(Node);
+	header.objectSize = sizeof(Object);
+	header.numNodes = mNumNodes;
+	header.numObjects = mNumObjects;
+	header.buildCost = mBuildCost;
+
+	header.nodesOffset = AlignUp(sizeof(CacheHeader), CACHE_ALIGNMENT);
+	header.objectsOffset = AlignUp(header.nodesOffset + mNumNodes * sizeof(Node), CACHE_ALIGNMENT);
+	header.objectSlotsOffset = AlignUp(header.objectsOffset + mNumObjects * sizeof(Object), CACHE_ALIGNMENT);
+
+	std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+	if (!file)
+		return false;
+
+	const char padding[CACHE_ALIGNMENT] = {};
+
+	const auto Write = [&](uint64_t offset, const void* data, size_t size)
+	{
+		file.write(padding, static_cast<std::streamsize>(offset - static_cast<uint64_t>(file.tellp())));
+		file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+	};
+
+	Write(0, &header, sizeof(CacheHeader));
+	Write(header.nodesOffset, mNodes, mNumNodes * sizeof(Node));
+	Write(header.objectsOffset, mObjects, mNumObjects * sizeof(Object));
+	Write(header.objectSlotsOffset, mObjectSlots, mNumObjects * sizeof(uint32_t));
+
+	return static_cast<bool>(file);
+}
+
+uint64_t LinearBVH::HashTransforms(const MeshInstance* meshes, int count)
+{
+	uint64_t hash = Hash(FNV_OFFSET_BASIS, &count, sizeof(count));
+
+	for (int i = 0; i < count; ++i)
+	{
+		const XMFLOAT3 position = meshes[i].GetPosition();
+		const XMFLOAT4 rotation = meshes[i].GetRotation();
+		const XMFLOAT3 scale = meshes[i].GetScale();
+		const BoundingBox& boundingBox = meshes[i].GetBoundingBox();
+
+		hash = Hash(hash, &position, sizeof(position));
+		hash = Hash(hash, &rotation, sizeof(rotation));
+		hash = Hash(hash, &scale, sizeof(scale));
+		hash = Hash(hash, &boundingBox.Center, sizeof(boundingBox.Center));
+		hash = Hash(hash, &boundingBox.Extents, sizeof(boundingBox.Extents));
+	}
+
+	return hash;
+}
+
+int LinearBVH::GetVisibleGeometry(const CullingFrustum& frustum, std::vector<MeshInstance*>& visibleInstances, const OcclusionBuffer* occlusion) const
+{
+	mCullingStats = CullingStats();
+	mCullingStats.nodesVisited = 1;
+	mCullingStats.planeTests = CullingFrustum::NUM_PLANES;
+
+	CullingFrustum::BoxBatch batch;
+	batch.Add(mNodes[0].center, mNodes[0].extents);
+
+	CullingFrustum::BatchResult result;
+
+	uint32_t visible = frustum.Test(batch, CullingFrustum::ALL_PLANES, result);
+	mCullingStats.smallBoxes += frustum.CullSmallBoxes(batch, visible);
+
+	if (!visible)
+		return 0;
+
+	const uint32_t planeMask = mPlaneMasking ? result.undecidedPlanes[0] : CullingFrustum::ALL_PLANES;
+
+	const size_t firstVisible = visibleInstances.size();
+	mCullingStats += CullSubtree(frustum, 0, planeMask, visibleInstances, occlusion);
+
+	return (int) (visibleInstances.size() - firstVisible);
+}
+
+template <typename Output>
+CullingStats LinearBVH::CullSubtree(const CullingFrustum& frustum, uint32_t rootIdx, uint32_t planeMask, Output& visibleInstances, const OcclusionBuffer* occlusion) const
+{
+	CullingStats stats;
+
+	// Depth-first traversal. Only nodes that are known to intersect the frustum are pushed, along with the planes
+	// they intersect. The build caps the depth of the tree, so the stack can live on the stack
+	struct StackEntry
+	{
+		uint32_t nodeIdx;
+		uint32_t planeMask;
+	};
+
+	StackEntry stack[MAX_DEPTH + 2];
+	int stackSize = 0;
+
+	stack[stackSize++] = { rootIdx, planeMask };
+
+	CullingFrustum::BoxBatch batch;
+	CullingFrustum::BatchResult result;
+
+	while (stackSize > 0)
+	{
+		const StackEntry entry = stack[--stackSize];
+		const Node& node = mNodes[entry.nodeIdx];
+
+		// Fully inside the frustum, so everything below it is visible (unless it is occluded, or too small to
+		// be drawn even at the node's furthest corner)
+		if (entry.planeMask == 0 && !occlusion && frustum.IsAboveMinScreenSize(node.center, node.extents, mMinObjectSizes[entry.nodeIdx]))
+		{
+			AcceptSubtree(entry.nodeIdx, visibleInstances);
+			continue;
+		}
+
+		if (node.IsLeaf())
+		{
+			// Frustum check geometry, a batch at a time
+			for (uint32_t first = node.offset; first < node.offset + node.count; first += CullingFrustum::BATCH_SIZE)
+			{
+				const uint32_t last = std::min(first + CullingFrustum::BATCH_SIZE, node.offset + node.count);
+
+				batch.Clear();
+				for (uint32_t i = first; i < last; ++i)
+					batch.Add(mObjects[i].extent);
+
+				stats.planeTests += batch.count * CullingFrustum::CountPlanes(entry.planeMask);
+
+				uint32_t visible = frustum.Test(batch, entry.planeMask, result);
+				stats.smallBoxes += frustum.CullSmallBoxes(batch, visible);
+
+				for (; visible; visible &= visible - 1)
+				{
+					const Object& object = mObjects[first + CullingFrustum::LowestBit(visible)];
+
+					if (occlusion && occlusion->IsOccluded(object.extent))
+					{
+						++stats.occludedBoxes;
+						continue;
+					}
+
+					visibleInstances.push_back(GetInstance(object));
+				}
+			}
+		}
+		else
+		{
+			uint32_t children[2];
+			uint32_t childMasks[2];
+			const int numChildren = GetVisibleChildren(frustum, entry.nodeIdx, entry.planeMask, children, childMasks, stats, occlusion);
+
+			// Push the second child first, so the first child (which directly follows its parent in memory) is visited next
+			for (int i = numChildren - 1; i >= 0; --i)
+				stack[stackSize++] = { children[i], childMasks[i] };
+		}
+	}
+
+	return stats;
+}
+
+int LinearBVH::GetVisibleChildren(const CullingFrustum& frustum, uint32_t nodeIdx, uint32_t planeMask, uint32_t children[2], uint32_t childMasks[2], CullingStats& stats, const OcclusionBuffer* occlusion) const
+{
+	const Node& node = mNodes[nodeIdx];
+	assert(!node.IsLeaf());
+
+	const uint32_t childIndices[2] = { nodeIdx + 1, node.offset };
+
+	CullingFrustum::BoxBatch batch;
+	uint32_t batchChildren[2];
+
+	stats.nodesVisited += 2;
+
+	for (uint32_t childIdx : childIndices)
+	{
+		const Node& child = mNodes[childIdx];
+
+		// A view moves little from one frame to the next, so the plane that rejected a node last time
+		// is likely to reject it again. Try it on its own before testing the remaining planes
+		const uint32_t cachedPlane = mRejectingPlanes[childIdx * CullingFrustum::MAX_CACHED_VIEWS + frustum.GetViewId()];
+
+		if (mPlaneMasking && cachedPlane != CullingFrustum::NO_PLANE && (planeMask & (1u << cachedPlane)))
+		{
+			++stats.planeTests;
+
+			if (frustum.IsOutside(child.center, child.extents, cachedPlane))
+				continue;
+		}
+
+		batchChildren[batch.count] = childIdx;
+		batch.Add(child.center, child.extents);
+	}
+
+	if (batch.count == 0)
+		return 0;
+
+	// Test the remaining children at once
+	CullingFrustum::BatchResult result;
+	uint32_t visible = frustum.Test(batch, planeMask, result);
+	stats.smallBoxes += frustum.CullSmallBoxes(batch, visible);
+
+	stats.planeTests += batch.count * CullingFrustum::CountPlanes(planeMask);
+
+	int numChildren = 0;
+
+	for (int lane = 0; lane < batch.count; ++lane)
+	{
+		mRejectingPlanes[batchChildren[lane] * CullingFrustum::MAX_CACHED_VIEWS + frustum.GetViewId()] = static_cast<uint8_t>(result.rejectingPlane[lane]);
+
+		if (!(visible & (1u << lane)))
+			continue;
+
+		if (occlusion && occlusion->IsOccluded(mNodes[batchChildren[lane]].GetExtent()))
+		{
+			++stats.occludedBoxes;
+			continue;
+		}
+
+		children[numChildren] = batchChildren[lane];
+		childMasks[numChildren] = mPlaneMasking ? result.undecidedPlanes[lane] : CullingFrustum::ALL_PLANES;
+		++numChildren;
+	}
+
+	return numChildren;
+}
+
+CullingStats LinearBVH::CullMultiView(const MultiViewFrustum& frustum, uint32_t rootIdx, const MultiViewFrustum::ViewMask& rootMask, MultiViewVisibility& visibility) const
+{
+	CullingStats stats;
+
+	// Same traversal as CullSubtree, so every view's objects come out in the same order as a query for that view alone
+	struct StackEntry
+	{
+		uint32_t nodeIdx;
+		MultiViewFrustum::ViewMask mask;
+	};
+
+	StackEntry stack[MAX_DEPTH + 2];
+	int stackSize = 0;
+
+	stack[stackSize++] = { rootIdx, rootMask };
+
+	CullingFrustum::BoxBatch batch;
+	MultiViewFrustum::ViewMask results[CullingFrustum::BATCH_SIZE];
+
+	while (stackSize > 0)
+	{
+		const StackEntry entry = stack[--stackSize];
+		const Node& node = mNodes[entry.nodeIdx];
+
+		// Fully inside every view it is visible in
+		if (MultiViewFrustum::IsInside(entry.mask))
+		{
+			AcceptSubtree(entry.nodeIdx, entry.mask.views, visibility);
+			continue;
+		}
+
+		if (node.IsLeaf())
+		{
+			for (uint32_t first = node.offset; first < node.offset + node.count; first += CullingFrustum::BATCH_SIZE)
+			{
+				const uint32_t last = std::min(first + CullingFrustum::BATCH_SIZE, node.offset + node.count);
+
+				batch.Clear();
+				for (uint32_t i = first; i < last; ++i)
+					batch.Add(mObjects[i].extent);
+
+				frustum.Test(batch, entry.mask, mPlaneMasking, results, stats);
+
+				for (int lane = 0; lane < batch.count; ++lane)
+				{
+					if (!results[lane].views)
+						continue;
+
+					MeshInstance* instance = GetInstance(mObjects[first + lane]);
+					visibility.Add(instance, (uint32_t) (instance - mMeshes), results[lane].views);
+				}
+			}
+		}
+		else
+		{
+			const uint32_t childIndices[2] = { entry.nodeIdx + 1, node.offset };
+
+			batch.Clear();
+			for (uint32_t childIdx : childIndices)
+				batch.Add(mNodes[childIdx].center, mNodes[childIdx].extents);
+
+			stats.nodesVisited += 2;
+			frustum.Test(batch, entry.mask, mPlaneMasking, results, stats);
+
+			// Push the second child first, so the first child is visited next
+			for (int i = 1; i >= 0; --i)
+			{
+				if (results[i].views)
+					stack[stackSize++] = { childIndices[i], results[i] };
+			}
+		}
+	}
+
+	return stats;
+}
+
+CullingStats LinearBVH::Raycast(const Ray& ray, RayQueryMode mode, RayHit& hit) const
+{
+	CullingStats stats;
+	stats.nodesVisited = 1;
+
+	hit = RayHit();
+	PreparedRay preparedRay(ray);
+
+	// Nodes the ray enters, along with the distance it enters them at
+	struct StackEntry
+	{
+		uint32_t nodeIdx;
+		float tNear;
+	};
+
+	StackEntry stack[MAX_DEPTH + 2];
+	int stackSize = 0;
+
+	float tNear;
+	if (!preparedRay.Intersect(mNodes[0].center, mNodes[0].extents, tNear))
+		return stats;
+
+	stack[stackSize++] = { 0, tNear };
+
+	while (stackSize > 0)
+	{
+		const StackEntry entry = stack[--stackSize];
+		const Node& node = mNodes[entry.nodeIdx];
+
+		// Something closer has been hit since the node was pushed
+		if (entry.tNear > preparedRay.GetMaxDistance())
+			continue;
+
+		if (node.IsLeaf())
+		{
+			for (uint32_t i = node.offset; i < node.offset + node.count; ++i)
+			{
+				const BoundingBox& extent = mObjects[i].extent;
+
+				if (!preparedRay.Intersect(extent.Center, extent.Extents, tNear) || tNear >= hit.distance)
+					continue;
+
+				hit.instance = GetInstance(mObjects[i]);
+				hit.distance = tNear;
+
+				if (mode == RayQueryMode::ANY_HIT)
+					return stats;
+
+				preparedRay.SetMaxDistance(tNear);
+			}
+		}
+		else
+		{
+			const uint32_t children[2] = { entry.nodeIdx + 1, node.offset };
+			float childNear[2];
+			bool childHit[2];
+
+			for (int i = 0; i < 2; ++i)
+				childHit[i] = preparedRay.Intersect(mNodes[children[i]].center, mNodes[children[i]].extents, childNear[i]);
+
+			stats.nodesVisited += 2;
+
+			// Push the further child first, so that the nearer one is visited next
+			const int nearest = (childHit[1] && (!childHit[0] || childNear[1] < childNear[0])) ? 1 : 0;
+			const int furthest = 1 - nearest;
+
+			if (childHit[furthest])
+				stack[stackSize++] = { children[furthest], childNear[furthest] };
+
+			if (childHit[nearest])
+				stack[stackSize++] = { children[nearest], childNear[nearest] };
+		}
+	}
+
+	return stats;
+}
+
+CullingStats LinearBVH::Raycast(RayPacket& packet, RayQueryMode mode, RayHit hits[RayPacket::MAX_SIZE]) const
+{
+	CullingStats stats;
+	stats.nodesVisited = 1;
+
+	for (int i = 0; i < packet.GetCount(); ++i)
+		hits[i] = RayHit();
+
+	// Rays that are still looking for a hit. With RayQueryMode::ANY_HIT, a ray drops out as soon as it hits something
+	uint32_t searchingRays = packet.GetAllRays();
+
+	// Nodes entered by at least one ray, along with the rays that enter them
+	struct StackEntry
+	{
+		uint32_t nodeIdx;
+		uint32_t rays;
+	};
+
+	StackEntry stack[MAX_DEPTH + 2];
+	int stackSize = 0;
+
+	float tNear[RayPacket::MAX_SIZE];
+
+	const uint32_t rootRays = packet.Intersect(mNodes[0].center, mNodes[0].extents, searchingRays, tNear);
+	if (!rootRays)
+		return stats;
+
+	stack[stackSize++] = { 0, rootRays };
+
+	while (stackSize > 0)
+	{
+		const StackEntry entry = stack[--stackSize];
+		const Node& node = mNodes[entry.nodeIdx];
+
+		uint32_t rays = entry.rays & searchingRays;
+		if (!rays)
+			continue;
+
+		if (node.IsLeaf())
+		{
+			for (uint32_t i = node.offset; i < node.offset + node.count && rays; ++i)
+			{
+				const BoundingBox& extent = mObjects[i].extent;
+
+				for (uint32_t hitRays = packet.Intersect(extent.Center, extent.Extents, rays, tNear); hitRays; hitRays &= hitRays - 1)
+				{
+					const uint32_t ray = CullingFrustum::LowestBit(hitRays);
+
+					if (tNear[ray] >= hits[ray].distance)
+						continue;
+
+					hits[ray].instance = GetInstance(mObjects[i]);
+					hits[ray].distance = tNear[ray];
+					packet.SetMaxDistance(ray, tNear[ray]);
+
+					if (mode == RayQueryMode::ANY_HIT)
+					{
+						searchingRays &= ~(1u << ray);
+						rays &= ~(1u << ray);
+					}
+				}
+			}
+
+			if (!searchingRays)
+				return stats;
+		}
+		else
+		{
+			const uint32_t children[2] = { entry.nodeIdx + 1, node.offset };
+			uint32_t childRays[2];
+			float childNear[2];
+
+			for (int i = 0; i < 2; ++i)
+			{
+				childRays[i] = packet.Intersect(mNodes[children[i]].center, mNodes[children[i]].extents, rays, tNear);
+
+				// Children are ordered by the closest distance any of the packet's rays enter them at
+				childNear[i] = FLT_MAX;
+				for (uint32_t hitRays = childRays[i]; hitRays; hitRays &= hitRays - 1)
+					childNear[i] = std::min(childNear[i], tNear[CullingFrustum::LowestBit(hitRays)]);
+			}
+
+			stats.nodesVisited += 2;
+
+			// Push the further child first, so that the nearer one is visited next
+			const int nearest = (childNear[1] < childNear[0]) ? 1 : 0;
+			const int furthest = 1 - nearest;
+
+			if (childRays[furthest])
+				stack[stackSize++] = { children[furthest], childRays[furthest] };
+
+			if (childRays[nearest])
+				stack[stackSize++] = { children[nearest], childRays[nearest] };
+		}
+	}
+
+	return stats;
+}
+
+bool LinearBVH::CheckLayout(uint32_t nodeIdx, int depth, uint32_t& nextNode, uint32_t& nextObject) const
+{
+	if (nodeIdx != nextNode || nodeIdx >= mNumNodes || depth > MAX_DEPTH)
+		return false;
+
+	const Node& node = mNodes[nodeIdx];
+	++nextNode;
+
+	if (node.IsLeaf())
+	{
+		if (node.offset != nextObject || node.count > mNumObjects - nextObject)
+			return false;
+
+		nextObject += node.count;
+		return true;
+	}
+
+	// The second child has to follow the whole subtree of the first
+	return CheckLayout(nodeIdx + 1, depth + 1, nextNode, nextObject) && CheckLayout(node.offset, depth + 1, nextNode, nextObject);
+}
+
+void LinearBVH::GetSubtreeRange(uint32_t nodeIdx, uint32_t& first, uint32_t& last) const
+{
+	// The objects below a node form a contiguous range, from the first object of its leftmost leaf up to the
+	// last object of its rightmost leaf
+	uint32_t firstLeaf = nodeIdx;
+	while (!mNodes[firstLeaf].IsLeaf())
+		firstLeaf = firstLeaf + 1;
+
+	uint32_t lastLeaf = nodeIdx;
+	while (!mNodes[lastLeaf].IsLeaf())
+		lastLeaf = mNodes[lastLeaf].offset;
+
+	first = mNodes[firstLeaf].offset;
+	last = mNodes[lastLeaf].offset + mNodes[lastLeaf].count;
+}
+
+template <typename Output>
+void LinearBVH::AcceptSubtree(uint32_t nodeIdx, Output& visibleInstances) const
+{
+	uint32_t first, last;
+	GetSubtreeRange(nodeIdx, first, last);
+
+	for (uint32_t i = first; i < last; ++i)
+		visibleInstances.push_back(GetInstance(mObjects[i]));
+}
+
+void LinearBVH::AcceptSubtree(uint32_t nodeIdx, uint32_t views, MultiViewVisibility& visibility) const
+{
+	uint32_t first, last;
+	GetSubtreeRange(nodeIdx, first, last);
+
+	for (uint32_t i = first; i < last; ++i)
+		visibility.Add(GetInstance(mObjects[i]), mObjects[i].meshIdx, views);
+}
+
+int LinearBVH::Refit(MeshInstance* const* movedInstances, int count)
+{
+	// Nothing is written, so a mapped hierarchy is not copied either
+	if (count == 0)
+		return 0;
+
+	if (!mParentsLinked)
+		LinkParents();
+
+	mDirtyNodes.clear();
+
+	for (int i = 0; i < count; ++i)
+	{
+		const uint32_t slot = mObjectSlots[movedInstances[i] - mMeshes];
+		Object& object = mObjects[slot];
+
+		const MeshInstance* instance = GetInstance(object);
+
+		BoundingBox boundingBox = instance->GetBoundingBox();
+		boundingBox.Transform(object.extent, instance->GetWorldMatrix());
+
+		// Mark the path up to the root, stopping where another object's path already joined it
+		for (uint32_t nodeIdx = mObjectLeaves[slot]; nodeIdx != NO_PARENT && !mIsDirty[nodeIdx]; nodeIdx = mParents[nodeIdx])
+		{
+			mIsDirty[nodeIdx] = 1;
+			mDirtyNodes.push_back(nodeIdx);
+		}
+	}
+
+	// Children are always stored after their parent, so refitting in descending order of index goes bottom-up
+	std::sort(mDirtyNodes.begin(), mDirtyNodes.end(), [](uint32_t a, uint32_t b) { return a > b; });
+
+	for (uint32_t nodeIdx : mDirtyNodes)
+	{
+		FitExtent(mNodes[nodeIdx], nodeIdx);
+		mIsDirty[nodeIdx] = 0;
+	}
+
+	return (int) mDirtyNodes.size();
+}
+
+void LinearBVH::LinkParents()
+{
+	mParents.assign(mNumNodes, NO_PARENT);
+	mObjectLeaves.resize(mNumObjects);
+	mIsDirty.assign(mNumNodes, 0);
+
+	for (uint32_t nodeIdx = 0; nodeIdx < mNumNodes; ++nodeIdx)
+	{
+		const Node& node = mNodes[nodeIdx];
+
+		if (node.IsLeaf())
+		{
+			for (uint32_t i = node.offset; i < node.offset + node.count; ++i)
+				mObjectLeaves[i] = nodeIdx;
+		}
+		else
+		{
+			mParents[nodeIdx + 1] = nodeIdx;
+			mParents[node.offset] = nodeIdx;
+		}
+	}
+
+	mParentsLinked = true;
+}
+
+void LinearBVH::Build(int begin, int end, int depth)
+{
+	const uint32_t nodeIdx = (uint32_t) mNodeStorage.size();
+	mNodeStorage.emplace_back();
+
+	mNodes[nodeIdx].count = 0;
+	mNodes[nodeIdx].offset = 0;
+
+	// Calculate the bounds of the objects, as well as the bounds of their centres
+	XMVECTOR boundsMin = XMVectorReplicate(FLT_MAX);
+	XMVECTOR boundsMax = XMVectorReplicate(-FLT_MAX);
+	XMVECTOR centroidMin = boundsMin;
+	XMVECTOR centroidMax = boundsMax;
+
+	for (int i = begin; i < end; ++i)
+	{
+		MergeExtent(boundsMin, boundsMax, mObjects[i].extent.Center, mObjects[i].extent.Extents);
+
+		XMVECTOR centroid = XMLoadFloat3(&mObjects[i].extent.Center);
+		centroidMin = XMVectorMin(centroidMin, centroid);
+		centroidMax = XMVectorMax(centroidMax, centroid);
+	}
+
+	StoreExtent(mNodes[nodeIdx], boundsMin, boundsMax);
+
+	const int count = end - begin;
+	mBuildCost += 1 + count;
+
+	const auto MakeLeaf = [&]()
+	{
+		mNodes[nodeIdx].offset = begin;
+		mNodes[nodeIdx].count = count;
+	};
+
+	if (count <= 1 || depth >= MAX_DEPTH)
+	{
+		MakeLeaf();
+		return;
+	}
+
+	XMFLOAT3 cMin, cMax;
+	XMStoreFloat3(&cMin, centroidMin);
+	XMStoreFloat3(&cMax, centroidMax);
+
+	Split split = FindSplit(begin, end, cMin, cMax, HalfArea(boundsMin, boundsMax));
+
+	// Intersecting every object in a leaf costs one unit per object
+	if (count <= MAX_LEAF_SIZE && split.cost >= (float) count)
+	{
+		MakeLeaf();
+		return;
+	}
+
+	int mid = begin;
+
+	if (split.axis >= 0)
+	{
+		// Move the objects in the bins left of the split to the front of the range
+		const float centroidMinAxis = GetAxis(cMin, split.axis);
+		const float binScale = NUM_BINS / (GetAxis(cMax, split.axis) - centroidMinAxis);
+
+		Object* first = mObjects + begin;
+		Object* last = mObjects + end;
+
+		mid = begin + static_cast<int>(std::partition(first, last, [&](const Object& object)
+		{
+			return GetBin(GetAxis(object.extent.Center, split.axis), centroidMinAxis, binScale) <= split.bin;
+		}) - first);
+	}
+
+	// All centres are in the same place (or the split put everything on one side), so just halve the range
+	if (mid == begin || mid == end)
+		mid = begin + count / 2;
+
+	Build(begin, mid, depth + 1);
+
+	mNodes[nodeIdx].offset = (uint32_t) mNodeStorage.size();
+	Build(mid, end, depth + 1);
+}
+
+auto LinearBVH::FindSplit(int begin, int end, const XMFLOAT3& centroidMin, const XMFLOAT3& centroidMax, float parentArea) const -> Split
+{
+	struct Bin
+	{
+		int count = 0;
+		XMVECTOR boundsMin = XMVectorReplicate(FLT_MAX);
+		XMVECTOR boundsMax = XMVectorReplicate(-FLT_MAX);
+	};
+
+	Split best;
+
+	if (parentArea <= 0.f)
+		return best;
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		const float axisMin = GetAxis(centroidMin, axis);
+		const float axisExtent = GetAxis(centroidMax, axis) - axisMin;
+
+		// Every centre lies on the same plane along this axis, so it cannot be split
+		if (axisExtent <= 1e-6f)
+			continue;
+
+		const float binScale = NUM_BINS / axisExtent;
+
+		Bin bins[NUM_BINS];
+
+		for (int i = begin; i < end; ++i)
+		{
+			const BoundingBox& extent = mObjects[i].extent;
+			Bin& bin = bins[GetBin(GetAxis(extent.Center, axis), axisMin, binScale)];
+
+			++bin.count;
+			MergeExtent(bin.boundsMin, bin.boundsMax, extent.Center, extent.Extents);
+		}
+
+		// Sweep from the right to find the area and count on the right side of every split
+		float rightArea[NUM_BINS];
+		int rightCount[NUM_BINS];
+
+		XMVECTOR sweepMin = XMVectorReplicate(FLT_MAX);
+		XMVECTOR sweepMax = XMVectorReplicate(-FLT_MAX);
+		int sweepCount = 0;
+
+		for (int i = NUM_BINS - 1; i > 0; --i)
+		{
+			sweepMin = XMVectorMin(sweepMin, bins[i].boundsMin);
+			sweepMax = XMVectorMax(sweepMax, bins[i].boundsMax);
+			sweepCount += bins[i].count;
+
+			rightArea[i] = sweepCount ? HalfArea(sweepMin, sweepMax) : 0.f;
+			rightCount[i] = sweepCount;
+		}
+
+		// Sweep from the left, evaluating the SAH for a split after each bin
+		sweepMin = XMVectorReplicate(FLT_MAX);
+		sweepMax = XMVectorReplicate(-FLT_MAX);
+		sweepCount = 0;
+
+		for (int i = 0; i < NUM_BINS - 1; ++i)
+		{
+			sweepMin = XMVectorMin(sweepMin, bins[i].boundsMin);
+			sweepMax = XMVectorMax(sweepMax, bins[i].boundsMax);
+			sweepCount += bins[i].count;
+
+			if (sweepCount == 0 || rightCount[i + 1] == 0)
+				continue;
+
+			const float leftArea = HalfArea(sweepMin, sweepMax);
+			const float cost = TRAVERSAL_COST + (leftArea * sweepCount + rightArea[i + 1] * rightCount[i + 1]) / parentArea;
+
+			if (cost < best.cost)
+			{
+				best.axis = axis;
+				best.bin = i;
+				best.cost = cost;
+			}
+		}
+	}
+
+	return best;
+}
+
+void LinearBVH::FitExtent(Node& node, uint32_t nodeIdx)
+{
+	XMVECTOR boundsMin = XMVectorReplicate(FLT_MAX);
+	XMVECTOR boundsMax = XMVectorReplicate(-FLT_MAX);
+
+	if (node.IsLeaf())
+	{
+		for (uint32_t i = node.offset; i < node.offset + node.count; ++i)
+			MergeExtent(boundsMin, boundsMax, mObjects[i].extent.Center, mObjects[i].extent.Extents);
+	}
+	else
+	{
+		const Node& firstChild = mNodes[nodeIdx + 1];
+		const Node& secondChild = mNodes[node.offset];
+
+		MergeExtent(boundsMin, boundsMax, firstChild.center, firstChild.extents);
+		MergeExtent(boundsMin, boundsMax, secondChild.center, secondChild.extents);
+	}
+
+	StoreExtent(node, boundsMin, boundsMax);
+	FitMinObjectSize(nodeIdx);
+}
+
+void LinearBVH::FitMinObjectSizes()
+{
+	mMinObjectSizes.resize(mNumNodes);
+
+	// Children are always stored after their parent
+	for (uint32_t nodeIdx = mNumNodes; nodeIdx-- > 0; )
+		FitMinObjectSize(nodeIdx);
+}
+
+void LinearBVH::FitMinObjectSize(uint32_t nodeIdx)
+{
+	const Node& node = mNodes[nodeIdx];
+
+	if (!node.IsLeaf())
+	{
+		mMinObjectSizes[nodeIdx] = std::min(mMinObjectSizes[nodeIdx + 1], mMinObjectSizes[node.offset]);
+		return;
+	}
+
+	float minObjectSize = FLT_MAX;
+
+	for (uint32_t i = node.offset; i < node.offset + node.count; ++i)
+		minObjectSize = std::min(minObjectSize, XMVectorGetX(XMVector3LengthSq(XMLoadFloat3(&mObjects[i].extent.Extents))));
+
+	mMinObjectSizes[nodeIdx] = minObjectSize;
+}
+
+// BoundingVolume culls into either kind of output
+template CullingStats LinearBVH::CullSubtree(const CullingFrustum&, uint32_t, uint32_t, std::vector<MeshInstance*>&, const OcclusionBuffer*) const;
+template CullingStats LinearBVH::CullSubtree(const CullingFrustum&, uint32_t, uint32_t, InstanceSpan&, const OcclusionBuffer*) const;
@@ -0,0 +1,264 @@
+// A bounding volume hierarchy stored as a flat, depth-first array of nodes
+// Built top-down using the surface area heuristic (SAH), or from Morton codes when it is rebuilt every frame
+// (see MortonBuilder). Leaves reference contiguous ranges of objects, so traversing the hierarchy never has to chase
+// pointers or touch the heap
+// Nothing in the arrays depends on where they live in memory, so a built hierarchy can be saved to a cache file,
+// and later mapped straight back into memory instead of being rebuilt
+
+#pragma once
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+#include <vector>
+#include <cstdint>
+#include <cfloat>
+#include <string>
+#include <memory>
+
+#include "MeshInstance.h"
+#include "CullingFrustum.h"
+#include "MultiViewFrustum.h"
+#include "RayQuery.h"
+#include "MappedFile.h"
+
+class OcclusionBuffer;
+class MortonBuilder;
+class WorkerPool;
+
+using namespace DirectX;
+
+class LinearBVH
+{
+public:
+	// Objects per leaf is capped so that traversal does not degenerate into a linear scan
+	static constexpr int MAX_LEAF_SIZE = 4;
+
+	// Caps the traversal stack. Nodes at this depth are turned into leaves regardless of their size
+	static constexpr int MAX_DEPTH = 64;
+
+	// Number of bins used when evaluating the SAH along an axis
+	static constexpr int NUM_BINS = 16;
+
+	// A node is 32 bytes so that two of them fit in a cache line
+	struct Node
+	{
+		XMFLOAT3 center;
+
+		// Leaf: index of the node's first object
+		// Internal: index of the second child. The first child always directly follows its parent
+		uint32_t offset;
+
+		XMFLOAT3 extents;
+
+		// Number of objects in a leaf, 0 for internal nodes
+		uint32_t count;
+
+		bool IsLeaf() const { return count > 0; }
+
+		BoundingBox GetExtent() const { return BoundingBox(center, extents); }
+	};
+
+	static_assert(sizeof(Node) == 32, "LinearBVH::Node is expected to be 32 bytes");
+
+	// Object stored in the leaves of the BVH
+	struct Object
+	{
+		// Object's world-space bounding box
+		BoundingBox extent;
+
+		// Index of the object within the array of meshes the BVH was built from
+		uint32_t meshIdx = 0;
+	};
+
+	// Bumped whenever the layout of the cache file (or of Node or Object) changes
+	static constexpr uint32_t CACHE_VERSION = 1;
+
+	LinearBVH(MeshInstance* const meshes, int count);
+
+	// Map a hierarchy saved with LinearBVH::SaveCache. Returns nullptr if the file is missing, from another version,
+	// or was built from meshes whose transforms (or count) differ from these
+	static std::shared_ptr<LinearBVH> LoadCache(const std::string& filename, MeshInstance* const meshes, int count);
+
+	// Build with Morton codes instead of the SAH. Builds many times faster, at the cost of a somewhat looser tree
+	static std::shared_ptr<LinearBVH> BuildMorton(MeshInstance* const meshes, int count, WorkerPool* pool = nullptr);
+
+	// Rebuild the whole hierarchy from scratch with Morton codes, from the meshes' current transforms
+	// The build runs on the pool's workers if there is one, and reuses the memory of the previous build
+	void RebuildMorton(WorkerPool* pool = nullptr);
+
+	// Write the hierarchy to a cache file, keyed by the hash of the transforms it was built from
+	bool SaveCache(const std::string& filename) const;
+
+	// Hash of everything about the meshes that affects the hierarchy: their count, transforms and bounding boxes
+	static uint64_t HashTransforms(const MeshInstance* meshes, int count);
+
+	LinearBVH(const LinearBVH&) = delete;
+	LinearBVH& operator=(const LinearBVH&) = delete;
+
+	// Populates a vector with the objects whose bounding box is not outside the frustum
+	// Both children of a node, and the objects of a leaf, are tested against the frustum as one batch
+	// If an OcclusionBuffer is given, nodes and objects hidden behind its occluders are culled too
+	int GetVisibleGeometry(const CullingFrustum& frustum, std::vector<MeshInstance*>& visibleInstances, const OcclusionBuffer* occlusion = nullptr) const;
+
+	// Appends the visible objects below a node that is already known to intersect the frustum
+	// planeMask holds the planes the node intersects. Objects are appended in the same order as GetVisibleGeometry would
+	// Only the node's own subtree is touched, so disjoint subtrees may be culled on several threads at once
+	// Output is either a std::vector<MeshInstance*> or an InstanceSpan
+	template <typename Output>
+	CullingStats CullSubtree(const CullingFrustum& frustum, uint32_t rootIdx, uint32_t planeMask, Output& visibleInstances, const OcclusionBuffer* occlusion) const;
+
+	// Writes out the indices (and plane masks) of an internal node's children that intersect the frustum, in traversal order
+	int GetVisibleChildren(const CullingFrustum& frustum, uint32_t nodeIdx, uint32_t planeMask, uint32_t children[2], uint32_t childMasks[2], CullingStats& stats, const OcclusionBuffer* occlusion) const;
+
+	// Adds the objects below a node to the lists of the views they are visible in, testing each node against every
+	// view at once. rootMask holds the views the node is visible in. The cached rejecting planes belong to
+	// single-view queries, so they are neither used nor updated
+	CullingStats CullMultiView(const MultiViewFrustum& frustum, uint32_t rootIdx, const MultiViewFrustum::ViewMask& rootMask, MultiViewVisibility& visibility) const;
+
+	// Finds the nearest object whose bounding box the ray hits, or with RayQueryMode::ANY_HIT, the first one found
+	// Nodes are visited nearest first, and skipped once they are further away than the closest hit so far
+	CullingStats Raycast(const Ray& ray, RayQueryMode mode, RayHit& hit) const;
+
+	// As above, for a packet of rays traced together. A node is visited if any of the rays still looking for a hit
+	// enter it. The packet's max distances shrink as hits are found
+	CullingStats Raycast(RayPacket& packet, RayQueryMode mode, RayHit hits[RayPacket::MAX_SIZE]) const;
+
+	// When enabled, nodes only test the planes their parent intersects, whole subtrees inside the frustum are accepted
+	// without testing them, and every node first tries the plane that rejected it in the last query of the same view
+	void SetPlaneMasking(bool enabled) { mPlaneMasking = enabled; }
+
+	// Recalculate the extents of the given objects, and refit the nodes above them to match
+	// The topology of the tree is left untouched, so the quality of the tree degrades if objects move far
+	// Returns the number of nodes that were refitted, which is 0 if nothing moved
+	int Refit(MeshInstance* const* movedInstances, int count);
+
+	const Node* GetNodes() const { return mNodes; }
+	int GetNumNodes() const { return (int) mNumNodes; }
+
+	const Object* GetObjects() const { return mObjects; }
+	int GetNumObjects() const { return (int) mNumObjects; }
+
+	// Whether the hierarchy was mapped from a cache file rather than built
+	bool IsFromCache() const { return mCacheFile.IsOpen(); }
+
+	BoundingBox GetSceneExtent() const { return mNodes[0].GetExtent(); }
+
+	// Work done by the last call to GetVisibleGeometry
+	const CullingStats& GetCullingStats() const { return mCullingStats; }
+
+	// Nodes created + objects partitioned while building the hierarchy
+	int GetBuildCost() const { return mBuildCost; }
+
+private:
+	// Layout of a cache file. The arrays follow the header, each starting on a CACHE_ALIGNMENT boundary
+	struct CacheHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t transformHash;
+
+		// Checked as well as the version, in case the file was written by a build with a different layout
+		uint32_t nodeSize;
+		uint32_t objectSize;
+
+		uint32_t numNodes;
+		uint32_t numObjects;
+		int32_t buildCost;
+		uint32_t padding;
+
+		uint64_t nodesOffset;
+		uint64_t objectsOffset;
+		uint64_t objectSlotsOffset;
+	};
+
+	static constexpr size_t CACHE_ALIGNMENT = 64;
+
+	// Used by LoadCache. The arrays are pointed at the mapped file afterwards
+	explicit LinearBVH(MeshInstance* const meshes) : mMeshes(meshes) {}
+
+	MeshInstance* GetInstance(const Object& object) const { return mMeshes + object.meshIdx; }
+
+	// Recursively build the subtree containing objects [begin, end), appending its nodes depth-first
+	void Build(int begin, int end, int depth);
+
+	// Candidate split of a node, found by binning the objects' centres
+	struct Split
+	{
+		int axis = -1;
+
+		// Objects in bins [0, bin] go into the first child
+		int bin = 0;
+
+		// Estimated cost of traversing the split node, relative to intersecting a single object
+		float cost = FLT_MAX;
+	};
+
+	// Find the cheapest split of [begin, end) according to the SAH
+	Split FindSplit(int begin, int end, const XMFLOAT3& centroidMin, const XMFLOAT3& centroidMax, float parentArea) const;
+
+	void FitExtent(Node& node, uint32_t nodeIdx);
+
+	// Fill in mMinObjectSizes for every node, bottom-up
+	void FitMinObjectSizes();
+	void FitMinObjectSize(uint32_t nodeIdx);
+
+	// Fill in mParents and mObjectLeaves from the nodes, for Refit to find the ancestors of the objects that moved
+	void LinkParents();
+
+	// Whether the subtree at nodeIdx has the layout Build gives it: children directly after their parent, leaves
+	// covering the objects in order, and no deeper than the traversal stacks allow. nextNode and nextObject are the
+	// node and object the subtree is expected to start at, and are moved past its end
+	bool CheckLayout(uint32_t nodeIdx, int depth, uint32_t& nextNode, uint32_t& nextObject) const;
+
+	// The objects below a node form the contiguous range [first, last) of mObjects
+	void GetSubtreeRange(uint32_t nodeIdx, uint32_t& first, uint32_t& last) const;
+
+	// Append every object below a node
+	template <typename Output>
+	void AcceptSubtree(uint32_t nodeIdx, Output& visibleInstances) const;
+	void AcceptSubtree(uint32_t nodeIdx, uint32_t views, MultiViewVisibility& visibility) const;
+
+	// Point into either the storage below, or a mapped cache file
+	Node* mNodes = nullptr;
+	uint32_t mNumNodes = 0;
+	Object* mObjects = nullptr;
+	uint32_t mNumObjects = 0;
+
+	// The (contiguous) array the BVH was built from, and the position of each mesh within mObjects
+	MeshInstance* mMeshes = nullptr;
+	uint32_t* mObjectSlots = nullptr;
+
+	std::vector<Node> mNodeStorage;
+	std::vector<Object> mObjectStorage;
+	std::vector<uint32_t> mObjectSlotStorage;
+
+	MappedFile mCacheFile;
+
+	// Scratch space of RebuildMorton
+	std::shared_ptr<MortonBuilder> mMortonBuilder;
+
+	// Parent of every node (NO_PARENT for the root) and the leaf of every object slot, linked by the first Refit after
+	// the nodes were built or mapped. Only read, so a mapped hierarchy stays shared with the file until something moves
+	static constexpr uint32_t NO_PARENT = UINT32_MAX;
+	std::vector<uint32_t> mParents;
+	std::vector<uint32_t> mObjectLeaves;
+	bool mParentsLinked = false;
+
+	// Nodes above the objects that moved, and which of them are already in the list
+	std::vector<uint32_t> mDirtyNodes;
+	std::vector<uint8_t> mIsDirty;
+
+	int mBuildCost = 0;
+
+	bool mPlaneMasking = true;
+
+	// The plane that last rejected each node, or CullingFrustum::NO_PLANE, for each view: CullingFrustum::MAX_CACHED_VIEWS
+	// entries per node, indexed by CullingFrustum::GetViewId
+	// NOTE: Updated during (const) traversals. Every node belongs to one subtree, so threads never share an entry
+	mutable std::vector<uint8_t> mRejectingPlanes;
+
+	// Squared length of the extents of the smallest object below each node, for small-feature culling
+	// Kept apart from the nodes so that the layout of the cache file does not change
+	std::vector<float> mMinObjectSizes;
+
+	mutable CullingStats mCullingStats;
+};
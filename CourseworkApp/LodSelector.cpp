@@ -0,0 +1,76 @@
+#include "LodSelector.h"
+#include <algorithm>
+#include <cfloat>
+
+void XM_CALLCONV LodSelector::SetView(FXMVECTOR eye, CXMMATRIX projection, float screenHeight)
+{
+	XMStoreFloat3(&mEye, eye);
+	mPixelScale = GetPixelScale(projection, screenHeight);
+}
+
+float XM_CALLCONV LodSelector::GetPixelScale(FXMMATRIX projection, float screenHeight)
+{
+	// _22 is cot(fovY / 2); a unit-sized object at distance 1 covers _22 / 2 of the screen's height
+	XMFLOAT4X4 proj;
+	XMStoreFloat4x4(&proj, projection);
+
+	return 0.5f * screenHeight * proj._22;
+}
+
+float LodSelector::GetScreenSize(const BoundingBox& box) const
+{
+	const XMVECTOR center = XMLoadFloat3(&box.Center);
+	const float radius = XMVectorGetX(XMVector3Length(XMLoadFloat3(&box.Extents)));
+	const float distance = XMVectorGetX(XMVector3Length(center - XMLoadFloat3(&mEye)));
+
+	// The camera is inside the bounding sphere
+	if (distance <= radius)
+		return FLT_MAX;
+
+	return 2.f * radius * mPixelScale / distance;
+}
+
+int LodSelector::SelectLod(float screenSize, int currentLod, int numLods) const
+{
+	int lod = std::min(currentLod, numLods - 1);
+
+	// Each step has to get past its threshold by the hysteresis margin
+	while (lod + 1 < numLods && screenSize < GetThreshold(lod) * (1.f - mHysteresis))
+		++lod;
+
+	while (lod > 0 && screenSize >= GetThreshold(lod - 1) * (1.f + mHysteresis))
+		--lod;
+
+	return lod;
+}
+
+int LodSelector::SelectLods(const std::vector<MeshInstance*>& instances, std::vector<MeshInstance*> buckets[MeshInstance::MAX_LODS]) const
+{
+	int triangles = 0;
+
+	for (MeshInstance* instance : instances)
+	{
+		// Bounding boxes are stored in the mesh's local space
+		BoundingBox extent;
+		instance->GetBoundingBox().Transform(extent, instance->GetWorldMatrix());
+
+		const int lod = SelectLod(GetScreenSize(extent), instance->GetLod(), instance->GetNumLods());
+
+		instance->SetLod(lod);
+		buckets[lod].push_back(instance);
+
+		triangles += GetTriangles(*instance, lod);
+	}
+
+	return triangles;
+}
+
+int LodSelector::GetTriangles(const MeshInstance& instance, int lod)
+{
+	return instance.GetMesh(lod)->getIndexCount() / 3;
+}
+
+float LodSelector::GetThreshold(int lod) const
+{
+	return mLodPixels / static_cast<float>(1 << lod);
+}
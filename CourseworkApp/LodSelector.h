@@ -0,0 +1,56 @@
+// Picks the level of detail (LOD) of every visible MeshInstance from how large its world-space bounding box is on screen,
+// and sorts the instances into a bucket per LOD so that every LOD can be drawn with one instanced draw call
+// An instance only changes LOD once it is clearly past a threshold, which stops it from flickering between two LODs
+
+#pragma once
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+#include <vector>
+
+#include "MeshInstance.h"
+
+using namespace DirectX;
+
+class LodSelector
+{
+public:
+	// Projected size (in pixels) below which LOD 1 is used. Every further LOD halves it
+	static constexpr float DEFAULT_LOD_PIXELS = 160.f;
+
+	// How far (as a fraction of the threshold) an instance must go past a threshold to change LOD
+	static constexpr float DEFAULT_HYSTERESIS = 0.15f;
+
+	// Set up the camera the LODs are picked for
+	void XM_CALLCONV SetView(FXMVECTOR eye, CXMMATRIX projection, float screenHeight);
+
+	void SetLodPixels(float pixels) { mLodPixels = pixels; }
+	void SetHysteresis(float hysteresis) { mHysteresis = hysteresis; }
+
+	// Pixels per world unit at a distance of one unit, for a perspective projection
+	static float XM_CALLCONV GetPixelScale(FXMMATRIX projection, float screenHeight);
+
+	// Projected diameter of a world-space box, in pixels
+	float GetScreenSize(const BoundingBox& box) const;
+
+	// The LOD an instance of the given size should use, given the LOD it currently uses
+	int SelectLod(float screenSize, int currentLod, int numLods) const;
+
+	// Pick the LOD of every instance, and add each instance to the bucket of its LOD
+	// Returns the number of triangles the instances add up to
+	int SelectLods(const std::vector<MeshInstance*>& instances, std::vector<MeshInstance*> buckets[MeshInstance::MAX_LODS]) const;
+
+	// Number of triangles of an instance's mesh at the given LOD
+	static int GetTriangles(const MeshInstance& instance, int lod);
+
+private:
+	// Size of the threshold between LOD lod and LOD lod + 1
+	float GetThreshold(int lod) const;
+
+	XMFLOAT3 mEye = { 0.f, 0.f, 0.f };
+
+	// Pixels per world unit at a distance of one unit
+	float mPixelScale = 1.f;
+
+	float mLodPixels = DEFAULT_LOD_PIXELS;
+	float mHysteresis = DEFAULT_HYSTERESIS;
+};
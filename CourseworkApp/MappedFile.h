@@ -0,0 +1,36 @@
+// A file mapped into memory, so that its contents can be used in place without reading or parsing them
+// The mapping is copy-on-write: the contents may be modified, but changes only ever live in memory
+
+#pragma once
+#include <string>
+#include <cstddef>
+
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Map the whole file. Returns false if it does not exist or cannot be mapped
+	bool Open(const std::string& filename);
+
+	void Close();
+
+	bool IsOpen() const { return mData != nullptr; }
+
+	// Page-aligned start of the file's contents
+	char* GetData() const { return mData; }
+	size_t GetSize() const { return mSize; }
+
+private:
+	char* mData = nullptr;
+	size_t mSize = 0;
+
+#if defined(_WIN32)
+	void* mFile = nullptr;
+	void* mMapping = nullptr;
+#endif
+};
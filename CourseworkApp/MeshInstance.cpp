@@ -1,4 +1,16 @@
 #include "MeshInstance.h"
+#include <cassert>
+
+void MeshInstance::SetLods(BaseMesh* const* meshes, int count)
+{
+	assert(count > 0 && count <= MAX_LODS);
+
+	for (int i = 0; i < count; ++i)
+		mLods[i] = meshes[i];
+
+	mNumLods = count;
+	mLod = 0;
+}
 
 XMMATRIX MeshInstance::GetWorldMatrix() const
 {
@@ -1,8 +1,19 @@
 // Class that has a mesh and a transform matrix
 // Provides an interface for manipulating scale, rotation and translation
+// The mesh may be a chain of levels of detail (LODs), of which one is drawn at a time
+// Instances also carry the texture and the shader they are drawn with, which InstanceBatcher groups them by
 
 #pragma once
+#if !defined(CULLING_HEADLESS)
 #include "../DXFramework/BaseMesh.h"
+#else
+// Built without D3D (see CullingBench); instances only have a transform and a bounding box
+class BaseMesh;
+struct ID3D11ShaderResourceView;
+#endif
+
+class InstanceShader;
+
 #include <DirectXMath.h>
 #include <memory>
 #include <DirectXCollision.h>
@@ -12,22 +23,39 @@ using namespace DirectX;
 class MeshInstance
 {
 public:
+	static constexpr int MAX_LODS = 4;
+
 	~MeshInstance() = default;
 
+#if !defined(CULLING_HEADLESS)
 	// Data must be sent to the shader before calling this function
 	// ShaderType& must be a pointer type
 	template <typename ShaderType>
 	void Draw(ID3D11DeviceContext* context, ShaderType& shader)
 	{
-		mMesh->sendData(context);
-		shader->render(context, mMesh->getIndexCount());
+		BaseMesh* mesh = GetMesh();
+
+		mesh->sendData(context);
+		shader->render(context, mesh->getIndexCount());
 	}
+#endif
 
 	//
 	//// Setters
 	//
 
-	void SetMesh(BaseMesh* mesh) { mMesh = mesh; }
+	// Use a single mesh, without any LODs
+	void SetMesh(BaseMesh* mesh) { SetLods(&mesh, 1); }
+
+	// Use a chain of meshes, from the most to the least detailed
+	void SetLods(BaseMesh* const* meshes, int count);
+
+	// The LOD that is drawn. Picked every frame by LodSelector
+	void SetLod(int lod) { mLod = lod; }
+
+	// Material of the instance when it is drawn with instancing
+	void SetTexture(ID3D11ShaderResourceView* texture) { mTexture = texture; }
+	void SetShader(InstanceShader* shader) { mShader = shader; }
 
 	void SetBoundingBox(const BoundingBox& boundingBox) { mBoundingBox = boundingBox; }
 
@@ -63,10 +91,24 @@ public:
 
 	XMMATRIX GetWorldMatrix() const;
 
+	BaseMesh* GetMesh() const { return mLods[mLod]; }
+	BaseMesh* GetMesh(int lod) const { return mLods[lod]; }
+
+	int GetLod() const { return mLod; }
+	int GetNumLods() const { return mNumLods; }
+
+	ID3D11ShaderResourceView* GetTexture() const { return mTexture; }
+	InstanceShader* GetShader() const { return mShader; }
+
 private:
-	BaseMesh* mMesh = nullptr;
+	BaseMesh* mLods[MAX_LODS] = {};
+	int mNumLods = 1;
+	int mLod = 0;
 	BoundingBox mBoundingBox;
 
+	ID3D11ShaderResourceView* mTexture = nullptr;
+	InstanceShader* mShader = nullptr;
+
 	XMFLOAT3 mPosition;
 	XMFLOAT4 mRotation = { 0.f, 0.f, 0.f, 1.f };
 	XMFLOAT3 mScale = { 1.f, 1.f, 1.f };
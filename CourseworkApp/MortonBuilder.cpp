@@ -0,0 +1,432 @@
+#include "MortonBuilder.h"
+#include <algorithm>
+#include <cassert>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace
+{
+	// Enough ranges per worker that stealing can even out ranges that take longer than others
+	constexpr int RANGES_PER_WORKER = 4;
+
+	// Ranges smaller than this are not worth handing to another worker
+	constexpr int MIN_RANGE_SIZE = 4 * 1024;
+
+	// Subtrees written out per worker
+	constexpr int EMIT_TASKS_PER_WORKER = 8;
+
+	constexpr uint32_t NO_PARENT = 0xffffffffu;
+
+	int CountLeadingZeros(uint32_t x)
+	{
+		assert(x != 0);
+
+#if defined(_MSC_VER)
+		unsigned long bit;
+		_BitScanReverse(&bit, x);
+		return 31 - static_cast<int>(bit);
+#else
+		return __builtin_clz(x);
+#endif
+	}
+
+	// Spread the lowest 10 bits of v out so that there are two zero bits between each of them
+	uint32_t ExpandBits(uint32_t v)
+	{
+		v = (v * 0x00010001u) & 0xff0000ffu;
+		v = (v * 0x00000101u) & 0x0f00f00fu;
+		v = (v * 0x00000011u) & 0xc30c30c3u;
+		v = (v * 0x00000005u) & 0x49249249u;
+
+		return v;
+	}
+
+	int GetNumRanges(WorkerPool* pool, int count)
+	{
+		if (!pool)
+			return 1;
+
+		return std::max(1, std::min(pool->GetNumWorkers() * RANGES_PER_WORKER, count / MIN_RANGE_SIZE));
+	}
+
+	// Run job(begin, end, rangeIdx) over count items split into GetNumRanges contiguous ranges
+	template <typename Job>
+	void ParallelFor(WorkerPool* pool, int count, const Job& job)
+	{
+		const int numRanges = GetNumRanges(pool, count);
+		const int rangeSize = (count + numRanges - 1) / numRanges;
+
+		const auto RunRange = [&](int rangeIdx)
+		{
+			const int begin = std::min(count, rangeIdx * rangeSize);
+			const int end = std::min(count, begin + rangeSize);
+
+			job(begin, end, rangeIdx);
+		};
+
+		if (numRanges > 1)
+			pool->Run(numRanges, [&](int rangeIdx, int) { RunRange(rangeIdx); });
+		else
+			RunRange(0);
+	}
+
+	void StoreExtent(LinearBVH::Node& node, const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax)
+	{
+		const XMVECTOR nodeMin = XMLoadFloat3(&boundsMin);
+		const XMVECTOR nodeMax = XMLoadFloat3(&boundsMax);
+
+		XMStoreFloat3(&node.center, (nodeMin + nodeMax) * 0.5f);
+		XMStoreFloat3(&node.extents, (nodeMax - nodeMin) * 0.5f);
+	}
+}
+
+void MortonBuilder::Build(MeshInstance* const meshes, int count, WorkerPool* pool, std::vector<LinearBVH::Node>& nodes, std::vector<LinearBVH::Object>& objects)
+{
+	assert(count > 0);
+
+	mCount = count;
+	mExtents.resize(count);
+	mCodes.resize(count);
+	mMeshIndices.resize(count);
+	objects.resize(count);
+
+	// World-space boxes, and the bounds of their centres within each range
+	const int numRanges = GetNumRanges(pool, count);
+	mRangeMin.assign(numRanges, XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX));
+	mRangeMax.assign(numRanges, XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX));
+
+	ParallelFor(pool, count, [&](int begin, int end, int rangeIdx)
+	{
+		XMVECTOR centroidMin = XMLoadFloat3(&mRangeMin[rangeIdx]);
+		XMVECTOR centroidMax = XMLoadFloat3(&mRangeMax[rangeIdx]);
+
+		for (int i = begin; i < end; ++i)
+		{
+			meshes[i].GetBoundingBox().Transform(mExtents[i], meshes[i].GetWorldMatrix());
+
+			const XMVECTOR center = XMLoadFloat3(&mExtents[i].Center);
+			centroidMin = XMVectorMin(centroidMin, center);
+			centroidMax = XMVectorMax(centroidMax, center);
+		}
+
+		XMStoreFloat3(&mRangeMin[rangeIdx], centroidMin);
+		XMStoreFloat3(&mRangeMax[rangeIdx], centroidMax);
+	});
+
+	XMVECTOR centroidMin = XMLoadFloat3(&mRangeMin[0]);
+	XMVECTOR centroidMax = XMLoadFloat3(&mRangeMax[0]);
+
+	for (int i = 1; i < numRanges; ++i)
+	{
+		centroidMin = XMVectorMin(centroidMin, XMLoadFloat3(&mRangeMin[i]));
+		centroidMax = XMVectorMax(centroidMax, XMLoadFloat3(&mRangeMax[i]));
+	}
+
+	// Codes of the centres, relative to the bounds of all of them. Flat scenes leave an axis with no extent
+	const XMVECTOR invSize = XMVectorReciprocal(XMVectorMax(centroidMax - centroidMin, XMVectorReplicate(1e-6f)));
+
+	ParallelFor(pool, count, [&](int begin, int end, int)
+	{
+		for (int i = begin; i < end; ++i)
+		{
+			mCodes[i] = GetMortonCode((XMLoadFloat3(&mExtents[i].Center) - centroidMin) * invSize);
+			mMeshIndices[i] = (uint32_t) i;
+		}
+	});
+
+	mSort.Sort(mCodes.data(), mMeshIndices.data(), count, pool);
+
+	ParallelFor(pool, count, [&](int begin, int end, int)
+	{
+		for (int i = begin; i < end; ++i)
+		{
+			objects[i].extent = mExtents[mMeshIndices[i]];
+			objects[i].meshIdx = mMeshIndices[i];
+		}
+	});
+
+	mObjects = objects.data();
+
+	// A single object is a single leaf
+	if (count == 1)
+	{
+		nodes.resize(1);
+		nodes[0].center = objects[0].extent.Center;
+		nodes[0].extents = objects[0].extent.Extents;
+		nodes[0].offset = 0;
+		nodes[0].count = 1;
+		return;
+	}
+
+	const int numInternal = count - 1;
+	mBuildNodes.resize(numInternal);
+	mObjectParents.resize(count);
+
+	if (mFittedCapacity < (size_t) numInternal)
+	{
+		mFittedChildren.reset(new std::atomic<uint32_t>[numInternal]);
+		mFittedCapacity = numInternal;
+	}
+
+	// Every internal node finds its own range and split, independently of the others
+	ParallelFor(pool, numInternal, [&](int begin, int end, int)
+	{
+		for (int i = begin; i < end; ++i)
+		{
+			FindSplit(i);
+			mFittedChildren[i].store(0, std::memory_order_relaxed);
+		}
+	});
+
+	mBuildNodes[0].parent = NO_PARENT;
+
+	// Walk up from every object. Only the second child to reach a node goes on, so every node is fitted once, after
+	// both of its children
+	ParallelFor(pool, count, [&](int begin, int end, int)
+	{
+		for (int i = begin; i < end; ++i)
+			FitBounds((uint32_t) i);
+	});
+
+	nodes.resize(mBuildNodes[0].numNodes);
+
+	// Write out the top of the tree until there are enough subtrees to go around, then every subtree on its own
+	// Every subtree knows how many nodes it turns into, so it knows where its nodes go before any are written
+	const int targetTasks = pool ? pool->GetNumWorkers() * EMIT_TASKS_PER_WORKER : 1;
+
+	mEmitTasks.clear();
+	mEmitTasks.push_back({ 0, 0 });
+
+	while ((int) mEmitTasks.size() < targetTasks)
+	{
+		mNextEmitTasks.clear();
+		bool splitAny = false;
+
+		for (const EmitTask& task : mEmitTasks)
+		{
+			EmitTask children[2];
+
+			if (EmitNode(task.child, task.nodeIdx, nodes.data(), children))
+			{
+				mNextEmitTasks.push_back(children[0]);
+				mNextEmitTasks.push_back(children[1]);
+				splitAny = true;
+			}
+		}
+
+		mEmitTasks.swap(mNextEmitTasks);
+
+		if (!splitAny)
+			break;
+	}
+
+	const auto EmitTaskSubtree = [&](int taskIdx, int)
+	{
+		EmitSubtree(mEmitTasks[taskIdx].child, mEmitTasks[taskIdx].nodeIdx, nodes.data());
+	};
+
+	if (pool && mEmitTasks.size() > 1)
+		pool->Run((int) mEmitTasks.size(), EmitTaskSubtree);
+	else
+	{
+		for (int i = 0; i < (int) mEmitTasks.size(); ++i)
+			EmitTaskSubtree(i, 0);
+	}
+}
+
+uint32_t XM_CALLCONV MortonBuilder::GetMortonCode(FXMVECTOR normalisedPosition)
+{
+	XMFLOAT3 position;
+	XMStoreFloat3(&position, XMVectorSaturate(normalisedPosition) * static_cast<float>((1 << BITS_PER_AXIS) - 1));
+
+	const uint32_t x = ExpandBits(static_cast<uint32_t>(position.x));
+	const uint32_t y = ExpandBits(static_cast<uint32_t>(position.y));
+	const uint32_t z = ExpandBits(static_cast<uint32_t>(position.z));
+
+	return (x << 2) | (y << 1) | z;
+}
+
+int MortonBuilder::GetCommonPrefix(int i, int j) const
+{
+	if (j < 0 || j >= mCount)
+		return -1;
+
+	// Objects with the same code are told apart by their position in the sorted order
+	if (mCodes[i] == mCodes[j])
+		return 32 + CountLeadingZeros((uint32_t) (i ^ j));
+
+	return CountLeadingZeros(mCodes[i] ^ mCodes[j]);
+}
+
+void MortonBuilder::FindSplit(int i)
+{
+	// The node's range starts or ends at i, and extends towards the neighbour that shares more of i's prefix
+	const int direction = (GetCommonPrefix(i, i + 1) > GetCommonPrefix(i, i - 1)) ? 1 : -1;
+
+	// Every object in the range shares more than this with i
+	const int minPrefix = GetCommonPrefix(i, i - direction);
+
+	// Find the other end of the range: an upper bound first, then a binary search
+	int maxLength = 2;
+	while (GetCommonPrefix(i, i + maxLength * direction) > minPrefix)
+		maxLength *= 2;
+
+	int length = 0;
+	for (int step = maxLength / 2; step >= 1; step /= 2)
+	{
+		if (GetCommonPrefix(i, i + (length + step) * direction) > minPrefix)
+			length += step;
+	}
+
+	const int j = i + length * direction;
+
+	// The split is where the prefix shared by the whole range ends, found with another binary search
+	const int nodePrefix = GetCommonPrefix(i, j);
+
+	int split = 0;
+	int divisor = 2;
+
+	for (int step = (length + 1) / 2; ; step = (length + divisor - 1) / divisor)
+	{
+		if (GetCommonPrefix(i, i + (split + step) * direction) > nodePrefix)
+			split += step;
+
+		if (step == 1)
+			break;
+
+		divisor *= 2;
+	}
+
+	const int gamma = i + split * direction + std::min(direction, 0);
+
+	BuildNode& node = mBuildNodes[i];
+	node.first = (uint32_t) std::min(i, j);
+	node.last = (uint32_t) std::max(i, j);
+
+	// A child that covers a single object is that object
+	node.children[0] = (node.first == (uint32_t) gamma) ? (gamma | OBJECT_FLAG) : gamma;
+	node.children[1] = (node.last == (uint32_t) gamma + 1) ? ((gamma + 1) | OBJECT_FLAG) : gamma + 1;
+
+	for (uint32_t child : node.children)
+	{
+		if (child & OBJECT_FLAG)
+			mObjectParents[child & ~OBJECT_FLAG] = (uint32_t) i;
+		else
+			mBuildNodes[child].parent = (uint32_t) i;
+	}
+}
+
+void MortonBuilder::FitBounds(uint32_t objectIdx)
+{
+	uint32_t nodeIdx = mObjectParents[objectIdx];
+
+	while (nodeIdx != NO_PARENT)
+	{
+		// The first child to get here leaves the node to the second. The acquire makes the first child's bounds visible
+		if (mFittedChildren[nodeIdx].fetch_add(1, std::memory_order_acq_rel) == 0)
+			return;
+
+		BuildNode& node = mBuildNodes[nodeIdx];
+
+		XMVECTOR boundsMin = XMVectorReplicate(FLT_MAX);
+		XMVECTOR boundsMax = XMVectorReplicate(-FLT_MAX);
+
+		for (uint32_t child : node.children)
+		{
+			if (child & OBJECT_FLAG)
+			{
+				const BoundingBox& extent = mObjects[child & ~OBJECT_FLAG].extent;
+				const XMVECTOR center = XMLoadFloat3(&extent.Center);
+				const XMVECTOR extents = XMLoadFloat3(&extent.Extents);
+
+				boundsMin = XMVectorMin(boundsMin, center - extents);
+				boundsMax = XMVectorMax(boundsMax, center + extents);
+			}
+			else
+			{
+				boundsMin = XMVectorMin(boundsMin, XMLoadFloat3(&mBuildNodes[child].boundsMin));
+				boundsMax = XMVectorMax(boundsMax, XMLoadFloat3(&mBuildNodes[child].boundsMax));
+			}
+		}
+
+		XMStoreFloat3(&node.boundsMin, boundsMin);
+		XMStoreFloat3(&node.boundsMax, boundsMax);
+
+		// Ranges that fit in a leaf are written out as one
+		if (node.last - node.first + 1 <= (uint32_t) LinearBVH::MAX_LEAF_SIZE)
+			node.numNodes = 1;
+		else
+			node.numNodes = 1 + GetNumNodes(node.children[0]) + GetNumNodes(node.children[1]);
+
+		nodeIdx = node.parent;
+	}
+}
+
+bool MortonBuilder::EmitNode(uint32_t child, uint32_t nodeIdx, LinearBVH::Node* nodes, EmitTask children[2]) const
+{
+	LinearBVH::Node& node = nodes[nodeIdx];
+
+	if (child & OBJECT_FLAG)
+	{
+		const uint32_t objectIdx = child & ~OBJECT_FLAG;
+		const BoundingBox& extent = mObjects[objectIdx].extent;
+
+		node.center = extent.Center;
+		node.extents = extent.Extents;
+		node.offset = objectIdx;
+		node.count = 1;
+
+		return false;
+	}
+
+	const BuildNode& buildNode = mBuildNodes[child];
+	StoreExtent(node, buildNode.boundsMin, buildNode.boundsMax);
+
+	if (buildNode.numNodes == 1)
+	{
+		node.offset = buildNode.first;
+		node.count = buildNode.last - buildNode.first + 1;
+
+		return false;
+	}
+
+	// The first child directly follows its parent, and the second follows the first child's subtree
+	children[0] = { buildNode.children[0], nodeIdx + 1 };
+	children[1] = { buildNode.children[1], nodeIdx + 1 + GetNumNodes(buildNode.children[0]) };
+
+	node.offset = children[1].nodeIdx;
+	node.count = 0;
+
+	return true;
+}
+
+void MortonBuilder::EmitSubtree(uint32_t child, uint32_t nodeIdx, LinearBVH::Node* nodes) const
+{
+	// Every level of the tree shares at least one more bit of the 62-bit keys (code and index), so it is never deeper
+	// than LinearBVH::MAX_DEPTH, and neither is the stack
+	EmitTask stack[LinearBVH::MAX_DEPTH + 2];
+	int stackSize = 0;
+
+	stack[stackSize++] = { child, nodeIdx };
+
+	while (stackSize > 0)
+	{
+		const EmitTask task = stack[--stackSize];
+
+		EmitTask children[2];
+		if (!EmitNode(task.child, task.nodeIdx, nodes, children))
+			continue;
+
+		assert(stackSize + 2 <= LinearBVH::MAX_DEPTH + 2);
+
+		stack[stackSize++] = children[1];
+		stack[stackSize++] = children[0];
+	}
+}
+
+uint32_t MortonBuilder::GetNumNodes(uint32_t child) const
+{
+	return (child & OBJECT_FLAG) ? 1 : mBuildNodes[child].numNodes;
+}
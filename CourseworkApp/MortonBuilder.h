@@ -0,0 +1,109 @@
+// Builds the nodes of a LinearBVH from scratch using Morton codes (a "linear BVH"), fast enough to rebuild every frame
+// Objects are sorted along a Z-order curve through the scene, and the hierarchy is read straight off the bits of their
+// sorted codes (Karras, "Maximizing Parallelism in the Construction of BVHs, Octrees, and k-d Trees"). Every step runs
+// in parallel: the codes, a radix sort, the range and split of every internal node, the bounds from the leaves up, and
+// writing the nodes out in the depth-first order LinearBVH traverses them in
+// The tree is of lower quality than an SAH build, which is traded for building it in a fraction of the time
+
+#pragma once
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+
+#include "LinearBVH.h"
+#include "RadixSort.h"
+#include "WorkerPool.h"
+
+using namespace DirectX;
+
+class MortonBuilder
+{
+public:
+	// Bits of a Morton code per axis. The 30-bit codes are made unique by falling back on the objects' indices
+	static constexpr int BITS_PER_AXIS = 10;
+
+	// Build the hierarchy of the meshes' current transforms. Nodes are stored the way LinearBVH stores them, and
+	// objects are sorted so that every leaf references a contiguous range of them
+	// Scratch space is kept, so rebuilding a scene of the same size does not allocate
+	void Build(MeshInstance* const meshes, int count, WorkerPool* pool, std::vector<LinearBVH::Node>& nodes, std::vector<LinearBVH::Object>& objects);
+
+	// Interleave the bits of a position within the scene, normalised to [0, 1] on every axis
+	static uint32_t XM_CALLCONV GetMortonCode(FXMVECTOR normalisedPosition);
+
+private:
+	// Internal node of the binary radix tree, which has one fewer internal nodes than there are objects
+	struct BuildNode
+	{
+		// Range of sorted objects below the node
+		uint32_t first;
+		uint32_t last;
+
+		// Either another internal node, or an object (flagged with OBJECT_FLAG)
+		uint32_t children[2];
+
+		uint32_t parent;
+
+		// Number of LinearBVH nodes the subtree turns into. Small subtrees collapse into a single leaf
+		uint32_t numNodes;
+
+		XMFLOAT3 boundsMin;
+		XMFLOAT3 boundsMax;
+	};
+
+	// Subtree that is written out by one task, and where its nodes start
+	struct EmitTask
+	{
+		uint32_t child;
+		uint32_t nodeIdx;
+	};
+
+	static constexpr uint32_t OBJECT_FLAG = 0x80000000u;
+
+	// Number of common leading bits of the (unique) keys of two sorted objects, or -1 if j is out of range
+	int GetCommonPrefix(int i, int j) const;
+
+	// Find the range and split of internal node i
+	void FindSplit(int i);
+
+	// Walk up from an object, fitting every node whose other child is already done
+	void FitBounds(uint32_t objectIdx);
+
+	// Write the LinearBVH node of a child at nodeIdx. Returns false if it is a leaf, and otherwise where its two
+	// children go
+	bool EmitNode(uint32_t child, uint32_t nodeIdx, LinearBVH::Node* nodes, EmitTask children[2]) const;
+
+	// Write a child's node and everything below it, depth-first
+	void EmitSubtree(uint32_t child, uint32_t nodeIdx, LinearBVH::Node* nodes) const;
+
+	uint32_t GetNumNodes(uint32_t child) const;
+
+	int mCount = 0;
+
+	// World-space boxes of the meshes, in the order of the meshes
+	std::vector<BoundingBox> mExtents;
+
+	// Bounds of the objects' centres within each range of meshes
+	std::vector<XMFLOAT3> mRangeMin;
+	std::vector<XMFLOAT3> mRangeMax;
+
+	// Sorted codes, and the mesh each belongs to
+	std::vector<uint32_t> mCodes;
+	std::vector<uint32_t> mMeshIndices;
+	RadixSort<uint32_t> mSort;
+
+	// Objects of the build, in sorted order
+	const LinearBVH::Object* mObjects = nullptr;
+
+	std::vector<BuildNode> mBuildNodes;
+	std::vector<uint32_t> mObjectParents;
+
+	// Number of children of each node that have been fitted. The second child to finish fits the node itself
+	std::unique_ptr<std::atomic<uint32_t>[]> mFittedChildren;
+	size_t mFittedCapacity = 0;
+
+	std::vector<EmitTask> mEmitTasks;
+	std::vector<EmitTask> mNextEmitTasks;
+};
@@ -0,0 +1,94 @@
+#include "MultiViewFrustum.h"
+#include <cassert>
+
+MultiViewFrustum::MultiViewFrustum(const CullingFrustum* views, int numViews)
+	:	mNumViews(numViews)
+{
+	assert(numViews > 0 && numViews <= MAX_VIEWS);
+
+	for (int i = 0; i < numViews; ++i)
+		mViews[i] = views[i];
+}
+
+void MultiViewFrustum::Test(const CullingFrustum::BoxBatch& boxes, const ViewMask& parent, bool planeMasking, ViewMask results[CullingFrustum::BATCH_SIZE], CullingStats& stats) const
+{
+	for (int lane = 0; lane < boxes.count; ++lane)
+		results[lane].views = 0;
+
+	CullingFrustum::BatchResult batchResult;
+
+	for (uint32_t views = parent.views; views; views &= views - 1)
+	{
+		const uint32_t view = CullingFrustum::LowestBit(views);
+		const uint32_t viewBit = 1u << view;
+		const uint32_t planeMask = parent.planeMasks[view];
+
+		// Inside the parent means inside all of its children
+		if (planeMask == 0)
+		{
+			for (int lane = 0; lane < boxes.count; ++lane)
+			{
+				results[lane].views |= viewBit;
+				results[lane].planeMasks[view] = 0;
+			}
+
+			continue;
+		}
+
+		const uint32_t visible = mViews[view].Test(boxes, planeMask, batchResult);
+		stats.planeTests += boxes.count * CullingFrustum::CountPlanes(planeMask);
+
+		for (int lane = 0; lane < boxes.count; ++lane)
+		{
+			if (!(visible & (1u << lane)))
+				continue;
+
+			results[lane].views |= viewBit;
+			results[lane].planeMasks[view] = static_cast<uint8_t>(planeMasking ? batchResult.undecidedPlanes[lane] : CullingFrustum::ALL_PLANES);
+		}
+	}
+}
+
+auto MultiViewFrustum::GetRootMask() const -> ViewMask
+{
+	ViewMask mask;
+	mask.views = (1u << mNumViews) - 1;
+
+	for (int i = 0; i < MAX_VIEWS; ++i)
+		mask.planeMasks[i] = CullingFrustum::ALL_PLANES;
+
+	return mask;
+}
+
+bool MultiViewFrustum::IsInside(const ViewMask& mask)
+{
+	for (uint32_t views = mask.views; views; views &= views - 1)
+	{
+		if (mask.planeMasks[CullingFrustum::LowestBit(views)] != 0)
+			return false;
+	}
+
+	return true;
+}
+
+void MultiViewVisibility::Reset(int numObjects)
+{
+	viewMasks.assign(numObjects, 0);
+
+	for (int i = 0; i < MultiViewFrustum::MAX_VIEWS; ++i)
+		visibleInstances[i].clear();
+
+	visibleObjects = 0;
+}
+
+void MultiViewVisibility::Add(MeshInstance* instance, uint32_t objectIdx, uint32_t views)
+{
+	viewMasks[objectIdx] = views;
+	++visibleObjects;
+
+	for (uint32_t view = 0; views; ++view, views >>= 1)
+	{
+		if (views & 1)
+			visibleInstances[view].push_back(instance);
+	}
+}
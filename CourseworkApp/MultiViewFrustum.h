@@ -0,0 +1,65 @@
+// Several frustums (e.g. the camera, the shadow-casting light, cascades and probes) culled in a single traversal
+// Each node of a hierarchy is loaded once and tested against every view it may still be visible in, rather than
+// walking the hierarchy once per view. Views that fully contain a node are not tested again below it
+
+#pragma once
+#include <vector>
+#include <cstdint>
+
+#include "CullingFrustum.h"
+#include "MeshInstance.h"
+
+class MultiViewFrustum
+{
+public:
+	// View masks are stored in a byte per plane mask, so the number of views is kept small
+	static constexpr int MAX_VIEWS = 8;
+
+	// The views a box may be visible in, along with the planes of each of those views it intersects
+	struct ViewMask
+	{
+		// Bit v is set if the box is inside or intersecting view v
+		uint32_t views = 0;
+
+		// Planes of view v the box intersects. 0 if it is fully inside view v
+		uint8_t planeMasks[MAX_VIEWS];
+	};
+
+	MultiViewFrustum() = default;
+	MultiViewFrustum(const CullingFrustum* views, int numViews);
+
+	// Test a batch of boxes against the views the parent of the boxes is visible in
+	// Views the parent is fully inside of are passed on to every box without testing them
+	void Test(const CullingFrustum::BoxBatch& boxes, const ViewMask& parent, bool planeMasking, ViewMask results[CullingFrustum::BATCH_SIZE], CullingStats& stats) const;
+
+	// Every view, with every plane undecided
+	ViewMask GetRootMask() const;
+
+	// Whether a box is fully inside every view it is visible in, so that there is nothing left to test below it
+	static bool IsInside(const ViewMask& mask);
+
+	int GetNumViews() const { return mNumViews; }
+	const CullingFrustum& GetView(int idx) const { return mViews[idx]; }
+
+private:
+	CullingFrustum mViews[MAX_VIEWS];
+	int mNumViews = 0;
+};
+
+// Objects found by a multi-view query
+struct MultiViewVisibility
+{
+	// Bit v of entry i is set if object i (of the array the hierarchy was built from) is visible in view v
+	std::vector<uint32_t> viewMasks;
+
+	// Visible objects of each view, in the same order as a query for that view alone would give
+	std::vector<MeshInstance*> visibleInstances[MultiViewFrustum::MAX_VIEWS];
+
+	// Number of objects visible in at least one view
+	int visibleObjects = 0;
+
+	// Clear the results of the previous query. The lists keep their memory
+	void Reset(int numObjects);
+
+	void Add(MeshInstance* instance, uint32_t objectIdx, uint32_t views);
+};
@@ -0,0 +1,338 @@
+#include "OcclusionBuffer.h"
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#include <cassert>
+
+namespace
+{
+	// Corners closer to the eye than this (in clip-space w) are not projected
+	constexpr float MIN_W = 1e-3f;
+
+	// Corners of a box are numbered by their signs along x (bit 0), y (bit 1) and z (bit 2)
+	// Each face is listed as a loop around its corners
+	constexpr int BOX_FACES[6][4] =
+	{
+		{ 0, 2, 6, 4 }, { 1, 3, 7, 5 },
+		{ 0, 1, 5, 4 }, { 2, 3, 7, 6 },
+		{ 0, 1, 3, 2 }, { 4, 5, 7, 6 }
+	};
+
+	// Keep far off-screen coordinates within the range of an int before converting them to pixels
+	float Clamp(float coordinate, int size)
+	{
+		return std::min(std::max(coordinate, -1.f), (float) size + 1.f);
+	}
+
+	// Coefficients of a function that is linear in screen space: f(x, y) = a * x + b * y + c
+	struct LinearFunction
+	{
+		float a, b, c;
+	};
+}
+
+OcclusionBuffer::OcclusionBuffer()
+{
+	static_assert((WIDTH & (WIDTH - 1)) == 0 && (HEIGHT & (HEIGHT - 1)) == 0, "OcclusionBuffer dimensions must be powers of two");
+	static_assert(WIDTH % 4 == 0, "Rows of the OcclusionBuffer are rasterised four pixels at a time");
+
+	// Keep halving until either dimension reaches one pixel
+	for (int width = WIDTH, height = HEIGHT; width >= 1 && height >= 1; width /= 2, height /= 2)
+	{
+		mMinDepth.emplace_back(mNumLevels == 0 ? 0 : width * height, 1.f);
+		mMaxDepth.emplace_back(width * height, 1.f);
+
+		++mNumLevels;
+	}
+
+	XMStoreFloat4x4(&mViewProjection, XMMatrixIdentity());
+}
+
+void XM_CALLCONV OcclusionBuffer::Begin(FXMMATRIX viewProjection)
+{
+	XMStoreFloat4x4(&mViewProjection, viewProjection);
+
+	std::fill(mMaxDepth[0].begin(), mMaxDepth[0].end(), 1.f);
+
+	mOccludersRendered = 0;
+	mTrianglesRendered = 0;
+}
+
+void OcclusionBuffer::AddOccluder(const BoundingBox& box)
+{
+	ScreenVertex corners[8];
+
+	if (!ProjectBox(box, corners))
+		return;
+
+	for (const auto& face : BOX_FACES)
+	{
+		RasteriseTriangle(corners[face[0]], corners[face[1]], corners[face[2]]);
+		RasteriseTriangle(corners[face[0]], corners[face[2]], corners[face[3]]);
+	}
+
+	++mOccludersRendered;
+}
+
+void OcclusionBuffer::Finish()
+{
+	for (int level = 1; level < mNumLevels; ++level)
+	{
+		const int width = GetLevelWidth(level);
+		const int height = HEIGHT >> level;
+
+		const int parentWidth = GetLevelWidth(level - 1);
+
+		// Level 0 only has the one buffer
+		const std::vector<float>& parentMin = level == 1 ? mMaxDepth[0] : mMinDepth[level - 1];
+		const std::vector<float>& parentMax = mMaxDepth[level - 1];
+
+		for (int y = 0; y < height; ++y)
+		{
+			for (int x = 0; x < width; ++x)
+			{
+				const int topLeft = (2 * y) * parentWidth + 2 * x;
+				const int bottomLeft = topLeft + parentWidth;
+
+				mMinDepth[level][y * width + x] = std::min(std::min(parentMin[topLeft], parentMin[topLeft + 1]), std::min(parentMin[bottomLeft], parentMin[bottomLeft + 1]));
+				mMaxDepth[level][y * width + x] = std::max(std::max(parentMax[topLeft], parentMax[topLeft + 1]), std::max(parentMax[bottomLeft], parentMax[bottomLeft + 1]));
+			}
+		}
+	}
+}
+
+bool OcclusionBuffer::IsOccluded(const BoundingBox& box) const
+{
+	ScreenVertex corners[8];
+
+	if (!ProjectBox(box, corners))
+		return false;
+
+	float minX = FLT_MAX, minY = FLT_MAX, minZ = FLT_MAX;
+	float maxX = -FLT_MAX, maxY = -FLT_MAX;
+
+	for (const auto& corner : corners)
+	{
+		minX = std::min(minX, corner.x);
+		minY = std::min(minY, corner.y);
+		minZ = std::min(minZ, corner.z);
+		maxX = std::max(maxX, corner.x);
+		maxY = std::max(maxY, corner.y);
+	}
+
+	if (minZ <= 0.f)
+		return false;
+
+	// Every pixel the box touches, clamped to the screen
+	const int x0 = std::max(static_cast<int>(std::floor(Clamp(minX, WIDTH))), 0);
+	const int y0 = std::max(static_cast<int>(std::floor(Clamp(minY, HEIGHT))), 0);
+	const int x1 = std::min(static_cast<int>(std::floor(Clamp(maxX, WIDTH))), WIDTH - 1);
+	const int y1 = std::min(static_cast<int>(std::floor(Clamp(maxY, HEIGHT))), HEIGHT - 1);
+
+	// Off-screen. That is for frustum culling to deal with
+	if (x0 > x1 || y0 > y1)
+		return false;
+
+	// Start at the finest level at which the box covers no more than 2x2 texels
+	int level = 0;
+
+	while (level < mNumLevels - 1 && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1))
+		++level;
+
+	return !IsRegionVisible(level, x0, y0, x1, y1, minZ);
+}
+
+void XM_CALLCONV OcclusionBuffer::SelectOccluders(const std::vector<MeshInstance*>& candidates, FXMVECTOR eye, int budget, float occluderScale, std::vector<BoundingBox>& occluders)
+{
+	struct Candidate
+	{
+		BoundingBox extent;
+
+		// Size relative to the distance from the eye, which is roughly proportional to the size on screen
+		float weight;
+	};
+
+	std::vector<Candidate> weighted;
+	weighted.reserve(candidates.size());
+
+	for (const auto& instance : candidates)
+	{
+		Candidate candidate;
+		instance->GetBoundingBox().Transform(candidate.extent, instance->GetWorldMatrix());
+
+		const float size = XMVectorGetX(XMVector3Length(XMLoadFloat3(&candidate.extent.Extents)));
+		const float distance = XMVectorGetX(XMVector3Length(XMLoadFloat3(&candidate.extent.Center) - eye));
+
+		candidate.weight = size / std::max(distance, 1e-3f);
+		weighted.push_back(candidate);
+	}
+
+	const int count = std::min(budget, (int) weighted.size());
+
+	std::partial_sort(weighted.begin(), weighted.begin() + count, weighted.end(), [](const Candidate& a, const Candidate& b)
+	{
+		return a.weight > b.weight;
+	});
+
+	for (int i = 0; i < count; ++i)
+	{
+		BoundingBox occluder = weighted[i].extent;
+		XMStoreFloat3(&occluder.Extents, XMLoadFloat3(&occluder.Extents) * occluderScale);
+
+		occluders.push_back(occluder);
+	}
+}
+
+bool OcclusionBuffer::ProjectBox(const BoundingBox& box, ScreenVertex corners[8]) const
+{
+	const XMMATRIX viewProjection = XMLoadFloat4x4(&mViewProjection);
+
+	const XMVECTOR center = XMLoadFloat3(&box.Center);
+	const XMVECTOR extents = XMLoadFloat3(&box.Extents);
+
+	for (int i = 0; i < 8; ++i)
+	{
+		const XMVECTOR signs = XMVectorSet(i & 1 ? 1.f : -1.f, i & 2 ? 1.f : -1.f, i & 4 ? 1.f : -1.f, 0.f);
+		const XMVECTOR corner = XMVectorSetW(XMVectorMultiplyAdd(extents, signs, center), 1.f);
+
+		XMFLOAT4 clip;
+		XMStoreFloat4(&clip, XMVector4Transform(corner, viewProjection));
+
+		if (clip.w < MIN_W)
+			return false;
+
+		// NDC to pixels; y flips, as it points down the screen
+		const float invW = 1.f / clip.w;
+
+		corners[i].x = (clip.x * invW * 0.5f + 0.5f) * WIDTH;
+		corners[i].y = (clip.y * invW * -0.5f + 0.5f) * HEIGHT;
+		corners[i].z = clip.z * invW;
+	}
+
+	return true;
+}
+
+void OcclusionBuffer::RasteriseTriangle(ScreenVertex v0, ScreenVertex v1, ScreenVertex v2)
+{
+	// Twice the signed area of the triangle. Box faces are not wound consistently, so accept either winding
+	float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+
+	if (area < 0.f)
+	{
+		std::swap(v1, v2);
+		area = -area;
+	}
+
+	if (area < 1e-6f)
+		return;
+
+	// Pixels whose centres fall within the bounds of the triangle. Rows start on a multiple of four pixels
+	const int minX = std::max(static_cast<int>(std::floor(Clamp(std::min({ v0.x, v1.x, v2.x }), WIDTH) - 0.5f)), 0) & ~3;
+	const int minY = std::max(static_cast<int>(std::floor(Clamp(std::min({ v0.y, v1.y, v2.y }), HEIGHT) - 0.5f)), 0);
+	const int maxX = std::min(static_cast<int>(std::ceil(Clamp(std::max({ v0.x, v1.x, v2.x }), WIDTH) - 0.5f)), WIDTH - 1);
+	const int maxY = std::min(static_cast<int>(std::ceil(Clamp(std::max({ v0.y, v1.y, v2.y }), HEIGHT) - 0.5f)), HEIGHT - 1);
+
+	if (minX > maxX || minY > maxY)
+		return;
+
+	++mTrianglesRendered;
+
+	// Edge functions, positive on the inside of each edge
+	const auto Edge = [](const ScreenVertex& a, const ScreenVertex& b)
+	{
+		LinearFunction edge;
+		edge.a = a.y - b.y;
+		edge.b = b.x - a.x;
+		edge.c = -(edge.a * a.x + edge.b * a.y);
+
+		return edge;
+	};
+
+	const LinearFunction edges[3] = { Edge(v1, v2), Edge(v2, v0), Edge(v0, v1) };
+
+	// Depth after the perspective divide is linear in screen space
+	const float invArea = 1.f / area;
+
+	LinearFunction depth;
+	depth.a = (edges[0].a * v0.z + edges[1].a * v1.z + edges[2].a * v2.z) * invArea;
+	depth.b = (edges[0].b * v0.z + edges[1].b * v1.z + edges[2].b * v2.z) * invArea;
+	depth.c = (edges[0].c * v0.z + edges[1].c * v1.z + edges[2].c * v2.z) * invArea;
+
+	// Four neighbouring pixel centres at a time
+	const XMVECTOR pixelOffsets = XMVectorSet(0.5f, 1.5f, 2.5f, 3.5f);
+
+	XMVECTOR edgeStep[3];
+	for (int i = 0; i < 3; ++i)
+		edgeStep[i] = XMVectorReplicate(edges[i].a * 4.f);
+
+	const XMVECTOR depthStep = XMVectorReplicate(depth.a * 4.f);
+	const XMVECTOR zero = XMVectorZero();
+
+	std::vector<float>& buffer = mMaxDepth[0];
+
+	for (int y = minY; y <= maxY; ++y)
+	{
+		const float pixelY = y + 0.5f;
+		const XMVECTOR pixelX = XMVectorAdd(XMVectorReplicate((float) minX), pixelOffsets);
+
+		XMVECTOR edgeValues[3];
+		for (int i = 0; i < 3; ++i)
+			edgeValues[i] = XMVectorMultiplyAdd(pixelX, XMVectorReplicate(edges[i].a), XMVectorReplicate(edges[i].b * pixelY + edges[i].c));
+
+		XMVECTOR depthValues = XMVectorMultiplyAdd(pixelX, XMVectorReplicate(depth.a), XMVectorReplicate(depth.b * pixelY + depth.c));
+
+		float* row = buffer.data() + y * WIDTH;
+
+		for (int x = minX; x <= maxX; x += 4)
+		{
+			// Inside all three edges
+			XMVECTOR inside = XMVectorGreaterOrEqual(edgeValues[0], zero);
+			inside = XMVectorAndInt(inside, XMVectorGreaterOrEqual(edgeValues[1], zero));
+			inside = XMVectorAndInt(inside, XMVectorGreaterOrEqual(edgeValues[2], zero));
+
+			// Keep the nearest depth
+			// NOTE: std::vector only guarantees 8-byte alignment on Win32, so these loads are unaligned
+			XMFLOAT4* pixels = reinterpret_cast<XMFLOAT4*>(row + x);
+			const XMVECTOR current = XMLoadFloat4(pixels);
+
+			XMStoreFloat4(pixels, XMVectorSelect(current, XMVectorMin(current, depthValues), inside));
+
+			for (int i = 0; i < 3; ++i)
+				edgeValues[i] = XMVectorAdd(edgeValues[i], edgeStep[i]);
+
+			depthValues = XMVectorAdd(depthValues, depthStep);
+		}
+	}
+}
+
+bool OcclusionBuffer::IsRegionVisible(int level, int x0, int y0, int x1, int y1, float depth) const
+{
+	const int width = GetLevelWidth(level);
+
+	for (int ty = y0 >> level; ty <= (y1 >> level); ++ty)
+	{
+		for (int tx = x0 >> level; tx <= (x1 >> level); ++tx)
+		{
+			const int texel = ty * width + tx;
+
+			// Every pixel under this texel is in front of the box
+			if (depth > mMaxDepth[level][texel])
+				continue;
+
+			// The box is in front of every pixel under this texel (or this is a single pixel)
+			if (level == 0 || depth <= mMinDepth[level][texel])
+				return true;
+
+			// Undecided, so look at the part of the region covered by this texel at the next level down
+			const int childX0 = std::max(x0, tx << level);
+			const int childY0 = std::max(y0, ty << level);
+			const int childX1 = std::min(x1, ((tx + 1) << level) - 1);
+			const int childY1 = std::min(y1, ((ty + 1) << level) - 1);
+
+			if (IsRegionVisible(level - 1, childX0, childY0, childX1, childY1, depth))
+				return true;
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,78 @@
+// Low-resolution depth buffer rendered on the CPU, used to cull objects hidden behind other objects
+// A few large, nearby occluders are rasterised four pixels at a time, and a pyramid holding the minimum and maximum
+// depth of every 2x2 block is built on top. Bounding boxes are then tested against the coarsest level that
+// can decide them. Does not use the GPU at all, so it can be run (and benchmarked) anywhere
+
+#pragma once
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+#include <vector>
+
+#include "MeshInstance.h"
+
+using namespace DirectX;
+
+class OcclusionBuffer
+{
+public:
+	// Must be powers of two, so that every level of the pyramid halves both dimensions
+	static constexpr int WIDTH = 256;
+	static constexpr int HEIGHT = 128;
+
+	OcclusionBuffer();
+
+	// Clear the buffer, ready to render occluders as seen through the given view-projection matrix
+	void XM_CALLCONV Begin(FXMMATRIX viewProjection);
+
+	// Rasterise a solid box as an occluder. The box must be contained by the object it stands in for
+	// Boxes that cross the near plane are skipped rather than clipped
+	void AddOccluder(const BoundingBox& box);
+
+	// Build the depth pyramid. Must be called after adding the occluders, and before testing against them
+	void Finish();
+
+	// Whether the box is entirely behind the occluders
+	// Boxes that cross the near plane or lie off-screen are never reported as occluded
+	bool IsOccluded(const BoundingBox& box) const;
+
+	// Pick up to budget of the candidates, nearest (relative to their size) to the eye first, and write out a box
+	// for each of them. occluderScale shrinks their world-space bounding boxes to fit inside the actual geometry
+	static void XM_CALLCONV SelectOccluders(const std::vector<MeshInstance*>& candidates, FXMVECTOR eye, int budget, float occluderScale, std::vector<BoundingBox>& occluders);
+
+	int GetOccludersRendered() const { return mOccludersRendered; }
+	int GetTrianglesRendered() const { return mTrianglesRendered; }
+
+	// Depth of the nearest occluder at every pixel, 1 where there is none
+	const std::vector<float>& GetDepth() const { return mMaxDepth[0]; }
+
+private:
+	struct ScreenVertex
+	{
+		// Pixel coordinates, with y pointing down
+		float x, y;
+
+		// Depth after the perspective divide
+		float z;
+	};
+
+	// Transform the corners of a box to pixel coordinates
+	// Returns false if any of the corners is too close to (or behind) the eye
+	bool ProjectBox(const BoundingBox& box, ScreenVertex corners[8]) const;
+
+	void RasteriseTriangle(ScreenVertex v0, ScreenVertex v1, ScreenVertex v2);
+
+	// Whether any pixel in [x0, x1] x [y0, y1] (in level 0 pixels) is further away than depth, starting at the given level
+	bool IsRegionVisible(int level, int x0, int y0, int x1, int y1, float depth) const;
+
+	int GetLevelWidth(int level) const { return WIDTH >> level; }
+
+	XMFLOAT4X4 mViewProjection;
+
+	// Depth pyramid. Level 0 is the full-resolution buffer, where the minimum and maximum are one and the same
+	int mNumLevels = 0;
+	std::vector< std::vector<float> > mMinDepth;
+	std::vector< std::vector<float> > mMaxDepth;
+
+	int mOccludersRendered = 0;
+	int mTrianglesRendered = 0;
+};
@@ -0,0 +1,63 @@
+#include "ParallelRecorder.h"
+#include <algorithm>
+
+void ParallelRecorder::Split(const size_t* numDraws, int numPasses, size_t chunkSize)
+{
+	mChunks.clear();
+
+	chunkSize = std::max<size_t>(chunkSize, 1);
+
+	for (int pass = 0; pass < numPasses; ++pass)
+	{
+		for (size_t first = 0; first < numDraws[pass]; first += chunkSize)
+		{
+			Chunk chunk;
+			chunk.pass = pass;
+			chunk.first = first;
+			chunk.count = std::min(chunkSize, numDraws[pass] - first);
+
+			mChunks.push_back(chunk);
+		}
+	}
+
+	if (mCommands.size() < mChunks.size())
+		mCommands.resize(mChunks.size());
+}
+
+void ParallelRecorder::Record(const RecordFunction& record, WorkerPool* pool)
+{
+	const auto RecordChunk = [&](int chunkIdx)
+	{
+		CommandBuffer& commands = mCommands[chunkIdx];
+
+		commands.Clear();
+		record(mChunks[chunkIdx], chunkIdx, commands);
+	};
+
+	if (pool && mChunks.size() > 1)
+		pool->Run(GetNumChunks(), [&](int chunkIdx, int) { RecordChunk(chunkIdx); });
+	else
+	{
+		for (int i = 0; i < GetNumChunks(); ++i)
+			RecordChunk(i);
+	}
+}
+
+void ParallelRecorder::Execute(int pass, CommandBackend& target) const
+{
+	for (int i = 0; i < GetNumChunks(); ++i)
+	{
+		if (mChunks[i].pass == pass)
+			mCommands[i].Execute(target);
+	}
+}
+
+size_t ParallelRecorder::GetSize() const
+{
+	size_t size = 0;
+
+	for (int i = 0; i < GetNumChunks(); ++i)
+		size += mCommands[i].GetSize();
+
+	return size;
+}
@@ -0,0 +1,54 @@
+// Records the draws of several passes into command buffers on a WorkerPool, to be executed later in a fixed order
+// Every pass is split into chunks of at most a given number of draws, and every chunk is recorded by one task into its
+// own CommandBuffer, so the chunks of all passes are recorded at the same time. A chunk cannot rely on anything an
+// earlier chunk bound or uploaded, so it binds everything it needs itself; executing the chunks of a pass in order
+// gives the same draws as recording the pass on a single thread, plus a few rebinds at the start of every chunk
+// Memory is kept from frame to frame
+
+#pragma once
+#include <vector>
+#include <functional>
+#include <cstddef>
+
+#include "CommandBuffer.h"
+#include "WorkerPool.h"
+
+class ParallelRecorder
+{
+public:
+	static constexpr int DEFAULT_CHUNK_SIZE = 64;
+
+	// A range of draws of a pass
+	struct Chunk
+	{
+		int pass;
+		size_t first;
+		size_t count;
+	};
+
+	// Records the draws [chunk.first, chunk.first + chunk.count) of chunk.pass into commands
+	// Called on any worker thread, so anything it writes to has to be kept per chunk, e.g. indexed by chunkIdx
+	using RecordFunction = std::function<void(const Chunk& chunk, int chunkIdx, CommandBackend& commands)>;
+
+	// Split passes of numDraws[pass] draws into chunks of at most chunkSize draws. Passes without draws get no chunks
+	void Split(const size_t* numDraws, int numPasses, size_t chunkSize);
+
+	// Record every chunk into its own command buffer, spread across the pool if there is one
+	void Record(const RecordFunction& record, WorkerPool* pool = nullptr);
+
+	// Replay the chunks of a pass onto target, in order
+	void Execute(int pass, CommandBackend& target) const;
+
+	int GetNumChunks() const { return (int) mChunks.size(); }
+	const Chunk& GetChunk(int idx) const { return mChunks[idx]; }
+	const CommandBuffer& GetCommands(int idx) const { return mCommands[idx]; }
+
+	// Bytes recorded into every chunk
+	size_t GetSize() const;
+
+private:
+	std::vector<Chunk> mChunks;
+
+	// One per chunk. Never shrinks, so the buffers keep their memory
+	std::vector<CommandBuffer> mCommands;
+};
@@ -0,0 +1,148 @@
+// Least significant digit radix sort of (key, value) pairs, eight bits at a time
+// Every pass splits the pairs into contiguous blocks: each block counts its digits, the counts are turned into where
+// each block writes every digit, and then the blocks scatter their pairs. Blocks write in order, so the sort is stable
+// With a WorkerPool, the blocks of a pass are counted and scattered on all of its workers
+// Passes where every key has the same digit (e.g. the unused high bits of the keys) are skipped
+
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <type_traits>
+
+#include "WorkerPool.h"
+
+template <typename Key>
+class RadixSort
+{
+	static_assert(std::is_unsigned<Key>::value, "RadixSort sorts unsigned integer keys");
+
+public:
+	static constexpr int DIGIT_BITS = 8;
+	static constexpr int RADIX = 1 << DIGIT_BITS;
+
+	// Blocks smaller than this are not worth handing to another worker
+	static constexpr size_t MIN_BLOCK_SIZE = 16 * 1024;
+
+	// Sort keys in ascending order, moving values along with them. The scratch space is kept for the next sort
+	void Sort(Key* keys, uint32_t* values, size_t count, WorkerPool* pool = nullptr);
+
+	// Number of passes the last sort did, out of sizeof(Key) bytes
+	int GetPasses() const { return mPasses; }
+
+private:
+	template <typename Job>
+	void RunBlocks(WorkerPool* pool, int numBlocks, const Job& job);
+
+	std::vector<Key> mKeys;
+	std::vector<uint32_t> mValues;
+
+	// Digit counts of every block, turned into the block's write offset for every digit
+	std::vector<size_t> mOffsets;
+
+	int mPasses = 0;
+};
+
+template <typename Key>
+void RadixSort<Key>::Sort(Key* keys, uint32_t* values, size_t count, WorkerPool* pool)
+{
+	mPasses = 0;
+
+	if (count < 2)
+		return;
+
+	mKeys.resize(count);
+	mValues.resize(count);
+
+	const int maxBlocks = pool ? pool->GetNumWorkers() : 1;
+	const int numBlocks = (int) std::max<size_t>(1, std::min<size_t>(maxBlocks, count / MIN_BLOCK_SIZE));
+	const size_t blockSize = (count + numBlocks - 1) / numBlocks;
+
+	mOffsets.resize(numBlocks * RADIX);
+
+	Key* srcKeys = keys;
+	uint32_t* srcValues = values;
+	Key* dstKeys = mKeys.data();
+	uint32_t* dstValues = mValues.data();
+
+	for (int shift = 0; shift < (int) sizeof(Key) * 8; shift += DIGIT_BITS)
+	{
+		RunBlocks(pool, numBlocks, [&](int block)
+		{
+			size_t* counts = mOffsets.data() + block * RADIX;
+			std::fill(counts, counts + RADIX, size_t(0));
+
+			const size_t end = std::min(count, (block + 1) * blockSize);
+
+			for (size_t i = block * blockSize; i < end; ++i)
+				++counts[(srcKeys[i] >> shift) & (RADIX - 1)];
+		});
+
+		// Turn the counts into offsets: digits in order, and within a digit, blocks in order
+		bool isUniform = false;
+		size_t offset = 0;
+
+		for (int digit = 0; digit < RADIX; ++digit)
+		{
+			const size_t digitStart = offset;
+
+			for (int block = 0; block < numBlocks; ++block)
+			{
+				const size_t digitCount = mOffsets[block * RADIX + digit];
+				mOffsets[block * RADIX + digit] = offset;
+				offset += digitCount;
+			}
+
+			// Every key has this digit, so the pass would leave the order as it is
+			if (offset - digitStart == count)
+				isUniform = true;
+		}
+
+		if (isUniform)
+			continue;
+
+		RunBlocks(pool, numBlocks, [&](int block)
+		{
+			size_t* offsets = mOffsets.data() + block * RADIX;
+			const size_t end = std::min(count, (block + 1) * blockSize);
+
+			for (size_t i = block * blockSize; i < end; ++i)
+			{
+				const size_t dst = offsets[(srcKeys[i] >> shift) & (RADIX - 1)]++;
+				dstKeys[dst] = srcKeys[i];
+				dstValues[dst] = srcValues[i];
+			}
+		});
+
+		std::swap(srcKeys, dstKeys);
+		std::swap(srcValues, dstValues);
+		++mPasses;
+	}
+
+	// An odd number of passes leaves the result in the scratch space
+	if (srcKeys != keys)
+	{
+		RunBlocks(pool, numBlocks, [&](int block)
+		{
+			const size_t begin = std::min(count, block * blockSize);
+			const size_t end = std::min(count, (block + 1) * blockSize);
+
+			std::copy(srcKeys + begin, srcKeys + end, keys + begin);
+			std::copy(srcValues + begin, srcValues + end, values + begin);
+		});
+	}
+}
+
+template <typename Key>
+template <typename Job>
+void RadixSort<Key>::RunBlocks(WorkerPool* pool, int numBlocks, const Job& job)
+{
+	if (pool && numBlocks > 1)
+		pool->Run(numBlocks, [&](int block, int) { job(block); });
+	else
+	{
+		for (int block = 0; block < numBlocks; ++block)
+			job(block);
+	}
+}
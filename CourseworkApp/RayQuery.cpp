@@ -0,0 +1,165 @@
+#include "RayQuery.h"
+#include <algorithm>
+#include <cmath>
+#include <cassert>
+
+namespace
+{
+	// Directions parallel to an axis would give an infinite reciprocal, and 0 * infinity (NaN) for rays that start
+	// on one of the box's faces. Nudging them off the axis keeps every slab distance finite
+	constexpr float MIN_DIRECTION = 1e-20f;
+
+	float SafeReciprocal(float direction)
+	{
+		if (std::fabs(direction) < MIN_DIRECTION)
+			direction = std::copysign(MIN_DIRECTION, direction);
+
+		return 1.f / direction;
+	}
+
+	// Distances along a ray at which it crosses the two planes of a slab, nearest first
+	void GetSlab(float boxMin, float boxMax, float origin, float invDirection, float& tNear, float& tFar)
+	{
+		const float t0 = (boxMin - origin) * invDirection;
+		const float t1 = (boxMax - origin) * invDirection;
+
+		tNear = std::min(t0, t1);
+		tFar = std::max(t0, t1);
+	}
+}
+
+Ray Ray::CreateSegment(const XMFLOAT3& start, const XMFLOAT3& end)
+{
+	const XMVECTOR delta = XMLoadFloat3(&end) - XMLoadFloat3(&start);
+	const float length = XMVectorGetX(XMVector3Length(delta));
+
+	Ray ray;
+	ray.origin = start;
+	ray.maxDistance = length;
+
+	// A segment of zero length still hits the boxes its start point is inside of
+	if (length > 0.f)
+		XMStoreFloat3(&ray.direction, delta / length);
+
+	return ray;
+}
+
+PreparedRay::PreparedRay(const Ray& ray)
+	:	mOrigin(ray.origin), mMaxDistance(ray.maxDistance)
+{
+	mInvDirection.x = SafeReciprocal(ray.direction.x);
+	mInvDirection.y = SafeReciprocal(ray.direction.y);
+	mInvDirection.z = SafeReciprocal(ray.direction.z);
+}
+
+bool PreparedRay::Intersect(const XMFLOAT3& center, const XMFLOAT3& extents, float& tNear) const
+{
+	float nearX, farX, nearY, farY, nearZ, farZ;
+	GetSlab(center.x - extents.x, center.x + extents.x, mOrigin.x, mInvDirection.x, nearX, farX);
+	GetSlab(center.y - extents.y, center.y + extents.y, mOrigin.y, mInvDirection.y, nearY, farY);
+	GetSlab(center.z - extents.z, center.z + extents.z, mOrigin.z, mInvDirection.z, nearZ, farZ);
+
+	// The ray is inside the box where it is inside all three slabs at once
+	tNear = std::max(std::max(nearX, nearY), std::max(nearZ, 0.f));
+	const float tFar = std::min(std::min(farX, farY), std::min(farZ, mMaxDistance));
+
+	return tNear <= tFar;
+}
+
+RayPacket::RayPacket(const Ray* rays, int count)
+	:	mCount(count)
+{
+	assert(count > 0 && count <= MAX_SIZE);
+
+	for (int i = 0; i < MAX_SIZE; ++i)
+	{
+		// Unused lanes never hit anything
+		const Ray ray = (i < count) ? rays[i] : Ray(XMFLOAT3(0.f, 0.f, 0.f), XMFLOAT3(0.f, 0.f, 1.f), -1.f);
+
+		mOriginX[i] = ray.origin.x;
+		mOriginY[i] = ray.origin.y;
+		mOriginZ[i] = ray.origin.z;
+
+		mInvDirectionX[i] = SafeReciprocal(ray.direction.x);
+		mInvDirectionY[i] = SafeReciprocal(ray.direction.y);
+		mInvDirectionZ[i] = SafeReciprocal(ray.direction.z);
+
+		mMaxDistance[i] = ray.maxDistance;
+	}
+}
+
+uint32_t RayPacket::Intersect(const XMFLOAT3& center, const XMFLOAT3& extents, uint32_t activeRays, float tNear[MAX_SIZE]) const
+{
+#if defined(_XM_SSE_INTRINSICS_)
+	const __m128 minX = _mm_set1_ps(center.x - extents.x);
+	const __m128 minY = _mm_set1_ps(center.y - extents.y);
+	const __m128 minZ = _mm_set1_ps(center.z - extents.z);
+
+	const __m128 maxX = _mm_set1_ps(center.x + extents.x);
+	const __m128 maxY = _mm_set1_ps(center.y + extents.y);
+	const __m128 maxZ = _mm_set1_ps(center.z + extents.z);
+
+	uint32_t hits = 0;
+
+	for (int first = 0; first < mCount; first += LANE_WIDTH)
+	{
+		// Skip the lanes that are done with this part of the hierarchy
+		if (!((activeRays >> first) & 0xf))
+			continue;
+
+		const __m128 originX = _mm_load_ps(mOriginX + first);
+		const __m128 originY = _mm_load_ps(mOriginY + first);
+		const __m128 originZ = _mm_load_ps(mOriginZ + first);
+
+		const __m128 invDirectionX = _mm_load_ps(mInvDirectionX + first);
+		const __m128 invDirectionY = _mm_load_ps(mInvDirectionY + first);
+		const __m128 invDirectionZ = _mm_load_ps(mInvDirectionZ + first);
+
+		const __m128 t0X = _mm_mul_ps(_mm_sub_ps(minX, originX), invDirectionX);
+		const __m128 t1X = _mm_mul_ps(_mm_sub_ps(maxX, originX), invDirectionX);
+		const __m128 t0Y = _mm_mul_ps(_mm_sub_ps(minY, originY), invDirectionY);
+		const __m128 t1Y = _mm_mul_ps(_mm_sub_ps(maxY, originY), invDirectionY);
+		const __m128 t0Z = _mm_mul_ps(_mm_sub_ps(minZ, originZ), invDirectionZ);
+		const __m128 t1Z = _mm_mul_ps(_mm_sub_ps(maxZ, originZ), invDirectionZ);
+
+		const __m128 nearXY = _mm_max_ps(_mm_min_ps(t0X, t1X), _mm_min_ps(t0Y, t1Y));
+		const __m128 nearZ = _mm_max_ps(_mm_min_ps(t0Z, t1Z), _mm_setzero_ps());
+		const __m128 farXY = _mm_min_ps(_mm_max_ps(t0X, t1X), _mm_max_ps(t0Y, t1Y));
+		const __m128 farZ = _mm_min_ps(_mm_max_ps(t0Z, t1Z), _mm_load_ps(mMaxDistance + first));
+
+		const __m128 entry = _mm_max_ps(nearXY, nearZ);
+		const __m128 exit = _mm_min_ps(farXY, farZ);
+
+		_mm_storeu_ps(tNear + first, entry);
+		hits |= static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(entry, exit))) << first;
+	}
+
+	return hits & activeRays;
+#else
+	return IntersectScalar(center, extents, activeRays, tNear);
+#endif
+}
+
+uint32_t RayPacket::IntersectScalar(const XMFLOAT3& center, const XMFLOAT3& extents, uint32_t activeRays, float tNear[MAX_SIZE]) const
+{
+	uint32_t hits = 0;
+
+	for (int i = 0; i < mCount; ++i)
+	{
+		if (!(activeRays & (1u << i)))
+			continue;
+
+		float nearX, farX, nearY, farY, nearZ, farZ;
+		GetSlab(center.x - extents.x, center.x + extents.x, mOriginX[i], mInvDirectionX[i], nearX, farX);
+		GetSlab(center.y - extents.y, center.y + extents.y, mOriginY[i], mInvDirectionY[i], nearY, farY);
+		GetSlab(center.z - extents.z, center.z + extents.z, mOriginZ[i], mInvDirectionZ[i], nearZ, farZ);
+
+		tNear[i] = std::max(std::max(nearX, nearY), std::max(nearZ, 0.f));
+		const float tFar = std::min(std::min(farX, farY), std::min(farZ, mMaxDistance[i]));
+
+		if (tNear[i] <= tFar)
+			hits |= 1u << i;
+	}
+
+	return hits;
+}
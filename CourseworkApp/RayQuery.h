@@ -0,0 +1,111 @@
+// Rays and segments tested against bounding boxes, either one at a time or in packets
+// A packet holds up to eight rays as a structure of arrays, so one SSE instruction handles one component of four rays
+// Rays hit the objects' world-space bounding boxes, i.e. the same boxes the hierarchy culls with
+
+#pragma once
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+#include <cstdint>
+#include <cfloat>
+
+using namespace DirectX;
+
+class MeshInstance;
+
+struct Ray
+{
+	XMFLOAT3 origin = { 0.f, 0.f, 0.f };
+
+	// Does not have to be normalised. Distances are measured in multiples of its length
+	XMFLOAT3 direction = { 0.f, 0.f, 1.f };
+
+	// Hits further along the ray than this are ignored
+	float maxDistance = FLT_MAX;
+
+	Ray() = default;
+	Ray(const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance = FLT_MAX) : origin(origin), direction(direction), maxDistance(maxDistance) {}
+
+	// A ray that stops at the end of the segment, with a unit direction, so distances are in world units
+	static Ray CreateSegment(const XMFLOAT3& start, const XMFLOAT3& end);
+};
+
+enum class RayQueryMode
+{
+	// Find the hit closest to the origin of the ray
+	NEAREST,
+
+	// Stop at the first hit found, which is not necessarily the nearest one. Enough for line of sight tests
+	ANY_HIT
+};
+
+struct RayHit
+{
+	MeshInstance* instance = nullptr;
+
+	// Distance along the ray to where it enters the object's bounding box. 0 if the ray starts inside of it
+	float distance = FLT_MAX;
+
+	bool IsHit() const { return instance != nullptr; }
+};
+
+// A single ray, with its reciprocal direction worked out once so that every box test is multiplications only
+class PreparedRay
+{
+public:
+	explicit PreparedRay(const Ray& ray);
+
+	// Whether the ray enters the box no further than its max distance. tNear receives the distance it enters at
+	bool Intersect(const XMFLOAT3& center, const XMFLOAT3& extents, float& tNear) const;
+
+	// Shorten the ray once something has been hit, so that boxes further away are rejected
+	void SetMaxDistance(float distance) { mMaxDistance = distance; }
+	float GetMaxDistance() const { return mMaxDistance; }
+
+	const XMFLOAT3& GetOrigin() const { return mOrigin; }
+
+private:
+	XMFLOAT3 mOrigin;
+	XMFLOAT3 mInvDirection;
+	float mMaxDistance;
+};
+
+// Up to MAX_SIZE rays that are traced through the hierarchy together. Works best for rays that start close to each
+// other and point in similar directions (e.g. the pixels of a tile), since those visit mostly the same nodes
+class RayPacket
+{
+public:
+	static constexpr int MAX_SIZE = 8;
+
+	// Number of rays tested by one SSE instruction
+	static constexpr int LANE_WIDTH = 4;
+
+	RayPacket(const Ray* rays, int count);
+
+	// Test the rays in activeRays against a box. Bit i of the returned mask is set if ray i enters the box no further
+	// than its max distance, and tNear[i] receives the distance it enters at
+	uint32_t Intersect(const XMFLOAT3& center, const XMFLOAT3& extents, uint32_t activeRays, float tNear[MAX_SIZE]) const;
+
+	// Scalar fallback of RayPacket::Intersect. Used when SSE is not available
+	uint32_t IntersectScalar(const XMFLOAT3& center, const XMFLOAT3& extents, uint32_t activeRays, float tNear[MAX_SIZE]) const;
+
+	void SetMaxDistance(int ray, float distance) { mMaxDistance[ray] = distance; }
+	float GetMaxDistance(int ray) const { return mMaxDistance[ray]; }
+
+	int GetCount() const { return mCount; }
+
+	// Mask with a bit set for every ray in the packet
+	uint32_t GetAllRays() const { return (1u << mCount) - 1; }
+
+private:
+	alignas(16) float mOriginX[MAX_SIZE];
+	alignas(16) float mOriginY[MAX_SIZE];
+	alignas(16) float mOriginZ[MAX_SIZE];
+
+	alignas(16) float mInvDirectionX[MAX_SIZE];
+	alignas(16) float mInvDirectionY[MAX_SIZE];
+	alignas(16) float mInvDirectionZ[MAX_SIZE];
+
+	alignas(16) float mMaxDistance[MAX_SIZE];
+
+	int mCount;
+};
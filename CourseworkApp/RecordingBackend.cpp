@@ -0,0 +1,162 @@
+#include "RecordingBackend.h"
+#include <cstring>
+
+namespace
+{
+	// FNV-1a
+	constexpr uint64_t HASH_OFFSET = 14695981039346656037ull;
+	constexpr uint64_t HASH_PRIME = 1099511628211ull;
+
+	uint64_t Hash(uint64_t hash, const void* data, size_t size)
+	{
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+		for (size_t i = 0; i < size; ++i)
+			hash = (hash ^ bytes[i]) * HASH_PRIME;
+
+		return hash;
+	}
+}
+
+bool RecordingBackend::DrawRecord::operator==(const DrawRecord& other) const
+{
+	return shaders == other.shaders && layout == other.layout && vertexBuffers[0] == other.vertexBuffers[0] &&
+		vertexBuffers[1] == other.vertexBuffers[1] && indexBuffer == other.indexBuffer && topology == other.topology &&
+		texture == other.texture && indexCount == other.indexCount && instanceCount == other.instanceCount &&
+		startInstance == other.startInstance && constantsHash == other.constantsHash;
+}
+
+RecordingBackend::RecordingBackend(bool keepDraws)
+	:	mKeepDraws(keepDraws)
+{
+}
+
+void RecordingBackend::Clear()
+{
+	mDraws.clear();
+	mStats = Stats();
+}
+
+void RecordingBackend::SetInputLayout(ID3D11InputLayout* layout)
+{
+	++mStats.calls;
+	mState.layout = layout;
+}
+
+void RecordingBackend::SetShaders(const ShaderSet& shaders)
+{
+	++mStats.calls;
+	mState.shaders = shaders;
+}
+
+void RecordingBackend::SetConstantBuffers(Stage stage, uint32_t slot, uint32_t count, ID3D11Buffer* const* buffers)
+{
+	++mStats.calls;
+
+	for (uint32_t i = 0; i < count && slot + i < NUM_SLOTS; ++i)
+		mConstantBuffers[(int) stage][slot + i] = buffers[i];
+}
+
+void RecordingBackend::SetShaderResources(Stage stage, uint32_t slot, uint32_t count, ID3D11ShaderResourceView* const* views)
+{
+	++mStats.calls;
+
+	if (stage == Stage::PS && slot == 0 && count > 0)
+		mState.texture = views[0];
+}
+
+void RecordingBackend::SetSamplers(Stage, uint32_t, uint32_t, ID3D11SamplerState* const*)
+{
+	++mStats.calls;
+}
+
+void RecordingBackend::UpdateConstantBuffer(ID3D11Buffer* buffer, const void* data, uint32_t size)
+{
+	++mStats.calls;
+	++mStats.constantUpdates;
+	mStats.constantBytes += size;
+
+	if (mKeepDraws)
+	{
+		auto& contents = mConstants[buffer];
+		contents.assign(static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + size);
+	}
+}
+
+void RecordingBackend::SetDrawConstants(Stage stage, uint32_t slot, ID3D11Buffer* buffer, const void* data, uint32_t size)
+{
+	UpdateConstantBuffer(buffer, data, size);
+
+	if (slot < NUM_SLOTS)
+		mConstantBuffers[(int) stage][slot] = buffer;
+}
+
+void RecordingBackend::SetVertexBuffer(uint32_t slot, ID3D11Buffer* buffer, uint32_t, uint32_t)
+{
+	++mStats.calls;
+
+	if (slot < 2)
+		mState.vertexBuffers[slot] = buffer;
+}
+
+void RecordingBackend::SetIndexBuffer(ID3D11Buffer* buffer, IndexFormat, uint32_t)
+{
+	++mStats.calls;
+	mState.indexBuffer = buffer;
+}
+
+void RecordingBackend::SetTopology(Topology topology)
+{
+	++mStats.calls;
+	mState.topology = topology;
+}
+
+void RecordingBackend::DrawIndexed(uint32_t indexCount, uint32_t, int32_t)
+{
+	Record(indexCount, 1, 0);
+}
+
+void RecordingBackend::DrawIndexedInstanced(uint32_t indexCount, uint32_t instanceCount, uint32_t, int32_t, uint32_t startInstance)
+{
+	Record(indexCount, instanceCount, startInstance);
+}
+
+void RecordingBackend::Record(uint32_t indexCount, uint32_t instanceCount, uint32_t startInstance)
+{
+	++mStats.calls;
+	++mStats.draws;
+
+	if (!mKeepDraws)
+		return;
+
+	mState.indexCount = indexCount;
+	mState.instanceCount = instanceCount;
+	mState.startInstance = startInstance;
+	mState.constantsHash = HashConstants();
+
+	mDraws.push_back(mState);
+}
+
+uint64_t RecordingBackend::HashConstants() const
+{
+	uint64_t hash = HASH_OFFSET;
+
+	for (const auto& stage : mConstantBuffers)
+	{
+		for (ID3D11Buffer* buffer : stage)
+		{
+			if (!buffer)
+				continue;
+
+			// Which buffer is bound matters as well as what is in it, e.g. for buffers that were never updated
+			hash = Hash(hash, &buffer, sizeof(buffer));
+
+			auto contents = mConstants.find(buffer);
+
+			if (contents != mConstants.end())
+				hash = Hash(hash, contents->second.data(), contents->second.size());
+		}
+	}
+
+	return hash;
+}
@@ -0,0 +1,97 @@
+// CommandBackend that draws nothing, and runs without D3D
+// It counts the calls made to it, and can keep the draw stream: the state every draw was issued with, including a
+// hash of the constant buffers bound at the time. Two ways of submitting a frame can then be checked for giving the
+// GPU exactly the same work, and submission can be measured without a driver underneath
+
+#pragma once
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+#include "CommandBackend.h"
+
+class RecordingBackend : public CommandBackend
+{
+public:
+	// Slots kept track of per stage. Bindings past them are only counted
+	static constexpr uint32_t NUM_SLOTS = 16;
+
+	struct DrawRecord
+	{
+		ShaderSet shaders;
+		ID3D11InputLayout* layout = nullptr;
+
+		ID3D11Buffer* vertexBuffers[2] = {};
+		ID3D11Buffer* indexBuffer = nullptr;
+		Topology topology = Topology::TRIANGLE_LIST;
+
+		// Texture of the pixel shader's first slot
+		ID3D11ShaderResourceView* texture = nullptr;
+
+		uint32_t indexCount = 0;
+		uint32_t instanceCount = 0;
+		uint32_t startInstance = 0;
+
+		// Contents of the constant buffers bound to every stage, hashed
+		uint64_t constantsHash = 0;
+
+		bool operator==(const DrawRecord& other) const;
+		bool operator!=(const DrawRecord& other) const { return !(*this == other); }
+	};
+
+	// Calls made since the last clear
+	struct Stats
+	{
+		int calls = 0;
+		int draws = 0;
+		int constantUpdates = 0;
+		size_t constantBytes = 0;
+	};
+
+	// Without keepDraws, calls are only counted, which makes it a null backend
+	explicit RecordingBackend(bool keepDraws = true);
+
+	// Forget the draws and stats. Bound state and constant buffer contents are kept, like a device context's are
+	void Clear();
+
+	const std::vector<DrawRecord>& GetDraws() const { return mDraws; }
+	const Stats& GetStats() const { return mStats; }
+
+	void SetInputLayout(ID3D11InputLayout* layout) override;
+	void SetShaders(const ShaderSet& shaders) override;
+
+	void SetConstantBuffers(Stage stage, uint32_t slot, uint32_t count, ID3D11Buffer* const* buffers) override;
+	void SetShaderResources(Stage stage, uint32_t slot, uint32_t count, ID3D11ShaderResourceView* const* views) override;
+	void SetSamplers(Stage stage, uint32_t slot, uint32_t count, ID3D11SamplerState* const* samplers) override;
+
+	void UpdateConstantBuffer(ID3D11Buffer* buffer, const void* data, uint32_t size) override;
+
+	// Recorded as updating buffer and binding it, so that draws compare equal whichever way their constants went
+	void SetDrawConstants(Stage stage, uint32_t slot, ID3D11Buffer* buffer, const void* data, uint32_t size) override;
+
+	void SetVertexBuffer(uint32_t slot, ID3D11Buffer* buffer, uint32_t stride, uint32_t offset) override;
+	void SetIndexBuffer(ID3D11Buffer* buffer, IndexFormat format, uint32_t offset) override;
+	void SetTopology(Topology topology) override;
+
+	void DrawIndexed(uint32_t indexCount, uint32_t startIndex, int32_t baseVertex) override;
+	void DrawIndexedInstanced(uint32_t indexCount, uint32_t instanceCount, uint32_t startIndex, int32_t baseVertex, uint32_t startInstance) override;
+
+private:
+	// Add a draw with the current state
+	void Record(uint32_t indexCount, uint32_t instanceCount, uint32_t startInstance);
+
+	uint64_t HashConstants() const;
+
+	bool mKeepDraws;
+
+	std::vector<DrawRecord> mDraws;
+	Stats mStats;
+
+	// The state draws are recorded with
+	DrawRecord mState;
+	ID3D11Buffer* mConstantBuffers[(int) Stage::NUM_STAGES][NUM_SLOTS] = {};
+
+	// Last contents of every constant buffer that was updated
+	std::unordered_map<ID3D11Buffer*, std::vector<uint8_t>> mConstants;
+};
@@ -0,0 +1,89 @@
+#include "RenderQueue.h"
+#include <algorithm>
+#include <cmath>
+
+static_assert(RenderQueue::PASS_BITS + 1 + RenderQueue::SHADER_BITS + RenderQueue::TEXTURE_BITS + RenderQueue::MESH_BITS + RenderQueue::DEPTH_BITS == 64,
+	"RenderQueue keys are expected to use all 64 bits");
+
+void RenderQueue::Clear()
+{
+	mPackets.clear();
+	mKeys.clear();
+	mOrder.clear();
+}
+
+void RenderQueue::Submit(Pass pass, bool translucent, float depth, const DrawPacket& packet)
+{
+	const uint32_t maxDepth = (1u << DEPTH_BITS) - 1;
+	const float normalisedDepth = std::min(std::max(depth / mMaxDepth, 0.f), 1.f);
+	const uint32_t quantisedDepth = static_cast<uint32_t>(normalisedDepth * maxDepth);
+
+	mKeys.push_back(MakeKey(pass, translucent, GetId(mShaderIds, packet.shader), GetId(mTextureIds, packet.texture), GetId(mMeshIds, packet.mesh), quantisedDepth));
+	mOrder.push_back(static_cast<uint32_t>(mPackets.size()));
+	mPackets.push_back(packet);
+}
+
+void RenderQueue::Sort(WorkerPool* pool)
+{
+	mSubmittedRebinds = CountRebinds(mOrder.data());
+
+	mSort.Sort(mKeys.data(), mOrder.data(), mKeys.size(), pool);
+
+	mSortedRebinds = CountRebinds(mOrder.data());
+}
+
+uint64_t RenderQueue::MakeKey(Pass pass, bool translucent, uint32_t shaderId, uint32_t textureId, uint32_t meshId, uint32_t depth)
+{
+	const uint64_t shader = shaderId & ((1u << SHADER_BITS) - 1);
+	const uint64_t texture = textureId & ((1u << TEXTURE_BITS) - 1);
+	const uint64_t mesh = meshId & ((1u << MESH_BITS) - 1);
+
+	uint64_t key = static_cast<uint64_t>(pass) << 1 | (translucent ? 1 : 0);
+
+	if (!translucent)
+	{
+		// Group by state, then front-to-back
+		key = (key << SHADER_BITS) | shader;
+		key = (key << TEXTURE_BITS) | texture;
+		key = (key << MESH_BITS) | mesh;
+		key = (key << DEPTH_BITS) | depth;
+	}
+	else
+	{
+		// Back-to-front first, as the order of blended draws matters more than their state
+		const uint32_t farToNear = ((1u << DEPTH_BITS) - 1) - depth;
+
+		key = (key << DEPTH_BITS) | farToNear;
+		key = (key << SHADER_BITS) | shader;
+		key = (key << TEXTURE_BITS) | texture;
+		key = (key << MESH_BITS) | mesh;
+	}
+
+	return key;
+}
+
+uint32_t RenderQueue::GetId(IdMap& ids, const void* object)
+{
+	return ids.emplace(object, static_cast<uint32_t>(ids.size())).first->second;
+}
+
+auto RenderQueue::CountRebinds(const uint32_t* order) const -> RebindStats
+{
+	RebindStats stats;
+
+	// The first draw binds everything
+	const DrawPacket* previous = nullptr;
+
+	for (size_t i = 0; i < mPackets.size(); ++i)
+	{
+		const DrawPacket& packet = mPackets[order[i]];
+
+		stats.shaders += !previous || packet.shader != previous->shader;
+		stats.textures += !previous || packet.texture != previous->texture;
+		stats.meshes += !previous || packet.mesh != previous->mesh;
+
+		previous = &packet;
+	}
+
+	return stats;
+}
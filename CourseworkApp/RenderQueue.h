@@ -0,0 +1,106 @@
+// Draws submitted in any order, and sorted by a 64-bit key before they are issued
+// From the most to the least significant bits, a key holds:
+//	opaque:			pass | 0 | shader | texture | mesh | depth
+//	translucent:	pass | 1 | far-to-near depth | shader | texture | mesh
+// so every pass is drawn in turn, opaque before translucent. Opaque draws are grouped by state to keep rebinds down,
+// and drawn front-to-back within a group; translucent draws have to be drawn back-to-front to blend correctly
+// Shaders, textures and meshes get small ids the first time they are seen, which are kept for the queue's lifetime
+
+#pragma once
+#include <DirectXMath.h>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+#include "MeshInstance.h"
+#include "RadixSort.h"
+#include "WorkerPool.h"
+
+using namespace DirectX;
+
+class BaseShader;
+
+class RenderQueue
+{
+public:
+	enum class Pass : uint32_t
+	{
+		SHADOW,
+		MAIN
+	};
+
+	// Bits of every field of a key. Ids past the number of bits wrap around, which only costs some grouping
+	static constexpr int PASS_BITS = 3;
+	static constexpr int SHADER_BITS = 10;
+	static constexpr int TEXTURE_BITS = 12;
+	static constexpr int MESH_BITS = 14;
+	static constexpr int DEPTH_BITS = 24;
+
+	// Everything needed to issue a draw
+	struct DrawPacket
+	{
+		MeshInstance* instance;
+		BaseShader* shader;
+		ID3D11ShaderResourceView* texture;
+		BaseMesh* mesh;
+	};
+
+	// Number of times consecutive draws use a different shader, texture or mesh
+	struct RebindStats
+	{
+		int shaders = 0;
+		int textures = 0;
+		int meshes = 0;
+	};
+
+	// Remove every draw. Memory and ids are kept for the next frame
+	void Clear();
+
+	// Depths are quantised over [0, maxDepth]; anything further away is treated as being at maxDepth
+	void SetMaxDepth(float maxDepth) { mMaxDepth = maxDepth; }
+
+	// Queue a draw. depth is its distance along the view direction of the pass
+	void Submit(Pass pass, bool translucent, float depth, const DrawPacket& packet);
+
+	// Sort the draws by their keys, and count the rebinds before and after
+	void Sort(WorkerPool* pool = nullptr);
+
+	// Draws in sorted order
+	size_t GetNumPackets() const { return mPackets.size(); }
+	const DrawPacket& GetPacket(size_t idx) const { return mPackets[mOrder[idx]]; }
+	uint64_t GetKey(size_t idx) const { return mKeys[idx]; }
+
+	// Rebinds of the draws in the order they were submitted in, and in sorted order
+	const RebindStats& GetSubmittedRebinds() const { return mSubmittedRebinds; }
+	const RebindStats& GetSortedRebinds() const { return mSortedRebinds; }
+
+	static uint64_t MakeKey(Pass pass, bool translucent, uint32_t shaderId, uint32_t textureId, uint32_t meshId, uint32_t depth);
+
+	static Pass GetPass(uint64_t key) { return static_cast<Pass>(key >> (64 - PASS_BITS)); }
+	static bool IsTranslucent(uint64_t key) { return (key >> (64 - PASS_BITS - 1)) & 1; }
+
+private:
+	using IdMap = std::unordered_map<const void*, uint32_t>;
+
+	static uint32_t GetId(IdMap& ids, const void* object);
+
+	// Count the rebinds of the packets in the given order
+	RebindStats CountRebinds(const uint32_t* order) const;
+
+	float mMaxDepth = 1.f;
+
+	std::vector<DrawPacket> mPackets;
+
+	// Keys, and the packet each belongs to. Only sorted after RenderQueue::Sort
+	std::vector<uint64_t> mKeys;
+	std::vector<uint32_t> mOrder;
+	RadixSort<uint64_t> mSort;
+
+	IdMap mShaderIds;
+	IdMap mTextureIds;
+	IdMap mMeshIds;
+
+	RebindStats mSubmittedRebinds;
+	RebindStats mSortedRebinds;
+};
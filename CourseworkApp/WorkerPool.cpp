@@ -0,0 +1,138 @@
+#include "WorkerPool.h"
+#include <algorithm>
+#include <cassert>
+
+WorkerPool::WorkerPool(int numWorkers)
+	:	mNumWorkers(std::max(numWorkers, 1)),
+		mWorkers(new Worker[std::max(numWorkers, 1)])
+{
+	for (int i = 1; i < mNumWorkers; ++i)
+		mThreads.emplace_back(&WorkerPool::WorkerMain, this, i);
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mWakeMutex);
+		mQuit = true;
+	}
+
+	mWake.notify_all();
+
+	for (auto& thread : mThreads)
+		thread.join();
+}
+
+void WorkerPool::Run(int numTasks, const std::function<void(int taskIdx, int workerIdx)>& job)
+{
+	if (numTasks <= 0)
+		return;
+
+	assert(mRemainingTasks == 0);
+
+	mJob = &job;
+	mStolenTasks = 0;
+
+	// Set before any task is dealt out; a worker still finishing the previous batch may pick them up straight away
+	mRemainingTasks = numTasks;
+
+	// Deal the tasks out in contiguous blocks
+	for (int i = 0; i < mNumWorkers; ++i)
+	{
+		const int begin = static_cast<int>((int64_t) numTasks * i / mNumWorkers);
+		const int end = static_cast<int>((int64_t) numTasks * (i + 1) / mNumWorkers);
+
+		std::lock_guard<std::mutex> lock(mWorkers[i].mutex);
+		for (int taskIdx = begin; taskIdx < end; ++taskIdx)
+			mWorkers[i].tasks.push_back(taskIdx);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mWakeMutex);
+		++mGeneration;
+	}
+
+	mWake.notify_all();
+
+	// The calling thread works too, rather than sitting idle
+	Work(0);
+
+	std::unique_lock<std::mutex> lock(mWakeMutex);
+	mDone.wait(lock, [this]() { return mRemainingTasks == 0; });
+
+	mJob = nullptr;
+}
+
+void WorkerPool::WorkerMain(int workerIdx)
+{
+	uint64_t generation = 0;
+
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mWakeMutex);
+			mWake.wait(lock, [&]() { return mQuit || mGeneration != generation; });
+
+			if (mQuit)
+				return;
+
+			generation = mGeneration;
+		}
+
+		Work(workerIdx);
+	}
+}
+
+void WorkerPool::Work(int workerIdx)
+{
+	int taskIdx;
+
+	while (Pop(workerIdx, taskIdx) || Steal(workerIdx, taskIdx))
+	{
+		(*mJob)(taskIdx, workerIdx);
+
+		// Whoever finishes the last task wakes up the thread waiting in Run
+		if (--mRemainingTasks == 0)
+		{
+			std::lock_guard<std::mutex> lock(mWakeMutex);
+			mDone.notify_all();
+		}
+	}
+}
+
+bool WorkerPool::Pop(int workerIdx, int& taskIdx)
+{
+	Worker& worker = mWorkers[workerIdx];
+	std::lock_guard<std::mutex> lock(worker.mutex);
+
+	if (worker.tasks.empty())
+		return false;
+
+	taskIdx = worker.tasks.front();
+	worker.tasks.pop_front();
+
+	return true;
+}
+
+bool WorkerPool::Steal(int thiefIdx, int& taskIdx)
+{
+	// Start with the next worker along, so that thieves do not all go for the same victim
+	for (int i = 1; i < mNumWorkers; ++i)
+	{
+		Worker& victim = mWorkers[(thiefIdx + i) % mNumWorkers];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+
+		if (victim.tasks.empty())
+			continue;
+
+		// Take from the opposite end to the owner, furthest away from what it is working on
+		taskIdx = victim.tasks.back();
+		victim.tasks.pop_back();
+
+		++mStolenTasks;
+
+		return true;
+	}
+
+	return false;
+}
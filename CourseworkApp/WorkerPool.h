@@ -0,0 +1,66 @@
+// A fixed set of worker threads that run batches of independent tasks
+// Every worker has its own deque of tasks. A worker takes tasks from the front of its own deque, and once that is
+// empty it steals from the back of the others', so uneven tasks are balanced out without a central queue
+
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <cstdint>
+
+class WorkerPool
+{
+public:
+	// The thread calling WorkerPool::Run counts as worker 0, so numWorkers - 1 threads are started
+	explicit WorkerPool(int numWorkers = std::thread::hardware_concurrency());
+	~WorkerPool();
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	// Run job(taskIdx, workerIdx) for every task in [0, numTasks), and wait for all of them to finish
+	// Tasks are dealt out to the workers in contiguous blocks, so neighbouring tasks tend to run on the same worker
+	void Run(int numTasks, const std::function<void(int taskIdx, int workerIdx)>& job);
+
+	int GetNumWorkers() const { return mNumWorkers; }
+
+	// Number of tasks that ran on a different worker than the one they were dealt to, during the last call to Run
+	int GetStolenTasks() const { return mStolenTasks; }
+
+private:
+	struct Worker
+	{
+		// Only held long enough to push or pop a task, which is cheap next to the tasks themselves
+		std::mutex mutex;
+		std::deque<int> tasks;
+	};
+
+	void WorkerMain(int workerIdx);
+
+	// Run tasks until there are none left to pop or steal
+	void Work(int workerIdx);
+
+	bool Pop(int workerIdx, int& taskIdx);
+	bool Steal(int thiefIdx, int& taskIdx);
+
+	const int mNumWorkers;
+
+	std::vector<std::thread> mThreads;
+	std::unique_ptr<Worker[]> mWorkers;
+
+	// Wakes the threads up when there is a new batch of tasks
+	std::mutex mWakeMutex;
+	std::condition_variable mWake;
+	std::condition_variable mDone;
+	uint64_t mGeneration = 0;
+	bool mQuit = false;
+
+	const std::function<void(int, int)>* mJob = nullptr;
+	std::atomic<int> mRemainingTasks{ 0 };
+	std::atomic<int> mStolenTasks{ 0 };
+};
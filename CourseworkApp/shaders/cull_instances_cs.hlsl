@@ -0,0 +1,95 @@
+// Frustum culling of instances. Every thread tests the bounding box of one instance, and the world matrices of the
+// visible instances are compacted into gVisibleInstances, to be drawn with DrawIndexedInstancedIndirect
+// GpuCulling::Emulate runs the same kernel on the CPU, and has to be kept in step with it
+
+#define THREAD_GROUP_SIZE	64
+#define NUM_PLANES			6
+
+struct Instance
+{
+	// Rows of the world matrix, the way XMFLOAT4X4 stores them
+	float4 world[4];
+
+	// World-space bounding box
+	float3 center;
+	float padding0;
+	float3 extents;
+	float padding1;
+};
+
+cbuffer CullBuffer : register(b0)
+{
+	// Planes face out of the frustum
+	float4 gPlanes[NUM_PLANES];
+	uint gNumInstances;
+	uint3 gPadding;
+};
+
+StructuredBuffer<Instance> gInstances : register(t0);
+
+// World matrices of the visible instances, 64 bytes each, in the layout instance_vs.hlsl reads them in
+RWByteAddressBuffer gVisibleInstances : register(u0);
+
+// D3D11_DRAW_INDEXED_INSTANCED_INDIRECT_ARGS. InstanceCount (at byte 4) is reset to 0 before every dispatch
+RWByteAddressBuffer gArguments : register(u1);
+
+// Whether each thread's instance is visible, and then its offset within the group's range of the output
+groupshared uint gVisible[THREAD_GROUP_SIZE];
+groupshared uint gGroupStart;
+
+bool IsVisible(float3 center, float3 extents)
+{
+	bool visible = true;
+
+	[unroll]
+	for (int i = 0; i < NUM_PLANES; ++i)
+	{
+		// precise stops the compiler from fusing the multiplies and adds, so the results match GpuCulling::IsVisible
+		precise float distance = center.x * gPlanes[i].x + center.y * gPlanes[i].y + center.z * gPlanes[i].z + gPlanes[i].w;
+		precise float radius = extents.x * abs(gPlanes[i].x) + extents.y * abs(gPlanes[i].y) + extents.z * abs(gPlanes[i].z);
+
+		if (distance > radius)
+			visible = false;
+	}
+
+	return visible;
+}
+
+[numthreads(THREAD_GROUP_SIZE, 1, 1)]
+void main(int3 groupThreadID : SV_GroupThreadID, int3 dispatchID : SV_DispatchThreadID)
+{
+	const uint idx = dispatchID.x;
+
+	bool visible = false;
+	if (idx < gNumInstances)
+		visible = IsVisible(gInstances[idx].center, gInstances[idx].extents);
+
+	gVisible[groupThreadID.x] = visible ? 1 : 0;
+	GroupMemoryBarrierWithGroupSync();
+
+	// One thread turns the flags into offsets, so the instances of a group stay in order, and reserves the group's range
+	if (groupThreadID.x == 0)
+	{
+		uint count = 0;
+
+		for (uint i = 0; i < THREAD_GROUP_SIZE; ++i)
+		{
+			const uint flag = gVisible[i];
+			gVisible[i] = count;
+			count += flag;
+		}
+
+		gArguments.InterlockedAdd(4, count, gGroupStart);
+	}
+
+	GroupMemoryBarrierWithGroupSync();
+
+	if (visible)
+	{
+		const uint address = (gGroupStart + gVisible[groupThreadID.x]) * 64;
+
+		[unroll]
+		for (int row = 0; row < 4; ++row)
+			gVisibleInstances.Store4(address + row * 16, asuint(gInstances[idx].world[row]));
+	}
+}
@@ -0,0 +1,2 @@
+#define INSTANCE_AFFINE
+#include "instance_vs_header.hlsl"
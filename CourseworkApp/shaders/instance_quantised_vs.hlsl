@@ -0,0 +1,2 @@
+#define INSTANCE_QUANTISED
+#include "instance_vs_header.hlsl"
@@ -0,0 +1,2 @@
+#define INSTANCE_QUATERNION
+#include "instance_vs_header.hlsl"
@@ -0,0 +1,110 @@
+// Header file containing the instancing vertex shader. Every instance format (see InstancePacker) has a permutation
+// that defines one of INSTANCE_MATRIX, INSTANCE_AFFINE, INSTANCE_QUATERNION or INSTANCE_QUANTISED before including it
+
+cbuffer MatrixBuffer : register(b0)
+{
+	row_major matrix gViewMatrix;
+	row_major matrix gProjectionMatrix;
+};
+
+cbuffer CameraBuffer : register(b1)
+{
+	float3 gCameraPositionW;
+};
+
+// Range the positions and scales of quantised instances are stored in
+cbuffer QuantisationBuffer : register(b2)
+{
+	float3 gPositionMin;
+	float gMaxScale;
+	float3 gPositionRange;
+};
+
+struct Input
+{
+	float4 positionL : POSITION;
+	float2 tex : TEXCOORD0;
+	float3 normal : NORMAL;
+
+	// Instance specific data
+#if defined(INSTANCE_MATRIX)
+	row_major matrix worldMatrix : WORLD;
+#elif defined(INSTANCE_AFFINE)
+	// Columns of the world matrix
+	float4 worldColumns[3] : WORLD;
+#else
+	// Scale in w. Unsigned normalised when quantised
+	float4 positionScale : WORLD0;
+
+	// Signed normalised when quantised
+	float4 rotation : WORLD1;
+#endif
+};
+
+struct Output
+{
+	float3 positionW : POSITION;
+	float3 cameraVecW : CAMERA;
+	float2 tex : TEXCOORD0;
+	float3 normal : NORMAL;
+	float4 positionH : SV_POSITION;
+};
+
+// Rotation matrix of a unit quaternion, the same as XMMatrixRotationQuaternion
+float3x3 QuaternionToMatrix(float4 q)
+{
+	float3 q2 = q.xyz + q.xyz;
+	float3 qq2 = q.xyz * q2;
+	float3 wq2 = q.w * q2;
+	float xy2 = q.x * q2.y;
+	float xz2 = q.x * q2.z;
+	float yz2 = q.y * q2.z;
+
+	return float3x3(1.f - qq2.y - qq2.z, xy2 + wq2.z, xz2 - wq2.y,
+					xy2 - wq2.z, 1.f - qq2.x - qq2.z, yz2 + wq2.x,
+					xz2 + wq2.y, yz2 - wq2.x, 1.f - qq2.x - qq2.y);
+}
+
+// The world matrix of an instance without its constant last column
+float4x3 GetWorldMatrix(Input input)
+{
+#if defined(INSTANCE_MATRIX)
+	return (float4x3) input.worldMatrix;
+#elif defined(INSTANCE_AFFINE)
+	return transpose(float3x4(input.worldColumns[0], input.worldColumns[1], input.worldColumns[2]));
+#else
+	float4 positionScale = input.positionScale;
+	float4 rotation = input.rotation;
+
+#if defined(INSTANCE_QUANTISED)
+	positionScale = float4(gPositionMin, 0.f) + positionScale * float4(gPositionRange, gMaxScale);
+	rotation = normalize(rotation);
+#endif
+
+	float3x3 rotationScale = QuaternionToMatrix(rotation) * positionScale.w;
+
+	return float4x3(rotationScale[0], rotationScale[1], rotationScale[2], positionScale.xyz);
+#endif
+}
+
+Output main(Input input)
+{
+	input.positionL.w = 1.f;
+
+	float4x3 worldMatrix = GetWorldMatrix(input);
+
+	Output output;
+
+	output.positionW = mul(input.positionL, worldMatrix);
+
+	output.cameraVecW = gCameraPositionW - output.positionW;
+
+	output.positionH = mul(float4(output.positionW, 1.f), gViewMatrix);
+	output.positionH = mul(output.positionH, gProjectionMatrix);
+
+	output.tex = input.tex;
+
+	output.normal = normalize(mul(input.normal, (float3x3) worldMatrix));
+
+	return output;
+}
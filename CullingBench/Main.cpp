@@ -0,0 +1,452 @@
+// Command line benchmark for the culling hierarchies, built without D3D or a window
+// Replays a camera path through synthetic scenes of every type and size, and prints a line per scene and hierarchy
+//
+// Usage: CullingBench [--path camera_path.txt] [--frames 600] [--counts 1000,10000,...] [--rays 65536] [--cache bvh.cache] [--frustum] [--contribution] [--rebuild] [--pack] [--queue] [--commands] [--gpu] [--output] [--arena] [--parallel]
+// Paths are recorded in the application ("Record camera path"); without one, the camera orbits the centre of the scene
+// With --rays, ray queries are benchmarked too, tracing that many rays per configuration
+// With --cache, building the SAH hierarchy is compared against mapping it from a cache file at that path
+// With --frustum, the batched and scalar box tests are checked against BoundingFrustum::Contains on random boxes
+// With --contribution, culling with the frustum only is compared against also culling objects below a few sizes on screen
+// With --rebuild, rebuilding the LBVH from scratch is timed on 1, 2, 4... threads, up to the number of cores
+// With --pack, packing every object's transform into each of the instance formats is timed
+// With --queue, the visible objects of every frame are sorted by a RenderQueue, counting the state changes before and after
+// With --commands, submitting the draws of every frame straight to a null backend is compared against recording them
+// into a CommandBuffer and replaying it, which is also checked for giving the same draw stream. Replaying through a
+// FilteringBackend is timed and checked too, counting the binding calls it passes on and drops per draw
+// With --gpu, the GPU culling kernel is emulated on the CPU and checked against CullingFrustum
+// With --output, gathering the visible transforms into the instance buffer is compared against culling straight into it
+// With --arena, the FrameAllocator behind ConstantArena is checked against a simulated GPU a few frames behind
+// With --parallel, recording the draws of a shadow and a camera pass on one thread is compared against recording them in
+// chunks on 1, 2, 4... threads, up to the number of cores, which is also checked for giving the same draw stream
+//
+// Every check prints NO in its Match column, or a non-zero count of mismatches or errors, when it disagrees with its
+// reference, and makes the run return 1
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#include "CullingBenchmark.h"
+
+namespace
+{
+	// Rebuilds timed per thread count with --rebuild
+	constexpr int REBUILDS = 20;
+
+	// Frames of instances packed per format with --pack
+	constexpr int PACK_FRAMES = 20;
+
+	// Size of the buffer allocated from with --arena: two or three frames of a few hundred draws
+	constexpr size_t ARENA_CAPACITY = 256 * 1024;
+
+	// Draws per chunk recorded with --parallel
+	constexpr size_t PARALLEL_CHUNK_SIZE = ParallelRecorder::DEFAULT_CHUNK_SIZE;
+
+	// Random boxes and frustums tested with --frustum
+	constexpr int FRUSTUM_BOXES = 100'000;
+	constexpr int FRUSTUM_QUERIES = 32;
+
+	std::atomic<long long> gAllocations{ 0 };
+
+	long long CountAllocations()
+	{
+		return gAllocations.load();
+	}
+
+	std::vector<int> ParseCounts(const char* list)
+	{
+		std::vector<int> counts;
+
+		for (const char* c = list; *c; )
+		{
+			char* end;
+			long count = std::strtol(c, &end, 10);
+
+			if (end == c)
+				break;
+
+			counts.push_back(static_cast<int>(count));
+			c = (*end == ',') ? end + 1 : end;
+		}
+
+		return counts;
+	}
+}
+
+// Count every heap allocation, so that allocations made while culling show up in the results
+void* operator new(std::size_t size)
+{
+	++gAllocations;
+
+	if (void* memory = std::malloc(size ? size : 1))
+		return memory;
+
+	throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+	std::free(memory);
+}
+
+int main(int argc, char** argv)
+{
+	std::string pathFile;
+	int numFrames = 600;
+	std::vector<int> counts = { 1'000, 10'000, 100'000, 1'000'000, 10'000'000 };
+	int numRays = 0;
+	std::string cacheFile;
+	bool frustum = false;
+	bool contribution = false;
+	bool rebuild = false;
+	bool pack = false;
+	bool queue = false;
+	bool commands = false;
+	bool gpu = false;
+	bool output = false;
+	bool arena = false;
+	bool parallel = false;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (!std::strcmp(argv[i], "--path") && i + 1 < argc)
+			pathFile = argv[++i];
+		else if (!std::strcmp(argv[i], "--frames") && i + 1 < argc)
+			numFrames = std::atoi(argv[++i]);
+		else if (!std::strcmp(argv[i], "--counts") && i + 1 < argc)
+			counts = ParseCounts(argv[++i]);
+		else if (!std::strcmp(argv[i], "--rays") && i + 1 < argc)
+			numRays = std::atoi(argv[++i]);
+		else if (!std::strcmp(argv[i], "--cache") && i + 1 < argc)
+			cacheFile = argv[++i];
+		else if (!std::strcmp(argv[i], "--frustum"))
+			frustum = true;
+		else if (!std::strcmp(argv[i], "--contribution"))
+			contribution = true;
+		else if (!std::strcmp(argv[i], "--rebuild"))
+			rebuild = true;
+		else if (!std::strcmp(argv[i], "--pack"))
+			pack = true;
+		else if (!std::strcmp(argv[i], "--queue"))
+			queue = true;
+		else if (!std::strcmp(argv[i], "--commands"))
+			commands = true;
+		else if (!std::strcmp(argv[i], "--gpu"))
+			gpu = true;
+		else if (!std::strcmp(argv[i], "--output"))
+			output = true;
+		else if (!std::strcmp(argv[i], "--arena"))
+			arena = true;
+		else if (!std::strcmp(argv[i], "--parallel"))
+			parallel = true;
+		else
+		{
+			std::fprintf(stderr, "Usage: %s [--path camera_path.txt] [--frames 600] [--counts 1000,10000,...] [--rays 65536] [--cache bvh.cache] [--frustum] [--contribution] [--rebuild] [--pack] [--queue] [--commands] [--gpu] [--output] [--arena] [--parallel]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	std::vector<CullingBenchmark::CameraPose> path;
+
+	if (pathFile.empty())
+		path = CullingBenchmark::CreateOrbitPath(numFrames);
+	else if (!CullingBenchmark::LoadCameraPath(pathFile, path))
+	{
+		std::fprintf(stderr, "Could not read camera path '%s'\n", pathFile.c_str());
+		return 1;
+	}
+
+	std::printf("%-9s %-6s %9s %10s %10s %10s %9s %9s %12s\n", "Scene", "BVH", "Objects", "Build ms", "Query ms", "ns/object", "Nodes", "Visible", "Allocs/frame");
+
+	for (auto scene : { CullingBenchmark::SceneType::UNIFORM, CullingBenchmark::SceneType::CLUSTERED, CullingBenchmark::SceneType::CITY })
+	{
+		for (int count : counts)
+		{
+			for (auto type : { BoundingVolume::HierarchyType::OCTREE, BoundingVolume::HierarchyType::SAH, BoundingVolume::HierarchyType::LBVH })
+			{
+				const auto result = CullingBenchmark::RunCameraPath(scene, type, count, path, &CountAllocations);
+
+				std::printf("%-9s %-6s %9d %10.2f %10.4f %10.3f %9d %9d %12.2f\n", CullingBenchmark::GetName(scene), CullingBenchmark::GetName(type),
+					result.objectCount, result.buildMs, result.queryMs, result.nsPerObject, result.nodesVisited, result.visibleObjects, result.allocationsPerFrame);
+
+				std::fflush(stdout);
+			}
+		}
+	}
+
+	// Checks that disagreed with their reference. Any of them fails the run
+	int failures = 0;
+
+	if (frustum)
+	{
+		const auto result = CullingBenchmark::VerifyFrustumTests(FRUSTUM_BOXES, FRUSTUM_QUERIES);
+
+		std::printf("\n%9s %11s %11s %10s %13s\n", "Boxes", "Mismatches", "Batched ms", "Scalar ms", "Collision ms");
+		std::printf("%9d %11d %11.2f %10.2f %13.2f\n", result.boxesTested, result.mismatches, result.batchedMs, result.scalarMs, result.collisionMs);
+		std::fflush(stdout);
+
+		failures += result.mismatches;
+	}
+
+	if (!cacheFile.empty())
+	{
+		std::printf("\n%-9s %9s %10s %10s %10s %12s %12s %12s %6s\n", "Scene", "Objects", "Build ms", "Save ms", "Map ms", "File MB", "1st query", "(mapped)", "Match");
+
+		for (auto scene : { CullingBenchmark::SceneType::UNIFORM, CullingBenchmark::SceneType::CLUSTERED, CullingBenchmark::SceneType::CITY })
+		{
+			for (int count : counts)
+			{
+				const auto result = CullingBenchmark::MeasureCache(scene, count, cacheFile, numFrames);
+
+				std::printf("%-9s %9d %10.2f %10.2f %10.3f %12.2f %12.3f %12.3f %6s\n", CullingBenchmark::GetName(scene), count, result.buildMs, result.saveMs,
+					result.loadMs, result.fileBytes / (1024.0 * 1024.0), result.firstQueryMs, result.firstQueryMappedMs, result.matchesBuilt ? "yes" : "NO");
+
+				if (!result.matchesBuilt)
+					++failures;
+
+				std::fflush(stdout);
+			}
+		}
+
+		std::remove(cacheFile.c_str());
+	}
+
+	// 1, 2, 4... threads, up to the number of cores
+	std::vector<int> threadCounts;
+
+	for (int numThreads = 1; numThreads < (int) std::thread::hardware_concurrency(); numThreads *= 2)
+		threadCounts.push_back(numThreads);
+
+	threadCounts.push_back(std::max((int) std::thread::hardware_concurrency(), 1));
+
+	if (rebuild)
+	{
+		std::printf("\n%-9s %9s %8s %11s %6s\n", "Scene", "Objects", "Threads", "Rebuild ms", "Match");
+
+		for (auto scene : { CullingBenchmark::SceneType::UNIFORM, CullingBenchmark::SceneType::CLUSTERED, CullingBenchmark::SceneType::CITY })
+		{
+			for (int count : counts)
+			{
+				for (const auto& result : CullingBenchmark::MeasureRebuild(scene, count, REBUILDS, threadCounts))
+				{
+					std::printf("%-9s %9d %8d %11.3f %6s\n", CullingBenchmark::GetName(scene), count, result.numThreads, result.rebuildMs,
+						result.matchesSerial ? "yes" : "NO");
+
+					if (!result.matchesSerial)
+						++failures;
+				}
+
+				std::fflush(stdout);
+			}
+		}
+	}
+
+	if (pack)
+	{
+		std::printf("\n%-9s %9s %-10s %6s %10s %12s %12s %10s\n", "Scene", "Objects", "Format", "Bytes", "Pack ms", "ns/instance", "MB/frame", "Max error");
+
+		for (auto scene : { CullingBenchmark::SceneType::UNIFORM, CullingBenchmark::SceneType::CLUSTERED, CullingBenchmark::SceneType::CITY })
+		{
+			for (int count : counts)
+			{
+				for (const auto& result : CullingBenchmark::MeasureInstancePacking(scene, count, PACK_FRAMES))
+				{
+					std::printf("%-9s %9d %-10s %6u %10.3f %12.3f %12.2f %10.6f\n", CullingBenchmark::GetName(scene), count, InstancePacker::GetName(result.format),
+						result.stride, result.packMs, result.nsPerInstance, result.bytesPerFrame / (1024.0 * 1024.0), result.maxError);
+				}
+
+				std::fflush(stdout);
+			}
+		}
+	}
+
+	if (output)
+	{
+		std::printf("\n%-9s %9s %-10s %9s %9s %10s %9s %12s %10s %6s\n", "Scene", "Objects", "Format", "Visible", "Cull ms", "Gather ms", "Span ms", "Gather ns/in", "Span ns/in", "Match");
+
+		for (auto scene : { CullingBenchmark::SceneType::UNIFORM, CullingBenchmark::SceneType::CLUSTERED, CullingBenchmark::SceneType::CITY })
+		{
+			for (int count : counts)
+			{
+				for (const auto& result : CullingBenchmark::MeasureInstanceOutput(scene, count, numFrames))
+				{
+					std::printf("%-9s %9d %-10s %9d %9.3f %10.3f %9.3f %12.2f %10.2f %6s\n", CullingBenchmark::GetName(scene), count, InstancePacker::GetName(result.format),
+						result.visibleObjects, result.cullMs, result.gatherMs, result.spanMs, result.gatherNsPerInstance, result.spanNsPerInstance,
+						result.matchesGathered ? "yes" : "NO");
+
+					if (!result.matchesGathered)
+						++failures;
+				}
+
+				std::fflush(stdout);
+			}
+		}
+	}
+
+	if (queue)
+	{
+		std::printf("\n%-9s %9s %9s %10s %24s %24s %8s\n", "Scene", "Objects", "Draws", "Sort ms", "Submitted (sh/tex/mesh)", "Sorted (sh/tex/mesh)", "Ordered");
+
+		for (auto scene : { CullingBenchmark::SceneType::UNIFORM, CullingBenchmark::SceneType::CLUSTERED, CullingBenchmark::SceneType::CITY })
+		{
+			for (int count : counts)
+			{
+				const auto result = CullingBenchmark::MeasureRenderQueue(scene, count, numFrames);
+
+				const std::string submitted = std::to_string(result.submittedRebinds.shaders) + " / " + std::to_string(result.submittedRebinds.textures) + " / " + std::to_string(result.submittedRebinds.meshes);
+				const std::string sorted = std::to_string(result.sortedRebinds.shaders) + " / " + std::to_string(result.sortedRebinds.textures) + " / " + std::to_string(result.sortedRebinds.meshes);
+
+				std::printf("%-9s %9d %9d %10.3f %24s %24s %8s\n", CullingBenchmark::GetName(scene), count, result.draws, result.sortMs,
+					submitted.c_str(), sorted.c_str(), result.isOrdered ? "yes" : "NO");
+
+				if (!result.isOrdered)
+					++failures;
+
+				std::fflush(stdout);
+			}
+		}
+	}
+
+	if (commands)
+	{
+		std::printf("\n%-9s %9s %9s %9s %8s %9s %10s %10s %10s %10s %9s %9s %6s\n", "Scene", "Objects", "Draws", "Packets", "B/draw", "CB B/drw", "Direct ns",
+			"Record ns", "Replay ns", "Filter ns", "Set/draw", "Drop/drw", "Match");
+
+		for (auto scene : { CullingBenchmark::SceneType::UNIFORM, CullingBenchmark::SceneType::CLUSTERED, CullingBenchmark::SceneType::CITY })
+		{
+			for (int count : counts)
+			{
+				const auto result = CullingBenchmark::MeasureCommandBuffer(scene, count, numFrames);
+
+				std::printf("%-9s %9d %9d %9d %8.1f %9.1f %10.1f %10.1f %10.1f %10.1f %9.2f %9.2f %6s\n", CullingBenchmark::GetName(scene), count, result.draws,
+					result.packets, result.bytesPerDraw, result.constantBytesPerDraw, result.immediateNsPerDraw, result.recordNsPerDraw, result.replayNsPerDraw,
+					result.filteredReplayNsPerDraw, result.issuedPerDraw, result.filteredPerDraw, result.matchesImmediate ? "yes" : "NO");
+
+				if (!result.matchesImmediate)
+					++failures;
+
+				std::fflush(stdout);
+			}
+		}
+	}
+
+	if (parallel)
+	{
+		std::printf("\n%-9s %9s %8s %9s %7s %10s %12s %8s %6s\n", "Scene", "Objects", "Threads", "Draws", "Chunks", "Serial ms", "Parallel ms",
+			"Speedup", "Match");
+
+		for (auto scene : { CullingBenchmark::SceneType::UNIFORM, CullingBenchmark::SceneType::CLUSTERED, CullingBenchmark::SceneType::CITY })
+		{
+			for (int count : counts)
+			{
+				for (const auto& result : CullingBenchmark::MeasureParallelRecording(scene, count, numFrames, PARALLEL_CHUNK_SIZE, threadCounts))
+				{
+					std::printf("%-9s %9d %8d %9d %7d %10.3f %12.3f %8.2f %6s\n", CullingBenchmark::GetName(scene), count, result.numThreads,
+						result.draws, result.chunks, result.serialMs, result.parallelMs, result.parallelMs > 0.0 ? result.serialMs / result.parallelMs : 0.0,
+						result.matchesSerial ? "yes" : "NO");
+
+					if (!result.matchesSerial)
+						++failures;
+				}
+
+				std::fflush(stdout);
+			}
+		}
+	}
+
+	if (arena)
+	{
+		std::printf("\n%8s %9s %7s %9s %9s %10s %7s\n", "Latency", "Allocs", "Wraps", "Discards", "Peak KB", "ns/alloc", "Errors");
+
+		for (const auto& result : CullingBenchmark::VerifyFrameAllocator(ARENA_CAPACITY, numFrames, { 0, 1, 2, 3 }))
+		{
+			std::printf("%8d %9d %7d %9d %9.1f %10.2f %7d\n", result.latency, result.allocations, result.wraps, result.discards,
+				result.peakUsed / 1024.0, result.nsPerAllocation, result.errors);
+
+			failures += result.errors;
+		}
+
+		std::fflush(stdout);
+	}
+
+	if (gpu)
+	{
+		std::printf("\n%-9s %9s %9s %9s %11s %9s %12s %10s %12s %6s\n", "Scene", "Objects", "Visible", "SAH vis", "Emulate ms", "SAH ms", "Upload KB", "GPU B/frm", "CPU KB/frm", "Match");
+
+		for (auto scene : { CullingBenchmark::SceneType::UNIFORM, CullingBenchmark::SceneType::CLUSTERED, CullingBenchmark::SceneType::CITY })
+		{
+			for (int count : counts)
+			{
+				const auto result = CullingBenchmark::MeasureGpuCulling(scene, count, numFrames);
+
+				std::printf("%-9s %9d %9d %9d %11.3f %9.3f %12.1f %10lld %12.1f %6s\n", CullingBenchmark::GetName(scene), count, result.visibleObjects,
+					result.hierarchyVisible, result.emulateMs, result.hierarchyMs, result.uploadBytes / 1024.0, result.bytesPerFrame,
+					result.cpuBytesPerFrame / 1024.0, result.matchesReference ? "yes" : "NO");
+
+				if (!result.matchesReference)
+					++failures;
+
+				std::fflush(stdout);
+			}
+		}
+	}
+
+	if (contribution)
+	{
+		std::printf("\n%-6s %9s %10s %10s %9s %9s %9s %9s %6s\n", "BVH", "Objects", "Min px", "Query ms", "Nodes", "Visible", "Small", "Saved", "Match");
+
+		for (int count : counts)
+		{
+			for (auto type : { BoundingVolume::HierarchyType::OCTREE, BoundingVolume::HierarchyType::SAH })
+			{
+				for (const auto& result : CullingBenchmark::CompareContributionCulling(type, count, { 0.f, 1.f, 2.f, 4.f, 8.f }, numFrames))
+				{
+					std::printf("%-6s %9d %10.1f %10.4f %9d %9d %9d %9d %6s\n", CullingBenchmark::GetName(type), count, result.minPixels, result.queryMs,
+						result.nodesVisited, result.visibleObjects, result.smallBoxes, result.instancesSaved, result.matchesPerObject ? "yes" : "NO");
+
+					if (!result.matchesPerObject)
+						++failures;
+				}
+
+				std::fflush(stdout);
+			}
+		}
+	}
+
+	if (numRays <= 0)
+		return failures > 0 ? 1 : 0;
+
+	std::printf("\n%-6s %9s %-6s %-8s %-6s %10s %10s %9s %6s\n", "BVH", "Objects", "Rays", "Mode", "Packet", "Mrays/s", "Nodes/ray", "Hits", "Match");
+
+	for (int count : counts)
+	{
+		for (auto type : { BoundingVolume::HierarchyType::OCTREE, BoundingVolume::HierarchyType::SAH })
+		{
+			for (const auto& result : CullingBenchmark::CompareRayQueries(type, count, numRays))
+			{
+				const std::string packet = result.packetSize ? std::to_string(result.packetSize) : "Scan";
+
+				std::printf("%-6s %9d %-6s %-8s %-6s %10.3f %10.1f %9d %6s\n", CullingBenchmark::GetName(type), count, result.coherent ? "Camera" : "Random",
+					CullingBenchmark::GetName(result.mode), packet.c_str(), result.raysPerSecond * 1e-6, result.nodesPerRay, result.hits, result.matchesSingle ? "yes" : "NO");
+
+				if (!result.matchesSingle)
+					++failures;
+			}
+
+			std::fflush(stdout);
+		}
+	}
+
+	return failures > 0 ? 1 : 0;
+}
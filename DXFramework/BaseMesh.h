@@ -28,6 +28,11 @@ public:
 	virtual void sendData(ID3D11DeviceContext* deviceContext);
 	int getIndexCount() const;
 
+	// What sendData binds, for code that submits draws without a device context
+	ID3D11Buffer* getVertexBuffer() const { return vertexBuffer; }
+	ID3D11Buffer* getIndexBuffer() const { return indexBuffer; }
+	UINT getVertexStride() const { return sizeof(VertexType); }
+
 	BoundingBox getBoundingBox() const;
 
 protected:
@@ -0,0 +1,132 @@
+// ConstantArena.cpp
+#include "ConstantArena.h"
+#include <cstring>
+
+ConstantArena::ConstantArena(ID3D11Device* device, ID3D11DeviceContext* immediateContext, UINT capacity)
+	: allocator(capacity)
+{
+	D3D11_FEATURE_DATA_D3D11_OPTIONS options;
+	ZeroMemory(&options, sizeof(options));
+
+	// Both fail on the D3D11.0 runtime, which leaves the arena unsupported
+	if (FAILED(device->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS, &options, sizeof(options))) ||
+		!options.ConstantBufferOffsetting || !options.MapNoOverwriteOnDynamicConstantBuffer)
+		return;
+
+	if (FAILED(immediateContext->QueryInterface(__uuidof(ID3D11DeviceContext1), (void**) &context)))
+		return;
+
+	D3D11_BUFFER_DESC bufferDesc;
+	bufferDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	bufferDesc.ByteWidth = capacity;
+	bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	bufferDesc.MiscFlags = 0;
+	bufferDesc.StructureByteStride = 0;
+	bufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+
+	device->CreateBuffer(&bufferDesc, 0, &buffer);
+
+	D3D11_QUERY_DESC queryDesc;
+	queryDesc.Query = D3D11_QUERY_EVENT;
+	queryDesc.MiscFlags = 0;
+
+	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+		device->CreateQuery(&queryDesc, &queries[i]);
+}
+
+ConstantArena::~ConstantArena()
+{
+	for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+	{
+		if (queries[i])
+			queries[i]->Release();
+	}
+
+	if (buffer)
+		buffer->Release();
+
+	if (context)
+		context->Release();
+}
+
+void ConstantArena::beginFrame()
+{
+	frameAllocations = 0;
+	frameDiscards = 0;
+
+	if (!isSupported())
+		return;
+
+	// Queries complete in order, so stop at the first one the GPU has not reached
+	while (numPending > 0)
+	{
+		BOOL done = FALSE;
+
+		if (context->GetData(queries[firstPending], &done, sizeof(done), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK || !done)
+			break;
+
+		allocator.retireFrames(pendingFences[firstPending]);
+
+		firstPending = (firstPending + 1) % MAX_FRAMES_IN_FLIGHT;
+		--numPending;
+	}
+}
+
+void ConstantArena::endFrame()
+{
+	if (!isSupported())
+		return;
+
+	// With every query in use, the frame's allocations carry over into the next, to be retired with it
+	if (numPending == MAX_FRAMES_IN_FLIGHT)
+		return;
+
+	const int query = (firstPending + numPending) % MAX_FRAMES_IN_FLIGHT;
+
+	context->End(queries[query]);
+	pendingFences[query] = fence;
+	++numPending;
+
+	allocator.endFrame(fence++);
+}
+
+bool ConstantArena::allocate(const void* data, UINT size, Allocation& allocation)
+{
+	if (!isSupported())
+		return false;
+
+	// The bound range is a whole number of 16-constant blocks, so that is what is allocated
+	const UINT alignedSize = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+
+	size_t offset = allocator.allocate(alignedSize, ALIGNMENT);
+
+	// Full of frames the GPU may still read. Discarding hands the driver's copy of them over to the GPU, and gives
+	// back an empty buffer to start over in
+	if (offset == FrameAllocator::INVALID_OFFSET)
+	{
+		if (alignedSize > allocator.getCapacity())
+			return false;
+
+		allocator.reset();
+		needsDiscard = true;
+
+		offset = allocator.allocate(alignedSize, ALIGNMENT);
+	}
+
+	D3D11_MAPPED_SUBRESOURCE map;
+	context->Map(buffer, 0, needsDiscard ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE, 0, &map);
+	std::memcpy(static_cast<char*>(map.pData) + offset, data, size);
+	context->Unmap(buffer, 0);
+
+	if (needsDiscard)
+		++frameDiscards;
+
+	needsDiscard = false;
+	++frameAllocations;
+
+	allocation.buffer = buffer;
+	allocation.firstConstant = (UINT) (offset / 16);
+	allocation.numConstants = alignedSize / 16;
+
+	return true;
+}
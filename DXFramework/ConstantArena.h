@@ -0,0 +1,81 @@
+// ConstantArena.h
+// One large dynamic constant buffer that per-draw constants are sub-allocated from, instead of mapping a small buffer
+// with D3D11_MAP_WRITE_DISCARD for every draw. Allocations are written with D3D11_MAP_WRITE_NO_OVERWRITE and bound
+// with the offsets of the D3D11.1 *SetConstantBuffers1 calls, so the driver never has to rename the buffer
+// Space is handed out by a FrameAllocator. Every frame ends with an event query, and its allocations are retired once
+// the GPU has passed it. If the buffer is full of frames still in flight, it is discarded and starts over
+// Needs the D3D11.1 runtime and a driver that supports both features--check isSupported before using it
+
+#ifndef _CONSTANTARENA_H_
+#define _CONSTANTARENA_H_
+
+#include <d3d11_1.h>
+#include "FrameAllocator.h"
+
+class ConstantArena
+{
+public:
+	// Where a draw's constants went, in the units of *SetConstantBuffers1
+	struct Allocation
+	{
+		ID3D11Buffer* buffer;
+		UINT firstConstant;
+		UINT numConstants;
+	};
+
+	// Constant buffer offsets are counted in 16-byte constants, and have to be multiples of 16 of them
+	static const UINT ALIGNMENT = 256;
+
+	// Frames that can be waited on at once. Frames past that are merged into the next
+	static const int MAX_FRAMES_IN_FLIGHT = 4;
+
+	ConstantArena(ID3D11Device* device, ID3D11DeviceContext* immediateContext, UINT capacity);
+	ConstantArena(const ConstantArena&) = delete;
+	ConstantArena& operator=(const ConstantArena&) = delete;
+	~ConstantArena();
+
+	bool isSupported() const { return buffer != nullptr; }
+
+	// Retire the frames the GPU has finished with
+	void beginFrame();
+
+	// Mark the end of the frame's allocations with an event query
+	void endFrame();
+
+	// Copy size bytes into the arena. Fails only if the arena is not supported, or size does not fit in it at all
+	bool allocate(const void* data, UINT size, Allocation& allocation);
+
+	// For the *SetConstantBuffers1 calls
+	ID3D11DeviceContext1* getContext() const { return context; }
+
+	UINT getCapacity() const { return (UINT) allocator.getCapacity(); }
+
+	// Work done in the current frame
+	int getAllocations() const { return frameAllocations; }
+	size_t getFrameBytes() const { return allocator.getFrameBytes(); }
+	int getDiscards() const { return frameDiscards; }
+	int getFramesInFlight() const { return allocator.getFramesInFlight(); }
+
+private:
+	ID3D11DeviceContext1* context = nullptr;
+	ID3D11Buffer* buffer = nullptr;
+
+	FrameAllocator allocator;
+
+	// The first map after creating the buffer has to discard it
+	bool needsDiscard = true;
+
+	// Ring of the queries of the frames in flight, oldest at firstPending
+	ID3D11Query* queries[MAX_FRAMES_IN_FLIGHT] = {};
+	int firstPending = 0;
+	int numPending = 0;
+
+	// Fence of the frame being written, and the fence every pending query stands for
+	uint64_t fence = 1;
+	uint64_t pendingFences[MAX_FRAMES_IN_FLIGHT] = {};
+
+	int frameAllocations = 0;
+	int frameDiscards = 0;
+};
+
+#endif
@@ -69,6 +69,9 @@ D3D::D3D(int screenWidth, int screenHeight, bool vsync, HWND hwnd, bool fullscre
 	// Create the swap chain, Direct3D device, and Direct3D device context.
 	D3D11CreateDeviceAndSwapChain(NULL, D3D_DRIVER_TYPE_HARDWARE, NULL, deviceFlags, &featureLevel, 1, D3D11_SDK_VERSION, &swapChainDesc, &swapChain, &device, NULL, &deviceContext);
 
+	// 1 MB of per-draw constants, 4096 draws' worth
+	constantArena = new ConstantArena(device, deviceContext, 1024 * 1024);
+
 	// Configure back buffer
 	swapChain->GetBuffer(0, __uuidof(ID3D11Texture2D), (LPVOID*) &backBufferPtr);
 
@@ -291,6 +294,12 @@ D3D::~D3D()
 		renderTargetView = 0;
 	}
 
+	if (constantArena)
+	{
+		delete constantArena;
+		constantArena = 0;
+	}
+
 	if (deviceContext)
 	{
 		deviceContext->Release();
@@ -323,12 +332,16 @@ void D3D::beginScene(float red, float green, float blue, float alpha)
 	deviceContext->ClearRenderTargetView(renderTargetView, color);
 	deviceContext->ClearDepthStencilView(depthStencilView, D3D11_CLEAR_DEPTH, 1.0f, 0);
 
+	constantArena->beginFrame();
+
 	return;
 }
 
 // Present the back buffer to the screen now rendering is complete (based on vsync switch)
 void D3D::endScene()
 {
+	constantArena->endFrame();
+
 	swapChain->Present(vsync_enabled, 0);
 }
 
@@ -344,6 +357,11 @@ ID3D11DeviceContext* D3D::getDeviceContext() const
 	return deviceContext;
 }
 
+ConstantArena* D3D::getConstantArena() const
+{
+	return constantArena;
+}
+
 
 XMMATRIX D3D::getProjectionMatrix() const
 {
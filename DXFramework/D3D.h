@@ -8,6 +8,7 @@
 #include <Windows.h>
 #include <d3d11.h>
 #include <DirectXMath.h>
+#include "ConstantArena.h"
 
 using namespace DirectX;
 
@@ -33,6 +34,9 @@ public:
 	ID3D11Device* getDevice() const;
 	ID3D11DeviceContext* getDeviceContext() const;
 
+	// Per-draw constants, retired a frame at a time by beginScene and endScene
+	ConstantArena* getConstantArena() const;
+
 	XMMATRIX getProjectionMatrix() const;
 	XMMATRIX getWorldMatrix() const;
 	XMMATRIX getOrthoMatrix() const;
@@ -81,6 +85,7 @@ protected:
 	ID3D11BlendState* alphaEnableBlendingState;
 	ID3D11BlendState* alphaDisableBlendingState;
 	D3D11_VIEWPORT viewport;
+	ConstantArena* constantArena;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,73 @@
+// FrameAllocator.cpp
+#include "FrameAllocator.h"
+
+FrameAllocator::FrameAllocator(size_t capacity)
+	: capacity(capacity)
+{
+}
+
+size_t FrameAllocator::allocate(size_t size, size_t alignment)
+{
+	if (size == 0 || size > capacity)
+		return INVALID_OFFSET;
+
+	size_t offset = (head + alignment - 1) & ~(alignment - 1);
+
+	// The space in use is one contiguous range of the ring ending at head, so whatever is skipped to align or wrap
+	// is taken up as well, until the frame is retired
+	size_t bytes;
+	bool wrapped = false;
+
+	if (offset + size > capacity)
+	{
+		offset = 0;
+		bytes = capacity - head + size;
+		wrapped = true;
+	}
+	else
+		bytes = offset - head + size;
+
+	if (used + bytes > capacity)
+		return INVALID_OFFSET;
+
+	head = offset + size;
+	used += bytes;
+	frameBytes += bytes;
+
+	if (wrapped)
+		++wraps;
+
+	return offset;
+}
+
+void FrameAllocator::endFrame(uint64_t fence)
+{
+	Frame frame;
+	frame.fence = fence;
+	frame.bytes = frameBytes;
+
+	frames.push_back(frame);
+	frameBytes = 0;
+}
+
+void FrameAllocator::retireFrames(uint64_t completedFence)
+{
+	while (!frames.empty() && frames.front().fence <= completedFence)
+	{
+		used -= frames.front().bytes;
+		frames.pop_front();
+	}
+
+	// Nothing is in use, so the next allocation can start from the beginning without wrapping
+	if (used == 0)
+		head = 0;
+}
+
+void FrameAllocator::reset()
+{
+	frames.clear();
+
+	head = 0;
+	used = 0;
+	frameBytes = 0;
+}
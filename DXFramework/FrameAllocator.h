@@ -0,0 +1,65 @@
+// FrameAllocator.h
+// Hands out ranges of a ring buffer for data that lives until the GPU has finished the frame it was written in, such as
+// per-draw constants. Only offsets are handed out--the memory belongs to whoever owns the buffer (see ConstantArena)--
+// so that it runs, and can be checked, without a device
+// The allocations of a frame are retired together, once the fence the frame ended with has completed. An allocation
+// that would run into a frame still in flight fails instead of overwriting what the GPU may still be reading
+
+#ifndef _FRAMEALLOCATOR_H_
+#define _FRAMEALLOCATOR_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+
+class FrameAllocator
+{
+public:
+	static const size_t INVALID_OFFSET = SIZE_MAX;
+
+	explicit FrameAllocator(size_t capacity);
+
+	// Offset of size bytes, aligned to alignment (a power of two), or INVALID_OFFSET if they do not fit in the space
+	// the GPU is done with. Allocations never straddle the end of the buffer--they start over from the beginning
+	size_t allocate(size_t size, size_t alignment);
+
+	// Close the current frame. Its allocations are retired once fence has completed
+	void endFrame(uint64_t fence);
+
+	// Retire every frame that ended with a fence of at most completedFence
+	void retireFrames(uint64_t completedFence);
+
+	// Free everything, including frames still in flight, e.g. once the buffer was discarded and the driver renamed it
+	void reset();
+
+	size_t getCapacity() const { return capacity; }
+
+	// Bytes in use by frames in flight and the current frame, including what was skipped to align or wrap
+	size_t getUsed() const { return used; }
+	size_t getFrameBytes() const { return frameBytes; }
+	int getFramesInFlight() const { return (int) frames.size(); }
+
+	// Times the allocations started over from the beginning of the buffer
+	int getWraps() const { return wraps; }
+
+private:
+	struct Frame
+	{
+		uint64_t fence;
+		size_t bytes;
+	};
+
+	size_t capacity;
+
+	// Where the next allocation goes
+	size_t head = 0;
+
+	size_t used = 0;
+	size_t frameBytes = 0;
+	int wraps = 0;
+
+	// Oldest first
+	std::deque<Frame> frames;
+};
+
+#endif